@@ -63,6 +63,12 @@
 #define SO_DOMAIN		39
 
 #define SO_RXQ_OVFL		40
+
+#define SO_BUSY_POLL		46
+
+#define SO_INCOMING_CPU	49
+
+#define SO_ZEROCOPY		60
 #endif /* _ASM_SOCKET_H */
 
 
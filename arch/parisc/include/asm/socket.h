@@ -61,6 +61,12 @@
 
 #define SO_RXQ_OVFL             0x4021
 
+#define SO_BUSY_POLL            0x4027
+
+#define SO_INCOMING_CPU         0x402A
+
+#define SO_ZEROCOPY             0x4035
+
 /* O_NONBLOCK clashes with the bits used for socket types.  Therefore we
  * have to define SOCK_NONBLOCK to a different value here.
  */
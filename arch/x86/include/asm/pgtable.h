@@ -341,6 +341,18 @@ static inline int pte_hidden(pte_t pte)
 	return pte_flags(pte) & _PAGE_HIDDEN;
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * A PROT_NONE pte is not present to the hardware but still maps a page,
+ * see pte_numa() in include/linux/mm.h.
+ */
+static inline int pte_protnone(pte_t pte)
+{
+	return (pte_flags(pte) & (_PAGE_PROTNONE | _PAGE_PRESENT))
+		== _PAGE_PROTNONE;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 static inline int pmd_present(pmd_t pmd)
 {
 	/*
@@ -5825,16 +5825,20 @@ static bool igb_clean_tx_irq(struct igb_q_vector *q_vector)
  * @q_vector: structure containing interrupt and ring information
  * @skb: packet to send up
  * @vlan_tag: vlan tag for packet
+ * @rx_list: skbs to pass up in one go at the end of the poll
  **/
 static void igb_receive_skb(struct igb_q_vector *q_vector,
                             struct sk_buff *skb,
-                            u16 vlan_tag)
+                            u16 vlan_tag,
+                            struct sk_buff_head *rx_list)
 {
 	struct igb_adapter *adapter = q_vector->adapter;
 
 	if (vlan_tag)
 		vlan_gro_receive(&q_vector->napi, adapter->vlgrp,
 		                 vlan_tag, skb);
+	else if (!(skb->dev->features & NETIF_F_GRO))
+		__skb_queue_tail(rx_list, skb);
 	else
 		napi_gro_receive(&q_vector->napi, skb);
 }
@@ -5908,7 +5912,9 @@ static bool igb_clean_rx_irq(struct igb_q_vector *q_vector, int budget)
 	u16 vlan_tag = 0;
 	u16 cleaned_count = igb_desc_unused(rx_ring);
 	u16 i = rx_ring->next_to_clean;
+	struct sk_buff_head rx_list;
 
+	__skb_queue_head_init(&rx_list);
 	rx_desc = IGB_RX_DESC(rx_ring, i);
 
 	while (igb_test_staterr(rx_desc, E1000_RXD_STAT_DD)) {
@@ -5997,7 +6003,7 @@ static bool igb_clean_rx_irq(struct igb_q_vector *q_vector, int budget)
 
 		skb->protocol = eth_type_trans(skb, rx_ring->netdev);
 
-		igb_receive_skb(q_vector, skb, vlan_tag);
+		igb_receive_skb(q_vector, skb, vlan_tag, &rx_list);
 
 		budget--;
 next_desc:
@@ -6015,6 +6021,9 @@ next_desc:
 		rx_desc = next_rxd;
 	}
 
+	if (!skb_queue_empty(&rx_list))
+		netif_receive_skb_list(&rx_list);
+
 	rx_ring->next_to_clean = i;
 	rx_ring->rx_stats.packets += total_packets;
 	rx_ring->rx_stats.bytes += total_bytes;
@@ -1390,7 +1390,8 @@ static void ixgbe_process_skb_fields(struct ixgbe_ring *rx_ring,
 }
 
 static void ixgbe_rx_skb(struct ixgbe_q_vector *q_vector,
-			 struct sk_buff *skb, union ixgbe_adv_rx_desc *rx_desc)
+			 struct sk_buff *skb, union ixgbe_adv_rx_desc *rx_desc,
+			 struct sk_buff_head *rx_list)
 {
 	struct ixgbe_adapter *adapter = q_vector->adapter;
 	struct net_device *dev = skb->dev;
@@ -1399,8 +1400,17 @@ static void ixgbe_rx_skb(struct ixgbe_q_vector *q_vector,
 		if ((dev->features & NETIF_F_HW_VLAN_RX) &&
 		    ixgbe_test_staterr(rx_desc, IXGBE_RXD_STAT_VP)) {
 			u16 vid = le16_to_cpu(rx_desc->wb.upper.vlan);
-			vlan_gro_receive(&q_vector->napi, adapter->vlgrp, vid, skb);
+			if (ixgbe_qv_busy_polling(q_vector))
+				vlan_hwaccel_receive_skb(skb, adapter->vlgrp,
+							 vid);
+			else
+				vlan_gro_receive(&q_vector->napi,
+						 adapter->vlgrp, vid, skb);
 		}
+		else if (ixgbe_qv_busy_polling(q_vector) ||
+			 !(dev->features & NETIF_F_GRO))
+			/* handed to the stack at the end of the poll */
+			__skb_queue_tail(rx_list, skb);
 		else
 			napi_gro_receive(&q_vector->napi, skb);
 	} else {
@@ -1633,9 +1643,9 @@ static void ixgbe_add_rx_frag(struct ixgbe_ring *rx_ring,
  * expensive overhead for IOMMU access this provides a means of avoiding
  * it by maintaining the mapping of the page to the syste.
  *
- * Returns true if all work is completed without reaching budget
+ * Returns amount of work completed
  **/
-static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
+static int ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 			       struct ixgbe_ring *rx_ring,
 			       int budget)
 {
@@ -1645,6 +1655,9 @@ static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 	int ddp_bytes = 0;
 #endif /* IXGBE_FCOE */
 	u16 cleaned_count = ixgbe_desc_unused(rx_ring);
+	struct sk_buff_head rx_list;
+
+	__skb_queue_head_init(&rx_list);
 
 	do {
 		struct ixgbe_rx_buffer *rx_buffer;
@@ -1759,6 +1772,9 @@ static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 
 		/* populate checksum, timestamp, VLAN, and protocol */
 		ixgbe_process_skb_fields(rx_ring, rx_desc, skb);
+#ifdef CONFIG_NET_RX_BUSY_POLL
+		skb_mark_napi_id(skb, q_vector->napi_id);
+#endif
 
 #ifdef IXGBE_FCOE
 		/* if ddp, not passing to ULD unless for FCP_RSP or error */
@@ -1771,12 +1787,15 @@ static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 		}
 
 #endif /* IXGBE_FCOE */
-		ixgbe_rx_skb(q_vector, skb, rx_desc);
+		ixgbe_rx_skb(q_vector, skb, rx_desc, &rx_list);
 
 		/* update budget accounting */
 		budget--;
 	} while (likely(budget));
 
+	if (!skb_queue_empty(&rx_list))
+		netif_receive_skb_list(&rx_list);
+
 #ifdef IXGBE_FCOE
 	/* include DDPed FCoE data */
 	if (ddp_bytes > 0) {
@@ -1800,7 +1819,7 @@ static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 	if (cleaned_count)
 		ixgbe_alloc_rx_buffers(rx_ring, cleaned_count);
 
-	return !!budget;
+	return total_rx_packets;
 }
 
 /**
@@ -2370,9 +2389,16 @@ int ixgbe_poll(struct napi_struct *napi, int budget)
 	else
 		per_ring_budget = budget;
 
+	/* exit if busy polling owns the rx rings, it will clean them */
+	if (!ixgbe_qv_lock_napi(q_vector))
+		return budget;
+
 	ixgbe_for_each_ring(ring, q_vector->rx)
-		clean_complete &= ixgbe_clean_rx_irq(q_vector, ring,
-						     per_ring_budget);
+		clean_complete &= (ixgbe_clean_rx_irq(q_vector, ring,
+						      per_ring_budget) <
+				   per_ring_budget);
+
+	ixgbe_qv_unlock_napi(q_vector);
 
 	/* If all work not completed, return budget and keep polling */
 	if (!clean_complete)
@@ -2388,6 +2414,40 @@ int ixgbe_poll(struct napi_struct *napi, int budget)
 	return 0;
 }
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/**
+ * ixgbe_low_latency_recv - busy poll the Rx rings of a q_vector
+ * @napi: napi context the busy polling socket was last fed from
+ *
+ * Called from sk_busy_loop() with bottom halves disabled.  Returns the
+ * number of packets cleaned, or LL_FLUSH_* when the rings can't be polled.
+ **/
+static int ixgbe_low_latency_recv(struct napi_struct *napi)
+{
+	struct ixgbe_q_vector *q_vector =
+			container_of(napi, struct ixgbe_q_vector, napi);
+	struct ixgbe_adapter *adapter = q_vector->adapter;
+	struct ixgbe_ring *ring;
+	int found = 0;
+
+	if (test_bit(__IXGBE_DOWN, &adapter->state))
+		return LL_FLUSH_FAILED;
+
+	if (!ixgbe_qv_lock_poll(q_vector))
+		return LL_FLUSH_BUSY;
+
+	ixgbe_for_each_ring(ring, q_vector->rx) {
+		found = ixgbe_clean_rx_irq(q_vector, ring, 4);
+		if (found)
+			break;
+	}
+
+	ixgbe_qv_unlock_poll(q_vector);
+
+	return found;
+}
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
 /**
  * ixgbe_request_msix_irqs - Initialize MSI-X interrupts
  * @adapter: board private structure
@@ -3595,16 +3655,23 @@ static void ixgbe_napi_enable_all(struct ixgbe_adapter *adapter)
 {
 	int q_idx;
 
-	for (q_idx = 0; q_idx < adapter->num_q_vectors; q_idx++)
+	for (q_idx = 0; q_idx < adapter->num_q_vectors; q_idx++) {
+		ixgbe_qv_init_lock(adapter->q_vector[q_idx]);
 		napi_enable(&adapter->q_vector[q_idx]->napi);
+	}
 }
 
 static void ixgbe_napi_disable_all(struct ixgbe_adapter *adapter)
 {
 	int q_idx;
 
-	for (q_idx = 0; q_idx < adapter->num_q_vectors; q_idx++)
+	for (q_idx = 0; q_idx < adapter->num_q_vectors; q_idx++) {
 		napi_disable(&adapter->q_vector[q_idx]->napi);
+		while (!ixgbe_qv_disable(adapter->q_vector[q_idx])) {
+			pr_info("QV %d locked\n", q_idx);
+			usleep_range(1000, 20000);
+		}
+	}
 }
 
 #ifdef CONFIG_IXGBE_DCB
@@ -6914,6 +6981,9 @@ static int __devinit ixgbe_probe(struct pci_dev *pdev,
 #ifdef IXGBE_FCOE
 	netdev_extended(netdev)->ndo_fcoe_get_hbainfo = ixgbe_fcoe_get_hbainfo;
 #endif /* IXGBE_FCOE */
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	netdev_extended(netdev)->ndo_busy_poll = ixgbe_low_latency_recv;
+#endif
 	ixgbe_set_ethtool_ops(netdev);
 	netdev->watchdog_timeo = 5 * HZ;
 	strncpy(netdev->name, pci_name(pdev), sizeof(netdev->name) - 1);
@@ -391,7 +391,7 @@ int acridafs_file_flush(struct file *file, fl_owner_t id)
 			spin_lock(&file->f_mapping->tree_lock);
 			page = radix_tree_lookup(&file->f_mapping->page_tree,
 					0);
-			if (!page)
+			if (!page || radix_tree_exceptional_entry(page))
 				goto page_out;
 			printk(KERN_ERR "page:%x\n", page);
 			buff = page_address(page);
@@ -1575,7 +1575,7 @@ void do_baio_read(struct file *file, struct kiocb *iocb, loff_t *ppos,
 		rcu_read_unlock();
 
 		pr_debug("To read %ld bytes\n", nr);
-		if (page)
+		if (page && !radix_tree_exceptional_entry(page))
 			continue;
 		
 		page = page_cache_alloc_cold(mapping);
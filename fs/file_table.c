@@ -50,6 +50,7 @@ static inline void file_free_rcu(struct rcu_head *head)
 
 static inline void file_free(struct file *f)
 {
+	kfree(f->f_ra_streams);
 	percpu_counter_dec(&nr_files);
 	file_check_state(f);
 	call_rcu(&f->f_u.fu_rcuhead, file_free_rcu);
@@ -257,6 +258,7 @@ void __fput(struct file *file)
 		cdev_put(inode->i_cdev);
 	fops_put(file->f_op);
 	put_pid(file->f_owner.pid);
+	file_ra_streams_release(file);
 	file_kill(file);
 	if (file->f_mode & FMODE_WRITE)
 		drop_file_write_access(file);
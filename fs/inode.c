@@ -326,7 +326,7 @@ void clear_inode(struct inode *inode)
 	 * and we must not free mapping under it.
 	 */
 	spin_lock_irq(&inode->i_data.tree_lock);
-	BUG_ON(inode->i_data.nrpages);
+	BUG_ON(mapping_populated(&inode->i_data));
 	spin_unlock_irq(&inode->i_data.tree_lock);
 	BUG_ON(!(inode->i_state & I_FREEING));
 	BUG_ON(inode->i_state & I_CLEAR);
@@ -359,7 +359,7 @@ static void dispose_list(struct list_head *head)
 		inode = list_first_entry(head, struct inode, i_list);
 		list_del(&inode->i_list);
 
-		if (inode->i_data.nrpages)
+		if (mapping_populated(&inode->i_data))
 			truncate_inode_pages(&inode->i_data, 0);
 		clear_inode(inode);
 
@@ -1301,7 +1301,7 @@ static void generic_forget_inode(struct inode *inode)
 {
 	if (!generic_detach_inode(inode))
 		return;
-	if (inode->i_data.nrpages)
+	if (mapping_populated(&inode->i_data))
 		truncate_inode_pages(&inode->i_data, 0);
 	clear_inode(inode);
 	wake_up_inode(inode);
@@ -612,14 +612,14 @@ void nilfs_delete_inode(struct inode *inode)
 	struct nilfs_inode_info *ii = NILFS_I(inode);
 
 	if (unlikely(is_bad_inode(inode))) {
-		if (inode->i_data.nrpages)
+		if (mapping_populated(&inode->i_data))
 			truncate_inode_pages(&inode->i_data, 0);
 		clear_inode(inode);
 		return;
 	}
 	nilfs_transaction_begin(sb, &ti, 0); /* never fails */
 
-	if (inode->i_data.nrpages)
+	if (mapping_populated(&inode->i_data))
 		truncate_inode_pages(&inode->i_data, 0);
 
 	nilfs_truncate_bmap(ii, 0);
@@ -493,6 +493,23 @@ static const struct file_operations proc_lstats_operations = {
 
 #endif
 
+#ifdef CONFIG_KSM
+static int proc_pid_ksm_stat(struct task_struct *task, char *buffer)
+{
+	struct mm_struct *mm = get_task_mm(task);
+	int len = 0;
+
+	if (mm) {
+		len = sprintf(buffer, "ksm_rmap_items %ld\n"
+				      "ksm_merging_pages %ld\n",
+			      atomic_long_read(&mm->ksm_rmap_items),
+			      atomic_long_read(&mm->ksm_merging_pages));
+		mmput(mm);
+	}
+	return len;
+}
+#endif
+
 static int proc_oom_score(struct task_struct *task, char *buffer)
 {
 	unsigned long points = 0;
@@ -2979,6 +2996,9 @@ static const struct pid_entry tgid_base_stuff[] = {
 #ifdef CONFIG_TASK_IO_ACCOUNTING
 	INF("io",	S_IRUSR, proc_tgid_io_accounting),
 #endif
+#ifdef CONFIG_KSM
+	INF("ksm_stat",   S_IRUSR, proc_pid_ksm_stat),
+#endif
 };
 
 static int proc_tgid_base_readdir(struct file * filp,
@@ -28,6 +28,8 @@
 #define POLLRDHUP       0x2000
 #endif
 
+#define POLL_BUSY_LOOP	0x8000	/* kernel internal, see sock_poll() */
+
 struct pollfd {
 	int fd;
 	short events;
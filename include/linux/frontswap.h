@@ -0,0 +1,104 @@
+#ifndef _LINUX_FRONTSWAP_H
+#define _LINUX_FRONTSWAP_H
+
+#include <linux/swap.h>
+#include <linux/mm.h>
+#include <linux/bitops.h>
+
+/*
+ * A frontswap backend keeps swapped out pages somewhere other than the
+ * swap device, e.g. compressed in memory.  Pages it accepts are never
+ * written to the device; pages it refuses take the normal swap path.
+ */
+struct frontswap_ops {
+	void (*init)(unsigned type);
+	int (*store)(unsigned type, pgoff_t offset, struct page *page);
+	int (*load)(unsigned type, pgoff_t offset, struct page *page);
+	void (*invalidate_page)(unsigned type, pgoff_t offset);
+	void (*invalidate_area)(unsigned type);
+};
+
+extern bool frontswap_enabled;
+extern struct frontswap_ops *frontswap_register_ops(struct frontswap_ops *ops);
+
+extern void __frontswap_init(unsigned type, unsigned long *map);
+extern int __frontswap_store(struct page *page);
+extern int __frontswap_load(struct page *page);
+extern void __frontswap_invalidate_page(unsigned type, pgoff_t offset);
+extern void __frontswap_invalidate_area(unsigned type);
+
+#ifdef CONFIG_FRONTSWAP
+static inline bool frontswap_test(struct swap_info_struct *sis, pgoff_t offset)
+{
+	return frontswap_enabled && sis->frontswap_map &&
+		test_bit(offset, sis->frontswap_map);
+}
+
+static inline void frontswap_map_set(struct swap_info_struct *sis,
+				     unsigned long *map)
+{
+	sis->frontswap_map = map;
+}
+
+static inline unsigned long *frontswap_map_get(struct swap_info_struct *sis)
+{
+	return sis->frontswap_map;
+}
+#else
+/* all inline routines become no-ops and all externs are ignored */
+
+#define frontswap_enabled (0)
+
+static inline bool frontswap_test(struct swap_info_struct *sis, pgoff_t offset)
+{
+	return false;
+}
+
+static inline void frontswap_map_set(struct swap_info_struct *sis,
+				     unsigned long *map)
+{
+}
+
+static inline unsigned long *frontswap_map_get(struct swap_info_struct *sis)
+{
+	return NULL;
+}
+#endif
+
+static inline int frontswap_store(struct page *page)
+{
+	int ret = -1;
+
+	if (frontswap_enabled)
+		ret = __frontswap_store(page);
+	return ret;
+}
+
+static inline int frontswap_load(struct page *page)
+{
+	int ret = -1;
+
+	if (frontswap_enabled)
+		ret = __frontswap_load(page);
+	return ret;
+}
+
+static inline void frontswap_invalidate_page(unsigned type, pgoff_t offset)
+{
+	if (frontswap_enabled)
+		__frontswap_invalidate_page(type, offset);
+}
+
+static inline void frontswap_invalidate_area(unsigned type)
+{
+	if (frontswap_enabled)
+		__frontswap_invalidate_area(type);
+}
+
+static inline void frontswap_init(unsigned type, unsigned long *map)
+{
+	if (frontswap_enabled)
+		__frontswap_init(type, map);
+}
+
+#endif /* _LINUX_FRONTSWAP_H */
@@ -782,6 +782,15 @@ static inline int mapping_mapped(struct address_space *mapping)
 		!list_empty(&mapping->i_mmap_nonlinear);
 }
 
+/*
+ * Might pages, or the shadow entries reclaim leaves behind for evicted
+ * pages, be left in the page cache of this file?
+ */
+static inline int mapping_populated(struct address_space *mapping)
+{
+	return mapping->nrpages || mapping->page_tree.rnode;
+}
+
 /*
  * Might pages of this file have been modified in userspace?
  * Note that i_mmap_writable counts all VM_SHARED vmas: do_mmap_pgoff
@@ -990,6 +999,28 @@ struct file_ra_state {
 	loff_t prev_pos;		/* Cache last read() position */
 };
 
+/*
+ * Interleaved sequential readers of one file share file->f_ra.  The
+ * readahead state of the streams not currently in f_ra is parked in a
+ * small per-file table, so that each stream keeps its own window.
+ */
+#define RA_MAX_STREAMS	4
+
+struct file_ra_stream {
+	pgoff_t start;			/* as in struct file_ra_state */
+	unsigned int size;
+	unsigned int async_size;
+	loff_t prev_pos;
+	pgoff_t acct_index;		/* window pages accounted up to here */
+	unsigned long stamp;		/* jiffies of the last window submit */
+};
+
+struct file_ra_streams {
+	struct file_ra_stream active;	/* bookkeeping for file->f_ra */
+	unsigned int nr_parked;
+	struct file_ra_stream parked[RA_MAX_STREAMS - 1]; /* MRU first */
+};
+
 /*
  * Check if @index falls in the readahead windows.
  */
@@ -1039,6 +1070,9 @@ struct file {
 #ifdef CONFIG_DEBUG_WRITECOUNT
 	unsigned long f_mnt_write_state;
 #endif
+#ifndef __GENKSYMS__
+	struct file_ra_streams	*f_ra_streams;
+#endif
 };
 extern spinlock_t files_lock;
 #define file_list_lock() spin_lock(&files_lock);
@@ -2497,6 +2531,7 @@ extern long do_splice_direct(struct file *in, loff_t *ppos, struct file *out,
 
 extern void
 file_ra_state_init(struct file_ra_state *ra, struct address_space *mapping);
+extern void file_ra_streams_release(struct file *filp);
 extern loff_t noop_llseek(struct file *file, loff_t offset, int origin);
 extern loff_t no_llseek(struct file *file, loff_t offset, int origin);
 extern loff_t generic_file_llseek(struct file *file, loff_t offset, int origin);
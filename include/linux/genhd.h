@@ -89,6 +89,10 @@ struct disk_stats {
 	unsigned long page_cache_readpages;
 	unsigned long page_cache_hit[2];
 	unsigned long page_cache_missed[2];
+#ifndef __GENKSYMS__
+	unsigned long page_cache_ra_hit;	/* readahead pages consumed */
+	unsigned long page_cache_ra_waste;	/* readahead pages abandoned */
+#endif
 #endif
 };
 	
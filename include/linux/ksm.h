@@ -38,6 +38,12 @@ static inline void ksm_exit(struct mm_struct *mm)
 		__ksm_exit(mm);
 }
 
+static inline void ksm_mm_init(struct mm_struct *mm)
+{
+	atomic_long_set(&mm->ksm_rmap_items, 0);
+	atomic_long_set(&mm->ksm_merging_pages, 0);
+}
+
 /*
  * A KSM page is one of those write-protected "shared pages" or "merged pages"
  * which KSM maps into multiple mms, wherever identical anonymous page content
@@ -101,6 +107,10 @@ static inline void ksm_exit(struct mm_struct *mm)
 {
 }
 
+static inline void ksm_mm_init(struct mm_struct *mm)
+{
+}
+
 static inline int PageKsm(struct page *page)
 {
 	return 0;
@@ -236,6 +236,11 @@ extern int mpol_parse_str(char *str, struct mempolicy **mpol, int no_context);
 extern int mpol_to_str(char *buffer, int maxlen, struct mempolicy *pol,
 			int no_context);
 
+#ifdef CONFIG_NUMA_BALANCING
+extern int mpol_misplaced(struct page *page, struct vm_area_struct *vma,
+			  unsigned long addr);
+#endif
+
 /* Check if a vma is migratable */
 static inline int vma_migratable(struct vm_area_struct *vma)
 {
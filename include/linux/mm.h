@@ -112,6 +112,7 @@ extern unsigned int kobjsize(const void *objp);
 #define VM_MERGEABLE	0x80000000	/* KSM may merge identical pages */
 #if BITS_PER_LONG > 32
 #define VM_HUGEPAGE	0x100000000UL	/* MADV_HUGEPAGE marked this vma */
+#define VM_NOHUGEPAGE	0x200000000UL	/* MADV_NOHUGEPAGE marked this vma */
 #endif
 
 /*
@@ -990,6 +991,27 @@ extern int mprotect_fixup(struct vm_area_struct *vma,
 			  struct vm_area_struct **pprev, unsigned long start,
 			  unsigned long end, unsigned long newflags);
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * change_prot_numa() marks ptes PROT_NONE while the vma keeps its
+ * access rights, so a PROT_NONE pte in an accessible vma is a NUMA
+ * hinting pte rather than the result of mprotect(PROT_NONE).
+ */
+static inline int pte_numa(struct vm_area_struct *vma, pte_t pte)
+{
+	return pte_protnone(pte) &&
+		(vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC));
+}
+
+extern unsigned long change_prot_numa(struct vm_area_struct *vma,
+			unsigned long start, unsigned long end);
+#else
+static inline int pte_numa(struct vm_area_struct *vma, pte_t pte)
+{
+	return 0;
+}
+#endif
+
 /*
  * doesn't attempt to fault and will return short.
  */
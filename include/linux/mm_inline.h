@@ -21,24 +21,41 @@ static inline int page_is_file_cache(struct page *page)
 	return !PageSwapBacked(page);
 }
 
+/*
+ * The LRU list helpers below must be called with @lruvec->lru_lock
+ * held, @lruvec being the lruvec @page is (to be) linked to.
+ */
 static inline void
-add_page_to_lru_list(struct zone *zone, struct page *page, enum lru_list l)
+add_page_to_lru_list(struct zone *zone, struct page *page,
+		     struct lruvec *lruvec, enum lru_list l)
 {
-	struct lruvec *lruvec;
-
-	lruvec = mem_cgroup_lru_add_list(zone, page, l);
+	mem_cgroup_lru_add_list(lruvec, page, l);
 	list_add(&page->lru, &lruvec->lists[l]);
 	__mod_zone_page_state(zone, NR_LRU_BASE + l, hpage_nr_pages(page));
 }
 
 static inline void
-del_page_from_lru_list(struct zone *zone, struct page *page, enum lru_list l)
+del_page_from_lru_list(struct zone *zone, struct page *page,
+		       struct lruvec *lruvec, enum lru_list l)
 {
-	mem_cgroup_lru_del_list(page, l);
+	mem_cgroup_lru_del_list(lruvec, page, l);
 	list_del(&page->lru);
 	__mod_zone_page_state(zone, NR_LRU_BASE + l, -hpage_nr_pages(page));
 }
 
+static inline void
+move_page_to_lru_list(struct zone *zone, struct page *page,
+		      struct lruvec *lruvec, enum lru_list from,
+		      enum lru_list to)
+{
+	int nr_pages = hpage_nr_pages(page);
+
+	mem_cgroup_lru_move_lists(lruvec, page, from, to);
+	list_move(&page->lru, &lruvec->lists[to]);
+	__mod_zone_page_state(zone, NR_LRU_BASE + from, -nr_pages);
+	__mod_zone_page_state(zone, NR_LRU_BASE + to, nr_pages);
+}
+
 /**
  * page_lru_base_type - which LRU list type should a page be on?
  * @page: the page to test
@@ -55,7 +72,7 @@ static inline enum lru_list page_lru_base_type(struct page *page)
 }
 
 static inline void
-del_page_from_lru(struct zone *zone, struct page *page)
+del_page_from_lru(struct zone *zone, struct page *page, struct lruvec *lruvec)
 {
 	enum lru_list l;
 
@@ -69,7 +86,7 @@ del_page_from_lru(struct zone *zone, struct page *page)
 			l += LRU_ACTIVE;
 		}
 	}
-	mem_cgroup_lru_del_list(page, l);
+	mem_cgroup_lru_del_list(lruvec, page, l);
 	list_del(&page->lru);
 	__mod_zone_page_state(zone, NR_LRU_BASE + l, -hpage_nr_pages(page));
 }
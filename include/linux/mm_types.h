@@ -79,7 +79,7 @@ struct page {
 		void *freelist;		/* SLUB: freelist req. slab lock */
 	};
 	struct list_head lru;		/* Pageout list, eg. active_list
-					 * protected by zone->lru_lock !
+					 * protected by lruvec->lru_lock !
 					 */
 	/*
 	 * On machines where all RAM is mapped into kernel address space,
@@ -318,6 +318,26 @@ struct mm_struct {
 
 	/* base of lib map area (ASCII armour) */
 	unsigned long shlib_base;
+#ifdef CONFIG_NUMA_BALANCING
+	/*
+	 * numa_next_scan is the next time that the PTEs will be marked
+	 * for NUMA hinting faults, numa_scan_offset the address the
+	 * next scan starts at and numa_scan_seq is bumped every time
+	 * the whole address space has been covered.
+	 */
+	unsigned long numa_next_scan;
+	unsigned long numa_scan_offset;
+	int numa_scan_seq;
+#endif
+#ifdef CONFIG_KSM
+	/*
+	 * ksm_rmap_items is the number of pages of this mm which KSM is
+	 * tracking, ksm_merging_pages how many of those are mapped to a
+	 * shared KSM page.
+	 */
+	atomic_long_t ksm_rmap_items;
+	atomic_long_t ksm_merging_pages;
+#endif
 #endif
 };
 
@@ -62,7 +62,7 @@ struct free_area {
 struct pglist_data;
 
 /*
- * zone->lock and zone->lru_lock are two of the hottest locks in the kernel.
+ * zone->lock and zone->lruvec.lru_lock are two of the hottest locks in the kernel.
  * So add a wild amount of padding here to ensure that they fall into separate
  * cachelines.  There are very few zone structures in the machine, so space
  * consumption is not a concern here.
@@ -168,7 +168,14 @@ static inline int is_unevictable_lru(enum lru_list l)
 /* LRU Isolation modes. */
 typedef unsigned __bitwise__ isolate_mode_t;
 
+/*
+ * Every lruvec carries its own lock, so that reclaim, pagevec draining
+ * and page freeing of different memcgs in the same zone do not serialize
+ * on a single zone-wide lock.  The lock comes first so that the lruvec
+ * embedded in struct zone overlays the old zone->lru_lock layout.
+ */
 struct lruvec {
+	spinlock_t lru_lock;
 	struct list_head lists[NR_LRU_LISTS];
 };
 
@@ -367,8 +374,8 @@ struct zone {
 	ZONE_PADDING(_pad1_)
 
 	/* Fields commonly accessed by the page reclaim scanner */
-	spinlock_t		lru_lock;
 #ifdef __GENKSYMS__
+	spinlock_t		lru_lock;
 	struct zone_lru {
 		struct list_head list;
 	} lru[NR_LRU_LISTS];
@@ -471,7 +478,9 @@ struct zone {
 	unsigned long		compact_cached_free_pfn;
 	unsigned long		compact_cached_migrate_pfn;
 #endif
-	unsigned long padding[13];
+	/* Evictions & activations on the inactive file list */
+	atomic_long_t		inactive_age;
+	unsigned long padding[12];
 #else
 	unsigned long padding[16];
 #endif
@@ -907,6 +907,7 @@ struct net_device
 #define NETIF_F_TSO_ECN		(SKB_GSO_TCP_ECN << NETIF_F_GSO_SHIFT)
 #define NETIF_F_TSO6		(SKB_GSO_TCPV6 << NETIF_F_GSO_SHIFT)
 #define NETIF_F_FSO		(SKB_GSO_FCOE << NETIF_F_GSO_SHIFT)
+#define NETIF_F_GSO_UDP_L4	(SKB_GSO_UDP_L4 << NETIF_F_GSO_SHIFT)
 #define NETIF_F_ALL_TSO 	(NETIF_F_TSO | NETIF_F_TSO6 | NETIF_F_TSO_ECN)
 
 	/* List of features with software fallbacks. */
@@ -1183,6 +1184,10 @@ struct net_device_extended {
 					struct scatterlist *sgl,
 					unsigned int sgc);
 #endif
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	/* see include/net/busy_poll.h */
+	int			(*ndo_busy_poll)(struct napi_struct *napi);
+#endif
 };
 
 #define NET_DEVICE_EXTENDED_SIZE \
@@ -1428,6 +1433,20 @@ struct packet_type {
 	struct list_head	list;
 };
 
+/*
+ * Batched receive handler for a packet_type, registered separately with
+ * dev_add_pack_list() because modules embed struct packet_type.  ->func
+ * takes a batch of skbs for ->pt from netif_receive_skb_list() and must
+ * consume all of them.
+ */
+struct packet_list_type {
+	struct packet_type	*pt;
+	void			(*func) (struct sk_buff_head *,
+					 struct packet_type *,
+					 struct net_device *);
+	struct list_head	list;
+};
+
 #include <linux/interrupt.h>
 #include <linux/notifier.h>
 
@@ -1466,6 +1485,8 @@ extern struct net_device *__dev_getfirstbyhwtype(struct net *net, unsigned short
 extern void		dev_add_pack(struct packet_type *pt);
 extern void		dev_remove_pack(struct packet_type *pt);
 extern void		__dev_remove_pack(struct packet_type *pt);
+extern void		dev_add_pack_list(struct packet_list_type *plt);
+extern void		dev_remove_pack_list(struct packet_list_type *plt);
 
 extern struct net_device	*dev_get_by_flags(struct net *net, unsigned short flags,
 						  unsigned short mask);
@@ -1856,6 +1877,7 @@ extern int		netif_rx(struct sk_buff *skb);
 extern int		netif_rx_ni(struct sk_buff *skb);
 #define HAVE_NETIF_RECEIVE_SKB 1
 extern int		netif_receive_skb(struct sk_buff *skb);
+extern void		netif_receive_skb_list(struct sk_buff_head *list);
 extern void		napi_gro_flush(struct napi_struct *napi);
 extern gro_result_t	dev_gro_receive(struct napi_struct *napi,
 					struct sk_buff *skb);
@@ -9,6 +9,9 @@ enum {
 	PCG_ACCT_LRU, /* page has been accounted for (under lru_lock) */
 	PCG_FILE_MAPPED, /* page is accounted as "mapped" */
 	PCG_MIGRATION, /* under page migration */
+	PCG_MOVE_LOCK, /* For race between move_account v.s. page stat update */
+	PCG_FILE_DIRTY, /* page is accounted as "dirty" */
+	PCG_FILE_WRITEBACK, /* page is accounted as "writeback" */
 	__NR_PCG_FLAGS,
 };
 
@@ -63,6 +66,10 @@ static inline void ClearPageCgroup##uname(struct page_cgroup *pc)	\
 static inline int TestClearPageCgroup##uname(struct page_cgroup *pc)	\
 	{ return test_and_clear_bit(PCG_##lname, &pc->flags);  }
 
+#define TESTSETPCGFLAG(uname, lname)			\
+static inline int TestSetPageCgroup##uname(struct page_cgroup *pc)	\
+	{ return test_and_set_bit(PCG_##lname, &pc->flags);  }
+
 /* Cache flag is set only once (at allocation) */
 TESTPCGFLAG(Cache, CACHE)
 CLEARPCGFLAG(Cache, CACHE)
@@ -85,6 +92,16 @@ SETPCGFLAG(Migration, MIGRATION)
 CLEARPCGFLAG(Migration, MIGRATION)
 TESTPCGFLAG(Migration, MIGRATION)
 
+TESTPCGFLAG(FileDirty, FILE_DIRTY)
+TESTSETPCGFLAG(FileDirty, FILE_DIRTY)
+CLEARPCGFLAG(FileDirty, FILE_DIRTY)
+TESTCLEARPCGFLAG(FileDirty, FILE_DIRTY)
+
+TESTPCGFLAG(FileWriteback, FILE_WRITEBACK)
+TESTSETPCGFLAG(FileWriteback, FILE_WRITEBACK)
+CLEARPCGFLAG(FileWriteback, FILE_WRITEBACK)
+TESTCLEARPCGFLAG(FileWriteback, FILE_WRITEBACK)
+
 static inline void lock_page_cgroup(struct page_cgroup *pc)
 {
 	bit_spin_lock(PCG_LOCK, &pc->flags);
@@ -100,6 +117,25 @@ static inline void unlock_page_cgroup(struct page_cgroup *pc)
 	bit_spin_unlock(PCG_LOCK, &pc->flags);
 }
 
+/*
+ * The dirty and writeback statistics are updated from end_page_writeback(),
+ * which may run in irq context, so they cannot use lock_page_cgroup().
+ * They use this irq-safe lock instead to keep pc->mem_cgroup stable.
+ */
+static inline void move_lock_page_cgroup(struct page_cgroup *pc,
+					 unsigned long *flags)
+{
+	local_irq_save(*flags);
+	bit_spin_lock(PCG_MOVE_LOCK, &pc->flags);
+}
+
+static inline void move_unlock_page_cgroup(struct page_cgroup *pc,
+					   unsigned long *flags)
+{
+	bit_spin_unlock(PCG_MOVE_LOCK, &pc->flags);
+	local_irq_restore(*flags);
+}
+
 #ifdef CONFIG_SPARSEMEM
 #define PCG_ARRAYID_WIDTH	SECTIONS_SHIFT
 #else
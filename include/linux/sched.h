@@ -1679,6 +1679,23 @@ struct task_struct {
 
 	u64 rx_bytes;
 	u64 tx_bytes;
+#ifndef __GENKSYMS__
+#ifdef CONFIG_NUMA_BALANCING
+	int numa_scan_seq;
+	int numa_work;			/* scan pending on return to user */
+	unsigned int numa_scan_period;
+	int numa_preferred_nid;
+	u64 node_stamp;			/* migration stamp  */
+	unsigned long numa_migrate_retry;
+	/*
+	 * numa_faults[nid] holds the decaying average of hinting faults
+	 * on node nid, numa_faults[nr_node_ids + nid] the faults recorded
+	 * during the current scan window.
+	 */
+	unsigned long *numa_faults;
+	unsigned long numa_faults_locality[2];	/* remote, local */
+#endif
+#endif
 };
 
 /* Future-safe accessor for struct task_struct's cpus_allowed. */
@@ -2105,6 +2122,23 @@ static inline void sched_autogroup_exit(struct signal_struct *sig) { }
 extern unsigned int sysctl_sched_cfs_bandwidth_slice;
 #endif
 
+#ifdef CONFIG_NUMA_BALANCING
+extern unsigned int sysctl_numa_balancing;
+extern unsigned int sysctl_numa_balancing_scan_delay;
+extern unsigned int sysctl_numa_balancing_scan_period_min;
+extern unsigned int sysctl_numa_balancing_scan_period_max;
+extern unsigned int sysctl_numa_balancing_scan_size;
+
+extern void task_numa_fault(int node, int pages, bool migrated);
+extern void task_numa_work(void);
+extern void task_numa_free(struct task_struct *p);
+extern void mm_init_numa_balancing(struct mm_struct *mm);
+#else
+static inline void task_numa_fault(int node, int pages, bool migrated) { }
+static inline void task_numa_free(struct task_struct *p) { }
+static inline void mm_init_numa_balancing(struct mm_struct *mm) { }
+#endif
+
 #ifdef CONFIG_RT_MUTEXES
 extern int rt_mutex_getprio(struct task_struct *p);
 extern void rt_mutex_setprio(struct task_struct *p, int prio);
@@ -231,6 +231,24 @@ struct ubuf_info {
 	unsigned long desc;
 };
 
+/*
+ * MSG_ZEROCOPY state of a socket send.  It is attached to skbs like a
+ * device zerocopy ubuf_info, but may be shared by several skb_shared_info
+ * (split and segmented skbs), each holding a reference.  When the last one
+ * goes the completion of notification ids [@id, @id + @len) is queued on
+ * the error queue of @sk.
+ */
+struct sock_zerocopy {
+	struct ubuf_info	ubuf;
+	struct sock		*sk;
+	struct sk_buff		*skb;		/* preallocated notification */
+	atomic_t		refcnt;
+	u32			id;
+	u16			len;
+	u8			zerocopy:1;	/* false if data was copied */
+	u32			bytelen;
+};
+
 /* This data is invariant across clones and lives at
  * the end of the header data, ie. at skb->end.
  */
@@ -285,6 +303,9 @@ enum {
 	SKB_GSO_TCPV6 = 1 << 4,
 
 	SKB_GSO_FCOE = 1 << 5,
+
+	/* UDP datagrams of gso_size each, not IP fragments as SKB_GSO_UDP */
+	SKB_GSO_UDP_L4 = 1 << 6,
 };
 
 #if BITS_PER_LONG > 32
@@ -433,9 +454,18 @@ struct sk_buff {
 
 	/* 0/13 bit hole */
 
+#ifdef __GENKSYMS__
 #ifdef CONFIG_NET_DMA
 	dma_cookie_t		dma_cookie;
 #endif
+#else
+#if defined(CONFIG_NET_DMA) || defined(CONFIG_NET_RX_BUSY_POLL)
+	union {
+		unsigned int	napi_id;
+		dma_cookie_t	dma_cookie;
+	};
+#endif
+#endif
 #ifdef CONFIG_NETWORK_SECMARK
 	__u32			secmark;
 #endif
@@ -584,6 +614,28 @@ static inline union skb_shared_tx *skb_tx(struct sk_buff *skb)
 	return &skb_shinfo(skb)->tx_flags;
 }
 
+extern void sock_zerocopy_callback(void *arg);
+
+/**
+ * skb_zcopy - return the MSG_ZEROCOPY state of an skb
+ * @skb: buffer, may be NULL
+ *
+ * Returns NULL if @skb carries no user pages from a socket, including
+ * device zerocopy buffers such as those of vhost-net.
+ */
+static inline struct sock_zerocopy *skb_zcopy(struct sk_buff *skb)
+{
+	struct ubuf_info *uarg;
+
+	if (!skb || !skb_tx(skb)->dev_zerocopy)
+		return NULL;
+
+	uarg = skb_shinfo(skb)->destructor_arg;
+	if (uarg->callback != sock_zerocopy_callback)
+		return NULL;
+	return container_of(uarg, struct sock_zerocopy, ubuf);
+}
+
 /**
  *	skb_queue_empty - check if a queue is empty
  *	@list: queue head
@@ -2022,6 +2074,15 @@ extern int             skb_splice_bits(struct sk_buff *skb,
 extern void	       skb_copy_and_csum_dev(const struct sk_buff *skb, u8 *to);
 extern void	       skb_split(struct sk_buff *skb,
 				 struct sk_buff *skb1, const u32 len);
+extern struct sock_zerocopy *sock_zerocopy_realloc(struct sock *sk, size_t size,
+						   struct sock_zerocopy *uarg);
+extern void sock_zerocopy_put(struct sock_zerocopy *uarg);
+extern void sock_zerocopy_put_abort(struct sock_zerocopy *uarg);
+extern struct sk_buff *sock_dequeue_err_skb(struct sock *sk);
+extern int skb_zerocopy_iter_stream(struct sock *sk, struct sk_buff *skb,
+				    unsigned char __user *from, int len,
+				    struct sock_zerocopy *uarg);
+extern int skb_orphan_frags_rx(struct sk_buff *skb, gfp_t gfp_mask);
 extern int	       skb_shift(struct sk_buff *tgt, struct sk_buff *skb,
 				 int shiftlen);
 
@@ -170,6 +170,29 @@ enum {
 #define COUNT_CONTINUED	0x80	/* See swap_map continuation for full count */
 #define SWAP_MAP_SHMEM	0xbf	/* Owned by shmem/tmpfs, in first swap_map */
 
+/*
+ * Swap slots are grouped in aligned clusters of SWAPFILE_CLUSTER pages.
+ * On solid state devices, each cluster counts its slots in use, and the
+ * empty ones are linked through their next field into the free cluster
+ * list of the device, from which each cpu takes a cluster of its own to
+ * allocate sequentially from.
+ */
+#define SWAPFILE_CLUSTER	256
+#define CLUSTER_NULL		(~0U)
+
+struct swap_cluster_info {
+	unsigned int count;	/* slots in use, header and bad slots included */
+	unsigned int next;	/* next free cluster, if this one is free */
+	unsigned int flags;
+};
+#define CLUSTER_FLAG_FREE	1	/* on the free cluster list */
+
+/* The cluster a cpu currently allocates from */
+struct percpu_cluster {
+	unsigned int index;	/* cluster index, or CLUSTER_NULL */
+	unsigned int next;	/* next offset to try in the cluster */
+};
+
 /*
  * The in-memory structure used to track swap areas.
  */
@@ -193,6 +216,16 @@ struct swap_info_struct {
 	unsigned int max;
 	unsigned int inuse_pages;
 	unsigned int old_block_size;
+#ifndef __GENKSYMS__
+#ifdef CONFIG_FRONTSWAP
+	unsigned long *frontswap_map;	/* frontswap in-use, one bit per page */
+	atomic_t frontswap_pages;	/* frontswap pages in-use counter */
+#endif
+	struct swap_cluster_info *cluster_info;	/* SSD only, else NULL */
+	unsigned int free_cluster_head;	/* free cluster list, FIFO */
+	unsigned int free_cluster_tail;
+	struct percpu_cluster *percpu_cluster;	/* per cpu's current cluster */
+#endif
 };
 
 struct swap_list_t {
@@ -203,6 +236,12 @@ struct swap_list_t {
 /* Swap 50% full? Release swapcache more aggressively.. */
 #define vm_swap_full() (nr_swap_pages*2 < total_swap_pages)
 
+/* linux/mm/workingset.c */
+void *workingset_eviction(struct address_space *mapping, struct page *page);
+bool workingset_refault(void *shadow);
+void workingset_activation(struct page *page);
+void workingset_forget(void *shadow);
+
 /* linux/mm/page_alloc.c */
 extern unsigned long totalram_pages;
 extern unsigned long totalreserve_pages;
@@ -218,7 +257,7 @@ extern unsigned int nr_free_pagecache_pages(void);
 /* linux/mm/swap.c */
 extern void __lru_cache_add(struct page *, enum lru_list lru);
 extern void lru_cache_add_lru(struct page *, enum lru_list lru);
-extern void lru_add_page_tail(struct zone* zone,
+extern void lru_add_page_tail(struct zone* zone, struct lruvec *lruvec,
 			      struct page *page, struct page *page_tail);
 extern void activate_page(struct page *);
 extern void mark_page_accessed(struct page *);
@@ -301,6 +340,7 @@ extern void swap_unplug_io_fn(struct backing_dev_info *, struct page *);
 /* linux/mm/page_io.c */
 extern int swap_readpage(struct page *);
 extern int swap_writepage(struct page *page, struct writeback_control *wbc);
+extern int __swap_writepage(struct page *page, struct writeback_control *wbc);
 extern void end_swap_bio_read(struct bio *bio, int err);
 
 /* linux/mm/swap_state.c */
@@ -319,11 +359,14 @@ extern struct page *read_swap_cache_async(swp_entry_t, gfp_t,
 extern struct page *swapin_readahead(swp_entry_t, gfp_t,
 			struct vm_area_struct *vma, unsigned long addr);
 
+/* linux/mm/swap_slots.c */
+extern swp_entry_t get_swap_page(void);
+
 /* linux/mm/swapfile.c */
 extern long nr_swap_pages;
 extern long total_swap_pages;
 extern void si_swapinfo(struct sysinfo *);
-extern swp_entry_t get_swap_page(void);
+extern int get_swap_pages(int n, swp_entry_t entries[]);
 extern swp_entry_t get_swap_page_of_type(int);
 extern int valid_swaphandles(swp_entry_t, unsigned long *);
 extern int add_swap_count_continuation(swp_entry_t, gfp_t);
@@ -332,6 +375,8 @@ extern int swap_duplicate(swp_entry_t);
 extern int swapcache_prepare(swp_entry_t);
 extern void swap_free(swp_entry_t);
 extern void swapcache_free(swp_entry_t, struct page *page);
+extern void swapcache_free_entries(swp_entry_t *entries, int n);
+extern int __swap_count(swp_entry_t entry);
 extern int free_swap_and_cache(swp_entry_t);
 extern int swap_type_of(dev_t, sector_t, struct block_device **);
 extern unsigned int count_swap_pages(int, int);
@@ -0,0 +1,31 @@
+#ifndef _LINUX_SWAP_SLOTS_H
+#define _LINUX_SWAP_SLOTS_H
+
+#include <linux/swap.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+
+#define SWAP_SLOTS_CACHE_SIZE	64
+
+/*
+ * Per-cpu cache of swap slots.  Slots for the swap cache are taken from
+ * the device in batches into slots[], and slots released by the swap
+ * cache are collected in slots_ret[] and given back in batches, so that
+ * swap_lock is taken once per batch instead of once per page.
+ */
+struct swap_slots_cache {
+	struct mutex	alloc_lock;	/* protects slots, nr, cur */
+	swp_entry_t	slots[SWAP_SLOTS_CACHE_SIZE];
+	int		nr;
+	int		cur;
+	spinlock_t	free_lock;	/* protects slots_ret, n_ret */
+	swp_entry_t	slots_ret[SWAP_SLOTS_CACHE_SIZE];
+	int		n_ret;
+};
+
+#ifdef CONFIG_SWAP
+extern int free_swap_slot(swp_entry_t entry);
+extern void drain_swap_slots_caches(void);
+#endif
+
+#endif /* _LINUX_SWAP_SLOTS_H */
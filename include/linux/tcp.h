@@ -449,6 +449,16 @@ struct tcp_sock {
 	 * socket. Used to retransmit SYNACKs etc.
 	 */
 	struct request_sock *fastopen_rsk;
+
+/* TCP Small Queues: per-socket throttling of bytes queued below TCP */
+	unsigned long		tsq_flags;
+	struct list_head	tsq_node; /* anchor in tsq_tasklet.head list */
+};
+
+enum tsq_flags {
+	TSQ_THROTTLED,
+	TSQ_QUEUED,
+	TSQ_OWNED, /* tcp_tasklet_func() found socket was locked */
 };
 
 static inline struct tcp_sock *tcp_sk(const struct sock *sk)
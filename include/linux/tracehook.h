@@ -678,6 +678,10 @@ static inline void tracehook_notify_resume(struct pt_regs *regs)
 	smp_mb();
 	if (task_utrace_flags(task))
 		utrace_resume(task, regs);
+#ifdef CONFIG_NUMA_BALANCING
+	if (unlikely(task->numa_work))
+		task_numa_work();
+#endif
 }
 #endif	/* TIF_NOTIFY_RESUME */
 
@@ -29,6 +29,8 @@ struct udphdr {
 /* UDP socket options */
 #define UDP_CORK	1	/* Never send partially complete segments */
 #define UDP_ENCAP	100	/* Set the socket to accept encapsulated packets */
+#define UDP_SEGMENT	103	/* Set GSO segmentation size */
+#define UDP_GRO		104	/* This socket can receive UDP GRO packets */
 
 /* UDP encapsulation types */
 #define UDP_ENCAP_ESPINUDP_NON_IKE	1 /* draft-ietf-ipsec-nat-t-ike-00/01 */
@@ -47,6 +49,8 @@ static inline struct udphdr *udp_hdr(const struct sk_buff *skb)
 
 #define UDP_HTABLE_SIZE		128
 
+#define UDP_MAX_SEGMENTS	(1 << 6UL)
+
 static inline int udp_hashfn(struct net *net, const unsigned num)
 {
 	return (num + net_hash_mix(net)) & (UDP_HTABLE_SIZE - 1);
@@ -73,7 +77,12 @@ struct udp_sock {
 #define UDPLITE_SEND_CC  0x2  		/* set via udplite setsockopt         */
 #define UDPLITE_RECV_CC  0x4		/* set via udplite setsocktopt        */
 	__u8		 pcflag;        /* marks socket as UDP-Lite if > 0    */
+#ifndef __GENKSYMS__
+	__u8		 gro_enabled;	/* UDP_GRO: accept coalesced datagrams */
+	__u16		 gso_size;	/* UDP_SEGMENT: segment size of sends */
+#else
 	__u8		 unused[3];
+#endif
 	/*
 	 * For encapsulation sockets.
 	 */
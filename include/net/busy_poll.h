@@ -0,0 +1,128 @@
+/*
+ * net busy poll support
+ *
+ * Sockets which had data delivered by a NAPI context recently may, instead
+ * of sleeping for the next interrupt, poll that NAPI context directly from
+ * recvmsg() and poll()/select() for a short while. This trades CPU time for
+ * latency, so it is opt-in: per socket with SO_BUSY_POLL, or with the
+ * net.core.busy_read and net.core.busy_poll sysctls.
+ *
+ * Drivers take part by tagging received skbs with the id napi_hash_add()
+ * gave their NAPI context and by providing ndo_busy_poll in
+ * net_device_extended, which cleans a few rx descriptors and hands the
+ * packets to the stack, returning how many it found, LL_FLUSH_BUSY if the
+ * context is being polled already or LL_FLUSH_FAILED if it is going away.
+ */
+
+#ifndef _LINUX_NET_BUSY_POLL_H
+#define _LINUX_NET_BUSY_POLL_H
+
+#include <linux/netdevice.h>
+#include <linux/sched.h>
+#include <net/sock.h>
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+
+#define LL_FLUSH_FAILED		-1
+#define LL_FLUSH_BUSY		-2
+
+extern unsigned int sysctl_net_busy_read __read_mostly;
+extern unsigned int sysctl_net_busy_poll __read_mostly;
+
+extern unsigned int napi_hash_add(struct napi_struct *napi);
+extern void napi_hash_del(unsigned int napi_id);
+extern struct napi_struct *napi_by_id(unsigned int napi_id);
+extern int sk_busy_loop(struct sock *sk, int nonblock);
+
+static inline int net_busy_loop_on(void)
+{
+	return sysctl_net_busy_poll;
+}
+
+/* cpu_clock() in usecs, roughly. Which cpu does not matter much as long
+ * as the same one is used within a loop, and a migration just makes it
+ * end a bit early or late.
+ */
+static inline u64 busy_loop_us_clock(void)
+{
+	u64 rc;
+
+	rc = cpu_clock(get_cpu());
+	put_cpu();
+
+	return rc >> 10;
+}
+
+static inline unsigned long sk_busy_loop_end_time(struct sock *sk)
+{
+	return busy_loop_us_clock() + ACCESS_ONCE(sk_extended(sk)->sk_ll_usec);
+}
+
+/* for poll()/select(), all sockets share the same deadline */
+static inline unsigned long busy_loop_end_time(void)
+{
+	return busy_loop_us_clock() + ACCESS_ONCE(sysctl_net_busy_poll);
+}
+
+static inline int busy_loop_timeout(unsigned long end_time)
+{
+	unsigned long now = busy_loop_us_clock();
+
+	return time_after(now, end_time);
+}
+
+static inline int sk_can_busy_loop(struct sock *sk)
+{
+	return sk_extended(sk)->sk_ll_usec && sk_extended(sk)->sk_napi_id &&
+	       !need_resched() && !signal_pending(current);
+}
+
+/* used in the NIC receive handler to mark the skb */
+static inline void skb_mark_napi_id(struct sk_buff *skb, unsigned int napi_id)
+{
+	skb->napi_id = napi_id;
+}
+
+/* used in the protocol handler to propagate the napi_id to the socket */
+static inline void sk_mark_napi_id(struct sock *sk, struct sk_buff *skb)
+{
+	sk_extended(sk)->sk_napi_id = skb->napi_id;
+}
+
+#else /* CONFIG_NET_RX_BUSY_POLL */
+
+static inline int net_busy_loop_on(void)
+{
+	return 0;
+}
+
+static inline unsigned long busy_loop_end_time(void)
+{
+	return 0;
+}
+
+static inline int busy_loop_timeout(unsigned long end_time)
+{
+	return 1;
+}
+
+static inline int sk_can_busy_loop(struct sock *sk)
+{
+	return 0;
+}
+
+static inline int sk_busy_loop(struct sock *sk, int nonblock)
+{
+	return 0;
+}
+
+static inline void skb_mark_napi_id(struct sk_buff *skb, unsigned int napi_id)
+{
+}
+
+static inline void sk_mark_napi_id(struct sock *sk, struct sk_buff *skb)
+{
+}
+
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+#endif /* _LINUX_NET_BUSY_POLL_H */
@@ -257,6 +257,10 @@ extern void __inet_hash_nolisten(struct sock *sk);
 extern void inet_hash(struct sock *sk);
 extern void inet_unhash(struct sock *sk);
 
+extern int inet_rcv_saddr_same(const struct sock *sk, const struct sock *sk2);
+extern void inet_reuseport_add_sock(struct sock *sk,
+				    struct inet_listen_hashbucket *ilb);
+
 extern struct sock *__inet_lookup_listener(struct net *net,
 					   struct inet_hashinfo *hashinfo,
 					   const __be32 saddr,
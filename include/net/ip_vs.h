@@ -19,6 +19,8 @@
 #include <asm/atomic.h>                 /* for struct atomic_t */
 #include <linux/compiler.h>
 #include <linux/timer.h>
+#include <linux/rcupdate.h>
+#include <linux/u64_stats_sync.h>
 
 #include <net/checksum.h>
 #include <linux/netfilter.h>		/* for union nf_inet_addr */
@@ -271,12 +273,29 @@ struct ip_vs_estimator {
 	u32			outbps;
 };
 
+/*
+ *	Counters bumped by the forwarding path, one set per cpu so that
+ *	packets never take a shared lock
+ */
+struct ip_vs_cpu_stats {
+	__u32			conns;
+	__u32			inpkts;
+	__u32			outpkts;
+	__u64			inbytes;
+	__u64			outbytes;
+	struct u64_stats_sync	syncp;
+};
+
 struct ip_vs_stats
 {
 	struct ip_vs_stats_user	ustats;         /* statistics */
 	struct ip_vs_estimator	est;		/* estimator */
 
 	spinlock_t              lock;           /* spin lock */
+#ifndef __GENKSYMS__
+	struct ip_vs_cpu_stats	*cpustats;	/* per cpu counters */
+	struct ip_vs_stats_user	ustats0;	/* counters at last zeroing */
+#endif
 };
 
 struct dst_entry;
@@ -355,7 +374,11 @@ extern struct ip_vs_protocol * ip_vs_proto_get(unsigned short proto);
  *	IP_VS structure allocated for each dynamically scheduled connection
  */
 struct ip_vs_conn {
+#ifndef __GENKSYMS__
+	struct hlist_node	c_list;         /* hashed list heads */
+#else
 	struct list_head        c_list;         /* hashed list heads */
+#endif
 
 	/* Protocol, addresses and port numbers */
 	u16                      af;		/* address family */
@@ -401,6 +424,10 @@ struct ip_vs_conn {
 	void                    *app_data;      /* Application private data */
 	struct ip_vs_seq        in_seq;         /* incoming seq. struct */
 	struct ip_vs_seq        out_seq;        /* outgoing seq. struct */
+
+#ifndef __GENKSYMS__
+	struct rcu_head		rcu_head;
+#endif
 };
 
 
@@ -668,6 +695,7 @@ struct ip_vs_conn * ip_vs_conn_out_get_proto(int af, const struct sk_buff *skb,
 /* put back the conn without restarting its timer */
 static inline void __ip_vs_conn_put(struct ip_vs_conn *cp)
 {
+	smp_mb__before_atomic_dec();
 	atomic_dec(&cp->refcnt);
 }
 extern void ip_vs_conn_put(struct ip_vs_conn *cp);
@@ -816,6 +844,8 @@ extern int sysctl_ip_vs_cache_bypass;
 extern int sysctl_ip_vs_expire_nodest_conn;
 extern int sysctl_ip_vs_expire_quiescent_template;
 extern int sysctl_ip_vs_sync_threshold[2];
+extern int sysctl_ip_vs_sync_ports;
+extern int sysctl_ip_vs_sync_qlen_max;
 extern int sysctl_ip_vs_nat_icmp_send;
 extern struct ip_vs_stats ip_vs_stats;
 extern const struct ctl_path net_vs_ctl_path[];
@@ -847,6 +877,8 @@ extern struct ip_vs_dest *ip_vs_try_bind_dest(struct ip_vs_conn *cp);
  *      IPVS sync daemon data and function prototypes
  *      (from ip_vs_sync.c)
  */
+#define IP_VS_SYNC_PORTS_MAX	64	/* limit of sync threads per state */
+
 extern volatile int ip_vs_sync_state;
 extern volatile int ip_vs_master_syncid;
 extern volatile int ip_vs_backup_syncid;
@@ -865,6 +897,7 @@ extern void ip_vs_estimator_cleanup(void);
 extern void ip_vs_new_estimator(struct ip_vs_stats *stats);
 extern void ip_vs_kill_estimator(struct ip_vs_stats *stats);
 extern void ip_vs_zero_estimator(struct ip_vs_stats *stats);
+extern void ip_vs_read_cpu_stats(struct ip_vs_stats *stats);
 
 /*
  *	Various IPVS packet transmitters (from ip_vs_xmit.c)
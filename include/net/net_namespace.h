@@ -88,6 +88,9 @@ struct net {
 #ifndef __GENKSYMS__
 	unsigned int ipv4_sysctl_ping_group_range[2];
 	struct netns_nf_frag	nf_frag;
+#if defined(CONFIG_NF_CONNTRACK) || defined(CONFIG_NF_CONNTRACK_MODULE)
+	struct netns_ct_gc	ct_gc;
+#endif
 #endif
 };
 
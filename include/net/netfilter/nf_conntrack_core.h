@@ -73,6 +73,14 @@ print_tuple(struct seq_file *s, const struct nf_conntrack_tuple *tuple,
             const struct nf_conntrack_l3proto *l3proto,
             const struct nf_conntrack_l4proto *proto);
 
+/* Protects expectations and helper assignment only; the conntrack hash
+ * is protected by nf_conntrack_locks[].
+ */
 extern spinlock_t nf_conntrack_lock ;
 
+#define CONNTRACK_LOCKS 1024
+
+extern spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS];
+extern void nf_conntrack_lock_bucket(spinlock_t *lock);
+
 #endif /* _NF_CONNTRACK_CORE_H */
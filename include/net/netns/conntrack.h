@@ -3,11 +3,30 @@
 
 #include <linux/list.h>
 #include <linux/list_nulls.h>
+#include <linux/seqlock.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
 #include <asm/atomic.h>
 
 struct ctl_table_header;
 struct nf_conntrack_ecache;
 
+/* Per-cpu lists of conntracks that are not in the hash table */
+struct ct_pcpu {
+	spinlock_t		lock;
+	struct hlist_nulls_head	unconfirmed;
+	struct hlist_nulls_head	dying;
+};
+
+/* State of the incremental garbage collector walking the hash table */
+struct netns_ct_gc {
+	struct delayed_work	dwork;
+	unsigned int		next_bucket;
+	unsigned int		next_gc_run;
+	bool			early_drop;
+	bool			exiting;
+};
+
 struct netns_ct {
 	atomic_t		count;
 	unsigned int		expect_count;
@@ -15,8 +34,13 @@ struct netns_ct {
 	struct kmem_cache	*nf_conntrack_cachep;
 	struct hlist_nulls_head	*hash;
 	struct hlist_head	*expect_hash;
+#ifndef __GENKSYMS__
+	struct ct_pcpu		*pcpu_lists;
+	seqcount_t		generation;
+#else
 	struct hlist_nulls_head	unconfirmed;
 	struct hlist_nulls_head	dying;
+#endif
 	struct ip_conntrack_stat *stat;
 	int			sysctl_events;
 	unsigned int		sysctl_events_retry_timeout;
@@ -100,6 +100,7 @@ typedef struct {
 
 struct sock;
 struct proto;
+struct sock_reuseport;
 struct net;
 
 /**
@@ -365,6 +366,45 @@ struct sock_extended {
 	 * existing modules. */
 	__u8			rcv_tos;
 	u32			icsk_user_timeout;
+
+	/*
+	 * Expansion space for packet pacing
+	 *	@sk_pacing_rate: pacing rate in bytes per second, computed by
+	 *			 the transport and honored by sch_fq
+	 */
+	u32			sk_pacing_rate;
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	/*
+	 * Busy polling, see include/net/busy_poll.h
+	 *	@sk_napi_id: id of the NAPI context that last fed this socket
+	 *	@sk_ll_usec: usecs to busy poll for when there is no data
+	 */
+	unsigned int		sk_napi_id;
+	unsigned int		sk_ll_usec;
+#endif
+
+	/*
+	 * SO_REUSEPORT groups, see include/net/sock_reuseport.h
+	 *	@sk_reuseport_cb: group this socket belongs to, RCU protected
+	 *	@sk_incoming_cpu: CPU this socket is pinned to with
+	 *			  SO_INCOMING_CPU, or -1
+	 */
+	struct sock_reuseport	*sk_reuseport_cb;
+	int			sk_incoming_cpu;
+
+	/*
+	 * MSG_ZEROCOPY, see struct sock_zerocopy
+	 *	@sk_zckey: next completion notification id
+	 */
+	atomic_t		sk_zckey;
+
+	/*
+	 * Work deferred while the socket was owned by user
+	 *	@sk_release_deferred: release_sock() must run tcp_release_cb(),
+	 *			      protected by sk_lock.slock
+	 */
+	__u8			sk_release_deferred;
 };
 
 #define __sk_tx_queue_mapping(sk) \
@@ -0,0 +1,53 @@
+#ifndef _SOCK_REUSEPORT_H
+#define _SOCK_REUSEPORT_H
+
+#include <linux/rcupdate.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+#include <net/sock.h>
+
+/*
+ * A SO_REUSEPORT group: every socket bound to the same address, port,
+ * device and owner shares one of these, so the receive path can pick a
+ * member in O(1) instead of scoring every socket in the hash chain.
+ *
+ * Members are changed under reuseport_lock and read under RCU.
+ *	@num_socks: members in use at the front of @socks
+ *	@max_socks: length of @socks
+ *	@has_conns: a member did connect(), the legacy lookup must be used
+ *	@cpu_socks: nr_cpu_ids entries, the member pinned to each CPU with
+ *		    SO_INCOMING_CPU, or NULL
+ */
+struct sock_reuseport {
+	struct rcu_head		rcu;
+	u16			max_socks;
+	u16			num_socks;
+	unsigned int		has_conns:1;
+	struct sock		**cpu_socks;
+	struct sock		*socks[0];
+};
+
+extern spinlock_t reuseport_lock;
+
+extern int reuseport_alloc(struct sock *sk);
+extern int reuseport_add_sock(struct sock *sk, struct sock *sk2);
+extern void reuseport_detach_sock(struct sock *sk);
+extern struct sock *reuseport_select_sock(struct sock *sk, u32 hash);
+extern int reuseport_set_incoming_cpu(struct sock *sk, int cpu);
+
+static inline void reuseport_has_conns_set(struct sock *sk)
+{
+	struct sock_reuseport *reuse;
+
+	if (!sk->sk_reuseport)
+		return;
+
+	spin_lock_bh(&reuseport_lock);
+	reuse = sk_extended(sk)->sk_reuseport_cb;
+	if (reuse)
+		reuse->has_conns = 1;
+	spin_unlock_bh(&reuseport_lock);
+}
+
+#endif  /* _SOCK_REUSEPORT_H */
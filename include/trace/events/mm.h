@@ -24,4 +24,8 @@ DECLARE_TRACE(page_cache_acct_miss,
 	TP_PROTO(struct super_block *sb, int rw),
 	TP_ARGS(sb, rw));
 
+DECLARE_TRACE(page_cache_acct_readahead,
+	TP_PROTO(struct super_block *sb, int hits, int waste),
+	TP_ARGS(sb, hits, waste));
+
 #endif
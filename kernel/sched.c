@@ -1865,6 +1865,9 @@ static unsigned long power_of(int cpu)
 }
 
 static int task_hot(struct task_struct *p, u64 now, struct sched_domain *sd);
+#ifdef CONFIG_NUMA_BALANCING
+static void migrate_task_to(struct task_struct *p, int dest_cpu);
+#endif
 
 static unsigned long cpu_avg_load_per_task(int cpu)
 {
@@ -2764,6 +2767,18 @@ static void __sched_fork(struct task_struct *p)
 	p->se.prev_sum_exec_runtime	= 0;
 	p->se.nr_migrations		= 0;
 
+#ifdef CONFIG_NUMA_BALANCING
+	p->node_stamp			= 0ULL;
+	p->numa_scan_seq		= p->mm ? p->mm->numa_scan_seq : 0;
+	p->numa_scan_period		= sysctl_numa_balancing_scan_delay;
+	p->numa_work			= 0;
+	p->numa_preferred_nid		= -1;
+	p->numa_migrate_retry		= 0;
+	p->numa_faults			= NULL;
+	p->numa_faults_locality[0]	= 0;
+	p->numa_faults_locality[1]	= 0;
+#endif
+
 #ifdef CONFIG_SCHEDSTATS
 	p->se.wait_start			= 0;
 	p->se.wait_max				= 0;
@@ -3801,6 +3816,37 @@ unlock:
 	task_rq_unlock(rq, &flags);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Move current to @dest_cpu on behalf of NUMA balancing, the same way
+ * sched_exec() does.
+ */
+static void migrate_task_to(struct task_struct *p, int dest_cpu)
+{
+	struct migration_req req;
+	unsigned long flags;
+	struct rq *rq;
+
+	rq = task_rq_lock(p, &flags);
+	if (dest_cpu != task_cpu(p) &&
+	    cpumask_test_cpu(dest_cpu, &p->cpus_allowed) &&
+	    likely(cpu_active(dest_cpu)) &&
+	    migrate_task(p, dest_cpu, &req)) {
+		/* Need to wait for migration thread (might exit: take ref). */
+		struct task_struct *mt = rq->migration_thread;
+
+		get_task_struct(mt);
+		task_rq_unlock(rq, &flags);
+		wake_up_process(mt);
+		put_task_struct(mt);
+		wait_for_completion(&req.done);
+
+		return;
+	}
+	task_rq_unlock(rq, &flags);
+}
+#endif
+
 /*
  * pull_task - move a task from a remote runqueue to the local runqueue.
  * Both runqueues must be locked.
@@ -3847,7 +3893,9 @@ int can_migrate_task(struct task_struct *p, struct rq *rq, int this_cpu,
 	 */
 
 	tsk_cache_hot = task_hot(p, rq->clock, sd);
-	if (!tsk_cache_hot ||
+	if (!tsk_cache_hot)
+		tsk_cache_hot = migrate_degrades_locality(p, this_cpu);
+	if (migrate_improves_locality(p, this_cpu) || !tsk_cache_hot ||
 		sd->nr_balance_failed > sd->cache_nice_tries) {
 #ifdef CONFIG_SCHEDSTATS
 		if (tsk_cache_hot) {
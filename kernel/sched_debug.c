@@ -481,6 +481,18 @@ void proc_sched_show_task(struct task_struct *p, struct seq_file *m)
 	P(se.load.weight);
 	P(policy);
 	P(prio);
+#ifdef CONFIG_NUMA_BALANCING
+	P(numa_scan_seq);
+	P(numa_scan_period);
+	P(numa_preferred_nid);
+	if (p->numa_faults) {
+		int nid;
+
+		for_each_online_node(nid)
+			SEQ_printf(m, "numa_faults node=%-24d:%21lu\n",
+				   nid, p->numa_faults[nid]);
+	}
+#endif
 #undef PN
 #undef __PN
 #undef P
@@ -22,6 +22,9 @@
 
 #include <linux/latencytop.h>
 #include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/mempolicy.h>
+#include <linux/tracehook.h>
 
 /*
  * Targeted preemption latency for CPU-bound tasks:
@@ -2850,6 +2853,328 @@ static void rq_offline_fair(struct rq *rq)
 
 #endif /* CONFIG_SMP */
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Automatic NUMA balancing: a task periodically has a chunk of its address
+ * space made PROT_NONE by task_numa_work().  The hinting faults taken on
+ * the next accesses tell which nodes the task's memory lives on; misplaced
+ * pages are migrated towards the faulting CPU and the task itself is
+ * steered towards the node that collects most of its faults.
+ */
+unsigned int sysctl_numa_balancing = 1;
+
+/* Portion of address space to scan in MB */
+unsigned int sysctl_numa_balancing_scan_size = 256;
+
+/*
+ * Scan @scan_size MB every @scan_period after an initial @scan_delay,
+ * units: milliseconds.  The period adapts between min and max depending
+ * on how local the task's faults are.
+ */
+unsigned int sysctl_numa_balancing_scan_period_min = 1000;
+unsigned int sysctl_numa_balancing_scan_period_max = 60000;
+unsigned int sysctl_numa_balancing_scan_delay = 1000;
+
+static inline int numa_balancing_enabled(void)
+{
+	return sysctl_numa_balancing && num_online_nodes() > 1;
+}
+
+void mm_init_numa_balancing(struct mm_struct *mm)
+{
+	mm->numa_next_scan = jiffies +
+		msecs_to_jiffies(sysctl_numa_balancing_scan_delay);
+	mm->numa_scan_offset = 0;
+	mm->numa_scan_seq = 0;
+}
+
+void task_numa_free(struct task_struct *p)
+{
+	kfree(p->numa_faults);
+	p->numa_faults = NULL;
+}
+
+/*
+ * Move the task to an idle CPU of its preferred node.  When the node is
+ * busy the load balancer does the job through migrate_improves_locality().
+ */
+static void numa_migrate_preferred(struct task_struct *p)
+{
+	int nid = p->numa_preferred_nid;
+	int cpu, dest_cpu = -1;
+
+	p->numa_migrate_retry = jiffies + HZ;
+
+	if (cpu_to_node(task_cpu(p)) == nid)
+		return;
+
+	for_each_cpu_and(cpu, cpumask_of_node(nid), &p->cpus_allowed) {
+		if (idle_cpu(cpu)) {
+			dest_cpu = cpu;
+			break;
+		}
+	}
+	if (dest_cpu == -1)
+		return;
+
+	migrate_task_to(p, dest_cpu);
+}
+
+/*
+ * Once per scan pass, fold the faults of the pass into the decaying
+ * per-node averages, pick the node with most faults as preferred node
+ * and adapt the scan period to how local the faults were.
+ */
+static void task_numa_placement(struct task_struct *p)
+{
+	unsigned long *buffer = p->numa_faults + nr_node_ids;
+	unsigned long max_faults = 0, local, remote;
+	int seq, nid, max_nid = -1;
+
+	seq = ACCESS_ONCE(p->mm->numa_scan_seq);
+	if (p->numa_scan_seq == seq)
+		return;
+	p->numa_scan_seq = seq;
+
+	for_each_online_node(nid) {
+		unsigned long faults;
+
+		faults = p->numa_faults[nid] / 2 + buffer[nid];
+		p->numa_faults[nid] = faults;
+		buffer[nid] = 0;
+
+		if (faults > max_faults) {
+			max_faults = faults;
+			max_nid = nid;
+		}
+	}
+
+	/* Back off while the task's memory is mostly local */
+	remote = p->numa_faults_locality[0];
+	local = p->numa_faults_locality[1];
+	if (local + remote) {
+		if (local > 3 * remote)
+			p->numa_scan_period = min(p->numa_scan_period * 2,
+					sysctl_numa_balancing_scan_period_max);
+		else
+			p->numa_scan_period = max(p->numa_scan_period / 2,
+					sysctl_numa_balancing_scan_period_min);
+	}
+	p->numa_faults_locality[0] = p->numa_faults_locality[1] = 0;
+
+	if (max_nid != -1 && max_nid != p->numa_preferred_nid) {
+		p->numa_preferred_nid = max_nid;
+		p->numa_migrate_retry = 0;
+	}
+}
+
+/*
+ * Got a NUMA hinting fault on @pages pages now living on @node.
+ */
+void task_numa_fault(int node, int pages, bool migrated)
+{
+	struct task_struct *p = current;
+
+	if (!numa_balancing_enabled() || !p->mm)
+		return;
+
+	/* Allocate buffer to track faults on a per-node basis */
+	if (unlikely(!p->numa_faults)) {
+		int size = sizeof(*p->numa_faults) * 2 * nr_node_ids;
+
+		p->numa_faults = kzalloc(size, GFP_KERNEL | __GFP_NOWARN);
+		if (!p->numa_faults)
+			return;
+	}
+
+	task_numa_placement(p);
+
+	/* A page that had to be migrated was not local to begin with */
+	p->numa_faults_locality[node == numa_node_id() && !migrated] += pages;
+	p->numa_faults[nr_node_ids + node] += pages;
+
+	if (p->numa_preferred_nid != -1 &&
+	    time_after_eq(jiffies, p->numa_migrate_retry))
+		numa_migrate_preferred(p);
+}
+
+static void reset_ptenuma_scan(struct mm_struct *mm)
+{
+	ACCESS_ONCE(mm->numa_scan_seq)++;
+	mm->numa_scan_offset = 0;
+}
+
+/*
+ * The expensive part of numa migration is done from the return to user
+ * path, armed by task_tick_numa().  Only one thread of an mm scans per
+ * period; a period covers sysctl_numa_balancing_scan_size MB of address
+ * space, resuming where the previous pass stopped.
+ */
+void task_numa_work(void)
+{
+	unsigned long migrate, next_scan, now = jiffies;
+	struct task_struct *p = current;
+	struct mm_struct *mm = p->mm;
+	struct vm_area_struct *vma;
+	unsigned long start, end;
+	long pages;
+
+	p->numa_work = 0;
+
+	if (!mm || (p->flags & PF_EXITING))
+		return;
+
+	/*
+	 * Enforce maximal scan/migration frequency.
+	 */
+	migrate = mm->numa_next_scan;
+	if (time_before(now, migrate))
+		return;
+
+	if (p->numa_scan_period == 0)
+		p->numa_scan_period = sysctl_numa_balancing_scan_period_min;
+
+	next_scan = now + msecs_to_jiffies(p->numa_scan_period);
+	if (cmpxchg(&mm->numa_next_scan, migrate, next_scan) != migrate)
+		return;
+
+	pages = sysctl_numa_balancing_scan_size;
+	pages <<= 20 - PAGE_SHIFT; /* MB in pages */
+	if (!pages)
+		return;
+
+	down_read(&mm->mmap_sem);
+	start = mm->numa_scan_offset;
+	vma = find_vma(mm, start);
+	if (!vma) {
+		reset_ptenuma_scan(mm);
+		start = 0;
+		vma = mm->mmap;
+	}
+	for (; vma; vma = vma->vm_next) {
+		if (!vma_migratable(vma) || (vma->vm_flags & VM_MIXEDMAP))
+			continue;
+
+		/* PROT_NONE mappings never take hinting faults */
+		if (!(vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC)))
+			continue;
+
+		/*
+		 * Shared library text is mapped by everybody, trapping
+		 * accesses to it would only cost faults.
+		 */
+		if (vma->vm_file &&
+		    (vma->vm_flags & (VM_READ | VM_WRITE)) == VM_READ)
+			continue;
+
+		do {
+			start = max(start, vma->vm_start);
+			end = ALIGN(start + (pages << PAGE_SHIFT), PMD_SIZE);
+			end = min(end, vma->vm_end);
+			change_prot_numa(vma, start, end);
+			pages -= (end - start) >> PAGE_SHIFT;
+
+			start = end;
+			if (pages <= 0)
+				goto out;
+		} while (end != vma->vm_end);
+	}
+
+out:
+	/*
+	 * It is possible to reach the end of the VMA list but the last few
+	 * VMAs are not guaranteed to be migratable. If they are not, we
+	 * would find the !migratable VMA on the next scan but not reset the
+	 * scanner to the start so check it now.
+	 */
+	if (vma)
+		mm->numa_scan_offset = start;
+	else
+		reset_ptenuma_scan(mm);
+	up_read(&mm->mmap_sem);
+}
+
+/*
+ * Drive the periodic memory faults: once the task has run for its scan
+ * period, arm task_numa_work() for the next return to user space.
+ */
+static void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+	u64 period, now;
+
+	/*
+	 * We don't care about NUMA placement if we don't have memory.
+	 */
+	if (!curr->mm || (curr->flags & (PF_EXITING | PF_KTHREAD)) ||
+	    curr->numa_work)
+		return;
+
+	if (!numa_balancing_enabled())
+		return;
+
+	now = curr->se.sum_exec_runtime;
+	period = (u64)curr->numa_scan_period * NSEC_PER_MSEC;
+
+	if (now - curr->node_stamp > period) {
+		if (!curr->node_stamp)
+			curr->numa_scan_period =
+				sysctl_numa_balancing_scan_period_min;
+		curr->node_stamp = now;
+
+		if (!time_before(jiffies, curr->mm->numa_next_scan)) {
+			curr->numa_work = 1;
+			set_notify_resume(curr);
+		}
+	}
+}
+
+/*
+ * Load balancer bias: moving a task onto its preferred node is always
+ * fine, moving it away is treated like moving a cache hot task.
+ */
+static bool migrate_improves_locality(struct task_struct *p, int dst_cpu)
+{
+	int src_nid, dst_nid;
+
+	if (!numa_balancing_enabled() || p->numa_preferred_nid == -1)
+		return false;
+
+	src_nid = cpu_to_node(task_cpu(p));
+	dst_nid = cpu_to_node(dst_cpu);
+
+	return src_nid != dst_nid && dst_nid == p->numa_preferred_nid;
+}
+
+static bool migrate_degrades_locality(struct task_struct *p, int dst_cpu)
+{
+	int src_nid, dst_nid;
+
+	if (!numa_balancing_enabled() || p->numa_preferred_nid == -1)
+		return false;
+
+	src_nid = cpu_to_node(task_cpu(p));
+	dst_nid = cpu_to_node(dst_cpu);
+
+	return src_nid != dst_nid && src_nid == p->numa_preferred_nid;
+}
+#else
+static void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+}
+
+static inline bool migrate_improves_locality(struct task_struct *p,
+					     int dst_cpu)
+{
+	return false;
+}
+
+static inline bool migrate_degrades_locality(struct task_struct *p,
+					     int dst_cpu)
+{
+	return false;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 /*
  * scheduler tick hitting a task of our scheduling class:
  */
@@ -2862,6 +3187,8 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 		cfs_rq = cfs_rq_of(se);
 		entity_tick(cfs_rq, se, queued);
 	}
+
+	task_tick_numa(rq, curr);
 }
 
 /*
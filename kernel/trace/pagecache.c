@@ -6,6 +6,7 @@ DEFINE_TRACE(page_cache_acct_misses);
 DEFINE_TRACE(page_cache_acct_hit);
 DEFINE_TRACE(page_cache_acct_miss);
 DEFINE_TRACE(page_cache_acct_readpages);
+DEFINE_TRACE(page_cache_acct_readahead);
 
 #ifdef CONFIG_PAGE_CACHE_ACCT
 
@@ -23,6 +24,20 @@ static void page_cache_acct_readpages(struct super_block *sb, int nr_pages)
 	}
 }
 
+static void page_cache_acct_readahead(struct super_block *sb, int hits,
+				      int waste)
+{
+	struct block_device *bdev = sb->s_bdev;
+	struct hd_struct *part;
+	int cpu;
+	if (likely(bdev) && likely(part = bdev->bd_part)) {
+		cpu = part_stat_lock();
+		part_stat_add(cpu, part, page_cache_ra_hit, hits);
+		part_stat_add(cpu, part, page_cache_ra_waste, waste);
+		part_stat_unlock();
+	}
+}
+
 static inline void __page_cache_acct_hit(struct super_block *sb, int rw, int nr_pages)
 {
 	struct block_device *bdev = sb->s_bdev;
@@ -83,6 +98,8 @@ static void pagecache_acct_setup(void)
 	WARN_ON(ret);
 	ret = register_trace_page_cache_acct_misses(page_cache_acct_misses);
 	WARN_ON(ret);
+	ret = register_trace_page_cache_acct_readahead(page_cache_acct_readahead);
+	WARN_ON(ret);
 
 	if (!ret)
 		pagecache_tracer_enabled = 1;
@@ -95,6 +112,7 @@ static void pagecache_acct_remove(void)
 	unregister_trace_page_cache_acct_hits(page_cache_acct_hits);
 	unregister_trace_page_cache_acct_miss(page_cache_acct_miss);
 	unregister_trace_page_cache_acct_misses(page_cache_acct_misses);
+	unregister_trace_page_cache_acct_readahead(page_cache_acct_readahead);
 
 	pagecache_tracer_enabled = 0;
 	tracepoint_synchronize_unregister();
@@ -151,12 +169,14 @@ static ssize_t sysfs_pagecache_trace_attr_show(struct device *dev,
 	       struct hd_struct  *p = dev_to_part(dev);
 
 	       ret = sprintf(buf,
-			       "%8lu %8lu %8lu %8lu %8lu\n",
+			       "%8lu %8lu %8lu %8lu %8lu %8lu %8lu\n",
 			       part_stat_read(p, page_cache_readpages),
 			       part_stat_read(p, page_cache_missed[READ]),
 			       part_stat_read(p, page_cache_hit[READ]),
 			       part_stat_read(p, page_cache_missed[WRITE]),
-			       part_stat_read(p, page_cache_hit[WRITE]));
+			       part_stat_read(p, page_cache_hit[WRITE]),
+			       part_stat_read(p, page_cache_ra_hit),
+			       part_stat_read(p, page_cache_ra_waste));
 		goto out;
 	}
 	if (attr == &dev_attr_enable)
@@ -186,6 +186,33 @@ static inline bool compact_trylock_irqsave(spinlock_t *lock,
 	return compact_checklock_irqsave(lock, flags, false, cc);
 }
 
+/*
+ * Switch the migrate scanner to the lru_lock of the lruvec @page is on.
+ * @locked is the lruvec whose lock is currently held, if any.  Taking a
+ * lock afresh follows the rules of compact_checklock_irqsave().  Returns
+ * the locked lruvec, or NULL with no lock held if isolation should stop.
+ */
+static struct lruvec *compact_relock_page_lruvec(struct page *page,
+			struct zone *zone, struct lruvec *locked,
+			unsigned long *flags, struct compact_control *cc)
+{
+	if (!locked) {
+		if (need_resched()) {
+			/* async aborts if taking too long */
+			if (!cc->sync) {
+				cc->contended = true;
+				return NULL;
+			}
+
+			cond_resched();
+			if (fatal_signal_pending(current))
+				return NULL;
+		}
+		local_irq_save(*flags);
+	}
+	return relock_page_lruvec(page, zone, locked);
+}
+
 /* Isolate free pages onto a private freelist. Must hold zone->lock */
 static unsigned long isolate_freepages_block(struct compact_control *cc,
 				struct zone *zone,
@@ -422,7 +449,7 @@ static unsigned long isolate_migratepages(struct zone *zone,
 	struct list_head *migratelist = &cc->migratepages;
 	isolate_mode_t mode = ISOLATE_ACTIVE|ISOLATE_INACTIVE;
 	unsigned long flags;
-	bool locked;
+	struct lruvec *lruvec = NULL;
 	struct page *page = NULL, *valid_page = NULL;
 
 	/* Do not scan outside zone boundaries */
@@ -451,20 +478,19 @@ static unsigned long isolate_migratepages(struct zone *zone,
 
 	/* Time to isolate some pages for migration */
 	cond_resched();
-	spin_lock_irqsave(&zone->lru_lock, flags);
-	locked = true;
 	for (; low_pfn < end_pfn; low_pfn++) {
 		/* give a chance to irqs before checking need_resched() */
-		if (!((low_pfn+1) % SWAP_CLUSTER_MAX)) {
-			spin_unlock_irqrestore(&zone->lru_lock, flags);
-			locked = 0;
+		if (lruvec && !((low_pfn+1) % SWAP_CLUSTER_MAX)) {
+			spin_unlock_irqrestore(&lruvec->lru_lock, flags);
+			lruvec = NULL;
 		}
 
 		/* Check if it is ok to still hold the lock */
-		locked = compact_checklock_irqsave(&zone->lru_lock, &flags,
-								locked, cc);
-		if (!locked)
+		if (lruvec && !compact_checklock_irqsave(&lruvec->lru_lock,
+							 &flags, true, cc)) {
+			lruvec = NULL;
 			break;
+		}
 
 		/*
 		 * migrate_pfn does not necessarily start aligned to a
@@ -521,10 +547,19 @@ static unsigned long isolate_migratepages(struct zone *zone,
 		if (!PageLRU(page))
 			continue;
 
+		/* Pages of different memcgs are on different lruvecs */
+		lruvec = compact_relock_page_lruvec(page, zone, lruvec,
+						    &flags, cc);
+		if (!lruvec)
+			break;
+
+		if (!page_on_lruvec(page, lruvec))
+			continue;
+
 		/*
-		 * PageLRU is set, and lru_lock excludes isolation,
-		 * splitting and collapsing (collapsing has already
-		 * happened if PageLRU is set).
+		 * The page is on the locked lruvec, and lru_lock excludes
+		 * isolation, splitting and collapsing (collapsing has
+		 * already happened if PageLRU is set).
 		 */
 		if (PageTransHuge(page)) {
 			low_pfn += (1 << compound_order(page)) - 1;
@@ -542,7 +577,7 @@ static unsigned long isolate_migratepages(struct zone *zone,
 
 		/* Successfully isolated */
 		cc->finished_update_migrate = true;
-		del_page_from_lru_list(zone, page, page_lru(page));
+		del_page_from_lru_list(zone, page, lruvec, page_lru(page));
 		list_add(&page->lru, migratelist);
 		cc->nr_migratepages++;
 
@@ -558,10 +593,10 @@ next_pageblock:
 		last_pageblock_nr = pageblock_nr;
 	}
 
-	acct_isolated(zone, locked, cc);
+	acct_isolated(zone, lruvec != NULL, cc);
 
-	if (locked)
-		spin_unlock_irqrestore(&zone->lru_lock, flags);
+	if (lruvec)
+		spin_unlock_irqrestore(&lruvec->lru_lock, flags);
 
 	/* Update the pageblock-skip if the whole pageblock was scanned */
 	if (low_pfn == end_pfn)
@@ -6,6 +6,7 @@
  */
 
 #include <linux/mm.h>
+#include <linux/mman.h>
 #include <linux/sched.h>
 #include <linux/highmem.h>
 #include <linux/hugetlb.h>
@@ -32,12 +33,9 @@ unsigned long transparent_hugepage_flags __read_mostly =
 
 /* default scan 8*512 pte (or vmas) every 30 second */
 static unsigned int khugepaged_pages_to_scan __read_mostly = HPAGE_PMD_NR*8;
-static unsigned int khugepaged_pages_collapsed;
-static unsigned int khugepaged_full_scans;
 static unsigned int khugepaged_scan_sleep_millisecs __read_mostly = 10000;
 /* during fragmentation poll the hugepage allocator once every minute */
 static unsigned int khugepaged_alloc_sleep_millisecs __read_mostly = 60000;
-static struct task_struct *khugepaged_thread __read_mostly;
 static DEFINE_MUTEX(khugepaged_mutex);
 static DEFINE_SPINLOCK(khugepaged_mm_lock);
 static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
@@ -48,8 +46,9 @@ static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
  */
 static unsigned int khugepaged_max_ptes_none __read_mostly = HPAGE_PMD_NR-1;
 
-static int khugepaged(void *none);
+static int khugepaged(void *data);
 static int mm_slots_hash_init(void);
+static int khugepaged_scans_init(void);
 static int khugepaged_slab_init(void);
 static void khugepaged_slab_free(void);
 
@@ -60,13 +59,15 @@ static struct kmem_cache *mm_slot_cache __read_mostly;
 /**
  * struct mm_slot - hash lookup from mm to mm_slot
  * @hash: hash collision list
- * @mm_node: khugepaged scan list headed in khugepaged_scan.mm_head
+ * @mm_node: khugepaged scan list headed in khugepaged_scan->mm_head
  * @mm: the mm that this information is valid for
+ * @nid: the node whose khugepaged scans this mm
  */
 struct mm_slot {
 	struct hlist_node hash;
 	struct list_head mm_node;
 	struct mm_struct *mm;
+	int nid;
 };
 
 /**
@@ -74,17 +75,47 @@ struct mm_slot {
  * @mm_head: the head of the mm list to scan
  * @mm_slot: the current mm_slot we are scanning
  * @address: the next address inside that to be scanned
+ * @nid: the node this cursor belongs to
+ * @thread: the khugepaged thread of the node
+ * @pmd_load: pages per node of the pmd being scanned
+ * @mm_load: pages per node found in the current pass over @mm_slot
+ * @pages_collapsed: hugepages collapsed
+ * @collapse_failed: collapse attempts that failed
+ * @full_scans: passes over the whole mm list
  *
- * There is only the one khugepaged_scan instance of this cursor structure.
+ * Every node with memory has its own khugepaged thread and cursor,
+ * and scans the mms that are mostly resident on it.  The lists and
+ * cursors are protected by khugepaged_mm_lock.
  */
 struct khugepaged_scan {
 	struct list_head mm_head;
 	struct mm_slot *mm_slot;
 	unsigned long address;
-} khugepaged_scan = {
-	.mm_head = LIST_HEAD_INIT(khugepaged_scan.mm_head),
+	int nid;
+	struct task_struct *thread;
+	unsigned int *pmd_load;
+	unsigned long *mm_load;
+	unsigned long pages_collapsed;
+	unsigned long collapse_failed;
+	unsigned long full_scans;
 };
 
+static struct khugepaged_scan *khugepaged_scans[MAX_NUMNODES] __read_mostly;
+
+/*
+ * The node whose khugepaged should scan an mm that is mostly resident
+ * on @nid, or any node with a khugepaged if @nid has none.
+ */
+static struct khugepaged_scan *khugepaged_node_scan(int nid)
+{
+	if (nid >= 0 && khugepaged_scans[nid])
+		return khugepaged_scans[nid];
+	for_each_node(nid)
+		if (khugepaged_scans[nid])
+			return khugepaged_scans[nid];
+	return NULL;
+}
+
 
 static int set_recommended_min_free_kbytes(void)
 {
@@ -126,29 +157,47 @@ static int set_recommended_min_free_kbytes(void)
 }
 late_initcall(set_recommended_min_free_kbytes);
 
+static int start_khugepaged_node(struct khugepaged_scan *scan)
+{
+	const struct cpumask *mask = cpumask_of_node(scan->nid);
+	struct task_struct *thread;
+
+	thread = kthread_create(khugepaged, scan, "khugepaged/%d", scan->nid);
+	if (unlikely(IS_ERR(thread))) {
+		printk(KERN_ERR
+		       "khugepaged: kthread_create(khugepaged/%d) failed\n",
+		       scan->nid);
+		return PTR_ERR(thread);
+	}
+	if (cpumask_any_and(mask, cpu_online_mask) < nr_cpu_ids)
+		set_cpus_allowed_ptr(thread, mask);
+	scan->thread = thread;
+	wake_up_process(thread);
+	return 0;
+}
+
 static int start_khugepaged(void)
 {
 	int err = 0;
 	if (khugepaged_enabled()) {
-		int wakeup;
+		struct khugepaged_scan *scan;
+		int nid, ret;
+
 		if (unlikely(!mm_slot_cache || !mm_slots_hash)) {
 			err = -ENOMEM;
 			goto out;
 		}
 		mutex_lock(&khugepaged_mutex);
-		if (!khugepaged_thread)
-			khugepaged_thread = kthread_run(khugepaged, NULL,
-							"khugepaged");
-		if (unlikely(IS_ERR(khugepaged_thread))) {
-			printk(KERN_ERR
-			       "khugepaged: kthread_run(khugepaged) failed\n");
-			err = PTR_ERR(khugepaged_thread);
-			khugepaged_thread = NULL;
+		for_each_node(nid) {
+			scan = khugepaged_scans[nid];
+			if (!scan || scan->thread)
+				continue;
+			ret = start_khugepaged_node(scan);
+			if (ret)
+				err = ret;
 		}
-		wakeup = !list_empty(&khugepaged_scan.mm_head);
 		mutex_unlock(&khugepaged_mutex);
-		if (wakeup)
-			wake_up_interruptible(&khugepaged_wait);
+		wake_up_interruptible(&khugepaged_wait);
 
 		set_recommended_min_free_kbytes();
 	} else
@@ -385,20 +434,41 @@ static struct kobj_attribute pages_to_scan_attr =
 	__ATTR(pages_to_scan, 0644, pages_to_scan_show,
 	       pages_to_scan_store);
 
+/* Sum up a statistic over the khugepaged threads of all nodes */
+#define khugepaged_stat_sum(field)				\
+({								\
+	unsigned long __sum = 0;				\
+	int __nid;						\
+								\
+	for_each_node(__nid)					\
+		if (khugepaged_scans[__nid])			\
+			__sum += khugepaged_scans[__nid]->field;\
+	__sum;							\
+})
+
 static ssize_t pages_collapsed_show(struct kobject *kobj,
 				    struct kobj_attribute *attr,
 				    char *buf)
 {
-	return sprintf(buf, "%u\n", khugepaged_pages_collapsed);
+	return sprintf(buf, "%lu\n", khugepaged_stat_sum(pages_collapsed));
 }
 static struct kobj_attribute pages_collapsed_attr =
 	__ATTR_RO(pages_collapsed);
 
+static ssize_t collapse_failed_show(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    char *buf)
+{
+	return sprintf(buf, "%lu\n", khugepaged_stat_sum(collapse_failed));
+}
+static struct kobj_attribute collapse_failed_attr =
+	__ATTR_RO(collapse_failed);
+
 static ssize_t full_scans_show(struct kobject *kobj,
 			       struct kobj_attribute *attr,
 			       char *buf)
 {
-	return sprintf(buf, "%u\n", khugepaged_full_scans);
+	return sprintf(buf, "%lu\n", khugepaged_stat_sum(full_scans));
 }
 static struct kobj_attribute full_scans_attr =
 	__ATTR_RO(full_scans);
@@ -458,6 +528,7 @@ static struct attribute *khugepaged_attr[] = {
 	&khugepaged_max_ptes_none_attr.attr,
 	&pages_to_scan_attr.attr,
 	&pages_collapsed_attr.attr,
+	&collapse_failed_attr.attr,
 	&full_scans_attr.attr,
 	&scan_sleep_millisecs_attr.attr,
 	&alloc_sleep_millisecs_attr.attr,
@@ -521,6 +592,12 @@ static int __init hugepage_init(void)
 		goto out;
 	}
 
+	err = khugepaged_scans_init();
+	if (err) {
+		khugepaged_slab_free();
+		goto out;
+	}
+
 	/*
 	 * By default disable transparent hugepages on smaller systems,
 	 * where the extra memory used could hurt more than TLB overhead
@@ -1182,10 +1259,11 @@ static void __split_huge_page_refcount(struct page *page)
 {
 	int i;
 	struct zone *zone = page_zone(page);
+	struct lruvec *lruvec;
 	int tail_count = 0;
 
 	/* prevent PageLRU to go away from under us, and freeze lru stats */
-	spin_lock_irq(&zone->lru_lock);
+	lruvec = lock_page_lruvec_irq(page, zone);
 	compound_lock(page);
 
 	for (i = HPAGE_PMD_NR - 1; i >= 1; i--) {
@@ -1246,7 +1324,7 @@ static void __split_huge_page_refcount(struct page *page)
 		BUG_ON(!PageSwapBacked(page_tail));
 
 		mem_cgroup_split_hugepage_commit(page_tail, page);
-		lru_add_page_tail(zone, page, page_tail);
+		lru_add_page_tail(zone, lruvec, page, page_tail);
 	}
 	atomic_sub(tail_count, &page->_count);
 	BUG_ON(atomic_read(&page->_count) <= 0);
@@ -1256,7 +1334,7 @@ static void __split_huge_page_refcount(struct page *page)
 
 	ClearPageCompound(page);
 	compound_unlock(page);
-	spin_unlock_irq(&zone->lru_lock);
+	spin_unlock_irq(&lruvec->lru_lock);
 
 	for (i = 1; i < HPAGE_PMD_NR; i++) {
 		struct page *page_tail = page + i;
@@ -1491,6 +1569,40 @@ static void __init mm_slots_hash_free(void)
 }
 #endif
 
+static int __init khugepaged_scans_init(void)
+{
+	struct khugepaged_scan *scan;
+	int nid;
+
+	for_each_node_state(nid, N_HIGH_MEMORY) {
+		scan = kzalloc_node(sizeof(*scan), GFP_KERNEL, nid);
+		if (!scan)
+			goto fail;
+		khugepaged_scans[nid] = scan;
+		INIT_LIST_HEAD(&scan->mm_head);
+		scan->nid = nid;
+		scan->pmd_load = kcalloc(nr_node_ids, sizeof(*scan->pmd_load),
+					 GFP_KERNEL);
+		scan->mm_load = kcalloc(nr_node_ids, sizeof(*scan->mm_load),
+					GFP_KERNEL);
+		if (!scan->pmd_load || !scan->mm_load)
+			goto fail;
+	}
+	return 0;
+
+fail:
+	for_each_node(nid) {
+		scan = khugepaged_scans[nid];
+		if (!scan)
+			continue;
+		kfree(scan->pmd_load);
+		kfree(scan->mm_load);
+		kfree(scan);
+		khugepaged_scans[nid] = NULL;
+	}
+	return -ENOMEM;
+}
+
 static struct mm_slot *get_mm_slot(struct mm_struct *mm)
 {
 	struct mm_slot *mm_slot;
@@ -1524,6 +1636,7 @@ static inline int khugepaged_test_exit(struct mm_struct *mm)
 
 int __khugepaged_enter(struct mm_struct *mm)
 {
+	struct khugepaged_scan *scan;
 	struct mm_slot *mm_slot;
 	int wakeup;
 
@@ -1539,13 +1652,19 @@ int __khugepaged_enter(struct mm_struct *mm)
 	}
 
 	spin_lock(&khugepaged_mm_lock);
+	/*
+	 * Until the first pass over the mm shows where its memory is,
+	 * assume it's on the node of the task that faults it in.
+	 */
+	scan = khugepaged_node_scan(numa_node_id());
+	mm_slot->nid = scan->nid;
 	insert_to_mm_slots_hash(mm, mm_slot);
 	/*
 	 * Insert just behind the scanning cursor, to let the area settle
 	 * down a little.
 	 */
-	wakeup = list_empty(&khugepaged_scan.mm_head);
-	list_add_tail(&mm_slot->mm_node, &khugepaged_scan.mm_head);
+	wakeup = list_empty(&scan->mm_head);
+	list_add_tail(&mm_slot->mm_node, &scan->mm_head);
 	spin_unlock(&khugepaged_mm_lock);
 
 	atomic_inc(&mm->mm_count);
@@ -1582,6 +1701,76 @@ int khugepaged_enter_vma_merge(struct vm_area_struct *vma)
 	return 0;
 }
 
+/*
+ * Have the khugepaged of @mm's node scan it next, after the mm it is
+ * working on.
+ */
+static void khugepaged_prioritize(struct mm_struct *mm)
+{
+	struct khugepaged_scan *scan;
+	struct mm_slot *mm_slot;
+
+	spin_lock(&khugepaged_mm_lock);
+	mm_slot = get_mm_slot(mm);
+	if (!mm_slot) {
+		spin_unlock(&khugepaged_mm_lock);
+		return;
+	}
+	scan = khugepaged_scans[mm_slot->nid];
+	if (scan->mm_slot != mm_slot) {
+		if (scan->mm_slot)
+			list_move(&mm_slot->mm_node, &scan->mm_slot->mm_node);
+		else
+			list_move(&mm_slot->mm_node, &scan->mm_head);
+	}
+	spin_unlock(&khugepaged_mm_lock);
+
+	wake_up_interruptible(&khugepaged_wait);
+}
+
+int hugepage_madvise(struct vm_area_struct *vma,
+		     unsigned long *vm_flags, int advice)
+{
+	switch (advice) {
+	case MADV_HUGEPAGE:
+		/*
+		 * Be somewhat over-protective like KSM for now!
+		 */
+		if (*vm_flags & (VM_HUGEPAGE | VM_NO_THP))
+			return -EINVAL;
+		*vm_flags &= ~VM_NOHUGEPAGE;
+		*vm_flags |= VM_HUGEPAGE;
+		/*
+		 * If the vma has pages already, register the mm with
+		 * khugepaged now rather than at the next fault, and take
+		 * the advice as a hint to collapse it soon.
+		 */
+		if (khugepaged_enabled() && vma->anon_vma && !vma->vm_ops) {
+			if (!test_bit(MMF_VM_HUGEPAGE, &vma->vm_mm->flags) &&
+			    __khugepaged_enter(vma->vm_mm))
+				return -ENOMEM;
+			khugepaged_prioritize(vma->vm_mm);
+		}
+		break;
+	case MADV_NOHUGEPAGE:
+		/*
+		 * Be somewhat over-protective like KSM for now!
+		 */
+		if (*vm_flags & (VM_NOHUGEPAGE | VM_NO_THP))
+			return -EINVAL;
+		*vm_flags &= ~VM_HUGEPAGE;
+		*vm_flags |= VM_NOHUGEPAGE;
+		/*
+		 * Setting VM_NOHUGEPAGE will prevent khugepaged from
+		 * scanning this vma and the fault path from allocating
+		 * hugepages in it, even with THP set to "always".
+		 */
+		break;
+	}
+
+	return 0;
+}
+
 void __khugepaged_exit(struct mm_struct *mm)
 {
 	struct mm_slot *mm_slot;
@@ -1589,7 +1778,7 @@ void __khugepaged_exit(struct mm_struct *mm)
 
 	spin_lock(&khugepaged_mm_lock);
 	mm_slot = get_mm_slot(mm);
-	if (mm_slot && khugepaged_scan.mm_slot != mm_slot) {
+	if (mm_slot && khugepaged_scans[mm_slot->nid]->mm_slot != mm_slot) {
 		hlist_del(&mm_slot->hash);
 		list_del(&mm_slot->mm_node);
 		free = 1;
@@ -1754,7 +1943,8 @@ static void collapse_huge_page(struct mm_struct *mm,
 			       unsigned long address,
 			       struct page **hpage,
 			       struct vm_area_struct *vma,
-			       int node)
+			       int node,
+			       struct khugepaged_scan *scan)
 {
 	pgd_t *pgd;
 	pud_t *pud;
@@ -1787,6 +1977,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	if (unlikely(!new_page)) {
 		up_read(&mm->mmap_sem);
 		count_vm_event(THP_COLLAPSE_ALLOC_FAILED);
+		scan->collapse_failed++;
 		*hpage = ERR_PTR(-ENOMEM);
 		return;
 	}
@@ -1794,6 +1985,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 #endif
 	if (unlikely(mem_cgroup_newpage_charge(new_page, mm, GFP_KERNEL))) {
 		up_read(&mm->mmap_sem);
+		scan->collapse_failed++;
 #ifdef CONFIG_NUMA
 		put_page(new_page);
 #endif
@@ -1818,7 +2010,8 @@ static void collapse_huge_page(struct mm_struct *mm,
 	if (address < hstart || address + HPAGE_PMD_SIZE > hend)
 		goto out;
 
-	if (!(vma->vm_flags & VM_HUGEPAGE) && !khugepaged_always())
+	if ((!(vma->vm_flags & VM_HUGEPAGE) && !khugepaged_always()) ||
+	    (vma->vm_flags & VM_NOHUGEPAGE))
 		goto out;
 
 	if (!vma->anon_vma || vma->vm_ops)
@@ -1907,12 +2100,13 @@ static void collapse_huge_page(struct mm_struct *mm,
 #ifndef CONFIG_NUMA
 	*hpage = NULL;
 #endif
-	khugepaged_pages_collapsed++;
+	scan->pages_collapsed++;
 out_up_write:
 	up_write(&mm->mmap_sem);
 	return;
 
 out:
+	scan->collapse_failed++;
 	mem_cgroup_uncharge_page(new_page);
 #ifdef CONFIG_NUMA
 	put_page(new_page);
@@ -1920,10 +2114,30 @@ out:
 	goto out_up_write;
 }
 
+/*
+ * Add the pages found in a pmd to the mm's pass, and return the node
+ * most of them are on, where the collapsed hugepage should go.
+ */
+static int khugepaged_find_target_node(struct khugepaged_scan *scan)
+{
+	unsigned int max = 0;
+	int nid, target = 0;
+
+	for (nid = 0; nid < nr_node_ids; nid++) {
+		scan->mm_load[nid] += scan->pmd_load[nid];
+		if (scan->pmd_load[nid] > max) {
+			max = scan->pmd_load[nid];
+			target = nid;
+		}
+	}
+	return target;
+}
+
 static int khugepaged_scan_pmd(struct mm_struct *mm,
 			       struct vm_area_struct *vma,
 			       unsigned long address,
-			       struct page **hpage)
+			       struct page **hpage,
+			       struct khugepaged_scan *scan)
 {
 	pgd_t *pgd;
 	pud_t *pud;
@@ -1933,7 +2147,7 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 	struct page *page;
 	unsigned long _address;
 	spinlock_t *ptl;
-	int node = -1;
+	int node;
 
 	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
 
@@ -1949,6 +2163,7 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
 		goto out;
 
+	memset(scan->pmd_load, 0, nr_node_ids * sizeof(*scan->pmd_load));
 	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
 	for (_address = address, _pte = pte; _pte < pte+HPAGE_PMD_NR;
 	     _pte++, _address += PAGE_SIZE) {
@@ -1964,13 +2179,7 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 		page = vm_normal_page(vma, _address, pteval);
 		if (unlikely(!page))
 			goto out_unmap;
-		/*
-		 * Chose the node of the first page. This could
-		 * be more sophisticated and look at more pages,
-		 * but isn't for now.
-		 */
-		if (node == -1)
-			node = page_to_nid(page);
+		scan->pmd_load[page_to_nid(page)]++;
 		VM_BUG_ON(PageCompound(page));
 		if (!PageLRU(page) || PageLocked(page) || !PageAnon(page))
 			goto out_unmap;
@@ -1985,9 +2194,10 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 		ret = 1;
 out_unmap:
 	pte_unmap_unlock(pte, ptl);
+	node = khugepaged_find_target_node(scan);
 	if (ret)
 		/* collapse_huge_page will return with the mmap_sem released */
-		collapse_huge_page(mm, address, hpage, vma, node);
+		collapse_huge_page(mm, address, hpage, vma, node, scan);
 out:
 	return ret;
 }
@@ -2015,7 +2225,46 @@ static void collect_mm_slot(struct mm_slot *mm_slot)
 	}
 }
 
-static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
+/* Start a pass over @mm_slot */
+static void khugepaged_scan_start_mm(struct khugepaged_scan *scan,
+				     struct mm_slot *mm_slot)
+{
+	scan->mm_slot = mm_slot;
+	scan->address = 0;
+	memset(scan->mm_load, 0, nr_node_ids * sizeof(*scan->mm_load));
+}
+
+/*
+ * After a full pass over an mm, hand it over to the khugepaged of the
+ * node that most of its memory was found on, if that's another one.
+ */
+static void khugepaged_rehome_mm_slot(struct khugepaged_scan *scan,
+				      struct mm_slot *mm_slot)
+{
+	unsigned long total = 0, max = 0;
+	struct khugepaged_scan *target;
+	int nid, best = scan->nid;
+
+	VM_BUG_ON(!spin_is_locked(&khugepaged_mm_lock));
+
+	for (nid = 0; nid < nr_node_ids; nid++) {
+		total += scan->mm_load[nid];
+		if (scan->mm_load[nid] > max && khugepaged_scans[nid]) {
+			max = scan->mm_load[nid];
+			best = nid;
+		}
+	}
+	if (best == scan->nid || max * 2 <= total)
+		return;
+
+	target = khugepaged_scans[best];
+	list_move_tail(&mm_slot->mm_node, &target->mm_head);
+	mm_slot->nid = best;
+	wake_up_interruptible(&khugepaged_wait);
+}
+
+static unsigned int khugepaged_scan_mm_slot(struct khugepaged_scan *scan,
+					    unsigned int pages,
 					    struct page **hpage)
 {
 	struct mm_slot *mm_slot;
@@ -2026,13 +2275,12 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 	VM_BUG_ON(!pages);
 	VM_BUG_ON(!spin_is_locked(&khugepaged_mm_lock));
 
-	if (khugepaged_scan.mm_slot)
-		mm_slot = khugepaged_scan.mm_slot;
+	if (scan->mm_slot)
+		mm_slot = scan->mm_slot;
 	else {
-		mm_slot = list_entry(khugepaged_scan.mm_head.next,
+		mm_slot = list_entry(scan->mm_head.next,
 				     struct mm_slot, mm_node);
-		khugepaged_scan.address = 0;
-		khugepaged_scan.mm_slot = mm_slot;
+		khugepaged_scan_start_mm(scan, mm_slot);
 	}
 	spin_unlock(&khugepaged_mm_lock);
 
@@ -2041,7 +2289,7 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 	if (unlikely(khugepaged_test_exit(mm)))
 		vma = NULL;
 	else
-		vma = find_vma(mm, khugepaged_scan.address);
+		vma = find_vma(mm, scan->address);
 
 	progress++;
 	for (; vma; vma = vma->vm_next) {
@@ -2053,8 +2301,9 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 			break;
 		}
 
-		if (!(vma->vm_flags & VM_HUGEPAGE) &&
-		    !khugepaged_always()) {
+		if ((!(vma->vm_flags & VM_HUGEPAGE) &&
+		     !khugepaged_always()) ||
+		    (vma->vm_flags & VM_NOHUGEPAGE)) {
 		skip:
 			progress++;
 			continue;
@@ -2075,26 +2324,26 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 		hend = vma->vm_end & HPAGE_PMD_MASK;
 		if (hstart >= hend)
 			goto skip;
-		if (khugepaged_scan.address > hend)
+		if (scan->address > hend)
 			goto skip;
-		if (khugepaged_scan.address < hstart)
-			khugepaged_scan.address = hstart;
-		VM_BUG_ON(khugepaged_scan.address & ~HPAGE_PMD_MASK);
+		if (scan->address < hstart)
+			scan->address = hstart;
+		VM_BUG_ON(scan->address & ~HPAGE_PMD_MASK);
 
-		while (khugepaged_scan.address < hend) {
+		while (scan->address < hend) {
 			int ret;
 			cond_resched();
 			if (unlikely(khugepaged_test_exit(mm)))
 				goto breakouterloop;
 
-			VM_BUG_ON(khugepaged_scan.address < hstart ||
-				  khugepaged_scan.address + HPAGE_PMD_SIZE >
+			VM_BUG_ON(scan->address < hstart ||
+				  scan->address + HPAGE_PMD_SIZE >
 				  hend);
 			ret = khugepaged_scan_pmd(mm, vma,
-						  khugepaged_scan.address,
-						  hpage);
+						  scan->address,
+						  hpage, scan);
 			/* move to next address */
-			khugepaged_scan.address += HPAGE_PMD_SIZE;
+			scan->address += HPAGE_PMD_SIZE;
 			progress += HPAGE_PMD_NR;
 			if (ret)
 				/* we released mmap_sem so break loop */
@@ -2108,25 +2357,32 @@ breakouterloop:
 breakouterloop_mmap_sem:
 
 	spin_lock(&khugepaged_mm_lock);
-	VM_BUG_ON(khugepaged_scan.mm_slot != mm_slot);
+	VM_BUG_ON(scan->mm_slot != mm_slot);
 	/*
 	 * Release the current mm_slot if this mm is about to die, or
 	 * if we scanned all vmas of this mm.
 	 */
 	if (khugepaged_test_exit(mm) || !vma) {
+		struct list_head *next = mm_slot->mm_node.next;
+
+		/*
+		 * Rehome before starting the next pass, which resets the
+		 * per node load of this one.
+		 */
+		if (!vma && !khugepaged_test_exit(mm))
+			khugepaged_rehome_mm_slot(scan, mm_slot);
+
 		/*
 		 * Make sure that if mm_users is reaching zero while
 		 * khugepaged runs here, khugepaged_exit will find
 		 * mm_slot not pointing to the exiting mm.
 		 */
-		if (mm_slot->mm_node.next != &khugepaged_scan.mm_head) {
-			khugepaged_scan.mm_slot = list_entry(
-				mm_slot->mm_node.next,
-				struct mm_slot, mm_node);
-			khugepaged_scan.address = 0;
+		if (next != &scan->mm_head) {
+			khugepaged_scan_start_mm(scan, list_entry(next,
+				struct mm_slot, mm_node));
 		} else {
-			khugepaged_scan.mm_slot = NULL;
-			khugepaged_full_scans++;
+			scan->mm_slot = NULL;
+			scan->full_scans++;
 		}
 
 		collect_mm_slot(mm_slot);
@@ -2135,19 +2391,20 @@ breakouterloop_mmap_sem:
 	return progress;
 }
 
-static int khugepaged_has_work(void)
+static int khugepaged_has_work(struct khugepaged_scan *scan)
 {
-	return !list_empty(&khugepaged_scan.mm_head) &&
+	return !list_empty(&scan->mm_head) &&
 		khugepaged_enabled();
 }
 
-static int khugepaged_wait_event(void)
+static int khugepaged_wait_event(struct khugepaged_scan *scan)
 {
-	return !list_empty(&khugepaged_scan.mm_head) ||
+	return !list_empty(&scan->mm_head) ||
 		!khugepaged_enabled();
 }
 
-static void khugepaged_do_scan(struct page **hpage)
+static void khugepaged_do_scan(struct khugepaged_scan *scan,
+			       struct page **hpage)
 {
 	unsigned int progress = 0, pass_through_head = 0;
 	unsigned int pages = khugepaged_pages_to_scan;
@@ -2175,11 +2432,12 @@ static void khugepaged_do_scan(struct page **hpage)
 			break;
 
 		spin_lock(&khugepaged_mm_lock);
-		if (!khugepaged_scan.mm_slot)
+		if (!scan->mm_slot)
 			pass_through_head++;
-		if (khugepaged_has_work() &&
+		if (khugepaged_has_work(scan) &&
 		    pass_through_head < 2)
-			progress += khugepaged_scan_mm_slot(pages - progress,
+			progress += khugepaged_scan_mm_slot(scan,
+							    pages - progress,
 							    hpage);
 		else
 			progress = pages;
@@ -2212,7 +2470,7 @@ static struct page *khugepaged_alloc_hugepage(void)
 }
 #endif
 
-static void khugepaged_loop(void)
+static void khugepaged_loop(struct khugepaged_scan *scan)
 {
 	struct page *hpage;
 
@@ -2231,7 +2489,7 @@ static void khugepaged_loop(void)
 		}
 #endif
 
-		khugepaged_do_scan(&hpage);
+		khugepaged_do_scan(scan, &hpage);
 #ifndef CONFIG_NUMA
 		if (hpage)
 			put_page(hpage);
@@ -2239,7 +2497,7 @@ static void khugepaged_loop(void)
 		try_to_freeze();
 		if (unlikely(kthread_should_stop()))
 			break;
-		if (khugepaged_has_work()) {
+		if (khugepaged_has_work(scan)) {
 			if (!khugepaged_scan_sleep_millisecs)
 				continue;
 			wait_event_freezable_timeout(khugepaged_wait, false,
@@ -2247,12 +2505,13 @@ static void khugepaged_loop(void)
 					khugepaged_scan_sleep_millisecs));
 		} else if (khugepaged_enabled())
 			wait_event_freezable(khugepaged_wait,
-					     khugepaged_wait_event());
+					     khugepaged_wait_event(scan));
 	}
 }
 
-static int khugepaged(void *none)
+static int khugepaged(void *data)
 {
+	struct khugepaged_scan *scan = data;
 	struct mm_slot *mm_slot;
 
 	set_freezable();
@@ -2263,9 +2522,9 @@ static int khugepaged(void *none)
 
 	for (;;) {
 		mutex_unlock(&khugepaged_mutex);
-		VM_BUG_ON(khugepaged_thread != current);
-		khugepaged_loop();
-		VM_BUG_ON(khugepaged_thread != current);
+		VM_BUG_ON(scan->thread != current);
+		khugepaged_loop(scan);
+		VM_BUG_ON(scan->thread != current);
 
 		mutex_lock(&khugepaged_mutex);
 		if (!khugepaged_enabled())
@@ -2275,13 +2534,13 @@ static int khugepaged(void *none)
 	}
 
 	spin_lock(&khugepaged_mm_lock);
-	mm_slot = khugepaged_scan.mm_slot;
-	khugepaged_scan.mm_slot = NULL;
+	mm_slot = scan->mm_slot;
+	scan->mm_slot = NULL;
 	if (mm_slot)
 		collect_mm_slot(mm_slot);
 	spin_unlock(&khugepaged_mm_lock);
 
-	khugepaged_thread = NULL;
+	scan->thread = NULL;
 	mutex_unlock(&khugepaged_mutex);
 
 	return 0;
@@ -86,6 +86,55 @@ extern unsigned long highest_memmap_pfn;
 extern int isolate_lru_page(struct page *page);
 extern void putback_lru_page(struct page *page);
 
+/*
+ * in mm/swap.c:
+ *
+ * LRU lists and their locks live in the lruvec of the memcg a page is
+ * charged to, so the lock protecting a page can change until it is
+ * held.  These helpers take the right lruvec lock for a page, with
+ * interrupts disabled, and return the locked lruvec.
+ *
+ * relock_page_lruvec() switches from the held @locked lruvec lock (or
+ * none) to the one of @page, for batched operations on pages of
+ * different memcgs and zones.  Interrupts must be disabled already.
+ */
+extern struct lruvec *relock_page_lruvec(struct page *page,
+					 struct zone *zone,
+					 struct lruvec *locked);
+
+static inline struct lruvec *lock_page_lruvec_irq(struct page *page,
+						  struct zone *zone)
+{
+	local_irq_disable();
+	return relock_page_lruvec(page, zone, NULL);
+}
+
+static inline struct lruvec *lock_page_lruvec_irqsave(struct page *page,
+						      struct zone *zone,
+						      unsigned long *flags)
+{
+	local_irq_save(*flags);
+	return relock_page_lruvec(page, zone, NULL);
+}
+
+/*
+ * page_on_lruvec - is @page linked to @lruvec?
+ *
+ * Must be called with @lruvec->lru_lock held.  This replaces the bare
+ * PageLRU() test of the zone lock days: a page can only be isolated,
+ * or have its memcg changed, under the lock of the lruvec it is on,
+ * so a positive answer is stable until the lock is dropped.
+ */
+static inline bool page_on_lruvec(struct page *page, struct lruvec *lruvec)
+{
+	if (!PageLRU(page))
+		return false;
+	if (mem_cgroup_page_lruvec(page, page_zone(page)) != lruvec)
+		return false;
+	smp_rmb();
+	return PageLRU(page);
+}
+
 /*
  * in mm/page_alloc.c
  */
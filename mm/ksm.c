@@ -77,36 +77,66 @@
  *    take 10 attempts to find a page in the unstable tree, once it is found,
  *    it is secured in the stable tree.  (When we scan a new page, we first
  *    compare it against the stable tree, and then against the unstable tree.)
+ *
+ * The scanning is shared out between several ksmd threads, each of which
+ * walks its own list of mms.  A full scan is complete only once every thread
+ * has been through its list, and only then are the unstable trees flushed.
+ * Each thread owns one shard of the unstable tree, but a page goes into the
+ * shard picked by its checksum rather than the one of the thread scanning
+ * it: identical pages have identical checksums, so they still meet however
+ * their mms were shared out.
+ *
+ * Unless merge_across_nodes is set, there is a stable tree (and an unstable
+ * tree in each shard) per NUMA node, and pages are only merged with pages of
+ * their own node, so that no task is left accessing remote memory for pages
+ * it used to have locally.
  */
 
 /**
  * struct mm_slot - ksm information per mm that is being scanned
  * @link: link to the mm_slots hash list
- * @mm_list: link into the mm_slots list, rooted in ksm_mm_head
+ * @mm_list: link into the mm_slots list, rooted in its ksm_scan's mm_head
  * @rmap_list: head for this mm_slot's singly-linked list of rmap_items
  * @mm: the mm that this information is valid for
+ * @scan: the scanning thread this mm is assigned to
  */
 struct mm_slot {
 	struct hlist_node link;
 	struct list_head mm_list;
 	struct rmap_item *rmap_list;
 	struct mm_struct *mm;
+	struct ksm_scan *scan;
 };
 
 /**
- * struct ksm_scan - cursor for scanning
+ * struct ksm_scan - scanning thread and its cursor
+ * @mm_head: head of the list of mm_slots assigned to this thread
  * @mm_slot: the current mm_slot we are scanning
  * @address: the next address inside that to be scanned
  * @rmap_list: link to the next rmap to be scanned in the rmap_list
- * @seqnr: count of completed full scans (needed when removing unstable node)
+ * @done: set once this thread has completed its part of the full scan
+ * @nid: node whose cpus the thread runs on
+ * @nr_mms: number of mm_slots on @mm_head, to balance new mms
+ * @unstable_lock: protects this thread's shard of the unstable tree
+ * @unstable_tree: the shard of the unstable tree, one root per node
+ * @stale_rmap_items: rmap_items unlinked from their mm under its mmap_sem,
+ *	to be taken out of the trees and freed once that is released
+ * @thread: the ksmd thread itself
  *
- * There is only the one ksm_scan instance of this cursor structure.
+ * There is one ksm_scan instance of this structure per ksmd thread.
  */
 struct ksm_scan {
+	struct mm_slot mm_head;
 	struct mm_slot *mm_slot;
 	unsigned long address;
 	struct rmap_item **rmap_list;
-	unsigned long seqnr;
+	int done;
+	int nid;
+	unsigned int nr_mms;
+	struct mutex unstable_lock;
+	struct rb_root *unstable_tree;
+	struct rmap_item *stale_rmap_items;
+	struct task_struct *thread;
 };
 
 /**
@@ -114,11 +144,23 @@ struct ksm_scan {
  * @node: rb node of this ksm page in the stable tree
  * @hlist: hlist head of rmap_items using this ksm page
  * @kpfn: page frame number of this ksm page
+ * @nid: node of the stable tree this node is in
  */
 struct stable_node {
 	struct rb_node node;
 	struct hlist_head hlist;
 	unsigned long kpfn;
+	int nid;
+};
+
+/**
+ * struct ksm_stable_tree - stable tree of one node
+ * @root: the stable rbtree
+ * @lock: serializes lookups and changes of the tree between ksmd threads
+ */
+struct ksm_stable_tree {
+	struct rb_root root;
+	struct mutex lock;
 };
 
 /**
@@ -128,6 +170,7 @@ struct stable_node {
  * @mm: the memory structure this rmap_item is pointing into
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
  * @oldchecksum: previous checksum of the page at that virtual address
+ * @nid: node of the stable or unstable tree this rmap_item is in
  * @node: rb node of this rmap_item in the unstable tree
  * @head: pointer to stable_node heading this list in the stable tree
  * @hlist: link into hlist of rmap_items hanging off that stable_node
@@ -138,6 +181,7 @@ struct rmap_item {
 	struct mm_struct *mm;
 	unsigned long address;		/* + low bits used for flags below */
 	unsigned int oldchecksum;	/* when unstable */
+	int nid;
 	union {
 		struct rb_node node;	/* when node of unstable tree */
 		struct {		/* when listed from stable tree */
@@ -151,49 +195,53 @@ struct rmap_item {
 #define UNSTABLE_FLAG	0x100	/* is a node of the unstable tree */
 #define STABLE_FLAG	0x200	/* is listed from the stable tree */
 
-/* The stable and unstable tree heads */
-static struct rb_root root_stable_tree = RB_ROOT;
-static struct rb_root root_unstable_tree = RB_ROOT;
+/* The stable trees, indexed by node */
+static struct ksm_stable_tree *ksm_stable_trees;
 
 #define MM_SLOTS_HASH_HEADS 1024
 static struct hlist_head *mm_slots_hash;
 
-static struct mm_slot ksm_mm_head = {
-	.mm_list = LIST_HEAD_INIT(ksm_mm_head.mm_list),
-};
-static struct ksm_scan ksm_scan = {
-	.mm_slot = &ksm_mm_head,
-};
+/* The ksmd threads, each owning one shard of the unstable tree */
+#define KSM_MAX_THREADS	64
+static struct ksm_scan *ksm_scans;
+static unsigned int ksm_nr_threads;
+
+/* Count of completed full scans (needed when removing unstable node) */
+static unsigned long ksm_seqnr;
 
 static struct kmem_cache *rmap_item_cache;
 static struct kmem_cache *stable_node_cache;
 static struct kmem_cache *mm_slot_cache;
 
 /* The number of nodes in the stable tree */
-static unsigned long ksm_pages_shared;
+static atomic_long_t ksm_pages_shared;
 
 /* The number of page slots additionally sharing those nodes */
-static unsigned long ksm_pages_sharing;
+static atomic_long_t ksm_pages_sharing;
 
 /* The number of nodes in the unstable tree */
-static unsigned long ksm_pages_unshared;
+static atomic_long_t ksm_pages_unshared;
 
 /* The number of rmap_items in use: to calculate pages_volatile */
-static unsigned long ksm_rmap_items;
+static atomic_long_t ksm_rmap_items;
 
-/* Number of pages ksmd should scan in one batch */
+/* Number of pages each ksmd thread should scan in one batch */
 static unsigned int ksm_thread_pages_to_scan = 100;
 
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/* Merge identical pages even if they are on different nodes */
+static unsigned int ksm_merge_across_nodes = 1;
+
 #define KSM_RUN_STOP	0
 #define KSM_RUN_MERGE	1
 #define KSM_RUN_UNMERGE	2
 static unsigned int ksm_run = KSM_RUN_STOP;
 
 static DECLARE_WAIT_QUEUE_HEAD(ksm_thread_wait);
-static DEFINE_MUTEX(ksm_thread_mutex);
+/* Held for read by the ksmd threads while scanning, for write to stop them */
+static DECLARE_RWSEM(ksm_thread_sem);
 static DEFINE_SPINLOCK(ksm_mmlist_lock);
 
 #define KSM_KMEM_CACHE(__struct, __flags) kmem_cache_create("ksm_"#__struct,\
@@ -232,19 +280,92 @@ static void __init ksm_slab_free(void)
 	mm_slot_cache = NULL;
 }
 
+static int __init ksm_trees_init(void)
+{
+	int i, nid;
+
+	ksm_stable_trees = kcalloc(nr_node_ids, sizeof(struct ksm_stable_tree),
+				   GFP_KERNEL);
+	if (!ksm_stable_trees)
+		return -ENOMEM;
+	for (nid = 0; nid < nr_node_ids; nid++) {
+		ksm_stable_trees[nid].root = RB_ROOT;
+		mutex_init(&ksm_stable_trees[nid].lock);
+	}
+
+	ksm_scans = kcalloc(ksm_nr_threads, sizeof(struct ksm_scan),
+			    GFP_KERNEL);
+	if (!ksm_scans)
+		goto out_free;
+	nid = first_online_node;
+	for (i = 0; i < ksm_nr_threads; i++) {
+		struct ksm_scan *scan = &ksm_scans[i];
+
+		INIT_LIST_HEAD(&scan->mm_head.mm_list);
+		scan->mm_slot = &scan->mm_head;
+		scan->nid = nid;
+		mutex_init(&scan->unstable_lock);
+		scan->unstable_tree = kcalloc(nr_node_ids,
+					      sizeof(struct rb_root), GFP_KERNEL);
+		if (!scan->unstable_tree)
+			goto out_free;
+
+		/* spread the threads over the nodes */
+		nid = next_online_node(nid);
+		if (nid == MAX_NUMNODES)
+			nid = first_online_node;
+	}
+	return 0;
+
+out_free:
+	if (ksm_scans) {
+		for (i = 0; i < ksm_nr_threads; i++)
+			kfree(ksm_scans[i].unstable_tree);
+		kfree(ksm_scans);
+	}
+	kfree(ksm_stable_trees);
+	return -ENOMEM;
+}
+
+static void __init ksm_trees_free(void)
+{
+	int i;
+
+	for (i = 0; i < ksm_nr_threads; i++)
+		kfree(ksm_scans[i].unstable_tree);
+	kfree(ksm_scans);
+	kfree(ksm_stable_trees);
+}
+
+/*
+ * The node whose trees a page belongs in: with merge_across_nodes
+ * there is just the one set of trees, all on node 0.
+ */
+static inline int ksm_page_nid(struct page *page)
+{
+	return ksm_merge_across_nodes ? 0 : page_to_nid(page);
+}
+
+/* The shard of the unstable tree a page of this checksum goes into */
+static inline struct ksm_scan *unstable_shard(unsigned int checksum)
+{
+	return &ksm_scans[checksum % ksm_nr_threads];
+}
+
 static inline struct rmap_item *alloc_rmap_item(void)
 {
 	struct rmap_item *rmap_item;
 
 	rmap_item = kmem_cache_zalloc(rmap_item_cache, GFP_KERNEL);
 	if (rmap_item)
-		ksm_rmap_items++;
+		atomic_long_inc(&ksm_rmap_items);
 	return rmap_item;
 }
 
 static inline void free_rmap_item(struct rmap_item *rmap_item)
 {
-	ksm_rmap_items--;
+	atomic_long_dec(&ksm_rmap_items);
+	atomic_long_dec(&rmap_item->mm->ksm_rmap_items);
 	rmap_item->mm = NULL;	/* debug safety */
 	kmem_cache_free(rmap_item_cache, rmap_item);
 }
@@ -471,6 +592,11 @@ out:		page = NULL;
 	return page;
 }
 
+/*
+ * Called with the lock of the stable_node's tree held: the rmap_items
+ * may belong to mms of other ksmd threads, which check STABLE_FLAG
+ * under that lock before touching their stable_node.
+ */
 static void remove_node_from_stable_tree(struct stable_node *stable_node)
 {
 	struct rmap_item *rmap_item;
@@ -478,15 +604,16 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node)
 
 	hlist_for_each_entry(rmap_item, hlist, &stable_node->hlist, hlist) {
 		if (rmap_item->hlist.next)
-			ksm_pages_sharing--;
+			atomic_long_dec(&ksm_pages_sharing);
 		else
-			ksm_pages_shared--;
+			atomic_long_dec(&ksm_pages_shared);
+		atomic_long_dec(&rmap_item->mm->ksm_merging_pages);
 		ksm_drop_anon_vma(rmap_item);
 		rmap_item->address &= PAGE_MASK;
 		cond_resched();
 	}
 
-	rb_erase(&stable_node->node, &root_stable_tree);
+	rb_erase(&stable_node->node, &ksm_stable_trees[stable_node->nid].root);
 	free_stable_node(stable_node);
 }
 
@@ -508,7 +635,7 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node)
  * a page to put something that might look like our key in page->mapping.
  *
  * include/linux/pagemap.h page_cache_get_speculative() is a good reference,
- * but this is different - made simpler by ksm_thread_mutex being held, but
+ * but this is different - made simpler by the stable tree lock being held, but
  * interesting for assuming that no other use of the struct page could ever
  * put our expected_mapping into page->mapping (or a field of the union which
  * coincides with page->mapping).  The RCU calls are not for KSM at all, but
@@ -550,57 +677,112 @@ stale:
  */
 static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 {
+again:
 	if (rmap_item->address & STABLE_FLAG) {
+		struct ksm_stable_tree *tree = &ksm_stable_trees[rmap_item->nid];
 		struct stable_node *stable_node;
 		struct page *page;
 
+		/*
+		 * Another ksmd thread finding the ksm page gone may remove
+		 * the stable_node under us: look again with the tree locked.
+		 */
+		mutex_lock(&tree->lock);
+		if (!(rmap_item->address & STABLE_FLAG)) {
+			mutex_unlock(&tree->lock);
+			goto out;
+		}
 		stable_node = rmap_item->head;
 		page = get_ksm_page(stable_node);
+		mutex_unlock(&tree->lock);
 		if (!page)
 			goto out;
 
+		/* Our reference keeps stable_node in the tree from here on */
 		lock_page(page);
 		hlist_del(&rmap_item->hlist);
-		unlock_page(page);
-		put_page(page);
-
 		if (stable_node->hlist.first)
-			ksm_pages_sharing--;
+			atomic_long_dec(&ksm_pages_sharing);
 		else
-			ksm_pages_shared--;
+			atomic_long_dec(&ksm_pages_shared);
+		unlock_page(page);
+		put_page(page);
 
+		atomic_long_dec(&rmap_item->mm->ksm_merging_pages);
 		ksm_drop_anon_vma(rmap_item);
 		rmap_item->address &= PAGE_MASK;
 
 	} else if (rmap_item->address & UNSTABLE_FLAG) {
+		struct ksm_scan *shard;
 		unsigned char age;
 		/*
 		 * Usually ksmd can and must skip the rb_erase, because
-		 * root_unstable_tree was already reset to RB_ROOT.
+		 * the unstable trees were already reset to RB_ROOT.
 		 * But be careful when an mm is exiting: do the rb_erase
 		 * if this rmap_item was inserted by this scan, rather
 		 * than left over from before.
 		 */
-		age = (unsigned char)(ksm_scan.seqnr - rmap_item->address);
+		age = (unsigned char)(ksm_seqnr - rmap_item->address);
 		BUG_ON(age > 1);
-		if (!age)
-			rb_erase(&rmap_item->node, &root_unstable_tree);
+		if (!age) {
+			/*
+			 * Another ksmd thread may have found it in the tree
+			 * meanwhile, and merged it into the stable tree.
+			 */
+			shard = unstable_shard(rmap_item->oldchecksum);
+			mutex_lock(&shard->unstable_lock);
+			if (!(rmap_item->address & UNSTABLE_FLAG)) {
+				mutex_unlock(&shard->unstable_lock);
+				goto again;
+			}
+			rb_erase(&rmap_item->node,
+				 &shard->unstable_tree[rmap_item->nid]);
+			mutex_unlock(&shard->unstable_lock);
+		}
 
-		ksm_pages_unshared--;
+		atomic_long_dec(&ksm_pages_unshared);
 		rmap_item->address &= PAGE_MASK;
 	}
 out:
 	cond_resched();		/* we're called from many long loops */
 }
 
+/*
+ * remove_rmap_item_from_tree() must not be called with an mmap_sem held:
+ * it may take a shard's unstable_lock, whose holder may be waiting to
+ * down_read the same mmap_sem from unstable_tree_search_insert() or the
+ * merge that follows, stuck behind a queued down_write.  So the rmap_items
+ * dropped while walking an mm are only unlinked from it there, and queued
+ * on the scan to be removed and freed by free_stale_rmap_items() after
+ * up_read - before mmdrop, since other threads may still find them in the
+ * unstable tree and look at their mm until then.
+ */
+static void drop_rmap_item(struct mm_slot *mm_slot,
+			   struct rmap_item *rmap_item)
+{
+	struct ksm_scan *scan = mm_slot->scan;
+
+	rmap_item->rmap_list = scan->stale_rmap_items;
+	scan->stale_rmap_items = rmap_item;
+}
+
+static void free_stale_rmap_items(struct ksm_scan *scan)
+{
+	while (scan->stale_rmap_items) {
+		struct rmap_item *rmap_item = scan->stale_rmap_items;
+		scan->stale_rmap_items = rmap_item->rmap_list;
+		remove_rmap_item_from_tree(rmap_item);
+		free_rmap_item(rmap_item);
+	}
+}
+
 static void remove_trailing_rmap_items(struct mm_slot *mm_slot,
 				       struct rmap_item **rmap_list)
 {
 	while (*rmap_list) {
 		struct rmap_item *rmap_item = *rmap_list;
 		*rmap_list = rmap_item->rmap_list;
-		remove_rmap_item_from_tree(rmap_item);
-		free_rmap_item(rmap_item);
+		drop_rmap_item(mm_slot, rmap_item);
 	}
 }
 
@@ -635,10 +817,42 @@ static int unmerge_ksm_pages(struct vm_area_struct *vma,
 }
 
 #ifdef CONFIG_SYSFS
+/*
+ * Only called through the sysfs control interface, with the ksmd threads
+ * locked out: forget the unstable trees and start the full scan afresh,
+ * so that no rmap_item is left in them from before.
+ */
+static void ksm_reset_full_scan(void)
+{
+	struct ksm_scan *scan;
+	struct mm_slot *mm_slot;
+	struct rmap_item *rmap_item;
+	int i, nid;
+
+	spin_lock(&ksm_mmlist_lock);
+	for (i = 0; i < ksm_nr_threads; i++) {
+		scan = &ksm_scans[i];
+		list_for_each_entry(mm_slot, &scan->mm_head.mm_list, mm_list) {
+			for (rmap_item = mm_slot->rmap_list; rmap_item;
+			     rmap_item = rmap_item->rmap_list) {
+				if (!(rmap_item->address & UNSTABLE_FLAG))
+					continue;
+				atomic_long_dec(&ksm_pages_unshared);
+				rmap_item->address &= PAGE_MASK;
+			}
+		}
+		scan->mm_slot = &scan->mm_head;
+		scan->done = 0;
+		for (nid = 0; nid < nr_node_ids; nid++)
+			scan->unstable_tree[nid] = RB_ROOT;
+	}
+	spin_unlock(&ksm_mmlist_lock);
+}
+
 /*
  * Only called through the sysfs control interface:
  */
-static int unmerge_and_remove_all_rmap_items(void)
+static int unmerge_and_remove_scan_rmap_items(struct ksm_scan *scan)
 {
 	struct mm_slot *mm_slot;
 	struct mm_struct *mm;
@@ -646,12 +860,12 @@ static int unmerge_and_remove_all_rmap_items(void)
 	int err = 0;
 
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = list_entry(ksm_mm_head.mm_list.next,
+	scan->mm_slot = list_entry(scan->mm_head.mm_list.next,
 						struct mm_slot, mm_list);
 	spin_unlock(&ksm_mmlist_lock);
 
-	for (mm_slot = ksm_scan.mm_slot;
-			mm_slot != &ksm_mm_head; mm_slot = ksm_scan.mm_slot) {
+	for (mm_slot = scan->mm_slot;
+			mm_slot != &scan->mm_head; mm_slot = scan->mm_slot) {
 		mm = mm_slot->mm;
 		down_read(&mm->mmap_sem);
 		for (vma = mm->mmap; vma; vma = vma->vm_next) {
@@ -668,33 +882,57 @@ static int unmerge_and_remove_all_rmap_items(void)
 		remove_trailing_rmap_items(mm_slot, &mm_slot->rmap_list);
 
 		spin_lock(&ksm_mmlist_lock);
-		ksm_scan.mm_slot = list_entry(mm_slot->mm_list.next,
+		scan->mm_slot = list_entry(mm_slot->mm_list.next,
 						struct mm_slot, mm_list);
 		if (ksm_test_exit(mm)) {
 			hlist_del(&mm_slot->link);
 			list_del(&mm_slot->mm_list);
+			scan->nr_mms--;
 			spin_unlock(&ksm_mmlist_lock);
 
 			free_mm_slot(mm_slot);
 			clear_bit(MMF_VM_MERGEABLE, &mm->flags);
 			up_read(&mm->mmap_sem);
+			free_stale_rmap_items(scan);
 			mmdrop(mm);
 		} else {
 			spin_unlock(&ksm_mmlist_lock);
 			up_read(&mm->mmap_sem);
+			free_stale_rmap_items(scan);
 		}
 	}
-
-	ksm_scan.seqnr = 0;
 	return 0;
 
 error:
 	up_read(&mm->mmap_sem);
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = &ksm_mm_head;
+	scan->mm_slot = &scan->mm_head;
 	spin_unlock(&ksm_mmlist_lock);
 	return err;
 }
+
+static int unmerge_and_remove_all_rmap_items(void)
+{
+	int err;
+	int i;
+
+	for (i = 0; i < ksm_nr_threads; i++) {
+		err = unmerge_and_remove_scan_rmap_items(&ksm_scans[i]);
+		if (err) {
+			/*
+			 * The threads not unmerged yet may be halfway through
+			 * the full scan: restarting just this one would leave
+			 * rmap_items of this scan ahead of its cursor.
+			 */
+			ksm_reset_full_scan();
+			return err;
+		}
+	}
+
+	ksm_reset_full_scan();
+	ksm_seqnr = 0;
+	return 0;
+}
 #endif /* CONFIG_SYSFS */
 
 static u32 calc_checksum(struct page *page)
@@ -1012,8 +1250,10 @@ static struct page *try_to_merge_two_pages(struct rmap_item *rmap_item,
  */
 static struct page *stable_tree_search(struct page *page)
 {
-	struct rb_node *node = root_stable_tree.rb_node;
+	struct ksm_stable_tree *tree;
+	struct rb_node *node;
 	struct stable_node *stable_node;
+	struct page *tree_page = NULL;
 
 	stable_node = page_stable_node(page);
 	if (stable_node) {			/* ksm page forked */
@@ -1021,15 +1261,17 @@ static struct page *stable_tree_search(struct page *page)
 		return page;
 	}
 
+	tree = &ksm_stable_trees[ksm_page_nid(page)];
+	mutex_lock(&tree->lock);
+	node = tree->root.rb_node;
 	while (node) {
-		struct page *tree_page;
 		int ret;
 
 		cond_resched();
 		stable_node = rb_entry(node, struct stable_node, node);
 		tree_page = get_ksm_page(stable_node);
 		if (!tree_page)
-			return NULL;
+			break;
 
 		ret = memcmp_pages(page, tree_page);
 
@@ -1040,10 +1282,12 @@ static struct page *stable_tree_search(struct page *page)
 			put_page(tree_page);
 			node = node->rb_right;
 		} else
-			return tree_page;
+			break;
+		tree_page = NULL;
 	}
+	mutex_unlock(&tree->lock);
 
-	return NULL;
+	return tree_page;
 }
 
 /*
@@ -1055,10 +1299,14 @@ static struct page *stable_tree_search(struct page *page)
  */
 static struct stable_node *stable_tree_insert(struct page *kpage)
 {
-	struct rb_node **new = &root_stable_tree.rb_node;
+	int nid = ksm_page_nid(kpage);
+	struct ksm_stable_tree *tree = &ksm_stable_trees[nid];
+	struct rb_node **new;
 	struct rb_node *parent = NULL;
 	struct stable_node *stable_node;
 
+	mutex_lock(&tree->lock);
+	new = &tree->root.rb_node;
 	while (*new) {
 		struct page *tree_page;
 		int ret;
@@ -1067,7 +1315,7 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 		stable_node = rb_entry(*new, struct stable_node, node);
 		tree_page = get_ksm_page(stable_node);
 		if (!tree_page)
-			return NULL;
+			goto fail;
 
 		ret = memcmp_pages(kpage, tree_page);
 		put_page(tree_page);
@@ -1083,23 +1331,29 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 			 * find this node: because at that time our page was
 			 * not yet write-protected, so may have changed since.
 			 */
-			return NULL;
+			goto fail;
 		}
 	}
 
 	stable_node = alloc_stable_node();
 	if (!stable_node)
-		return NULL;
+		goto fail;
 
 	rb_link_node(&stable_node->node, parent, new);
-	rb_insert_color(&stable_node->node, &root_stable_tree);
+	rb_insert_color(&stable_node->node, &tree->root);
 
 	INIT_HLIST_HEAD(&stable_node->hlist);
 
 	stable_node->kpfn = page_to_pfn(kpage);
+	stable_node->nid = nid;
 	set_page_stable_node(kpage, stable_node);
+	mutex_unlock(&tree->lock);
 
 	return stable_node;
+
+fail:
+	mutex_unlock(&tree->lock);
+	return NULL;
 }
 
 /*
@@ -1115,14 +1369,18 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
  *
  * This function does both searching and inserting, because they share
  * the same walking algorithm in an rbtree.
+ *
+ * Called with the unstable_lock of @shard held.
  */
 static
-struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
+struct rmap_item *unstable_tree_search_insert(struct ksm_scan *shard,
+					      struct rmap_item *rmap_item,
 					      struct page *page,
 					      struct page **tree_pagep)
 
 {
-	struct rb_node **new = &root_unstable_tree.rb_node;
+	int nid = ksm_page_nid(page);
+	struct rb_node **new = &shard->unstable_tree[nid].rb_node;
 	struct rb_node *parent = NULL;
 
 	while (*new) {
@@ -1144,6 +1402,15 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 			return NULL;
 		}
 
+		/*
+		 * The page may have been migrated to another node since it
+		 * was inserted: don't merge it with pages of our node then.
+		 */
+		if (ksm_page_nid(tree_page) != nid) {
+			put_page(tree_page);
+			return NULL;
+		}
+
 		ret = memcmp_pages(page, tree_page);
 
 		parent = *new;
@@ -1160,30 +1427,45 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 	}
 
 	rmap_item->address |= UNSTABLE_FLAG;
-	rmap_item->address |= (ksm_scan.seqnr & SEQNR_MASK);
+	rmap_item->address |= (ksm_seqnr & SEQNR_MASK);
+	rmap_item->nid = nid;
 	rb_link_node(&rmap_item->node, parent, new);
-	rb_insert_color(&rmap_item->node, &root_unstable_tree);
+	rb_insert_color(&rmap_item->node, &shard->unstable_tree[nid]);
 
-	ksm_pages_unshared++;
+	atomic_long_inc(&ksm_pages_unshared);
 	return NULL;
 }
 
+/*
+ * unstable_tree_erase - take an rmap_item which was found in the unstable
+ * tree out of it again.  Called with the unstable_lock of @shard held.
+ */
+static void unstable_tree_erase(struct ksm_scan *shard,
+				struct rmap_item *rmap_item)
+{
+	rb_erase(&rmap_item->node, &shard->unstable_tree[rmap_item->nid]);
+	atomic_long_dec(&ksm_pages_unshared);
+	rmap_item->address &= PAGE_MASK;
+}
+
 /*
  * stable_tree_append - add another rmap_item to the linked list of
  * rmap_items hanging off a given node of the stable tree, all sharing
- * the same ksm page.
+ * the same ksm page.  Called with the ksm page locked.
  */
 static void stable_tree_append(struct rmap_item *rmap_item,
 			       struct stable_node *stable_node)
 {
 	rmap_item->head = stable_node;
+	rmap_item->nid = stable_node->nid;
 	rmap_item->address |= STABLE_FLAG;
 	hlist_add_head(&rmap_item->hlist, &stable_node->hlist);
 
 	if (rmap_item->hlist.next)
-		ksm_pages_sharing++;
+		atomic_long_inc(&ksm_pages_sharing);
 	else
-		ksm_pages_shared++;
+		atomic_long_inc(&ksm_pages_shared);
+	atomic_long_inc(&rmap_item->mm->ksm_merging_pages);
 }
 
 /*
@@ -1200,6 +1482,7 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	struct rmap_item *tree_rmap_item;
 	struct page *tree_page = NULL;
 	struct stable_node *stable_node;
+	struct ksm_scan *shard;
 	struct page *kpage;
 	unsigned int checksum;
 	int err;
@@ -1235,8 +1518,15 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 		return;
 	}
 
-	tree_rmap_item =
-		unstable_tree_search_insert(rmap_item, page, &tree_page);
+	/*
+	 * tree_rmap_item may belong to an mm of another ksmd thread: the
+	 * shard stays locked until we are done with it, so that it cannot
+	 * be freed from under us.
+	 */
+	shard = unstable_shard(checksum);
+	mutex_lock(&shard->unstable_lock);
+	tree_rmap_item = unstable_tree_search_insert(shard, rmap_item,
+						     page, &tree_page);
 	if (tree_rmap_item) {
 		kpage = try_to_merge_two_pages(rmap_item, page,
 						tree_rmap_item, tree_page);
@@ -1247,7 +1537,7 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 		 * tree, and insert it instead as new node in the stable tree.
 		 */
 		if (kpage) {
-			remove_rmap_item_from_tree(tree_rmap_item);
+			unstable_tree_erase(shard, tree_rmap_item);
 
 			lock_page(kpage);
 			stable_node = stable_tree_insert(kpage);
@@ -1269,6 +1559,7 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			}
 		}
 	}
+	mutex_unlock(&shard->unstable_lock);
 }
 
 static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
@@ -1284,14 +1575,14 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 		if (rmap_item->address > addr)
 			break;
 		*rmap_list = rmap_item->rmap_list;
-		remove_rmap_item_from_tree(rmap_item);
-		free_rmap_item(rmap_item);
+		drop_rmap_item(mm_slot, rmap_item);
 	}
 
 	rmap_item = alloc_rmap_item();
 	if (rmap_item) {
 		/* It has already been zeroed */
 		rmap_item->mm = mm_slot->mm;
+		atomic_long_inc(&rmap_item->mm->ksm_rmap_items);
 		rmap_item->address = addr;
 		rmap_item->rmap_list = *rmap_list;
 		*rmap_list = rmap_item;
@@ -1299,18 +1590,52 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
-static struct rmap_item *scan_get_next_rmap_item(struct page **page)
+/*
+ * Called with ksm_mmlist_lock held, when a ksmd thread has been through its
+ * list or when a list has emptied.  Once no thread has anything left to do
+ * in this full scan, flush the unstable trees and start the next one.
+ *
+ * Returns 1 if a new full scan was started.
+ */
+static int ksm_end_full_scan(void)
+{
+	struct ksm_scan *scan;
+	int i, nid;
+
+	for (i = 0; i < ksm_nr_threads; i++) {
+		scan = &ksm_scans[i];
+		if (!scan->done && !list_empty(&scan->mm_head.mm_list))
+			return 0;
+	}
+
+	/*
+	 * No thread is scanning, so nobody holds an unstable_lock: any
+	 * thread with an empty list must take this lock to start.
+	 */
+	for (i = 0; i < ksm_nr_threads; i++) {
+		scan = &ksm_scans[i];
+		scan->done = 0;
+		for (nid = 0; nid < nr_node_ids; nid++)
+			scan->unstable_tree[nid] = RB_ROOT;
+	}
+	ksm_seqnr++;
+	return 1;
+}
+
+static struct rmap_item *scan_get_next_rmap_item(struct ksm_scan *scan,
+						 struct page **page)
 {
 	struct mm_struct *mm;
 	struct mm_slot *slot;
 	struct vm_area_struct *vma;
 	struct rmap_item *rmap_item;
+	int new_scan;
 
-	if (list_empty(&ksm_mm_head.mm_list))
+	if (list_empty(&scan->mm_head.mm_list))
 		return NULL;
 
-	slot = ksm_scan.mm_slot;
-	if (slot == &ksm_mm_head) {
+	slot = scan->mm_slot;
+	if (slot == &scan->mm_head) {
 		/*
 		 * A number of pages can hang around indefinitely on per-cpu
 		 * pagevecs, raised page count preventing write_protect_page
@@ -1323,18 +1648,21 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 		 */
 		lru_add_drain_all();
 
-		root_unstable_tree = RB_ROOT;
-
 		spin_lock(&ksm_mmlist_lock);
+		/* Wait for the other threads to complete this full scan */
+		if (scan->done) {
+			spin_unlock(&ksm_mmlist_lock);
+			return NULL;
+		}
 		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
-		ksm_scan.mm_slot = slot;
+		scan->mm_slot = slot;
 		spin_unlock(&ksm_mmlist_lock);
 		/* We raced against exit of last slot on the list */
-		if (slot == &ksm_mm_head)
+		if (slot == &scan->mm_head)
 			return NULL;
 next_mm:
-		ksm_scan.address = 0;
-		ksm_scan.rmap_list = &slot->rmap_list;
+		scan->address = 0;
+		scan->rmap_list = &slot->rmap_list;
 	}
 
 	mm = slot->mm;
@@ -1342,60 +1670,61 @@ next_mm:
 	if (ksm_test_exit(mm))
 		vma = NULL;
 	else
-		vma = find_vma(mm, ksm_scan.address);
+		vma = find_vma(mm, scan->address);
 
 	for (; vma; vma = vma->vm_next) {
 		if (!(vma->vm_flags & VM_MERGEABLE))
 			continue;
-		if (ksm_scan.address < vma->vm_start)
-			ksm_scan.address = vma->vm_start;
+		if (scan->address < vma->vm_start)
+			scan->address = vma->vm_start;
 		if (!vma->anon_vma)
-			ksm_scan.address = vma->vm_end;
+			scan->address = vma->vm_end;
 
-		while (ksm_scan.address < vma->vm_end) {
+		while (scan->address < vma->vm_end) {
 			if (ksm_test_exit(mm))
 				break;
-			*page = follow_page(vma, ksm_scan.address, FOLL_GET);
+			*page = follow_page(vma, scan->address, FOLL_GET);
 			if (IS_ERR_OR_NULL(*page)) {
-				ksm_scan.address += PAGE_SIZE;
+				scan->address += PAGE_SIZE;
 				cond_resched();
 				continue;
 			}
 			if (PageAnon(*page) ||
 			    page_trans_compound_anon(*page)) {
-				flush_anon_page(vma, *page, ksm_scan.address);
+				flush_anon_page(vma, *page, scan->address);
 				flush_dcache_page(*page);
 				rmap_item = get_next_rmap_item(slot,
-					ksm_scan.rmap_list, ksm_scan.address);
+					scan->rmap_list, scan->address);
 				if (rmap_item) {
-					ksm_scan.rmap_list =
+					scan->rmap_list =
 							&rmap_item->rmap_list;
-					ksm_scan.address += PAGE_SIZE;
+					scan->address += PAGE_SIZE;
 				} else
 					put_page(*page);
 				up_read(&mm->mmap_sem);
+				free_stale_rmap_items(scan);
 				return rmap_item;
 			}
 			put_page(*page);
-			ksm_scan.address += PAGE_SIZE;
+			scan->address += PAGE_SIZE;
 			cond_resched();
 		}
 	}
 
 	if (ksm_test_exit(mm)) {
-		ksm_scan.address = 0;
-		ksm_scan.rmap_list = &slot->rmap_list;
+		scan->address = 0;
+		scan->rmap_list = &slot->rmap_list;
 	}
 	/*
 	 * Nuke all the rmap_items that are above this current rmap:
 	 * because there were no VM_MERGEABLE vmas with such addresses.
 	 */
-	remove_trailing_rmap_items(slot, ksm_scan.rmap_list);
+	remove_trailing_rmap_items(slot, scan->rmap_list);
 
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = list_entry(slot->mm_list.next,
+	scan->mm_slot = list_entry(slot->mm_list.next,
 						struct mm_slot, mm_list);
-	if (ksm_scan.address == 0) {
+	if (scan->address == 0) {
 		/*
 		 * We've completed a full scan of all vmas, holding mmap_sem
 		 * throughout, and found no VM_MERGEABLE: so do the same as
@@ -1407,38 +1736,47 @@ next_mm:
 		 */
 		hlist_del(&slot->link);
 		list_del(&slot->mm_list);
+		scan->nr_mms--;
 		spin_unlock(&ksm_mmlist_lock);
 
 		free_mm_slot(slot);
 		clear_bit(MMF_VM_MERGEABLE, &mm->flags);
 		up_read(&mm->mmap_sem);
+		free_stale_rmap_items(scan);
 		mmdrop(mm);
 	} else {
 		spin_unlock(&ksm_mmlist_lock);
 		up_read(&mm->mmap_sem);
+		free_stale_rmap_items(scan);
 	}
 
 	/* Repeat until we've completed scanning the whole list */
-	slot = ksm_scan.mm_slot;
-	if (slot != &ksm_mm_head)
+	slot = scan->mm_slot;
+	if (slot != &scan->mm_head)
 		goto next_mm;
 
-	ksm_scan.seqnr++;
+	spin_lock(&ksm_mmlist_lock);
+	scan->done = 1;
+	new_scan = ksm_end_full_scan();
+	spin_unlock(&ksm_mmlist_lock);
+	if (new_scan)
+		wake_up_interruptible(&ksm_thread_wait);
 	return NULL;
 }
 
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
+ * @scan - the ksmd thread's cursor
  * @scan_npages - number of pages we want to scan before we return.
  */
-static void ksm_do_scan(unsigned int scan_npages)
+static void ksm_do_scan(struct ksm_scan *scan, unsigned int scan_npages)
 {
 	struct rmap_item *rmap_item;
 	struct page *uninitialized_var(page);
 
 	while (scan_npages-- && likely(!freezing(current))) {
 		cond_resched();
-		rmap_item = scan_get_next_rmap_item(&page);
+		rmap_item = scan_get_next_rmap_item(scan, &page);
 		if (!rmap_item)
 			return;
 		if (!PageKsm(page) || !in_stable_tree(rmap_item))
@@ -1447,30 +1785,33 @@ static void ksm_do_scan(unsigned int scan_npages)
 	}
 }
 
-static int ksmd_should_run(void)
+static int ksmd_should_run(struct ksm_scan *scan)
 {
-	return (ksm_run & KSM_RUN_MERGE) && !list_empty(&ksm_mm_head.mm_list);
+	return (ksm_run & KSM_RUN_MERGE) && !scan->done &&
+		!list_empty(&scan->mm_head.mm_list);
 }
 
-static int ksm_scan_thread(void *nothing)
+static int ksm_scan_thread(void *data)
 {
+	struct ksm_scan *scan = data;
+
 	set_freezable();
 	set_user_nice(current, 5);
 
 	while (!kthread_should_stop()) {
-		mutex_lock(&ksm_thread_mutex);
-		if (ksmd_should_run())
-			ksm_do_scan(ksm_thread_pages_to_scan);
-		mutex_unlock(&ksm_thread_mutex);
+		down_read(&ksm_thread_sem);
+		if (ksmd_should_run(scan))
+			ksm_do_scan(scan, ksm_thread_pages_to_scan);
+		up_read(&ksm_thread_sem);
 
 		try_to_freeze();
 
-		if (ksmd_should_run()) {
+		if (ksmd_should_run(scan)) {
 			schedule_timeout_interruptible(
 				msecs_to_jiffies(ksm_thread_sleep_millisecs));
 		} else {
 			wait_event_freezable(ksm_thread_wait,
-				ksmd_should_run() || kthread_should_stop());
+				ksmd_should_run(scan) || kthread_should_stop());
 		}
 	}
 	return 0;
@@ -1519,26 +1860,51 @@ int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 	return 0;
 }
 
+/*
+ * Pick the ksmd thread for a new mm: the one with the fewest mms among
+ * those running on this node, or among all of them if there is none here.
+ * Called with ksm_mmlist_lock held.
+ */
+static struct ksm_scan *ksm_choose_scan(void)
+{
+	int nid = numa_node_id();
+	struct ksm_scan *best = NULL;
+	int i;
+
+	for (i = 0; i < ksm_nr_threads; i++) {
+		struct ksm_scan *scan = &ksm_scans[i];
+
+		if (!best || (scan->nid == nid && best->nid != nid) ||
+		    ((scan->nid == nid) == (best->nid == nid) &&
+		     scan->nr_mms < best->nr_mms))
+			best = scan;
+	}
+	return best;
+}
+
 int __ksm_enter(struct mm_struct *mm)
 {
 	struct mm_slot *mm_slot;
+	struct ksm_scan *scan;
 	int needs_wakeup;
 
 	mm_slot = alloc_mm_slot();
 	if (!mm_slot)
 		return -ENOMEM;
 
-	/* Check ksm_run too?  Would need tighter locking */
-	needs_wakeup = list_empty(&ksm_mm_head.mm_list);
-
 	spin_lock(&ksm_mmlist_lock);
+	scan = ksm_choose_scan();
+	/* Check ksm_run too?  Would need tighter locking */
+	needs_wakeup = list_empty(&scan->mm_head.mm_list);
 	insert_to_mm_slots_hash(mm, mm_slot);
+	mm_slot->scan = scan;
+	scan->nr_mms++;
 	/*
 	 * Insert just behind the scanning cursor, to let the area settle
 	 * down a little; when fork is followed by immediate exec, we don't
 	 * want ksmd to waste time setting up and tearing down an rmap_list.
 	 */
-	list_add_tail(&mm_slot->mm_list, &ksm_scan.mm_slot->mm_list);
+	list_add_tail(&mm_slot->mm_list, &scan->mm_slot->mm_list);
 	spin_unlock(&ksm_mmlist_lock);
 
 	set_bit(MMF_VM_MERGEABLE, &mm->flags);
@@ -1553,7 +1919,9 @@ int __ksm_enter(struct mm_struct *mm)
 void __ksm_exit(struct mm_struct *mm)
 {
 	struct mm_slot *mm_slot;
+	struct ksm_scan *scan;
 	int easy_to_free = 0;
+	int new_scan = 0;
 
 	/*
 	 * This process is exiting: if it's straightforward (as is the
@@ -1566,18 +1934,26 @@ void __ksm_exit(struct mm_struct *mm)
 
 	spin_lock(&ksm_mmlist_lock);
 	mm_slot = get_mm_slot(mm);
-	if (mm_slot && ksm_scan.mm_slot != mm_slot) {
+	if (mm_slot && mm_slot->scan->mm_slot != mm_slot) {
+		scan = mm_slot->scan;
 		if (!mm_slot->rmap_list) {
 			hlist_del(&mm_slot->link);
 			list_del(&mm_slot->mm_list);
+			scan->nr_mms--;
 			easy_to_free = 1;
+			/* The other threads may be waiting for this one */
+			if (list_empty(&scan->mm_head.mm_list))
+				new_scan = ksm_end_full_scan();
 		} else {
 			list_move(&mm_slot->mm_list,
-				  &ksm_scan.mm_slot->mm_list);
+				  &scan->mm_slot->mm_list);
 		}
 	}
 	spin_unlock(&ksm_mmlist_lock);
 
+	if (new_scan)
+		wake_up_interruptible(&ksm_thread_wait);
+
 	if (easy_to_free) {
 		free_mm_slot(mm_slot);
 		clear_bit(MMF_VM_MERGEABLE, &mm->flags);
@@ -1784,12 +2160,13 @@ void ksm_migrate_page(struct page *newpage, struct page *oldpage)
 #endif /* CONFIG_MIGRATION */
 
 #ifdef CONFIG_MEMORY_HOTREMOVE
-static struct stable_node *ksm_check_stable_tree(unsigned long start_pfn,
+static struct stable_node *ksm_check_stable_tree(struct ksm_stable_tree *tree,
+						 unsigned long start_pfn,
 						 unsigned long end_pfn)
 {
 	struct rb_node *node;
 
-	for (node = rb_first(&root_stable_tree); node; node = rb_next(node)) {
+	for (node = rb_first(&tree->root); node; node = rb_next(node)) {
 		struct stable_node *stable_node;
 
 		stable_node = rb_entry(node, struct stable_node, node);
@@ -1805,6 +2182,8 @@ static int ksm_memory_callback(struct notifier_block *self,
 {
 	struct memory_notify *mn = arg;
 	struct stable_node *stable_node;
+	struct ksm_stable_tree *tree;
+	int nid;
 
 	switch (action) {
 	case MEM_GOING_OFFLINE:
@@ -1812,22 +2191,28 @@ static int ksm_memory_callback(struct notifier_block *self,
 		 * Keep it very simple for now: just lock out ksmd and
 		 * MADV_UNMERGEABLE while any memory is going offline.
 		 */
-		mutex_lock(&ksm_thread_mutex);
+		down_write(&ksm_thread_sem);
 		break;
 
 	case MEM_OFFLINE:
 		/*
 		 * Most of the work is done by page migration; but there might
 		 * be a few stable_nodes left over, still pointing to struct
-		 * pages which have been offlined: prune those from the tree.
+		 * pages which have been offlined: prune those from the trees.
 		 */
-		while ((stable_node = ksm_check_stable_tree(mn->start_pfn,
+		for (nid = 0; nid < nr_node_ids; nid++) {
+			tree = &ksm_stable_trees[nid];
+			mutex_lock(&tree->lock);
+			while ((stable_node = ksm_check_stable_tree(tree,
+					mn->start_pfn,
 					mn->start_pfn + mn->nr_pages)) != NULL)
-			remove_node_from_stable_tree(stable_node);
+				remove_node_from_stable_tree(stable_node);
+			mutex_unlock(&tree->lock);
+		}
 		/* fallthrough */
 
 	case MEM_CANCEL_OFFLINE:
-		mutex_unlock(&ksm_thread_mutex);
+		up_write(&ksm_thread_sem);
 		break;
 	}
 	return NOTIFY_OK;
@@ -1916,7 +2301,7 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 	 * on the list for when ksmd may be set running again).
 	 */
 
-	mutex_lock(&ksm_thread_mutex);
+	down_write(&ksm_thread_sem);
 	if (ksm_run != flags) {
 		ksm_run = flags;
 		if (flags & KSM_RUN_UNMERGE) {
@@ -1931,7 +2316,7 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 			}
 		}
 	}
-	mutex_unlock(&ksm_thread_mutex);
+	up_write(&ksm_thread_sem);
 
 	if (flags & KSM_RUN_MERGE)
 		wake_up_interruptible(&ksm_thread_wait);
@@ -1940,24 +2325,67 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 }
 KSM_ATTR(run);
 
+#ifdef CONFIG_NUMA
+static ssize_t merge_across_nodes_show(struct kobject *kobj,
+				       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_merge_across_nodes);
+}
+
+static ssize_t merge_across_nodes_store(struct kobject *kobj,
+					struct kobj_attribute *attr,
+					const char *buf, size_t count)
+{
+	int err;
+	unsigned long knob;
+
+	err = strict_strtoul(buf, 10, &knob);
+	if (err || knob > 1)
+		return -EINVAL;
+
+	/*
+	 * The trees a page belongs in change with the knob: only allow
+	 * that while nothing is merged, e.g. after run was set to 2.
+	 */
+	down_write(&ksm_thread_sem);
+	if (ksm_merge_across_nodes != knob) {
+		if (atomic_long_read(&ksm_pages_shared))
+			err = -EBUSY;
+		else
+			ksm_merge_across_nodes = knob;
+	}
+	up_write(&ksm_thread_sem);
+
+	return err ? err : count;
+}
+KSM_ATTR(merge_across_nodes);
+#endif
+
+static ssize_t nr_threads_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_nr_threads);
+}
+KSM_ATTR_RO(nr_threads);
+
 static ssize_t pages_shared_show(struct kobject *kobj,
 				 struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_shared);
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_pages_shared));
 }
 KSM_ATTR_RO(pages_shared);
 
 static ssize_t pages_sharing_show(struct kobject *kobj,
 				  struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_sharing);
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_pages_sharing));
 }
 KSM_ATTR_RO(pages_sharing);
 
 static ssize_t pages_unshared_show(struct kobject *kobj,
 				   struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_unshared);
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_pages_unshared));
 }
 KSM_ATTR_RO(pages_unshared);
 
@@ -1966,8 +2394,10 @@ static ssize_t pages_volatile_show(struct kobject *kobj,
 {
 	long ksm_pages_volatile;
 
-	ksm_pages_volatile = ksm_rmap_items - ksm_pages_shared
-				- ksm_pages_sharing - ksm_pages_unshared;
+	ksm_pages_volatile = atomic_long_read(&ksm_rmap_items)
+				- atomic_long_read(&ksm_pages_shared)
+				- atomic_long_read(&ksm_pages_sharing)
+				- atomic_long_read(&ksm_pages_unshared);
 	/*
 	 * It was not worth any locking to calculate that statistic,
 	 * but it might therefore sometimes be negative: conceal that.
@@ -1981,7 +2411,7 @@ KSM_ATTR_RO(pages_volatile);
 static ssize_t full_scans_show(struct kobject *kobj,
 			       struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_scan.seqnr);
+	return sprintf(buf, "%lu\n", ksm_seqnr);
 }
 KSM_ATTR_RO(full_scans);
 
@@ -1989,6 +2419,10 @@ static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
 	&run_attr.attr,
+#ifdef CONFIG_NUMA
+	&merge_across_nodes_attr.attr,
+#endif
+	&nr_threads_attr.attr,
 	&pages_shared_attr.attr,
 	&pages_sharing_attr.attr,
 	&pages_unshared_attr.attr,
@@ -2003,11 +2437,61 @@ static struct attribute_group ksm_attr_group = {
 };
 #endif /* CONFIG_SYSFS */
 
+static int __init setup_ksm_threads(char *str)
+{
+	unsigned long nr;
+
+	if (strict_strtoul(str, 0, &nr) || !nr || nr > KSM_MAX_THREADS) {
+		printk(KERN_WARNING
+		       "ksm_threads= must be between 1 and %d, ignored\n",
+		       KSM_MAX_THREADS);
+		return 0;
+	}
+	ksm_nr_threads = nr;
+	return 1;
+}
+__setup("ksm_threads=", setup_ksm_threads);
+
+static void __init ksm_stop_threads(void)
+{
+	int i;
+
+	for (i = 0; i < ksm_nr_threads; i++)
+		if (ksm_scans[i].thread)
+			kthread_stop(ksm_scans[i].thread);
+}
+
+static int __init ksm_start_threads(void)
+{
+	int i;
+
+	for (i = 0; i < ksm_nr_threads; i++) {
+		struct ksm_scan *scan = &ksm_scans[i];
+		const struct cpumask *mask = cpumask_of_node(scan->nid);
+		struct task_struct *thread;
+
+		thread = kthread_create(ksm_scan_thread, scan, "ksmd/%d", i);
+		if (IS_ERR(thread)) {
+			printk(KERN_ERR "ksm: creating kthread failed\n");
+			ksm_stop_threads();
+			return PTR_ERR(thread);
+		}
+		if (cpumask_any_and(mask, cpu_online_mask) < nr_cpu_ids)
+			set_cpus_allowed_ptr(thread, mask);
+		scan->thread = thread;
+		wake_up_process(thread);
+	}
+	return 0;
+}
+
 static int __init ksm_init(void)
 {
-	struct task_struct *ksm_thread;
 	int err;
 
+	/* By default, one scanning thread per node */
+	if (!ksm_nr_threads)
+		ksm_nr_threads = min_t(int, num_online_nodes(), KSM_MAX_THREADS);
+
 	err = ksm_slab_init();
 	if (err)
 		goto out;
@@ -2016,19 +2500,20 @@ static int __init ksm_init(void)
 	if (err)
 		goto out_free1;
 
-	ksm_thread = kthread_run(ksm_scan_thread, NULL, "ksmd");
-	if (IS_ERR(ksm_thread)) {
-		printk(KERN_ERR "ksm: creating kthread failed\n");
-		err = PTR_ERR(ksm_thread);
+	err = ksm_trees_init();
+	if (err)
 		goto out_free2;
-	}
+
+	err = ksm_start_threads();
+	if (err)
+		goto out_free3;
 
 #ifdef CONFIG_SYSFS
 	err = sysfs_create_group(mm_kobj, &ksm_attr_group);
 	if (err) {
 		printk(KERN_ERR "ksm: register sysfs failed\n");
-		kthread_stop(ksm_thread);
-		goto out_free2;
+		ksm_stop_threads();
+		goto out_free3;
 	}
 #else
 	ksm_run = KSM_RUN_STOP;	/* no way for user to start it */
@@ -2037,13 +2522,15 @@ static int __init ksm_init(void)
 
 #ifdef CONFIG_MEMORY_HOTREMOVE
 	/*
-	 * Choose a high priority since the callback takes ksm_thread_mutex:
+	 * Choose a high priority since the callback takes ksm_thread_sem:
 	 * later callbacks could only be taking locks which nest within that.
 	 */
 	hotplug_memory_notifier(ksm_memory_callback, 100);
 #endif
 	return 0;
 
+out_free3:
+	ksm_trees_free();
 out_free2:
 	mm_slots_hash_free();
 out_free1:
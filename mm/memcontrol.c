@@ -73,10 +73,18 @@ enum mem_cgroup_stat_index {
 	MEM_CGROUP_STAT_CACHE, 	   /* # of pages charged as cache */
 	MEM_CGROUP_STAT_RSS,	   /* # of pages charged as anon rss */
 	MEM_CGROUP_STAT_FILE_MAPPED,  /* # of pages charged as file rss */
+	MEM_CGROUP_STAT_FILE_DIRTY,   /* # of dirty pages in page cache */
+	MEM_CGROUP_STAT_WRITEBACK,    /* # of pages under writeback */
 	MEM_CGROUP_STAT_PGPGIN_COUNT,	/* # of pages paged in */
 	MEM_CGROUP_STAT_PGPGOUT_COUNT,	/* # of pages paged out */
 	MEM_CGROUP_STAT_EVENTS,	/* sum of pagein + pageout for internal use */
 	MEM_CGROUP_STAT_SWAPOUT, /* # of pages, swapped out */
+	MEM_CGROUP_STAT_DIRECT_RECLAIM,	/* # of direct reclaim runs */
+	MEM_CGROUP_STAT_PGRECLAIM_DIRECT, /* # of pages reclaimed by them */
+	MEM_CGROUP_STAT_BG_RECLAIM,	/* # of background reclaim runs */
+	MEM_CGROUP_STAT_PGRECLAIM_BG,	/* # of pages reclaimed by them */
+	MEM_CGROUP_STAT_WORKINGSET_REFAULT, /* # of refaulted cache pages */
+	MEM_CGROUP_STAT_WORKINGSET_ACTIVATE, /* # of them activated */
 
 	MEM_CGROUP_STAT_NSTATS,
 };
@@ -200,10 +208,9 @@ static void mem_cgroup_oom_notify(struct mem_cgroup *mem);
  * statistics based on the statistics developed by Rik Van Riel for clock-pro,
  * to help the administrator determine what knobs to tune.
  *
- * TODO: Add a water mark for the memory controller. Reclaim will begin when
- * we hit the water mark. May be even add a low water mark, such that
- * no reclaim occurs from a cgroup at it's low water mark, this is
- * a feature that will be implemented much later in the future.
+ * Once usage crosses the high watermark (wmark_ratio percent of the limit)
+ * a background worker reclaims from the cgroup until usage drops below the
+ * low watermark, so that charges rarely have to reclaim directly.
  */
 struct mem_cgroup {
 	struct cgroup_subsys_state css;
@@ -251,6 +258,23 @@ struct mem_cgroup {
 	 */
 	unsigned long 	move_charge_at_immigrate;
 
+	/*
+	 * Background reclaim watermarks in bytes, RESOURCE_MAX when
+	 * disabled. Protected by set_limit_mutex for writing.
+	 */
+	unsigned int	wmark_ratio;
+	u64		high_wmark;
+	u64		low_wmark;
+	struct work_struct bgreclaim_work;
+
+	/*
+	 * Percentage of the limit that may be dirty before the dirtier is
+	 * throttled, and before writeback is started. 0 means use the
+	 * global vm.dirty_ratio and vm.dirty_background_ratio.
+	 */
+	unsigned int	dirty_ratio;
+	unsigned int	dirty_background_ratio;
+
 	/*
 	 * statistics. This must be placed at the end of memcg.
 	 */
@@ -790,118 +814,151 @@ struct lruvec *mem_cgroup_zone_lruvec(struct zone *zone,
  */
 
 /**
- * mem_cgroup_lru_add_list - account for adding an lru page and return lruvec
+ * mem_cgroup_page_lruvec - return the lruvec of a page
+ * @page: the page
  * @zone: zone of the page
+ *
+ * For a page on the LRU, this returns the lruvec it is linked to.
+ * For a page off the LRU, this returns the lruvec it should be added
+ * to.  The result is only stable under the returned lruvec's
+ * lru_lock, see page_on_lruvec().
+ */
+struct lruvec *mem_cgroup_page_lruvec(struct page *page, struct zone *zone)
+{
+	struct mem_cgroup *memcg;
+	struct page_cgroup *pc;
+	int lru = PageLRU(page);
+
+	if (mem_cgroup_disabled())
+		return &zone->lruvec;
+
+	/*
+	 * Pair with the barriers in mem_cgroup_lru_add_list() and
+	 * mem_cgroup_lru_del_list().
+	 */
+	smp_rmb();
+	pc = lookup_page_cgroup(page);
+	/*
+	 * PCG_ACCT_LRU tells whether an LRU page is linked to
+	 * pc->mem_cgroup or babysat by root_mem_cgroup.  A page that
+	 * is not on the LRU goes to the memcg it is charged to.
+	 */
+	if (lru ? PageCgroupAcctLRU(pc) : PageCgroupUsed(pc)) {
+		/* Ensure pc->mem_cgroup is visible after reading the flags. */
+		smp_rmb();
+		memcg = pc->mem_cgroup;
+	} else
+		memcg = root_mem_cgroup;
+	return &page_cgroup_zoneinfo(memcg, page)->lruvec;
+}
+
+/**
+ * mem_cgroup_lru_add_list - account for adding an lru page
+ * @lruvec: lruvec the page is added to, from mem_cgroup_page_lruvec()
  * @page: the page
  * @lru: current lru
  *
- * This function accounts for @page being added to @lru, and returns
- * the lruvec for the given @zone and the memcg @page is charged to.
- *
- * The callsite is then responsible for physically linking the page to
- * the returned lruvec->lists[@lru].
+ * This function accounts for @page being added to @lru of @lruvec.
+ * The callsite holds @lruvec->lru_lock, links @page to
+ * @lruvec->lists[@lru] and sets PageLRU afterwards.
  */
-struct lruvec *mem_cgroup_lru_add_list(struct zone *zone, struct page *page,
-				       enum lru_list lru)
+void mem_cgroup_lru_add_list(struct lruvec *lruvec, struct page *page,
+			     enum lru_list lru)
 {
 	struct mem_cgroup_per_zone *mz;
-	int numpages = 1;
-	struct mem_cgroup *memcg;
 	struct page_cgroup *pc;
+	int numpages = 1;
 
 	if (mem_cgroup_disabled())
-		return &zone->lruvec;
+		return;
 
 	pc = lookup_page_cgroup(page);
 	VM_BUG_ON(PageCgroupAcctLRU(pc));
+	mz = container_of(lruvec, struct mem_cgroup_per_zone, lruvec);
 	/*
 	 * If the page is uncharged, it may be freed soon, but it
 	 * could also be swap cache (readahead, swapoff) that needs to
 	 * be reclaimable in the future.  root_mem_cgroup will babysit
 	 * it for the time being.
 	 */
-	if (PageCgroupUsed(pc)) {
-		/* Ensure pc->mem_cgroup is visible after reading PCG_USED. */
-		smp_rmb();
-		memcg = pc->mem_cgroup;
+	if (!mem_cgroup_is_root(mz->mem)) {
+		VM_BUG_ON(pc->mem_cgroup != mz->mem);
 		SetPageCgroupAcctLRU(pc);
-	} else
-		memcg = root_mem_cgroup;
-	mz = page_cgroup_zoneinfo(memcg, page);
+		/* Make PCG_ACCT_LRU visible before the caller's SetPageLRU. */
+		smp_wmb();
+	}
 	/* compound_order() is stabilized through lru_lock */
 	if (unlikely(PageTransHuge(page)))
 		numpages = 1 << compound_order(page);
 	MEM_CGROUP_ZSTAT(mz, lru) += numpages;
-	return &mz->lruvec;
 }
 
 /**
  * mem_cgroup_lru_del_list - account for removing an lru page
+ * @lruvec: lruvec the page is linked to
  * @page: the page
  * @lru: target lru
  *
- * This function accounts for @page being removed from @lru.
- *
- * The callsite is then responsible for physically unlinking
- * @page->lru.
+ * This function accounts for @page being removed from @lru of
+ * @lruvec.  The callsite holds @lruvec->lru_lock, has cleared
+ * PageLRU already and unlinks @page->lru.
  */
-void mem_cgroup_lru_del_list(struct page *page, enum lru_list lru)
+void mem_cgroup_lru_del_list(struct lruvec *lruvec, struct page *page,
+			     enum lru_list lru)
 {
 	struct mem_cgroup_per_zone *mz;
-	int numpages = 1;
-	struct mem_cgroup *memcg;
 	struct page_cgroup *pc;
+	int numpages = 1;
 
 	if (mem_cgroup_disabled())
 		return;
 
 	pc = lookup_page_cgroup(page);
-	/*
-	 * root_mem_cgroup babysits uncharged LRU pages, but
-	 * PageCgroupUsed is cleared when the page is about to get
-	 * freed.  PageCgroupAcctLRU remembers whether the
-	 * LRU-accounting happened against pc->mem_cgroup or
-	 * root_mem_cgroup.
-	 */
+	mz = container_of(lruvec, struct mem_cgroup_per_zone, lruvec);
 	if (unlikely(PageTransHuge(page)))
 		numpages = 1 << compound_order(page);
-	if (TestClearPageCgroupAcctLRU(pc)) {
-		VM_BUG_ON(!pc->mem_cgroup);
-		memcg = pc->mem_cgroup;
-	} else
-		memcg = root_mem_cgroup;
-	mz = page_cgroup_zoneinfo(memcg, page);
-	VM_BUG_ON(MEM_CGROUP_ZSTAT(mz, lru) < (1 << compound_order(page)));
+	/*
+	 * The test-and-clear orders the caller's ClearPageLRU before
+	 * dropping PCG_ACCT_LRU, so that a racing page_on_lruvec()
+	 * never mistakes this page for one babysat by root_mem_cgroup.
+	 */
+	if (TestClearPageCgroupAcctLRU(pc))
+		VM_BUG_ON(pc->mem_cgroup != mz->mem);
+	else
+		VM_BUG_ON(!mem_cgroup_is_root(mz->mem));
+	VM_BUG_ON(MEM_CGROUP_ZSTAT(mz, lru) < numpages);
 	MEM_CGROUP_ZSTAT(mz, lru) -= numpages;
 }
 
-void mem_cgroup_lru_del(struct page *page)
-{
-	mem_cgroup_lru_del_list(page, page_lru(page));
-}
-
 /**
  * mem_cgroup_lru_move_lists - account for moving a page between lrus
- * @zone: zone of the page
+ * @lruvec: lruvec the page is linked to
  * @page: the page
  * @from: current lru
  * @to: target lru
  *
  * This function accounts for @page being moved between the lrus @from
- * and @to, and returns the lruvec for the given @zone and the memcg
- * @page is charged to.
+ * and @to of @lruvec.  The page stays on the same lruvec, so its
+ * memcg-side LRU state is left alone.
  *
  * The callsite is then responsible for physically relinking
- * @page->lru to the returned lruvec->lists[@to].
+ * @page->lru to @lruvec->lists[@to].
  */
-struct lruvec *mem_cgroup_lru_move_lists(struct zone *zone,
-					 struct page *page,
-					 enum lru_list from,
-					 enum lru_list to)
+void mem_cgroup_lru_move_lists(struct lruvec *lruvec, struct page *page,
+			       enum lru_list from, enum lru_list to)
 {
-	/* XXX: Optimize this, especially for @from == @to */
-	mem_cgroup_lru_del_list(page, from);
-	return mem_cgroup_lru_add_list(zone, page, to);
+	struct mem_cgroup_per_zone *mz;
+	int numpages = 1;
+
+	if (mem_cgroup_disabled())
+		return;
+
+	mz = container_of(lruvec, struct mem_cgroup_per_zone, lruvec);
+	if (unlikely(PageTransHuge(page)))
+		numpages = 1 << compound_order(page);
+	VM_BUG_ON(MEM_CGROUP_ZSTAT(mz, from) < numpages);
+	MEM_CGROUP_ZSTAT(mz, from) -= numpages;
+	MEM_CGROUP_ZSTAT(mz, to) += numpages;
 }
 
 /*
@@ -909,57 +966,74 @@ struct lruvec *mem_cgroup_lru_move_lists(struct zone *zone,
  * lru because the page may.be reused after it's fully uncharged (because of
  * SwapCache behavior).To handle that, unlink page_cgroup from LRU when charge
  * it again. This function is only used to charge SwapCache. It's done under
- * lock_page and expected that zone->lru_lock is never held.
+ * lock_page and expected that no lruvec lock is held.
+ *
+ * Returns true if the page was taken off the LRU and has to be put back
+ * by mem_cgroup_lru_add_after_commit_swapcache().
  */
-static void mem_cgroup_lru_del_before_commit_swapcache(struct page *page)
+static bool mem_cgroup_lru_del_before_commit_swapcache(struct page *page)
 {
-	enum lru_list lru;
 	unsigned long flags;
 	struct zone *zone = page_zone(page);
 	struct page_cgroup *pc = lookup_page_cgroup(page);
+	struct lruvec *lruvec;
+	bool isolated = false;
 
-	spin_lock_irqsave(&zone->lru_lock, flags);
-	lru = page_lru(page);
+	lruvec = lock_page_lruvec_irqsave(page, zone, &flags);
 	/*
 	 * The uncharged page could still be registered to the LRU of
 	 * the stale pc->mem_cgroup.
 	 *
-	 * As pc->mem_cgroup is about to get overwritten, the old LRU
-	 * accounting needs to be taken care of.  Let root_mem_cgroup
-	 * babysit the page until the new memcg is responsible for it.
+	 * As pc->mem_cgroup is about to get overwritten, the page has
+	 * to leave the old memcg's lruvec, whose lock would no longer
+	 * be found through the page.  Take it off the LRU until the
+	 * new memcg is responsible for it.
 	 *
 	 * The PCG_USED bit is guarded by lock_page() as the page is
 	 * swapcache/pagecache.
 	 */
-	if (PageLRU(page) && PageCgroupAcctLRU(pc) && !PageCgroupUsed(pc)) {
-		del_page_from_lru_list(zone, page, lru);
-		add_page_to_lru_list(zone, page, lru);
+	if (page_on_lruvec(page, lruvec) &&
+	    PageCgroupAcctLRU(pc) && !PageCgroupUsed(pc)) {
+		ClearPageLRU(page);
+		del_page_from_lru_list(zone, page, lruvec, page_lru(page));
+		isolated = true;
 	}
-	spin_unlock_irqrestore(&zone->lru_lock, flags);
+	spin_unlock_irqrestore(&lruvec->lru_lock, flags);
+	return isolated;
 }
 
-static void mem_cgroup_lru_add_after_commit_swapcache(struct page *page)
+static void mem_cgroup_lru_add_after_commit_swapcache(struct page *page,
+						      bool isolated)
 {
-	enum lru_list lru;
 	unsigned long flags;
 	struct zone *zone = page_zone(page);
 	struct page_cgroup *pc = lookup_page_cgroup(page);
+	struct lruvec *lruvec;
 
-	spin_lock_irqsave(&zone->lru_lock, flags);
-	lru = page_lru(page);
-	/*
-	 * If the page is not on the LRU, someone will soon put it
-	 * there.  If it is, and also already accounted for on the
-	 * memcg-side, it must be on the right lruvec as setting
-	 * pc->mem_cgroup and PageCgroupUsed is properly ordered.
-	 * Otherwise, root_mem_cgroup has been babysitting the page
-	 * during the charge.  Move it to the new memcg now.
-	 */
-	if (PageLRU(page) && !PageCgroupAcctLRU(pc)) {
-		del_page_from_lru_list(zone, page, lru);
-		add_page_to_lru_list(zone, page, lru);
+	if (!isolated) {
+		lruvec = lock_page_lruvec_irqsave(page, zone, &flags);
+		/*
+		 * If the page is not on the LRU, someone will soon put it
+		 * there.  If it is, and also already accounted for on the
+		 * memcg-side, it must be on the right lruvec as setting
+		 * pc->mem_cgroup and PageCgroupUsed is properly ordered.
+		 * Otherwise, root_mem_cgroup has been babysitting the page
+		 * during the charge.  Move it to the new memcg now.
+		 */
+		if (!page_on_lruvec(page, lruvec) || PageCgroupAcctLRU(pc) ||
+		    !PageCgroupUsed(pc)) {
+			spin_unlock_irqrestore(&lruvec->lru_lock, flags);
+			return;
+		}
+		ClearPageLRU(page);
+		del_page_from_lru_list(zone, page, lruvec, page_lru(page));
+		spin_unlock_irqrestore(&lruvec->lru_lock, flags);
 	}
-	spin_unlock_irqrestore(&zone->lru_lock, flags);
+
+	lruvec = lock_page_lruvec_irqsave(page, zone, &flags);
+	add_page_to_lru_list(zone, page, lruvec, page_lru(page));
+	SetPageLRU(page);
+	spin_unlock_irqrestore(&lruvec->lru_lock, flags);
 }
 
 /*
@@ -1280,6 +1354,117 @@ static unsigned long mem_cgroup_reclaim(struct mem_cgroup *memcg,
 	return total;
 }
 
+static void mem_cgroup_reclaim_statistics(struct mem_cgroup *mem,
+					  bool background,
+					  unsigned long nr_reclaimed)
+{
+	struct mem_cgroup_stat_cpu *cpustat;
+	int cpu = get_cpu();
+
+	cpustat = &mem->stat.cpustat[cpu];
+	if (background) {
+		__mem_cgroup_stat_add_safe(cpustat,
+				MEM_CGROUP_STAT_BG_RECLAIM, 1);
+		__mem_cgroup_stat_add_safe(cpustat,
+				MEM_CGROUP_STAT_PGRECLAIM_BG, nr_reclaimed);
+	} else {
+		__mem_cgroup_stat_add_safe(cpustat,
+				MEM_CGROUP_STAT_DIRECT_RECLAIM, 1);
+		__mem_cgroup_stat_add_safe(cpustat,
+				MEM_CGROUP_STAT_PGRECLAIM_DIRECT, nr_reclaimed);
+	}
+	put_cpu();
+}
+
+/*
+ * Background reclaim. Works are queued on memcg_bgreclaim_wq, a per-cpu
+ * pool of kswapd-like threads shared by all memory cgroups.
+ */
+static struct workqueue_struct *memcg_bgreclaim_wq;
+
+/*
+ * Derive the watermarks from the limit: the high watermark is
+ * wmark_ratio percent of it, the low one a little below that so a
+ * background reclaim run makes some room ahead of the next charges.
+ */
+static void mem_cgroup_setup_wmarks(struct mem_cgroup *mem)
+{
+	u64 limit = res_counter_read_u64(&mem->res, RES_LIMIT);
+	u64 high, gap;
+
+	if (!mem->wmark_ratio || limit == RESOURCE_MAX) {
+		mem->high_wmark = RESOURCE_MAX;
+		mem->low_wmark = RESOURCE_MAX;
+		return;
+	}
+
+	high = div_u64(limit, 100) * mem->wmark_ratio;
+	gap = min_t(u64, high,
+		    max_t(u64, high >> 6, SWAP_CLUSTER_MAX * PAGE_SIZE));
+	mem->low_wmark = high - gap;
+	mem->high_wmark = high;
+}
+
+static void mem_cgroup_bgreclaim(struct work_struct *work)
+{
+	struct mem_cgroup *mem = container_of(work, struct mem_cgroup,
+					      bgreclaim_work);
+	unsigned long total = 0;
+	int loop;
+
+	if (css_is_removed(&mem->css))
+		goto out;
+
+	for (loop = 0; loop < MEM_CGROUP_MAX_RECLAIM_LOOPS; loop++) {
+		unsigned long nr;
+
+		if (res_counter_read_u64(&mem->res, RES_USAGE) <=
+		    mem->low_wmark)
+			break;
+		nr = try_to_free_mem_cgroup_pages(mem, GFP_KERNEL,
+						  mem->memsw_is_minimum,
+						  get_swappiness(mem));
+		total += nr;
+		/* Nothing reclaimable left, let direct reclaim handle it */
+		if (loop && !nr)
+			break;
+		cond_resched();
+	}
+	mem_cgroup_reclaim_statistics(mem, true, total);
+out:
+	mem_cgroup_put(mem);
+}
+
+/*
+ * Called after a successful charge: kick background reclaim for every
+ * cgroup of the hierarchy that went above its high watermark.
+ */
+static void mem_cgroup_check_wmarks(struct mem_cgroup *mem)
+{
+	if (!memcg_bgreclaim_wq)
+		return;
+
+	for (; mem; mem = parent_mem_cgroup(mem)) {
+		if (res_counter_read_u64(&mem->res, RES_USAGE) <=
+		    mem->high_wmark)
+			continue;
+		if (work_pending(&mem->bgreclaim_work))
+			continue;
+		mem_cgroup_get(mem);
+		if (!queue_work(memcg_bgreclaim_wq, &mem->bgreclaim_work))
+			mem_cgroup_put(mem);
+	}
+}
+
+static int __init mem_cgroup_bgreclaim_init(void)
+{
+	if (mem_cgroup_disabled())
+		return 0;
+	memcg_bgreclaim_wq = create_workqueue("memcg_bgreclaim");
+	return 0;
+}
+module_init(mem_cgroup_bgreclaim_init);
+
 static int mem_cgroup_soft_reclaim(struct mem_cgroup *root_mem,
 				   struct zone *zone,
 				   gfp_t gfp_mask)
@@ -1499,6 +1684,175 @@ done:
 	unlock_page_cgroup(pc);
 }
 
+/*
+ * Account a refault of the cache page @page, which was just charged,
+ * and whether it was activated because of it.
+ */
+void mem_cgroup_workingset_refault(struct page *page, bool activated)
+{
+	struct mem_cgroup *mem;
+	struct mem_cgroup_stat_cpu *cpustat;
+	struct page_cgroup *pc;
+
+	if (mem_cgroup_disabled())
+		return;
+
+	pc = lookup_page_cgroup(page);
+	if (unlikely(!pc))
+		return;
+
+	lock_page_cgroup(pc);
+	mem = pc->mem_cgroup;
+	if (!mem || !PageCgroupUsed(pc))
+		goto done;
+
+	/* Preemption is disabled by lock_page_cgroup() */
+	cpustat = &mem->stat.cpustat[smp_processor_id()];
+	__mem_cgroup_stat_add_safe(cpustat,
+				   MEM_CGROUP_STAT_WORKINGSET_REFAULT, 1);
+	if (activated)
+		__mem_cgroup_stat_add_safe(cpustat,
+				MEM_CGROUP_STAT_WORKINGSET_ACTIVATE, 1);
+done:
+	unlock_page_cgroup(pc);
+}
+
+/*
+ * Update the dirty or writeback statistics of the memcg @page is charged to.
+ * The PCG_FILE_* bits record what the page is accounted as, which keeps the
+ * counters balanced when the page is moved or uncharged in between.
+ */
+void mem_cgroup_update_page_stat(struct page *page,
+				 enum mem_cgroup_page_stat_item idx, int val)
+{
+	struct mem_cgroup *mem;
+	struct page_cgroup *pc;
+	unsigned long flags;
+	int stat;
+
+	if (mem_cgroup_disabled())
+		return;
+
+	pc = lookup_page_cgroup(page);
+	if (unlikely(!pc))
+		return;
+
+	move_lock_page_cgroup(pc, &flags);
+	mem = pc->mem_cgroup;
+	if (!mem || !PageCgroupUsed(pc))
+		goto done;
+
+	switch (idx) {
+	case MEMCG_NR_FILE_DIRTY:
+		if (val > 0) {
+			if (TestSetPageCgroupFileDirty(pc))
+				goto done;
+		} else if (!TestClearPageCgroupFileDirty(pc))
+			goto done;
+		stat = MEM_CGROUP_STAT_FILE_DIRTY;
+		break;
+	case MEMCG_NR_FILE_WRITEBACK:
+		if (val > 0) {
+			if (TestSetPageCgroupFileWriteback(pc))
+				goto done;
+		} else if (!TestClearPageCgroupFileWriteback(pc))
+			goto done;
+		stat = MEM_CGROUP_STAT_WRITEBACK;
+		break;
+	default:
+		BUG();
+	}
+
+	/* irqs are disabled by move_lock_page_cgroup() */
+	__mem_cgroup_stat_add_safe(&mem->stat.cpustat[smp_processor_id()],
+				   stat, val);
+done:
+	move_unlock_page_cgroup(pc, &flags);
+}
+
+/*
+ * Move the dirty and writeback statistics of @pc from @from to @to, or just
+ * drop them from @from when @to is NULL. Called under move_lock_page_cgroup().
+ */
+static void mem_cgroup_move_page_stat(struct page_cgroup *pc,
+				      struct mem_cgroup *from,
+				      struct mem_cgroup *to)
+{
+	int cpu = smp_processor_id();
+
+	if (PageCgroupFileDirty(pc)) {
+		__mem_cgroup_stat_add_safe(&from->stat.cpustat[cpu],
+					   MEM_CGROUP_STAT_FILE_DIRTY, -1);
+		if (to)
+			__mem_cgroup_stat_add_safe(&to->stat.cpustat[cpu],
+						MEM_CGROUP_STAT_FILE_DIRTY, 1);
+		else
+			ClearPageCgroupFileDirty(pc);
+	}
+	if (PageCgroupFileWriteback(pc)) {
+		__mem_cgroup_stat_add_safe(&from->stat.cpustat[cpu],
+					   MEM_CGROUP_STAT_WRITEBACK, -1);
+		if (to)
+			__mem_cgroup_stat_add_safe(&to->stat.cpustat[cpu],
+						MEM_CGROUP_STAT_WRITEBACK, 1);
+		else
+			ClearPageCgroupFileWriteback(pc);
+	}
+}
+
+static unsigned long mem_cgroup_page_stat(struct mem_cgroup *mem,
+					  enum mem_cgroup_stat_index idx)
+{
+	s64 val = mem_cgroup_read_stat(&mem->stat, idx);
+
+	/* The per-cpu counters can transiently sum up below zero */
+	return val < 0 ? 0 : val;
+}
+
+/*
+ * Fill in the dirty thresholds and dirty page counts of current's memcg.
+ * The thresholds are the memcg's dirty ratios, falling back to the global
+ * ones, applied to its limit. Returns false if the memcg imposes no dirty
+ * limit: for the root cgroup, an unlimited cgroup, or with vm.dirty_bytes
+ * in use and no memory.dirty_ratio set.
+ */
+bool mem_cgroup_dirty_info(struct mem_cgroup_dirty_info *info)
+{
+	struct mem_cgroup *mem;
+	unsigned int ratio, bg_ratio;
+	unsigned long limit;
+	bool ret = false;
+
+	if (mem_cgroup_disabled())
+		return false;
+
+	rcu_read_lock();
+	mem = mem_cgroup_from_task(current);
+	if (!mem || mem_cgroup_is_root(mem))
+		goto out;
+	if (res_counter_read_u64(&mem->res, RES_LIMIT) == RESOURCE_MAX)
+		goto out;
+
+	ratio = mem->dirty_ratio ? : vm_dirty_ratio;
+	bg_ratio = mem->dirty_background_ratio ? : dirty_background_ratio;
+	if (!ratio)
+		goto out;
+	if (bg_ratio >= ratio)
+		bg_ratio = ratio / 2;
+
+	limit = res_counter_read_u64(&mem->res, RES_LIMIT) >> PAGE_SHIFT;
+	info->dirty_thresh = limit * ratio / 100;
+	info->background_thresh = limit * bg_ratio / 100;
+	info->nr_file_dirty = mem_cgroup_page_stat(mem,
+						   MEM_CGROUP_STAT_FILE_DIRTY);
+	info->nr_writeback = mem_cgroup_page_stat(mem,
+						  MEM_CGROUP_STAT_WRITEBACK);
+	ret = true;
+out:
+	rcu_read_unlock();
+	return ret;
+}
+
 /*
  * size of first charge trial. "32" comes from vmscan.c's magic value.
  * TODO: maybe necessary to use big numbers in big irons.
@@ -1639,6 +1993,7 @@ static int __mem_cgroup_try_charge(struct mm_struct *mm,
 	int nr_retries = MEM_CGROUP_RECLAIM_RETRIES;
 	struct res_counter *fail_res;
 	bool direct_reclaimed = false;
+	unsigned long nr_reclaimed;
 
 	/*
 	 * Unlike gloval-vm's OOM-kill, we're not in memory shortage
@@ -1740,7 +2095,10 @@ again:
 		}
 					
 
-		mem_cgroup_reclaim(mem_over_limit, gfp_mask, flags);
+		nr_reclaimed = mem_cgroup_reclaim(mem_over_limit, gfp_mask,
+						  flags);
+		mem_cgroup_reclaim_statistics(mem_over_limit, false,
+					      nr_reclaimed);
 
 		if (mem_cgroup_check_room(mem_over_limit, page_size))
 			continue;
@@ -1801,6 +2159,7 @@ again:
 	}
 	if (batch == CHARGE_SIZE)
 		refill_stock(mem, batch - PAGE_SIZE);
+	mem_cgroup_check_wmarks(mem);
 	css_put(&mem->css);
 
 	if (unlikely(direct_reclaimed))
@@ -1965,6 +2324,7 @@ static int mem_cgroup_move_account(struct page *page, struct page_cgroup *pc,
 				   struct mem_cgroup *from, struct mem_cgroup *to,
 				   int page_size, bool uncharge)
 {
+	unsigned long flags;
 	int ret;
 
 	VM_BUG_ON(from == to);
@@ -1976,6 +2336,8 @@ static int mem_cgroup_move_account(struct page *page, struct page_cgroup *pc,
 	if (!PageCgroupUsed(pc) || pc->mem_cgroup != from)
 		goto out;
 
+	move_lock_page_cgroup(pc, &flags);
+
 	if (PageCgroupFileMapped(pc)) {
 		struct mem_cgroup_stat_cpu *cpustat;
 		struct mem_cgroup_stat *stat;
@@ -2002,8 +2364,10 @@ static int mem_cgroup_move_account(struct page *page, struct page_cgroup *pc,
 		/* This is not "cancel", but cancel_charge does all we need. */
 		mem_cgroup_cancel_charge(from, page_size, 1);
 
+	mem_cgroup_move_page_stat(pc, from, to);
 	/* caller should have done css_get */
 	pc->mem_cgroup = to;
+	move_unlock_page_cgroup(pc, &flags);
 	mem_cgroup_charge_statistics(to, pc, page_size);
 	ret = 0;
 out:
@@ -2220,6 +2584,7 @@ __mem_cgroup_commit_charge_swapin(struct page *page, struct mem_cgroup *ptr,
 					enum charge_type ctype)
 {
 	struct page_cgroup *pc;
+	bool isolated;
 
 	if (mem_cgroup_disabled())
 		return;
@@ -2227,9 +2592,9 @@ __mem_cgroup_commit_charge_swapin(struct page *page, struct mem_cgroup *ptr,
 		return;
 	cgroup_exclude_rmdir(&ptr->css);
 	pc = lookup_page_cgroup(page);
-	mem_cgroup_lru_del_before_commit_swapcache(page);
+	isolated = mem_cgroup_lru_del_before_commit_swapcache(page);
 	__mem_cgroup_commit_charge(ptr, pc, ctype, PAGE_SIZE);
-	mem_cgroup_lru_add_after_commit_swapcache(page);
+	mem_cgroup_lru_add_after_commit_swapcache(page, isolated);
 	/*
 	 * Now swap is on-memory. This means this page may be
 	 * counted both as mem and swap....double count.
@@ -2343,6 +2708,7 @@ __mem_cgroup_uncharge_common(struct page *page, enum charge_type ctype)
 	struct page_cgroup *pc;
 	struct mem_cgroup *mem = NULL;
 	int page_size = PAGE_SIZE;
+	unsigned long flags;
 
 	if (mem_cgroup_disabled())
 		return NULL;
@@ -2389,7 +2755,10 @@ __mem_cgroup_uncharge_common(struct page *page, enum charge_type ctype)
 
 	mem_cgroup_charge_statistics(mem, pc, -page_size);
 
+	move_lock_page_cgroup(pc, &flags);
+	mem_cgroup_move_page_stat(pc, mem, NULL);
 	ClearPageCgroupUsed(pc);
+	move_unlock_page_cgroup(pc, &flags);
 	/*
 	 * pc->mem_cgroup is not cleared here. It will be accessed when it's
 	 * freed from LRU. This is safe because uncharged page is expected not
@@ -2870,6 +3239,7 @@ static int mem_cgroup_resize_limit(struct mem_cgroup *memcg,
 				memcg->memsw_is_minimum = true;
 			else
 				memcg->memsw_is_minimum = false;
+			mem_cgroup_setup_wmarks(memcg);
 		}
 		mutex_unlock(&set_limit_mutex);
 
@@ -3050,10 +3420,8 @@ static int mem_cgroup_force_empty_list(struct mem_cgroup *mem,
 	unsigned long flags, loop;
 	struct list_head *list;
 	struct page *busy;
-	struct zone *zone;
 	int ret = 0;
 
-	zone = &NODE_DATA(node)->node_zones[zid];
 	mz = mem_cgroup_zoneinfo(mem, node, zid);
 	list = &mz->lruvec.lists[lru];
 
@@ -3066,19 +3434,19 @@ static int mem_cgroup_force_empty_list(struct mem_cgroup *mem,
 		struct page *page;
 
 		ret = 0;
-		spin_lock_irqsave(&zone->lru_lock, flags);
+		spin_lock_irqsave(&mz->lruvec.lru_lock, flags);
 		if (list_empty(list)) {
-			spin_unlock_irqrestore(&zone->lru_lock, flags);
+			spin_unlock_irqrestore(&mz->lruvec.lru_lock, flags);
 			break;
 		}
 		page = list_entry(list->prev, struct page, lru);
 		if (busy == page) {
 			list_move(&page->lru, list);
 			busy = 0;
-			spin_unlock_irqrestore(&zone->lru_lock, flags);
+			spin_unlock_irqrestore(&mz->lruvec.lru_lock, flags);
 			continue;
 		}
-		spin_unlock_irqrestore(&zone->lru_lock, flags);
+		spin_unlock_irqrestore(&mz->lruvec.lru_lock, flags);
 
 		pc = lookup_page_cgroup(page);
 
@@ -3434,6 +3802,8 @@ enum {
 	MCS_CACHE,
 	MCS_RSS,
 	MCS_FILE_MAPPED,
+	MCS_FILE_DIRTY,
+	MCS_WRITEBACK,
 	MCS_PGPGIN,
 	MCS_PGPGOUT,
 	MCS_SWAP,
@@ -3442,6 +3812,12 @@ enum {
 	MCS_INACTIVE_FILE,
 	MCS_ACTIVE_FILE,
 	MCS_UNEVICTABLE,
+	MCS_DIRECT_RECLAIM,
+	MCS_PGRECLAIM_DIRECT,
+	MCS_BG_RECLAIM,
+	MCS_PGRECLAIM_BG,
+	MCS_WORKINGSET_REFAULT,
+	MCS_WORKINGSET_ACTIVATE,
 	NR_MCS_STAT,
 };
 
@@ -3456,6 +3832,8 @@ struct {
 	{"cache", "total_cache"},
 	{"rss", "total_rss"},
 	{"mapped_file", "total_mapped_file"},
+	{"dirty", "total_dirty"},
+	{"writeback", "total_writeback"},
 	{"pgpgin", "total_pgpgin"},
 	{"pgpgout", "total_pgpgout"},
 	{"swap", "total_swap"},
@@ -3463,7 +3841,13 @@ struct {
 	{"active_anon", "total_active_anon"},
 	{"inactive_file", "total_inactive_file"},
 	{"active_file", "total_active_file"},
-	{"unevictable", "total_unevictable"}
+	{"unevictable", "total_unevictable"},
+	{"direct_reclaim", "total_direct_reclaim"},
+	{"pgreclaim_direct", "total_pgreclaim_direct"},
+	{"background_reclaim", "total_background_reclaim"},
+	{"pgreclaim_background", "total_pgreclaim_background"},
+	{"workingset_refault", "total_workingset_refault"},
+	{"workingset_activate", "total_workingset_activate"}
 };
 
 
@@ -3479,6 +3863,10 @@ mem_cgroup_get_local_stat(struct mem_cgroup *mem, struct mcs_total_stat *s)
 	s->stat[MCS_RSS] += val * PAGE_SIZE;
 	val = mem_cgroup_read_stat(&mem->stat, MEM_CGROUP_STAT_FILE_MAPPED);
 	s->stat[MCS_FILE_MAPPED] += val * PAGE_SIZE;
+	val = mem_cgroup_read_stat(&mem->stat, MEM_CGROUP_STAT_FILE_DIRTY);
+	s->stat[MCS_FILE_DIRTY] += val * PAGE_SIZE;
+	val = mem_cgroup_read_stat(&mem->stat, MEM_CGROUP_STAT_WRITEBACK);
+	s->stat[MCS_WRITEBACK] += val * PAGE_SIZE;
 	val = mem_cgroup_read_stat(&mem->stat, MEM_CGROUP_STAT_PGPGIN_COUNT);
 	s->stat[MCS_PGPGIN] += val;
 	val = mem_cgroup_read_stat(&mem->stat, MEM_CGROUP_STAT_PGPGOUT_COUNT);
@@ -3499,6 +3887,25 @@ mem_cgroup_get_local_stat(struct mem_cgroup *mem, struct mcs_total_stat *s)
 	s->stat[MCS_ACTIVE_FILE] += val * PAGE_SIZE;
 	val = mem_cgroup_get_local_zonestat(mem, LRU_UNEVICTABLE);
 	s->stat[MCS_UNEVICTABLE] += val * PAGE_SIZE;
+
+	/* reclaim stat */
+	val = mem_cgroup_read_stat(&mem->stat, MEM_CGROUP_STAT_DIRECT_RECLAIM);
+	s->stat[MCS_DIRECT_RECLAIM] += val;
+	val = mem_cgroup_read_stat(&mem->stat,
+				   MEM_CGROUP_STAT_PGRECLAIM_DIRECT);
+	s->stat[MCS_PGRECLAIM_DIRECT] += val;
+	val = mem_cgroup_read_stat(&mem->stat, MEM_CGROUP_STAT_BG_RECLAIM);
+	s->stat[MCS_BG_RECLAIM] += val;
+	val = mem_cgroup_read_stat(&mem->stat, MEM_CGROUP_STAT_PGRECLAIM_BG);
+	s->stat[MCS_PGRECLAIM_BG] += val;
+
+	/* workingset stat */
+	val = mem_cgroup_read_stat(&mem->stat,
+				   MEM_CGROUP_STAT_WORKINGSET_REFAULT);
+	s->stat[MCS_WORKINGSET_REFAULT] += val;
+	val = mem_cgroup_read_stat(&mem->stat,
+				   MEM_CGROUP_STAT_WORKINGSET_ACTIVATE);
+	s->stat[MCS_WORKINGSET_ACTIVATE] += val;
 }
 
 static void
@@ -3612,6 +4019,69 @@ static int mem_cgroup_swappiness_write(struct cgroup *cgrp, struct cftype *cft,
 	return 0;
 }
 
+static u64 mem_cgroup_wmark_ratio_read(struct cgroup *cgrp,
+				       struct cftype *cft)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+
+	return memcg->wmark_ratio;
+}
+
+static int mem_cgroup_wmark_ratio_write(struct cgroup *cgrp,
+					struct cftype *cft, u64 val)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+
+	/* No limit, hence no watermarks, on the root cgroup */
+	if (val > 100 || cgrp->parent == NULL)
+		return -EINVAL;
+
+	mutex_lock(&set_limit_mutex);
+	memcg->wmark_ratio = val;
+	mem_cgroup_setup_wmarks(memcg);
+	mutex_unlock(&set_limit_mutex);
+
+	return 0;
+}
+
+static u64 mem_cgroup_dirty_ratio_read(struct cgroup *cgrp,
+				       struct cftype *cft)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+
+	if (cft->private)
+		return memcg->dirty_background_ratio;
+	return memcg->dirty_ratio;
+}
+
+static int mem_cgroup_dirty_ratio_write(struct cgroup *cgrp,
+					struct cftype *cft, u64 val)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+
+	/* The root cgroup is bound by the global dirty limits only */
+	if (val > 100 || cgrp->parent == NULL)
+		return -EINVAL;
+
+	if (cft->private)
+		memcg->dirty_background_ratio = val;
+	else
+		memcg->dirty_ratio = val;
+
+	return 0;
+}
+
+static int mem_cgroup_wmarks_read(struct cgroup *cgrp, struct cftype *cft,
+				  struct cgroup_map_cb *cb)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+
+	cb->fill(cb, "high_wmark", memcg->high_wmark);
+	cb->fill(cb, "low_wmark", memcg->low_wmark);
+
+	return 0;
+}
+
 static int mem_cgroup_oom_notify_cb(struct mem_cgroup *mem)
 {
 	struct mem_cgroup_eventfd_list *ev;
@@ -3725,12 +4195,10 @@ static int mem_cgroup_drop_list(struct mem_cgroup *mem,
 	struct mem_cgroup_per_zone *mz;
 	unsigned long flags, loop;
 	struct list_head *list;
-	struct zone *zone;
 	int ret = 0;
 	struct page *busy = NULL;
 	unsigned long count = 0;
 
-	zone = &NODE_DATA(node)->node_zones[zid];
 	mz = mem_cgroup_zoneinfo(mem, node, zid);
 	list = &mz->lruvec.lists[lru];
 
@@ -3740,20 +4208,20 @@ static int mem_cgroup_drop_list(struct mem_cgroup *mem,
 		struct page *page;
 
 		ret = 0;
-		spin_lock_irqsave(&zone->lru_lock, flags);
+		spin_lock_irqsave(&mz->lruvec.lru_lock, flags);
 		if (list_empty(list)) {
-			spin_unlock_irqrestore(&zone->lru_lock, flags);
+			spin_unlock_irqrestore(&mz->lruvec.lru_lock, flags);
 			break;
 		}
 		page = list_entry(list->prev, struct page, lru);
 		if (busy == page) {
 			list_move(&page->lru, list);
-			spin_unlock_irqrestore(&zone->lru_lock, flags);
+			spin_unlock_irqrestore(&mz->lruvec.lru_lock, flags);
 			busy = NULL;
 			loop++;
 			continue;
 		}
-		spin_unlock_irqrestore(&zone->lru_lock, flags);
+		spin_unlock_irqrestore(&mz->lruvec.lru_lock, flags);
 
 		if (!page_cache_get_speculative(page) || !trylock_page(page)) {
 			busy = page;
@@ -3870,6 +4338,27 @@ static struct cftype mem_cgroup_files[] = {
 		.read_u64 = mem_cgroup_swappiness_read,
 		.write_u64 = mem_cgroup_swappiness_write,
 	},
+	{
+		.name = "wmark_ratio",
+		.read_u64 = mem_cgroup_wmark_ratio_read,
+		.write_u64 = mem_cgroup_wmark_ratio_write,
+	},
+	{
+		.name = "reclaim_wmarks",
+		.read_map = mem_cgroup_wmarks_read,
+	},
+	{
+		.name = "dirty_ratio",
+		.read_u64 = mem_cgroup_dirty_ratio_read,
+		.write_u64 = mem_cgroup_dirty_ratio_write,
+		.private = 0,
+	},
+	{
+		.name = "dirty_background_ratio",
+		.read_u64 = mem_cgroup_dirty_ratio_read,
+		.write_u64 = mem_cgroup_dirty_ratio_write,
+		.private = 1,
+	},
 	{
 		.name = "move_charge_at_immigrate",
 		.read_u64 = mem_cgroup_move_charge_read,
@@ -3956,6 +4445,7 @@ static int alloc_mem_cgroup_per_zone_info(struct mem_cgroup *mem, int node)
 
 	for (zone = 0; zone < MAX_NR_ZONES; zone++) {
 		mz = &pn->zoneinfo[zone];
+		spin_lock_init(&mz->lruvec.lru_lock);
 		for_each_lru(l)
 			INIT_LIST_HEAD(&mz->lruvec.lists[l]);
 		mz->usage_in_excess = 0;
@@ -4137,9 +4627,15 @@ mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 	}
 	spin_lock_init(&mem->reclaim_param_lock);
 	INIT_LIST_HEAD(&mem->oom_notify);
+	INIT_WORK(&mem->bgreclaim_work, mem_cgroup_bgreclaim);
+	mem->high_wmark = RESOURCE_MAX;
+	mem->low_wmark = RESOURCE_MAX;
 
-	if (parent)
+	if (parent) {
 		mem->swappiness = get_swappiness(parent);
+		mem->dirty_ratio = parent->dirty_ratio;
+		mem->dirty_background_ratio = parent->dirty_background_ratio;
+	}
 	atomic_set(&mem->refcnt, 1);
 	mem->move_charge_at_immigrate = 0;
 	return &mem->css;
@@ -4323,7 +4819,10 @@ static struct page *mc_handle_file_pte(struct vm_area_struct *vma,
 		pgoff = pte_to_pgoff(ptent);
 
 	/* page is moved even if it's not RSS of this task(page-faulted). */
-	page = find_get_page(mapping, pgoff);
+	page = find_get_entry(mapping, pgoff);
+	if (radix_tree_exceptional_entry(page) &&
+	    !mapping_cap_swap_backed(mapping))
+		page = NULL;	/* shadow of an evicted page */
 
 #ifdef CONFIG_SWAP
 	/* shmem/tmpfs may report page out on swap: account for that too. */
@@ -56,6 +56,7 @@
 #include <linux/kallsyms.h>
 #include <linux/swapops.h>
 #include <linux/elf.h>
+#include <linux/migrate.h>
 
 #include <asm/io.h>
 #include <asm/pgalloc.h>
@@ -3145,6 +3146,63 @@ static int do_nonlinear_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	return __do_fault(mm, vma, address, pmd, pgoff, flags, orig_pte);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * A NUMA hinting fault on a pte marked by change_prot_numa(): restore
+ * the access rights of the vma, account the fault to the node holding
+ * the page and move the page next to the faulting CPU if it is
+ * misplaced.
+ */
+static int do_numa_page(struct mm_struct *mm, struct vm_area_struct *vma,
+		unsigned long addr, pte_t *ptep, pmd_t *pmd, pte_t entry)
+{
+	struct page *page;
+	spinlock_t *ptl;
+	int page_nid, target_nid;
+	bool migrated = false;
+	pte_t pte;
+
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock(ptl);
+	if (unlikely(!pte_same(*ptep, entry))) {
+		pte_unmap_unlock(ptep, ptl);
+		return 0;
+	}
+
+	pte = pte_mkyoung(pte_modify(entry, vma->vm_page_prot));
+	set_pte_at(mm, addr, ptep, pte);
+	update_mmu_cache(vma, addr, pte);
+
+	page = vm_normal_page(vma, addr, pte);
+	if (!page) {
+		pte_unmap_unlock(ptep, ptl);
+		return 0;
+	}
+
+	count_vm_event(NUMA_HINT_FAULTS);
+	page_nid = page_to_nid(page);
+	if (page_nid == numa_node_id())
+		count_vm_event(NUMA_HINT_FAULTS_LOCAL);
+
+	get_page(page);
+	target_nid = mpol_misplaced(page, vma, addr);
+	pte_unmap_unlock(ptep, ptl);
+	if (target_nid == -1) {
+		put_page(page);
+		goto out;
+	}
+
+	/* Migrate to the requested node, this drops our page reference */
+	if (migrate_misplaced_page(page, target_nid)) {
+		page_nid = target_nid;
+		migrated = true;
+	}
+out:
+	task_numa_fault(page_nid, 1, migrated);
+	return 0;
+}
+#endif
+
 /*
  * These routines also need to handle stuff like marking pages dirty
  * and/or accessed for architectures that don't do it in hardware (most
@@ -3183,6 +3241,11 @@ int handle_pte_fault(struct mm_struct *mm,
 					pte, pmd, flags, entry);
 	}
 
+#ifdef CONFIG_NUMA_BALANCING
+	if (pte_numa(vma, entry))
+		return do_numa_page(mm, vma, address, pte, pmd, entry);
+#endif
+
 	ptl = pte_lockptr(mm, pmd);
 	spin_lock(ptl);
 	if (unlikely(!pte_same(*pte, entry)))
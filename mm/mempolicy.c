@@ -1907,6 +1907,47 @@ struct page *alloc_pages_current(gfp_t gfp, unsigned order)
 }
 EXPORT_SYMBOL(alloc_pages_current);
 
+#ifdef CONFIG_NUMA_BALANCING
+/**
+ * mpol_misplaced - check whether a page is placed according to policy
+ * @page:	page that took a NUMA hinting fault
+ * @vma:	vm area where the page is mapped
+ * @addr:	virtual address where the page is mapped
+ *
+ * Only pages governed by the system default (local allocation) policy
+ * are considered: a page is misplaced when it lives on another node than
+ * the CPU that just accessed it.  Explicit task, vma or shared policies
+ * are left to the placement the user asked for.
+ *
+ * Called from the fault path with mmap_sem held for read.
+ *
+ * Return: -1 if the page is fine where it is, or the node ID to migrate
+ * it to.
+ */
+int mpol_misplaced(struct page *page, struct vm_area_struct *vma,
+		   unsigned long addr)
+{
+	struct mempolicy *pol;
+	int thisnid = numa_node_id();
+	int ret = -1;
+
+	pol = get_vma_policy(current, vma, addr);
+	if (pol != &default_policy)
+		goto out;
+
+	if (page_to_nid(page) == thisnid)
+		goto out;
+
+	if (!node_isset(thisnid, cpuset_current_mems_allowed))
+		goto out;
+
+	ret = thisnid;
+out:
+	mpol_cond_put(pol);
+	return ret;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 /*
  * If mpol_dup() sees current->cpuset == cpuset_being_rebound, then it
  * rebinds the mempolicy its copying by calling mpol_rebind_policy()
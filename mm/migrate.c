@@ -1492,3 +1492,147 @@ int migrate_vmas(struct mm_struct *mm, const nodemask_t *to,
  	return err;
 }
 #endif
+
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Returns true if this is a safe migration target node for misplaced NUMA
+ * pages. Currently it only checks the watermarks, which is crude.
+ */
+static bool migrate_balanced_pgdat(struct pglist_data *pgdat,
+				   int nr_migrate_pages)
+{
+	int z;
+
+	for (z = pgdat->nr_zones - 1; z >= 0; z--) {
+		struct zone *zone = pgdat->node_zones + z;
+
+		if (!populated_zone(zone))
+			continue;
+
+		if (zone_is_all_unreclaimable(zone))
+			continue;
+
+		/* Avoid waking kswapd by allocating pages_to_migrate pages. */
+		if (!zone_watermark_ok(zone, 0,
+				       high_wmark_pages(zone) +
+				       nr_migrate_pages,
+				       0, 0))
+			continue;
+		return true;
+	}
+	return false;
+}
+
+static struct page *alloc_misplaced_dst_page(struct page *page,
+					   unsigned long data,
+					   int **result)
+{
+	int nid = (int) data;
+
+	return alloc_pages_exact_node(nid,
+				      (GFP_HIGHUSER_MOVABLE | __GFP_THISNODE |
+				       __GFP_NOMEMALLOC | __GFP_NORETRY |
+				       __GFP_NOWARN) &
+				      ~GFP_IOFS, 0);
+}
+
+/*
+ * page migration rate limiting control.
+ * Do not migrate more than @ratelimit_pages in a @migrate_interval_millisecs
+ * window of time. Default here says do not migrate more than 1280M per second.
+ */
+static unsigned int migrate_interval_millisecs __read_mostly = 100;
+static unsigned int ratelimit_pages __read_mostly = 128 << (20 - PAGE_SHIFT);
+
+static DEFINE_SPINLOCK(numabalancing_migrate_lock);
+static unsigned long numabalancing_migrate_next_window[MAX_NUMNODES];
+static unsigned long numabalancing_migrate_nr_pages[MAX_NUMNODES];
+
+/* Returns true if the node is migrate rate-limited after the update */
+static bool numamigrate_update_ratelimit(int node, unsigned long nr_pages)
+{
+	bool rate_limited = false;
+
+	spin_lock(&numabalancing_migrate_lock);
+	if (time_after(jiffies, numabalancing_migrate_next_window[node])) {
+		numabalancing_migrate_nr_pages[node] = 0;
+		numabalancing_migrate_next_window[node] = jiffies +
+			msecs_to_jiffies(migrate_interval_millisecs);
+	}
+	if (numabalancing_migrate_nr_pages[node] > ratelimit_pages)
+		rate_limited = true;
+	else
+		numabalancing_migrate_nr_pages[node] += nr_pages;
+	spin_unlock(&numabalancing_migrate_lock);
+
+	return rate_limited;
+}
+
+static int numamigrate_isolate_page(pg_data_t *pgdat, struct page *page)
+{
+	/* Avoid migrating to a node that is nearly full */
+	if (!migrate_balanced_pgdat(pgdat, 1))
+		return 0;
+
+	if (isolate_lru_page(page))
+		return 0;
+
+	inc_zone_page_state(page, NR_ISOLATED_ANON + page_is_file_cache(page));
+
+	/*
+	 * Isolating the page has taken another reference, so the
+	 * caller's reference can be safely dropped without the page
+	 * disappearing underneath us during migration.
+	 */
+	put_page(page);
+	return 1;
+}
+
+/*
+ * Attempt to migrate a misplaced page to the specified destination
+ * node. Caller is expected to have an elevated reference count on
+ * the page that will be dropped by this function before returning.
+ */
+int migrate_misplaced_page(struct page *page, int node)
+{
+	pg_data_t *pgdat = NODE_DATA(node);
+	int isolated = 0;
+	int nr_remaining;
+	LIST_HEAD(migratepages);
+
+	/*
+	 * Don't migrate pages that are mapped in multiple processes.  This
+	 * also skips shared pages that are only ever used from one node,
+	 * since accesses from different processes can't be told apart.
+	 */
+	if (page_mapcount(page) != 1 || PageCompound(page))
+		goto out;
+
+	/*
+	 * Rate-limit the amount of data that is being migrated to a node.
+	 * Optimal placement is no good if the memory bus is saturated and
+	 * all the time is being spent migrating!
+	 */
+	if (numamigrate_update_ratelimit(node, 1))
+		goto out;
+
+	isolated = numamigrate_isolate_page(pgdat, page);
+	if (!isolated)
+		goto out;
+
+	list_add(&page->lru, &migratepages);
+	nr_remaining = migrate_pages(&migratepages, alloc_misplaced_dst_page,
+				     node, false, MIGRATE_ASYNC);
+	/* migrate_pages() puts back whatever it failed to move */
+	if (nr_remaining)
+		isolated = 0;
+	else
+		count_vm_event(NUMA_PAGE_MIGRATE);
+	BUG_ON(!list_empty(&migratepages));
+	return isolated;
+
+out:
+	put_page(page);
+	return 0;
+}
+#endif /* CONFIG_NUMA_BALANCING */
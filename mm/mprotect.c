@@ -23,6 +23,7 @@
 #include <linux/swapops.h>
 #include <linux/mmu_notifier.h>
 #include <linux/migrate.h>
+#include <linux/ksm.h>
 #include <linux/perf_event.h>
 #include <asm/uaccess.h>
 #include <asm/pgtable.h>
@@ -157,6 +158,124 @@ static void change_protection(struct vm_area_struct *vma,
 	flush_tlb_range(vma, start, end);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+static unsigned long change_prot_numa_pte_range(struct vm_area_struct *vma,
+		pmd_t *pmd, unsigned long addr, unsigned long end,
+		pgprot_t newprot)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long pages = 0;
+	pte_t *pte, oldpte;
+	spinlock_t *ptl;
+
+	pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+	arch_enter_lazy_mmu_mode();
+	do {
+		struct page *page;
+		pte_t ptent;
+
+		oldpte = *pte;
+		if (!pte_present(oldpte) || pte_numa(vma, oldpte))
+			continue;
+		/*
+		 * The zero page and KSM pages are never migrated, don't
+		 * bother trapping accesses to them.
+		 */
+		page = vm_normal_page(vma, addr, oldpte);
+		if (!page || PageReserved(page) || PageKsm(page))
+			continue;
+
+		ptent = ptep_modify_prot_start(mm, addr, pte);
+		ptent = pte_modify(ptent, newprot);
+		ptep_modify_prot_commit(mm, addr, pte, ptent);
+		pages++;
+	} while (pte++, addr += PAGE_SIZE, addr != end);
+	arch_leave_lazy_mmu_mode();
+	pte_unmap_unlock(pte - 1, ptl);
+
+	return pages;
+}
+
+static inline unsigned long change_prot_numa_pmd_range(
+		struct vm_area_struct *vma, pud_t *pud, unsigned long addr,
+		unsigned long end, pgprot_t newprot)
+{
+	unsigned long pages = 0;
+	unsigned long next;
+	pmd_t *pmd;
+
+	pmd = pmd_offset(pud, addr);
+	do {
+		next = pmd_addr_end(addr, end);
+		/* Huge pmds are left to khugepaged and the LRU for now */
+		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
+			continue;
+		pages += change_prot_numa_pte_range(vma, pmd, addr, next,
+						    newprot);
+	} while (pmd++, addr = next, addr != end);
+
+	return pages;
+}
+
+static inline unsigned long change_prot_numa_pud_range(
+		struct vm_area_struct *vma, pgd_t *pgd, unsigned long addr,
+		unsigned long end, pgprot_t newprot)
+{
+	unsigned long pages = 0;
+	unsigned long next;
+	pud_t *pud;
+
+	pud = pud_offset(pgd, addr);
+	do {
+		next = pud_addr_end(addr, end);
+		if (pud_none_or_clear_bad(pud))
+			continue;
+		pages += change_prot_numa_pmd_range(vma, pud, addr, next,
+						    newprot);
+	} while (pud++, addr = next, addr != end);
+
+	return pages;
+}
+
+/*
+ * Make the present ptes of [addr, end) PROT_NONE without touching
+ * vma->vm_flags, so the next access to each page takes a NUMA hinting
+ * fault that is resolved by do_numa_page().  Returns the number of
+ * ptes updated.
+ */
+unsigned long change_prot_numa(struct vm_area_struct *vma,
+			unsigned long addr, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long start = addr;
+	unsigned long pages = 0;
+	unsigned long next;
+	pgprot_t newprot;
+	pgd_t *pgd;
+
+	BUG_ON(addr >= end);
+	newprot = vm_get_page_prot(vma->vm_flags &
+				   ~(VM_READ | VM_WRITE | VM_EXEC));
+
+	mmu_notifier_invalidate_range_start(mm, start, end);
+	pgd = pgd_offset(mm, addr);
+	flush_cache_range(vma, addr, end);
+	do {
+		next = pgd_addr_end(addr, end);
+		if (pgd_none_or_clear_bad(pgd))
+			continue;
+		pages += change_prot_numa_pud_range(vma, pgd, addr, next,
+						    newprot);
+	} while (pgd++, addr = next, addr != end);
+	if (pages)
+		flush_tlb_range(vma, start, end);
+	mmu_notifier_invalidate_range_end(mm, start, end);
+
+	count_vm_events(NUMA_PTE_UPDATES, pages);
+	return pages;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 int
 mprotect_fixup(struct vm_area_struct *vma, struct vm_area_struct **pprev,
 	unsigned long start, unsigned long end, unsigned long newflags)
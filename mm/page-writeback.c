@@ -35,6 +35,7 @@
 #include <linux/buffer_head.h>
 #include <linux/pagevec.h>
 #include <linux/blk-cgroup.h>
+#include <linux/memcontrol.h>
 #include <trace/events/kmem.h>
 #include <trace/events/writeback.h>
 
@@ -1120,6 +1121,53 @@ unlock:
 
 #endif
 
+/*
+ * Enforce the dirty limits of the memory cgroup the dirtier belongs to, on
+ * top of the global ones. Over the cgroup's background threshold the dirtier
+ * writes back pages of the mapping it is dirtying, which belong to its own
+ * cgroup, rather than waking the flusher to clean other cgroups' inodes.
+ * Over the cgroup's dirty threshold it also waits for that writeback.
+ */
+static void mem_cgroup_balance_dirty_pages(struct address_space *mapping,
+					   unsigned long pages_dirtied)
+{
+	struct backing_dev_info *bdi = mapping->backing_dev_info;
+	struct mem_cgroup_dirty_info info;
+	unsigned long write_chunk = pages_dirtied + pages_dirtied / 2;
+
+	while (mem_cgroup_dirty_info(&info)) {
+		struct writeback_control wbc = {
+			.sync_mode	= WB_SYNC_NONE,
+			.nr_to_write	= write_chunk,
+			.range_cyclic	= 1,
+		};
+
+		if (info.nr_file_dirty <= info.background_thresh)
+			break;
+
+		if (mapping_cap_writeback_dirty(mapping))
+			do_writepages(mapping, &wbc);
+
+		if (info.nr_file_dirty + info.nr_writeback <= info.dirty_thresh)
+			break;
+
+		/*
+		 * Nothing left to write in this mapping: the cgroup's dirty
+		 * pages are in other inodes, have the flusher push them out.
+		 */
+		if (wbc.nr_to_write == write_chunk &&
+		    !writeback_in_progress(bdi))
+			bdi_start_writeback(bdi, info.nr_file_dirty -
+					    info.background_thresh);
+
+		__set_current_state(TASK_KILLABLE);
+		io_schedule_timeout(HZ / 10);
+
+		if (fatal_signal_pending(current))
+			break;
+	}
+}
+
 /*
  * balance_dirty_pages() must be called by processes which are generating dirty
  * data.  It looks at the number of dirty pages in the machine and will force
@@ -1156,6 +1204,8 @@ static void balance_dirty_pages(struct address_space *mapping,
 		blkcg = NULL;
 #endif
 
+	mem_cgroup_balance_dirty_pages(mapping, pages_dirtied);
+
 	for (;;) {
 		unsigned long now = jiffies;
 
@@ -1901,6 +1951,7 @@ void account_page_dirtied(struct page *page, struct address_space *mapping)
 	if (mapping_cap_account_dirty(mapping)) {
 		int *p;
 
+		mem_cgroup_inc_page_stat(page, MEMCG_NR_FILE_DIRTY);
 		__inc_zone_page_state(page, NR_FILE_DIRTY);
 		__inc_bdi_stat(mapping->backing_dev_info, BDI_RECLAIMABLE);
 		__inc_bdi_stat(mapping->backing_dev_info, BDI_DIRTIED);
@@ -2108,6 +2159,7 @@ int clear_page_dirty_for_io(struct page *page)
 		 * for more comments.
 		 */
 		if (TestClearPageDirty(page)) {
+			mem_cgroup_dec_page_stat(page, MEMCG_NR_FILE_DIRTY);
 			dec_zone_page_state(page, NR_FILE_DIRTY);
 			dec_bdi_stat(mapping->backing_dev_info,
 					BDI_RECLAIMABLE);
@@ -2143,8 +2195,10 @@ int test_clear_page_writeback(struct page *page)
 	} else {
 		ret = TestClearPageWriteback(page);
 	}
-	if (ret)
+	if (ret) {
+		mem_cgroup_dec_page_stat(page, MEMCG_NR_FILE_WRITEBACK);
 		dec_zone_page_state(page, NR_WRITEBACK);
+	}
 	return ret;
 }
 
@@ -2177,8 +2231,10 @@ int test_set_page_writeback(struct page *page)
 	} else {
 		ret = TestSetPageWriteback(page);
 	}
-	if (!ret)
+	if (!ret) {
+		mem_cgroup_inc_page_stat(page, MEMCG_NR_FILE_WRITEBACK);
 		inc_zone_page_state(page, NR_WRITEBACK);
+	}
 	return ret;
 
 }
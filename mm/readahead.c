@@ -16,11 +16,15 @@
 #include <linux/task_io_accounting_ops.h>
 #include <linux/pagevec.h>
 #include <linux/pagemap.h>
+#include <linux/slab.h>
 #include <trace/events/mm.h>
 
 /* Don't do context readahead */
 int sysctl_enable_cnx_ra = 0;
 
+/* Max interleaved sequential streams tracked per struct file */
+int sysctl_ra_streams = RA_MAX_STREAMS;
+
 /*
  * Initialise a struct file's readahead state.  Assumes that the caller has
  * memset *ra to zero.
@@ -176,7 +180,7 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 		rcu_read_lock();
 		page = radix_tree_lookup(&mapping->page_tree, page_offset);
 		rcu_read_unlock();
-		if (page)
+		if (page && !radix_tree_exceptional_entry(page))
 			continue;
 
 		page = page_cache_alloc_readahead(mapping);
@@ -296,6 +300,241 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
 	return min(newsize, max);
 }
 
+/*
+ * Per-stream readahead state.
+ *
+ * file->f_ra always holds the window of the stream being served.  When a
+ * read does not fit that window, the live window is parked in
+ * file->f_ra_streams and, if the read continues one of the parked windows,
+ * that one is swapped back into f_ra.  Like f_ra itself the table is
+ * updated without locking: concurrent readers on one fd only cost us
+ * readahead accuracy.
+ *
+ * Each stream also remembers how much of its windows the reader actually
+ * consumed, so that pages which were read ahead but abandoned can be
+ * reported per block device through the page_cache_acct tracepoints.
+ */
+static struct file_ra_streams *ra_streams_get(struct file *filp,
+					      struct file_ra_state *ra)
+{
+	struct file_ra_streams *rs;
+
+	if (!filp || ra != &filp->f_ra)
+		return NULL;
+
+	rs = filp->f_ra_streams;
+	if (rs || sysctl_ra_streams <= 1)
+		return rs;
+
+	rs = kzalloc(sizeof(*rs), GFP_NOFS | __GFP_NOWARN);
+	if (!rs)
+		return NULL;
+	rs->active.acct_index = ra->start;
+	rs->active.stamp = jiffies;
+	if (cmpxchg(&filp->f_ra_streams, NULL, rs)) {
+		kfree(rs);
+		rs = filp->f_ra_streams;
+	}
+	return rs;
+}
+
+static void ra_stream_save(struct file_ra_stream *s, struct file_ra_state *ra)
+{
+	s->start = ra->start;
+	s->size = ra->size;
+	s->async_size = ra->async_size;
+	s->prev_pos = ra->prev_pos;
+}
+
+static void ra_stream_load(struct file_ra_state *ra, struct file_ra_stream *s)
+{
+	ra->start = s->start;
+	ra->size = s->size;
+	ra->async_size = s->async_size;
+	ra->prev_pos = s->prev_pos;
+}
+
+/*
+ * The reader has reached @offset: everything read ahead below it was used.
+ */
+static void ra_stream_consume(struct address_space *mapping,
+			      struct file_ra_stream *s, pgoff_t offset)
+{
+	if (offset > s->acct_index) {
+		trace_page_cache_acct_readahead(mapping->host->i_sb,
+						offset - s->acct_index, 0);
+		s->acct_index = offset;
+	}
+}
+
+/*
+ * The stream is abandoning its window: whatever the reader did not get to
+ * was read ahead for nothing.
+ */
+static void ra_stream_account(struct address_space *mapping,
+			      struct file_ra_stream *s)
+{
+	pgoff_t end = s->start + s->size;
+	pgoff_t used = (s->prev_pos >> PAGE_CACHE_SHIFT) + 1;
+	pgoff_t from = s->acct_index;
+	unsigned long hits = 0;
+	unsigned long waste = 0;
+
+	if (!s->size)
+		return;
+
+	if (used > end)
+		used = end;
+	if (used > from) {
+		hits = used - from;
+		from = used;
+	}
+	if (end > from)
+		waste = end - from;
+
+	if (hits || waste)
+		trace_page_cache_acct_readahead(mapping->host->i_sb,
+						hits, waste);
+	s->acct_index = end;
+}
+
+static unsigned int ra_streams_max_parked(void)
+{
+	return clamp(sysctl_ra_streams - 1, 0, RA_MAX_STREAMS - 1);
+}
+
+/*
+ * The live window in @ra is about to be replaced by the one of another
+ * stream: put it at the head of the parked list, dropping the least
+ * recently used streams if the list is full.
+ */
+static void ra_stream_park(struct address_space *mapping,
+			   struct file_ra_streams *rs, struct file_ra_state *ra)
+{
+	unsigned int max = ra_streams_max_parked();
+	unsigned int n = min_t(unsigned int, rs->nr_parked, RA_MAX_STREAMS - 1);
+
+	if (!ra->size)
+		return;
+
+	ra_stream_save(&rs->active, ra);
+	if (!max) {
+		ra_stream_account(mapping, &rs->active);
+		rs->nr_parked = 0;
+		return;
+	}
+
+	while (n >= max)
+		ra_stream_account(mapping, &rs->parked[--n]);
+
+	memmove(&rs->parked[1], &rs->parked[0], n * sizeof(rs->parked[0]));
+	rs->parked[0] = rs->active;
+	rs->nr_parked = n + 1;
+}
+
+/*
+ * The live window is being restarted by the same stream.
+ */
+static void ra_stream_retire(struct address_space *mapping,
+			     struct file_ra_streams *rs, struct file_ra_state *ra)
+{
+	ra_stream_save(&rs->active, ra);
+	ra_stream_account(mapping, &rs->active);
+}
+
+static bool ra_stream_match(struct file_ra_stream *s, pgoff_t offset,
+			    bool hit_readahead_marker)
+{
+	if (!s->size)
+		return false;
+	if (offset == s->start + s->size - s->async_size ||
+	    offset == s->start + s->size)
+		return true;
+	if (hit_readahead_marker &&
+	    offset >= s->start && offset < s->start + s->size)
+		return true;
+	return offset - (s->prev_pos >> PAGE_CACHE_SHIFT) <= 1UL;
+}
+
+/*
+ * Look for a parked stream that @offset continues and make it the live one.
+ */
+static bool ra_stream_switch(struct address_space *mapping,
+			     struct file_ra_streams *rs,
+			     struct file_ra_state *ra, pgoff_t offset,
+			     bool hit_readahead_marker)
+{
+	unsigned int n = min_t(unsigned int, rs->nr_parked, RA_MAX_STREAMS - 1);
+	struct file_ra_stream s;
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		if (ra_stream_match(&rs->parked[i], offset,
+				    hit_readahead_marker))
+			break;
+	}
+	if (i == n)
+		return false;
+
+	s = rs->parked[i];
+	memmove(&rs->parked[1], &rs->parked[0], i * sizeof(rs->parked[0]));
+	ra_stream_save(&rs->active, ra);
+	if (rs->active.size) {
+		rs->parked[0] = rs->active;
+	} else {
+		memmove(&rs->parked[0], &rs->parked[1],
+			(n - 1) * sizeof(rs->parked[0]));
+		rs->nr_parked = n - 1;
+	}
+
+	rs->active = s;
+	ra_stream_load(ra, &s);
+	return true;
+}
+
+/**
+ * file_ra_streams_release - account and free the per-stream readahead state
+ * @filp: the file being released
+ */
+void file_ra_streams_release(struct file *filp)
+{
+	struct file_ra_streams *rs = filp->f_ra_streams;
+	unsigned int i, n;
+
+	if (!rs)
+		return;
+
+	if (filp->f_mapping) {
+		ra_stream_retire(filp->f_mapping, rs, &filp->f_ra);
+		n = min_t(unsigned int, rs->nr_parked, RA_MAX_STREAMS - 1);
+		for (i = 0; i < n; i++)
+			ra_stream_account(filp->f_mapping, &rs->parked[i]);
+	}
+	filp->f_ra_streams = NULL;
+	kfree(rs);
+}
+
+/*
+ * Size of the window following a fully consumed one.  A reader that
+ * caught up with in-flight readahead, or ran past its window before the
+ * next one was issued, is waiting on the device, so the pipeline is not
+ * deep enough: open it up faster.  A reader that needed
+ * more than a second to consume the last window gains nothing from a
+ * larger one, so it keeps the current size.
+ */
+static unsigned long ra_stream_next_size(struct file_ra_streams *rs,
+					 struct file_ra_state *ra,
+					 unsigned long max, bool lagging)
+{
+	if (rs) {
+		if (lagging)
+			return min(4UL * ra->size, max);
+		if (time_after(jiffies, rs->active.stamp + HZ))
+			return min_t(unsigned long, ra->size, max);
+	}
+	return get_next_ra_size(ra, max);
+}
+
 /*
  * On-demand readahead design.
  *
@@ -333,6 +572,11 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
  *
  * The code ramps up the readahead size aggressively at first, but slow down as
  * it approaches max_readhead.
+ *
+ * Several sequential streams on one fd keep separate windows, see the
+ * per-stream readahead state above.  The window of a stream grows faster
+ * while the reader keeps catching up with its readahead I/O and stops
+ * growing while the reader is slow to consume it.
  */
 
 /*
@@ -348,7 +592,7 @@ static pgoff_t count_history_pages(struct address_space *mapping,
 	pgoff_t head;
 
 	rcu_read_lock();
-	head = radix_tree_prev_hole(&mapping->page_tree, offset - 1, max);
+	head = page_cache_prev_hole(mapping, offset - 1, max);
 	rcu_read_unlock();
 
 	return offset - 1 - head;
@@ -394,29 +638,55 @@ static int try_context_readahead(struct address_space *mapping,
 static unsigned long
 ondemand_readahead(struct address_space *mapping,
 		   struct file_ra_state *ra, struct file *filp,
-		   bool hit_readahead_marker, pgoff_t offset,
+		   bool hit_readahead_marker, bool lagging, pgoff_t offset,
 		   unsigned long req_size)
 {
 	unsigned long max = max_sane_readahead(ra->ra_pages);
+	struct file_ra_streams *rs = ra_streams_get(filp, ra);
+	bool switched = false;
 
 	/*
 	 * start of file
 	 */
-	if (!offset)
+	if (!offset) {
+		if (rs)
+			ra_stream_park(mapping, rs, ra);
 		goto initial_readahead;
+	}
 
+again:
 	/*
 	 * It's the expected callback offset, assume sequential access.
 	 * Ramp up sizes, and push forward the readahead window.
 	 */
 	if ((offset == (ra->start + ra->size - ra->async_size) ||
 	     offset == (ra->start + ra->size))) {
+		/*
+		 * A cache miss past the window means the next one was never
+		 * issued and the reader now waits on the device.  A miss on
+		 * the marker page means the window was reclaimed before use,
+		 * which is no reason to grow it.
+		 */
+		if (!hit_readahead_marker && offset == ra->start + ra->size)
+			lagging = true;
+		if (rs)
+			ra_stream_consume(mapping, &rs->active, offset);
 		ra->start += ra->size;
-		ra->size = get_next_ra_size(ra, max);
+		ra->size = ra_stream_next_size(rs, ra, max, lagging);
 		ra->async_size = ra->size;
 		goto readit;
 	}
 
+	/*
+	 * Not the live stream: it may be continuing a parked one.
+	 */
+	if (rs && !switched &&
+	    offset - (ra->prev_pos >> PAGE_CACHE_SHIFT) > 1UL &&
+	    ra_stream_switch(mapping, rs, ra, offset, hit_readahead_marker)) {
+		switched = true;
+		goto again;
+	}
+
 	/*
 	 * Hit a marked page without valid readahead state.
 	 * E.g. interleaved reads.
@@ -427,12 +697,19 @@ ondemand_readahead(struct address_space *mapping,
 		pgoff_t start;
 
 		rcu_read_lock();
-		start = radix_tree_next_hole(&mapping->page_tree, offset+1,max);
+		start = page_cache_next_hole(mapping, offset + 1, max);
 		rcu_read_unlock();
 
 		if (!start || start - offset > max)
 			return 0;
 
+		if (rs) {
+			if (ra_has_index(ra, offset))
+				ra_stream_retire(mapping, rs, ra);
+			else
+				ra_stream_park(mapping, rs, ra);
+			rs->active.acct_index = offset;
+		}
 		ra->start = start;
 		ra->size = start - offset;	/* old async_size */
 		ra->size += req_size;
@@ -458,8 +735,15 @@ ondemand_readahead(struct address_space *mapping,
 	 * that a sequential stream would leave behind.
 	 */
 	if (sysctl_enable_cnx_ra) {
-		if (try_context_readahead(mapping, ra, offset, req_size, max))
+		struct file_ra_state old = *ra;
+
+		if (try_context_readahead(mapping, ra, offset, req_size, max)) {
+			if (rs) {
+				ra_stream_park(mapping, rs, &old);
+				rs->active.acct_index = offset;
+			}
 			goto readit;
+		}
 	}
 
 	/*
@@ -469,6 +753,12 @@ ondemand_readahead(struct address_space *mapping,
 	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
 
 initial_readahead:
+	if (rs) {
+		/* restart of the live stream, new streams were parked above */
+		if (offset)
+			ra_stream_retire(mapping, rs, ra);
+		rs->active.acct_index = offset;
+	}
 	ra->start = offset;
 	ra->size = get_init_ra_size(req_size, max);
 	ra->async_size = ra->size > req_size ? ra->size - req_size : ra->size;
@@ -483,6 +773,8 @@ readit:
 		ra->async_size = get_next_ra_size(ra, max);
 		ra->size += ra->async_size;
 	}
+	if (rs)
+		rs->active.stamp = jiffies;
 
 	return ra_submit(ra, mapping, filp);
 }
@@ -516,7 +808,7 @@ void page_cache_sync_readahead(struct address_space *mapping,
 	}
 
 	/* do read-ahead */
-	ondemand_readahead(mapping, ra, filp, false, offset, req_size);
+	ondemand_readahead(mapping, ra, filp, false, false, offset, req_size);
 }
 EXPORT_SYMBOL_GPL(page_cache_sync_readahead);
 
@@ -560,7 +852,8 @@ page_cache_async_readahead(struct address_space *mapping,
 		return;
 
 	/* do read-ahead */
-	ondemand_readahead(mapping, ra, filp, true, offset, req_size);
+	ondemand_readahead(mapping, ra, filp, true, !PageUptodate(page),
+			   offset, req_size);
 
 #ifdef CONFIG_BLOCK
 	/*
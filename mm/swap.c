@@ -100,6 +100,37 @@ void get_page(struct page *page)
 }
 EXPORT_SYMBOL(get_page);
 
+/*
+ * Take the lru_lock of the lruvec @page belongs to, dropping @locked
+ * first if that is a different one.  The memcg of the page may change
+ * until we hold the lock of the lruvec it is on, so look again once
+ * the lock is taken.
+ *
+ * The per-zone info of a memcg is freed without RCU, but only by
+ * ->destroy(), which cgroup_diput() calls after a synchronize_rcu()
+ * that follows force_empty having moved all pages off the memcg.  So
+ * an lruvec looked up under rcu_read_lock() stays valid until the
+ * page is confirmed to be on it.
+ */
+struct lruvec *relock_page_lruvec(struct page *page, struct zone *zone,
+				  struct lruvec *locked)
+{
+	struct lruvec *lruvec;
+
+	rcu_read_lock();
+	for (;;) {
+		lruvec = mem_cgroup_page_lruvec(page, zone);
+		if (lruvec == locked)
+			break;
+		if (locked)
+			spin_unlock(&locked->lru_lock);
+		spin_lock(&lruvec->lru_lock);
+		locked = lruvec;
+	}
+	rcu_read_unlock();
+	return lruvec;
+}
+
 /*
  * This path almost never happens for VM activity - pages are normally
  * freed via pagevecs.  But it gets used by networking.
@@ -109,12 +140,13 @@ static void __page_cache_release(struct page *page)
 	if (PageLRU(page)) {
 		unsigned long flags;
 		struct zone *zone = page_zone(page);
+		struct lruvec *lruvec;
 
-		spin_lock_irqsave(&zone->lru_lock, flags);
-		VM_BUG_ON(!PageLRU(page));
+		lruvec = lock_page_lruvec_irqsave(page, zone, &flags);
+		VM_BUG_ON(!page_on_lruvec(page, lruvec));
 		__ClearPageLRU(page);
-		del_page_from_lru(zone, page);
-		spin_unlock_irqrestore(&zone->lru_lock, flags);
+		del_page_from_lru(zone, page, lruvec);
+		spin_unlock_irqrestore(&lruvec->lru_lock, flags);
 	}
 }
 
@@ -250,30 +282,22 @@ static void pagevec_move_tail(struct pagevec *pvec)
 {
 	int i;
 	int pgmoved = 0;
-	struct zone *zone = NULL;
+	struct lruvec *lruvec = NULL;
 
 	for (i = 0; i < pagevec_count(pvec); i++) {
 		struct page *page = pvec->pages[i];
-		struct zone *pagezone = page_zone(page);
 
-		if (pagezone != zone) {
-			if (zone)
-				spin_unlock(&zone->lru_lock);
-			zone = pagezone;
-			spin_lock(&zone->lru_lock);
-		}
-		if (PageLRU(page) && !PageActive(page) && !PageUnevictable(page)) {
+		lruvec = relock_page_lruvec(page, page_zone(page), lruvec);
+		if (page_on_lruvec(page, lruvec) && !PageActive(page) &&
+		    !PageUnevictable(page)) {
 			enum lru_list lru = page_lru_base_type(page);
-			struct lruvec *lruvec;
 
-			lruvec = mem_cgroup_lru_move_lists(page_zone(page),
-							   page, lru, lru);
 			list_move_tail(&page->lru, &lruvec->lists[lru]);
 			pgmoved++;
 		}
 	}
-	if (zone)
-		spin_unlock(&zone->lru_lock);
+	if (lruvec)
+		spin_unlock(&lruvec->lru_lock);
 	__count_vm_events(PGROTATED, pgmoved);
 	release_pages(pvec->pages, pvec->nr, pvec->cold);
 	pagevec_reinit(pvec);
@@ -308,6 +332,12 @@ static void update_page_reclaim_stat(struct zone *zone, struct page *page,
 
 	memcg_reclaim_stat = mem_cgroup_get_reclaim_stat_from_page(page);
 
+	/*
+	 * The zone-wide stat is only consumed when the memory controller
+	 * is disabled and zone->lruvec.lru_lock covers it.  Otherwise it
+	 * is updated under different lruvec locks, which is fine for the
+	 * heuristic it is.
+	 */
 	reclaim_stat->recent_scanned[file]++;
 	if (rotated)
 		reclaim_stat->recent_rotated[file]++;
@@ -326,21 +356,22 @@ static void update_page_reclaim_stat(struct zone *zone, struct page *page,
 void activate_page(struct page *page)
 {
 	struct zone *zone = page_zone(page);
+	struct lruvec *lruvec;
 
-	spin_lock_irq(&zone->lru_lock);
-	if (PageLRU(page) && !PageActive(page) && !PageUnevictable(page)) {
+	lruvec = lock_page_lruvec_irq(page, zone);
+	if (page_on_lruvec(page, lruvec) && !PageActive(page) &&
+	    !PageUnevictable(page)) {
 		int file = page_is_file_cache(page);
 		int lru = page_lru_base_type(page);
-		del_page_from_lru_list(zone, page, lru);
 
 		SetPageActive(page);
-		lru += LRU_ACTIVE;
-		add_page_to_lru_list(zone, page, lru);
+		move_page_to_lru_list(zone, page, lruvec, lru,
+				      lru + LRU_ACTIVE);
 		__count_vm_event(PGACTIVATE);
 
 		update_page_reclaim_stat(zone, page, file, 1);
 	}
-	spin_unlock_irq(&zone->lru_lock);
+	spin_unlock_irq(&lruvec->lru_lock);
 }
 
 /*
@@ -356,6 +387,8 @@ void mark_page_accessed(struct page *page)
 			PageReferenced(page) && PageLRU(page)) {
 		activate_page(page);
 		ClearPageReferenced(page);
+		if (page_is_file_cache(page))
+			workingset_activation(page);
 	} else if (!PageReferenced(page)) {
 		SetPageReferenced(page);
 	}
@@ -414,12 +447,13 @@ void lru_cache_add_lru(struct page *page, enum lru_list lru)
 void add_page_to_unevictable_list(struct page *page)
 {
 	struct zone *zone = page_zone(page);
+	struct lruvec *lruvec;
 
-	spin_lock_irq(&zone->lru_lock);
+	lruvec = lock_page_lruvec_irq(page, zone);
 	SetPageUnevictable(page);
+	add_page_to_lru_list(zone, page, lruvec, LRU_UNEVICTABLE);
 	SetPageLRU(page);
-	add_page_to_lru_list(zone, page, LRU_UNEVICTABLE);
-	spin_unlock_irq(&zone->lru_lock);
+	spin_unlock_irq(&lruvec->lru_lock);
 }
 
 /*
@@ -443,12 +477,13 @@ void add_page_to_unevictable_list(struct page *page)
  * be write it out by flusher threads as this is much more effective
  * than the single-page writeout from reclaim.
  */
-static void lru_deactivate(struct page *page, struct zone *zone)
+static void lru_deactivate(struct page *page, struct zone *zone,
+			   struct lruvec *lruvec)
 {
 	int lru, file;
 	bool active;
 
-	if (!PageLRU(page))
+	if (!page_on_lruvec(page, lruvec))
 		return;
 
 	if (PageUnevictable(page))
@@ -462,10 +497,9 @@ static void lru_deactivate(struct page *page, struct zone *zone)
 
 	file = page_is_file_cache(page);
 	lru = page_lru_base_type(page);
-	del_page_from_lru_list(zone, page, lru + active);
 	ClearPageActive(page);
 	ClearPageReferenced(page);
-	add_page_to_lru_list(zone, page, lru);
+	move_page_to_lru_list(zone, page, lruvec, lru + active, lru);
 
 	if (PageWriteback(page) || PageDirty(page)) {
 		/*
@@ -475,12 +509,10 @@ static void lru_deactivate(struct page *page, struct zone *zone)
 		 */
 		SetPageReclaim(page);
 	} else {
-		struct lruvec *lruvec;
 		/*
 		 * The page's writeback ends up during pagevec
 		 * We moves tha page into tail of inactive.
 		 */
-		lruvec = mem_cgroup_lru_move_lists(zone, page, lru, lru);
 		list_move_tail(&page->lru, &lruvec->lists[lru]);
 		__count_vm_event(PGROTATED);
 	}
@@ -493,22 +525,19 @@ static void lru_deactivate(struct page *page, struct zone *zone)
 static void ____pagevec_lru_deactivate(struct pagevec *pvec)
 {
 	int i;
-	struct zone *zone = NULL;
+	struct lruvec *lruvec = NULL;
 
+	local_irq_disable();
 	for (i = 0; i < pagevec_count(pvec); i++) {
 		struct page *page = pvec->pages[i];
-		struct zone *pagezone = page_zone(page);
+		struct zone *zone = page_zone(page);
 
-		if (pagezone != zone) {
-			if (zone)
-				spin_unlock_irq(&zone->lru_lock);
-			zone = pagezone;
-			spin_lock_irq(&zone->lru_lock);
-		}
-		lru_deactivate(page, zone);
+		lruvec = relock_page_lruvec(page, zone, lruvec);
+		lru_deactivate(page, zone, lruvec);
 	}
-	if (zone)
-		spin_unlock_irq(&zone->lru_lock);
+	if (lruvec)
+		spin_unlock(&lruvec->lru_lock);
+	local_irq_enable();
 
 	release_pages(pvec->pages, pvec->nr, pvec->cold);
 	pagevec_reinit(pvec);
@@ -590,7 +619,7 @@ int lru_add_drain_all(void)
  * passed pages.  If it fell to zero then remove the page from the LRU and
  * free it.
  *
- * Avoid taking zone->lru_lock if possible, but if it is taken, retain it
+ * Avoid taking an lruvec lock if possible, but if it is taken, retain it
  * for the remainder of the operation.
  *
  * The locking in this function is against shrink_inactive_list(): we recheck
@@ -602,7 +631,7 @@ void release_pages(struct page **pages, int nr, int cold)
 {
 	int i;
 	struct pagevec pages_to_free;
-	struct zone *zone = NULL;
+	struct lruvec *lruvec = NULL;
 	unsigned long uninitialized_var(flags);
 
 	pagevec_init(&pages_to_free, cold);
@@ -610,9 +639,10 @@ void release_pages(struct page **pages, int nr, int cold)
 		struct page *page = pages[i];
 
 		if (unlikely(PageCompound(page))) {
-			if (zone) {
-				spin_unlock_irqrestore(&zone->lru_lock, flags);
-				zone = NULL;
+			if (lruvec) {
+				spin_unlock_irqrestore(&lruvec->lru_lock,
+						       flags);
+				lruvec = NULL;
 			}
 			put_compound_page(page);
 			continue;
@@ -622,31 +652,28 @@ void release_pages(struct page **pages, int nr, int cold)
 			continue;
 
 		if (PageLRU(page)) {
-			struct zone *pagezone = page_zone(page);
-
-			if (pagezone != zone) {
-				if (zone)
-					spin_unlock_irqrestore(&zone->lru_lock,
-									flags);
-				zone = pagezone;
-				spin_lock_irqsave(&zone->lru_lock, flags);
-			}
-			VM_BUG_ON(!PageLRU(page));
+			struct zone *zone = page_zone(page);
+
+			if (!lruvec)
+				local_irq_save(flags);
+			lruvec = relock_page_lruvec(page, zone, lruvec);
+			VM_BUG_ON(!page_on_lruvec(page, lruvec));
 			__ClearPageLRU(page);
-			del_page_from_lru(zone, page);
+			del_page_from_lru(zone, page, lruvec);
 		}
 
 		if (!pagevec_add(&pages_to_free, page)) {
-			if (zone) {
-				spin_unlock_irqrestore(&zone->lru_lock, flags);
-				zone = NULL;
+			if (lruvec) {
+				spin_unlock_irqrestore(&lruvec->lru_lock,
+						       flags);
+				lruvec = NULL;
 			}
 			__pagevec_free(&pages_to_free);
 			pagevec_reinit(&pages_to_free);
   		}
 	}
-	if (zone)
-		spin_unlock_irqrestore(&zone->lru_lock, flags);
+	if (lruvec)
+		spin_unlock_irqrestore(&lruvec->lru_lock, flags);
 
 	pagevec_free(&pages_to_free);
 }
@@ -672,7 +699,7 @@ EXPORT_SYMBOL(__pagevec_release);
 
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 /* used by __split_huge_page_refcount() */
-void lru_add_page_tail(struct zone* zone,
+void lru_add_page_tail(struct zone* zone, struct lruvec *lruvec,
 		       struct page *page, struct page *page_tail)
 {
 	int active;
@@ -682,9 +709,7 @@ void lru_add_page_tail(struct zone* zone,
 	VM_BUG_ON(!PageHead(page));
 	VM_BUG_ON(PageCompound(page_tail));
 	VM_BUG_ON(PageLRU(page_tail));
-	VM_BUG_ON(!spin_is_locked(&zone->lru_lock));
-
-	SetPageLRU(page_tail);
+	VM_BUG_ON(!spin_is_locked(&lruvec->lru_lock));
 
 	if (page_evictable(page_tail, NULL)) {
 		if (PageActive(page)) {
@@ -701,9 +726,11 @@ void lru_add_page_tail(struct zone* zone,
 		lru = LRU_UNEVICTABLE;
 	}
 
-	if (likely(PageLRU(page)))
+	if (likely(PageLRU(page))) {
 		list_add_tail(&page_tail->lru, &page->lru);
-	else {
+		/* PCG_ACCT_LRU was copied from the head, order it */
+		smp_wmb();
+	} else {
 		struct list_head *list_head;
 		/*
 		 * Head page has not yet been counted, as an hpage,
@@ -712,10 +739,11 @@ void lru_add_page_tail(struct zone* zone,
 		 * Use the standard add function to put page_tail on the list,
 		 * but then correct its position so they all end up in order.
 		 */
-		add_page_to_lru_list(zone, page_tail, lru);
+		add_page_to_lru_list(zone, page_tail, lruvec, lru);
 		list_head = page_tail->lru.prev;
 		list_move_tail(&page_tail->lru, list_head);
 	}
+	SetPageLRU(page_tail);
 }
 #endif /* CONFIG_TRANSPARENT_HUGEPAGE */
 
@@ -726,35 +754,32 @@ void lru_add_page_tail(struct zone* zone,
 void ____pagevec_lru_add(struct pagevec *pvec, enum lru_list lru)
 {
 	int i;
-	struct zone *zone = NULL;
+	struct lruvec *lruvec = NULL;
 
 	VM_BUG_ON(is_unevictable_lru(lru));
 
+	local_irq_disable();
 	for (i = 0; i < pagevec_count(pvec); i++) {
 		struct page *page = pvec->pages[i];
-		struct zone *pagezone = page_zone(page);
+		struct zone *zone = page_zone(page);
 		int file;
 		int active;
 
-		if (pagezone != zone) {
-			if (zone)
-				spin_unlock_irq(&zone->lru_lock);
-			zone = pagezone;
-			spin_lock_irq(&zone->lru_lock);
-		}
+		lruvec = relock_page_lruvec(page, zone, lruvec);
 		VM_BUG_ON(PageActive(page));
 		VM_BUG_ON(PageUnevictable(page));
 		VM_BUG_ON(PageLRU(page));
-		SetPageLRU(page);
 		active = is_active_lru(lru);
 		file = is_file_lru(lru);
 		if (active)
 			SetPageActive(page);
 		update_page_reclaim_stat(zone, page, file, active);
-		add_page_to_lru_list(zone, page, lru);
+		add_page_to_lru_list(zone, page, lruvec, lru);
+		SetPageLRU(page);
 	}
-	if (zone)
-		spin_unlock_irq(&zone->lru_lock);
+	if (lruvec)
+		spin_unlock(&lruvec->lru_lock);
+	local_irq_enable();
 	release_pages(pvec->pages, pvec->nr, pvec->cold);
 	pagevec_reinit(pvec);
 }
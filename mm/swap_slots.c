@@ -0,0 +1,174 @@
+/*
+ * mm/swap_slots.c - per-cpu caches of swap slots
+ *
+ * Allocating a swap slot for every page that is swapped out, and
+ * releasing it again when the page is swapped in, takes the global
+ * swap_lock each time, which doesn't scale when many cpus swap at once.
+ *
+ * Instead, each cpu takes slots from the swap devices in batches, which
+ * also keeps its swap-out sequential on the device, and hands them out
+ * one by one from its cache.  Slots that were only held by the swap
+ * cache are collected in a second per-cpu cache on release, and given
+ * back to the device a batch at a time.
+ *
+ * Slots parked in the caches look allocated to the rest of the swap
+ * code, so the caches are drained before concluding that swap is full,
+ * when a cpu goes offline, and when a swap device is turned off.
+ */
+
+#include <linux/mm.h>
+#include <linux/swap_slots.h>
+#include <linux/swapops.h>
+#include <linux/swapfile.h>
+#include <linux/cpu.h>
+#include <linux/init.h>
+
+static DEFINE_PER_CPU(struct swap_slots_cache, swp_slots);
+
+/*
+ * Only fill the caches while there is plenty of swap left, so that
+ * slots parked in them don't run the devices out before their time.
+ */
+static bool swap_slots_cache_active(void)
+{
+	return nr_swap_pages > num_online_cpus() * SWAP_SLOTS_CACHE_SIZE * 2;
+}
+
+static void drain_slots_cache_cpu(unsigned int cpu)
+{
+	struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+	if (cache->nr) {
+		mutex_lock(&cache->alloc_lock);
+		if (cache->nr) {
+			swapcache_free_entries(cache->slots + cache->cur,
+					       cache->nr);
+			cache->cur = 0;
+			cache->nr = 0;
+		}
+		mutex_unlock(&cache->alloc_lock);
+	}
+	if (cache->n_ret) {
+		spin_lock(&cache->free_lock);
+		if (cache->n_ret) {
+			swapcache_free_entries(cache->slots_ret,
+					       cache->n_ret);
+			cache->n_ret = 0;
+		}
+		spin_unlock(&cache->free_lock);
+	}
+}
+
+/**
+ * drain_swap_slots_caches - give all cached swap slots back
+ *
+ * Must be called from process context.
+ */
+void drain_swap_slots_caches(void)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu)
+		drain_slots_cache_cpu(cpu);
+}
+
+/**
+ * get_swap_page - allocate a swap slot for the swap cache
+ *
+ * Returns the swap entry, or an entry with a zero value when swap is
+ * full.  May sleep.
+ */
+swp_entry_t get_swap_page(void)
+{
+	struct swap_slots_cache *cache;
+	swp_entry_t entry;
+
+	if (swap_slots_cache_active()) {
+		cache = &per_cpu(swp_slots, raw_smp_processor_id());
+		mutex_lock(&cache->alloc_lock);
+		if (!cache->nr) {
+			cache->cur = 0;
+			cache->nr = get_swap_pages(SWAP_SLOTS_CACHE_SIZE,
+						   cache->slots);
+		}
+		if (cache->nr) {
+			entry = cache->slots[cache->cur++];
+			cache->nr--;
+			mutex_unlock(&cache->alloc_lock);
+			return entry;
+		}
+		mutex_unlock(&cache->alloc_lock);
+	}
+
+	if (get_swap_pages(1, &entry))
+		return entry;
+
+	/* The slots parked in the caches may be all that's left */
+	drain_swap_slots_caches();
+	if (get_swap_pages(1, &entry))
+		return entry;
+
+	entry.val = 0;
+	return entry;
+}
+
+/**
+ * free_swap_slot - queue a swap slot for batched release
+ * @entry: swap entry the swap cache is letting go of
+ *
+ * Returns 1 if @entry was only held by the swap cache and has been
+ * queued, 0 if it has other references and needs to be released with
+ * swap_lock held.
+ */
+int free_swap_slot(swp_entry_t entry)
+{
+	struct swap_slots_cache *cache;
+	struct swap_info_struct *si;
+	pgoff_t offset = swp_offset(entry);
+
+	if (swp_type(entry) >= MAX_SWAPFILES)
+		return 0;
+	si = swap_info[swp_type(entry)];
+	if (!si || offset >= si->max)
+		return 0;
+	/*
+	 * The caller's swap cache reference keeps the device around, and
+	 * nobody can take a new reference to a slot that is only held by
+	 * the swap cache, so the check doesn't need swap_lock.
+	 */
+	if (ACCESS_ONCE(si->swap_map[offset]) != SWAP_HAS_CACHE)
+		return 0;
+
+	cache = &per_cpu(swp_slots, raw_smp_processor_id());
+	spin_lock(&cache->free_lock);
+	if (cache->n_ret == SWAP_SLOTS_CACHE_SIZE) {
+		swapcache_free_entries(cache->slots_ret, cache->n_ret);
+		cache->n_ret = 0;
+	}
+	cache->slots_ret[cache->n_ret++] = entry;
+	spin_unlock(&cache->free_lock);
+	return 1;
+}
+
+static int __cpuinit swap_slots_cpu_callback(struct notifier_block *nfb,
+					     unsigned long action, void *hcpu)
+{
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN)
+		drain_slots_cache_cpu((long)hcpu);
+	return NOTIFY_OK;
+}
+
+static int __init swap_slots_init(void)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+		mutex_init(&cache->alloc_lock);
+		spin_lock_init(&cache->free_lock);
+	}
+	hotcpu_notifier(swap_slots_cpu_callback, 0);
+	return 0;
+}
+__initcall(swap_slots_init);
@@ -319,6 +319,14 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		err = swapcache_prepare(entry);
 		if (err == -EEXIST) {
 			radix_tree_preload_end();
+			/*
+			 * Nobody references the contents of a slot that only
+			 * has the cache flag set, yet no page in the swap
+			 * cache: it's parked in a swap slots cache, or about
+			 * to be.  Don't wait for it to be handed out.
+			 */
+			if (!__swap_count(entry))
+				break;
 			/*
 			 * We might race against get_swap_page() and stumble
 			 * across a SWAP_HAS_CACHE swap_map entry whose page
@@ -31,6 +31,9 @@
 #include <linux/syscalls.h>
 #include <linux/memcontrol.h>
 #include <linux/oom.h>
+#include <linux/frontswap.h>
+#include <linux/swapfile.h>
+#include <linux/swap_slots.h>
 
 #include <asm/pgtable.h>
 #include <asm/tlbflush.h>
@@ -54,7 +57,7 @@ static const char Unused_offset[] = "Unused swap offset entry ";
 
 static struct swap_list_t swap_list = {-1, -1};
 
-static struct swap_info_struct *swap_info[MAX_SWAPFILES];
+struct swap_info_struct *swap_info[MAX_SWAPFILES];
 
 static DEFINE_MUTEX(swapon_mutex);
 
@@ -204,9 +207,151 @@ static int wait_for_discard(void *word)
 	return 0;
 }
 
-#define SWAPFILE_CLUSTER	256
 #define LATENCY_LIMIT		256
 
+/*
+ * Cluster bookkeeping of solid state devices, all under swap_lock.
+ */
+static void cluster_list_add_tail(struct swap_info_struct *si,
+				  unsigned int idx)
+{
+	struct swap_cluster_info *ci = &si->cluster_info[idx];
+
+	ci->flags = CLUSTER_FLAG_FREE;
+	ci->next = CLUSTER_NULL;
+	if (si->free_cluster_head == CLUSTER_NULL)
+		si->free_cluster_head = idx;
+	else
+		si->cluster_info[si->free_cluster_tail].next = idx;
+	si->free_cluster_tail = idx;
+}
+
+static unsigned int cluster_list_del_first(struct swap_info_struct *si)
+{
+	unsigned int idx = si->free_cluster_head;
+	struct swap_cluster_info *ci = &si->cluster_info[idx];
+
+	si->free_cluster_head = ci->next;
+	if (si->free_cluster_head == CLUSTER_NULL)
+		si->free_cluster_tail = CLUSTER_NULL;
+	ci->flags = 0;
+	return idx;
+}
+
+/* The slot at @offset is being allocated */
+static void inc_cluster_info_page(struct swap_info_struct *si,
+				  unsigned long offset)
+{
+	unsigned int idx = offset / SWAPFILE_CLUSTER;
+	struct swap_cluster_info *ci;
+
+	if (!si->cluster_info)
+		return;
+	ci = &si->cluster_info[idx];
+	if (ci->flags & CLUSTER_FLAG_FREE) {
+		VM_BUG_ON(si->free_cluster_head != idx);
+		cluster_list_del_first(si);
+	}
+	ci->count++;
+	VM_BUG_ON(ci->count > SWAPFILE_CLUSTER);
+}
+
+/*
+ * The slot at @offset was freed: once its cluster is empty, queue it at
+ * the tail of the free list, so that it's not reused right away and the
+ * writes are spread over the device.
+ */
+static void dec_cluster_info_page(struct swap_info_struct *si,
+				  unsigned long offset)
+{
+	unsigned int idx = offset / SWAPFILE_CLUSTER;
+	struct swap_cluster_info *ci;
+
+	if (!si->cluster_info)
+		return;
+	ci = &si->cluster_info[idx];
+	VM_BUG_ON(!ci->count);
+	if (!--ci->count)
+		cluster_list_add_tail(si, idx);
+}
+
+/*
+ * Free clusters are only ever taken off the head of the list, so an
+ * offset that lands in another free cluster must be moved to the head.
+ */
+static bool scan_swap_map_ssd_cluster_conflict(struct swap_info_struct *si,
+					       unsigned long offset)
+{
+	unsigned int idx = offset / SWAPFILE_CLUSTER;
+
+	return (si->cluster_info[idx].flags & CLUSTER_FLAG_FREE) &&
+		idx != si->free_cluster_head;
+}
+
+/*
+ * Take the first free cluster, discarding its old contents first if the
+ * device supports it.  The slots are marked bad while swap_lock is
+ * dropped for the discard, so that the linear scan stays out of them.
+ */
+static unsigned int scan_swap_map_new_cluster(struct swap_info_struct *si)
+{
+	unsigned int idx = cluster_list_del_first(si);
+	unsigned long start = idx * SWAPFILE_CLUSTER;
+
+	if (si->flags & SWP_DISCARDABLE) {
+		memset(si->swap_map + start, SWAP_MAP_BAD, SWAPFILE_CLUSTER);
+		spin_unlock(&swap_lock);
+
+		discard_swap_cluster(si, start, SWAPFILE_CLUSTER);
+
+		spin_lock(&swap_lock);
+		memset(si->swap_map + start, 0, SWAPFILE_CLUSTER);
+	}
+	return idx;
+}
+
+/*
+ * Pick the next offset of the cpu's current cluster, and take a new one
+ * off the free list once it's used up, so that each cpu allocates
+ * sequentially on the device.  Without free clusters, fall back to the
+ * linear scan from si->cluster_next.
+ */
+static void scan_swap_map_try_ssd_cluster(struct swap_info_struct *si,
+					  unsigned long *offset,
+					  unsigned long *scan_base)
+{
+	struct percpu_cluster *cluster;
+	unsigned long tmp, max;
+	unsigned int idx;
+
+new_cluster:
+	cluster = per_cpu_ptr(si->percpu_cluster, smp_processor_id());
+	if (cluster->index == CLUSTER_NULL) {
+		if (si->free_cluster_head == CLUSTER_NULL) {
+			*scan_base = *offset = si->cluster_next;
+			return;
+		}
+		idx = scan_swap_map_new_cluster(si);
+		/* we may have slept and moved to another cpu */
+		cluster = per_cpu_ptr(si->percpu_cluster, smp_processor_id());
+		cluster->index = idx;
+		cluster->next = idx * SWAPFILE_CLUSTER;
+	}
+
+	/* Other cpus may have allocated from our cluster in the meantime */
+	tmp = cluster->next;
+	max = min_t(unsigned long, si->max,
+		    (cluster->index + 1) * SWAPFILE_CLUSTER);
+	while (tmp < max && si->swap_map[tmp])
+		tmp++;
+	if (tmp >= max) {
+		cluster->index = CLUSTER_NULL;
+		goto new_cluster;
+	}
+	cluster->next = tmp + 1;
+	*scan_base = *offset = tmp;
+}
+
 static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 					  unsigned char usage)
 {
@@ -230,6 +375,12 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 	si->flags += SWP_SCANNING;
 	scan_base = offset = si->cluster_next;
 
+	/* SSD algorithm */
+	if (si->cluster_info) {
+		scan_swap_map_try_ssd_cluster(si, &offset, &scan_base);
+		goto checks;
+	}
+
 	if (unlikely(!si->cluster_nr--)) {
 		if (si->pages - si->inuse_pages < SWAPFILE_CLUSTER) {
 			si->cluster_nr = SWAPFILE_CLUSTER - 1;
@@ -314,6 +465,13 @@ checks:
 		goto no_page;
 	if (offset > si->highest_bit)
 		scan_base = offset = si->lowest_bit;
+	if (si->cluster_info &&
+	    scan_swap_map_ssd_cluster_conflict(si, offset)) {
+		per_cpu_ptr(si->percpu_cluster,
+			    smp_processor_id())->index = CLUSTER_NULL;
+		scan_swap_map_try_ssd_cluster(si, &offset, &scan_base);
+		goto checks;
+	}
 
 	/* reuse swap entry of cache-only swap if not busy. */
 	if (vm_swap_full() && si->swap_map[offset] == SWAP_HAS_CACHE) {
@@ -340,6 +498,7 @@ checks:
 		si->highest_bit = 0;
 	}
 	si->swap_map[offset] = usage;
+	inc_cluster_info_page(si, offset);
 	si->cluster_next = offset + 1;
 	si->flags -= SWP_SCANNING;
 
@@ -436,17 +595,25 @@ no_page:
 	return 0;
 }
 
-swp_entry_t get_swap_page(void)
+/*
+ * Allocate up to @n swap slots for the swap cache, all on the same
+ * device, in a single hold of swap_lock.  Returns the number of slots
+ * stored in @entries.
+ */
+int get_swap_pages(int n, swp_entry_t entries[])
 {
 	struct swap_info_struct *si;
 	pgoff_t offset;
 	int type, next;
 	int wrapped = 0;
+	int nr = 0;
 
 	spin_lock(&swap_lock);
 	if (nr_swap_pages <= 0)
 		goto noswap;
-	nr_swap_pages--;
+	if (n > nr_swap_pages)
+		n = nr_swap_pages;
+	nr_swap_pages -= n;
 
 	for (type = swap_list.next; type >= 0 && wrapped < 2; type = next) {
 		si = swap_info[type];
@@ -464,18 +631,21 @@ swp_entry_t get_swap_page(void)
 
 		swap_list.next = next;
 		/* This is called for allocating swap entry for cache */
-		offset = scan_swap_map(si, SWAP_HAS_CACHE);
-		if (offset) {
-			spin_unlock(&swap_lock);
-			return swp_entry(type, offset);
+		while (nr < n) {
+			offset = scan_swap_map(si, SWAP_HAS_CACHE);
+			if (!offset)
+				break;
+			entries[nr++] = swp_entry(type, offset);
 		}
+		if (nr)
+			break;
 		next = swap_list.next;
 	}
 
-	nr_swap_pages++;
+	nr_swap_pages += n - nr;
 noswap:
 	spin_unlock(&swap_lock);
-	return (swp_entry_t) {0};
+	return nr;
 }
 
 /* The only caller of this function is now susupend routine */
@@ -584,6 +754,8 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 			swap_list.next = p->type;
 		nr_swap_pages++;
 		p->inuse_pages--;
+		dec_cluster_info_page(p, offset);
+		frontswap_invalidate_page(p->type, offset);
 		if ((p->flags & SWP_BLKDEV) &&
 				disk->fops->swap_slot_free_notify)
 			disk->fops->swap_slot_free_notify(p->bdev, offset);
@@ -615,6 +787,16 @@ void swapcache_free(swp_entry_t entry, struct page *page)
 	struct swap_info_struct *p;
 	unsigned char count;
 
+	/*
+	 * A slot that is only held by the swap cache can't gain references
+	 * anymore, so its release can be batched in the slots cache.
+	 */
+	if (free_swap_slot(entry)) {
+		if (page)
+			mem_cgroup_uncharge_swapcache(page, entry, false);
+		return;
+	}
+
 	p = swap_info_get(entry);
 	if (p) {
 		count = swap_entry_free(p, entry, SWAP_HAS_CACHE);
@@ -624,6 +806,38 @@ void swapcache_free(swp_entry_t entry, struct page *page)
 	}
 }
 
+/*
+ * Release a batch of slots that were only held by a swap cache.
+ */
+void swapcache_free_entries(swp_entry_t *entries, int n)
+{
+	int i;
+
+	spin_lock(&swap_lock);
+	for (i = 0; i < n; i++)
+		swap_entry_free(swap_info[swp_type(entries[i])], entries[i],
+				SWAP_HAS_CACHE);
+	spin_unlock(&swap_lock);
+}
+
+/*
+ * Number of references to @entry other than the swap cache.  Zero for
+ * a slot that is sitting in a slots cache, or is just being allocated
+ * or freed, as well as for a slot that is free.
+ */
+int __swap_count(swp_entry_t entry)
+{
+	struct swap_info_struct *si = swap_info[swp_type(entry)];
+	pgoff_t offset = swp_offset(entry);
+	int count = 0;
+
+	spin_lock(&swap_lock);
+	if (si->swap_map && offset < si->max)
+		count = swap_count(si->swap_map[offset]);
+	spin_unlock(&swap_lock);
+	return count;
+}
+
 /*
  * How many references to page are currently swapped out?
  * This does not give an exact answer when swap count is continued,
@@ -1142,6 +1356,15 @@ static int try_to_unuse(unsigned int type)
 			 */
 			if (!*swap_map)
 				continue;
+			/*
+			 * Or the entry is parked in a swap slots cache:
+			 * give it back, and come round to it again.
+			 */
+			if (!swap_count(*swap_map)) {
+				drain_swap_slots_caches();
+				cond_resched();
+				continue;
+			}
 			retval = -ENOMEM;
 			break;
 		}
@@ -1536,6 +1759,9 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 {
 	struct swap_info_struct *p = NULL;
 	unsigned char *swap_map;
+	unsigned long *frontswap_map;
+	struct swap_cluster_info *cluster_info;
+	struct percpu_cluster *percpu_cluster;
 	struct file *swap_file, *victim;
 	struct address_space *mapping;
 	struct inode *inode;
@@ -1599,6 +1825,8 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	p->flags &= ~SWP_WRITEOK;
 	spin_unlock(&swap_lock);
 
+	drain_swap_slots_caches();
+
 	oom_score_adj = test_set_oom_score_adj(OOM_SCORE_ADJ_MAX);
 	err = try_to_unuse(type);
 	test_set_oom_score_adj(oom_score_adj);
@@ -1648,13 +1876,23 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 
 	swap_file = p->swap_file;
 	p->swap_file = NULL;
+	frontswap_invalidate_area(type);
+	frontswap_map = frontswap_map_get(p);
+	frontswap_map_set(p, NULL);
 	p->max = 0;
 	swap_map = p->swap_map;
 	p->swap_map = NULL;
+	cluster_info = p->cluster_info;
+	p->cluster_info = NULL;
+	percpu_cluster = p->percpu_cluster;
+	p->percpu_cluster = NULL;
 	p->flags = 0;
 	spin_unlock(&swap_lock);
 	mutex_unlock(&swapon_mutex);
 	vfree(swap_map);
+	vfree(frontswap_map);
+	vfree(cluster_info);
+	free_percpu(percpu_cluster);
 	/* Destroy swap account informatin */
 	swap_cgroup_swapoff(type);
 
@@ -1810,6 +2048,9 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	unsigned long maxpages = 1;
 	unsigned long swapfilepages;
 	unsigned char *swap_map = NULL;
+	unsigned long *frontswap_map = NULL;
+	struct swap_cluster_info *cluster_info = NULL;
+	struct percpu_cluster *percpu_cluster = NULL;
 	struct page *page = NULL;
 	struct inode *inode = NULL;
 	int did_down = 0;
@@ -2009,6 +2250,9 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	if (error)
 		goto bad_swap;
 
+	if (frontswap_enabled)
+		frontswap_map = vzalloc(BITS_TO_LONGS(maxpages) * sizeof(long));
+
 	nr_good_pages = swap_header->info.last_page -
 			swap_header->info.nr_badpages -
 			1 /* header page */;
@@ -2039,6 +2283,40 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 			p->flags |= SWP_DISCARDABLE;
 	}
 
+	if (p->flags & SWP_SOLIDSTATE) {
+		unsigned long nr_clusters;
+		unsigned long j;
+		int cpu;
+
+		nr_clusters = DIV_ROUND_UP(maxpages, SWAPFILE_CLUSTER);
+		cluster_info = vzalloc(nr_clusters * sizeof(*cluster_info));
+		percpu_cluster = alloc_percpu(struct percpu_cluster);
+		if (!cluster_info || !percpu_cluster) {
+			error = -ENOMEM;
+			goto bad_swap;
+		}
+		for_each_possible_cpu(cpu)
+			per_cpu_ptr(percpu_cluster, cpu)->index = CLUSTER_NULL;
+
+		/* The header, bad slots and slots past the end are never free */
+		for (j = 0; j < nr_clusters * SWAPFILE_CLUSTER; j++)
+			if (j >= maxpages || swap_map[j])
+				cluster_info[j / SWAPFILE_CLUSTER].count++;
+
+		/* Not yet writable, nobody looks at the clusters */
+		p->cluster_info = cluster_info;
+		p->free_cluster_head = p->free_cluster_tail = CLUSTER_NULL;
+		for (j = 0; j < nr_clusters; j++)
+			if (!cluster_info[j].count)
+				cluster_list_add_tail(p, j);
+	}
+
+	/*
+	 * The frontswap backend may sleep to set up for the new area, so do
+	 * it before taking swap_lock: nothing gets stored before SWP_WRITEOK.
+	 */
+	frontswap_init(type, frontswap_map);
+
 	mutex_lock(&swapon_mutex);
 	spin_lock(&swap_lock);
 	if (swap_flags & SWAP_FLAG_PREFER)
@@ -2047,6 +2325,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	else
 		p->prio = --least_priority;
 	p->swap_map = swap_map;
+	p->percpu_cluster = percpu_cluster;
 	p->flags |= SWP_WRITEOK;
 	nr_swap_pages += nr_good_pages;
 	total_swap_pages += nr_good_pages;
@@ -2084,9 +2363,13 @@ bad_swap:
 bad_swap_2:
 	spin_lock(&swap_lock);
 	p->swap_file = NULL;
+	p->cluster_info = NULL;
 	p->flags = 0;
 	spin_unlock(&swap_lock);
 	vfree(swap_map);
+	vfree(frontswap_map);
+	vfree(cluster_info);
+	free_percpu(percpu_cluster);
 	if (swap_file)
 		filp_close(swap_file, NULL);
 out:
@@ -73,6 +73,7 @@ void cancel_dirty_page(struct page *page, unsigned int account_size)
 	if (TestClearPageDirty(page)) {
 		struct address_space *mapping = page->mapping;
 		if (mapping && mapping_cap_account_dirty(mapping)) {
+			mem_cgroup_dec_page_stat(page, MEMCG_NR_FILE_DIRTY);
 			dec_zone_page_state(page, NR_FILE_DIRTY);
 			dec_bdi_stat(mapping->backing_dev_info,
 					BDI_RECLAIMABLE);
@@ -181,6 +182,53 @@ int invalidate_inode_page(struct page *page)
 	return invalidate_complete_page(mapping, page);
 }
 
+/*
+ * Drop the shadow entries that reclaim left in place of evicted pages
+ * (see mm/workingset.c) from the truncated range.
+ */
+static void truncate_shadow_entries(struct address_space *mapping,
+				    pgoff_t start, pgoff_t end)
+{
+	void **slots[PAGEVEC_SIZE];
+	unsigned long indices[PAGEVEC_SIZE];
+	pgoff_t shadows[PAGEVEC_SIZE];
+	pgoff_t index = start;
+	unsigned int i, nr, nr_shadows;
+	void *entry;
+
+	/* shmem/tmpfs keeps swap entries, not shadows, in its tree */
+	if (mapping_cap_swap_backed(mapping))
+		return;
+
+	while (index <= end) {
+		spin_lock_irq(&mapping->tree_lock);
+		nr = radix_tree_gang_lookup_slot(&mapping->page_tree,
+				slots, indices, index,
+				min(end - index, (pgoff_t)PAGEVEC_SIZE - 1) + 1);
+		/* Collect first: deletion may free the nodes of the slots */
+		nr_shadows = 0;
+		for (i = 0; i < nr && indices[i] <= end; i++) {
+			entry = radix_tree_deref_slot(slots[i]);
+			if (radix_tree_exceptional_entry(entry))
+				shadows[nr_shadows++] = indices[i];
+		}
+		for (i = 0; i < nr_shadows; i++) {
+			entry = radix_tree_lookup(&mapping->page_tree,
+						  shadows[i]);
+			if (!radix_tree_exceptional_entry(entry))
+				continue;
+			radix_tree_delete(&mapping->page_tree, shadows[i]);
+			workingset_forget(entry);
+		}
+		spin_unlock_irq(&mapping->tree_lock);
+
+		if (!nr || indices[nr - 1] >= end)
+			break;
+		index = indices[nr - 1] + 1;
+		cond_resched();
+	}
+}
+
 /**
  * truncate_inode_pages - truncate range of pages specified by start & end byte offsets
  * @mapping: mapping to truncate
@@ -211,7 +259,7 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	pgoff_t end;
 	int i;
 
-	if (mapping->nrpages == 0)
+	if (!mapping_populated(mapping))
 		return;
 
 	BUG_ON((lend & (PAGE_CACHE_SIZE - 1)) != (PAGE_CACHE_SIZE - 1));
@@ -289,6 +337,7 @@ void truncate_inode_pages_range(struct address_space *mapping,
 		mem_cgroup_uncharge_end();
 		index++;
 	}
+	truncate_shadow_entries(mapping, start, end);
 }
 EXPORT_SYMBOL(truncate_inode_pages_range);
 
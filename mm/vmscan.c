@@ -433,9 +433,11 @@ static pageout_t pageout(struct page *page, struct address_space *mapping,
 
 /*
  * Same as remove_mapping, but if the page is removed from the mapping, it
- * gets returned with a refcount of 0.
+ * gets returned with a refcount of 0.  @reclaimed tells whether the page
+ * is being evicted by reclaim rather than invalidated.
  */
-static int __remove_mapping(struct address_space *mapping, struct page *page)
+static int __remove_mapping(struct address_space *mapping, struct page *page,
+			    bool reclaimed)
 {
 	struct inode *inode = mapping->host;
 
@@ -483,11 +485,18 @@ static int __remove_mapping(struct address_space *mapping, struct page *page)
 		swapcache_free(swap, page);
 	} else {
 		void (*freepage)(struct page *) = NULL;
+		void *shadow = NULL;
 
 		if (IS_AOP_EXT(inode))
 			freepage = EXT_AOPS(mapping->a_ops)->freepage;
 
-		__remove_from_page_cache(page);
+		/*
+		 * Remember a shadow entry for reclaimed file cache in
+		 * order to detect refaults, thus thrashing, later on.
+		 */
+		if (reclaimed && page_is_file_cache(page))
+			shadow = workingset_eviction(mapping, page);
+		__remove_from_page_cache_shadow(page, shadow);
 		spin_unlock_irq(&mapping->tree_lock);
 		mem_cgroup_uncharge_cache_page(page);
 
@@ -510,7 +519,7 @@ cannot_free:
  */
 int remove_mapping(struct address_space *mapping, struct page *page)
 {
-	if (__remove_mapping(mapping, page)) {
+	if (__remove_mapping(mapping, page, false)) {
 		/*
 		 * Unfreezing the refcount with 1 rather than 2 effectively
 		 * drops the pagecache ref for us without requiring another
@@ -871,7 +880,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			}
 		}
 
-		if (!mapping || !__remove_mapping(mapping, page))
+		if (!mapping || !__remove_mapping(mapping, page, true))
 			goto keep_locked;
 
 		/*
@@ -1021,16 +1030,17 @@ int __isolate_lru_page(struct page *page, isolate_mode_t mode, int file)
 }
 
 /*
- * zone->lru_lock is heavily contended.  Some of the functions that
+ * The lruvec lru_lock is heavily contended.  Some of the functions that
  * shrink the lists perform better by taking out a batch of pages
  * and working on them outside the LRU lock.
  *
  * For pagecache intensive workloads, this function is the hottest
  * spot in the kernel (apart from copy_*_user functions).
  *
- * Appropriate locks must be held before calling this function.
+ * @lruvec->lru_lock must be held before calling this function.
  *
  * @nr_to_scan:	The number of pages to look through on the list.
+ * @lruvec:	The lruvec @src belongs to.
  * @src:	The LRU list to pull pages off.
  * @dst:	The temp list to put pages on to.
  * @scanned:	The number of pages that were scanned.
@@ -1041,7 +1051,7 @@ int __isolate_lru_page(struct page *page, isolate_mode_t mode, int file)
  * returns how many pages were moved onto *@dst.
  */
 static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
-		struct list_head *src, struct list_head *dst,
+		struct lruvec *lruvec, struct list_head *src, struct list_head *dst,
 		unsigned long *scanned, int order, isolate_mode_t mode,
 		int file)
 {
@@ -1063,7 +1073,7 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 
 		switch (__isolate_lru_page(page, mode, file)) {
 		case 0:
-			mem_cgroup_lru_del(page);
+			mem_cgroup_lru_del_list(lruvec, page, page_lru(page));
 			list_move(&page->lru, dst);
 			nr_taken += hpage_nr_pages(page);
 			break;
@@ -1119,10 +1129,17 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 			    !PageSwapCache(cursor_page))
 				break;
 
-			if (__isolate_lru_page(cursor_page, mode, file) == 0) {
+			/*
+			 * Only pages on the lruvec whose lock we hold can
+			 * be taken, neighbours charged to other memcgs end
+			 * the block scan.
+			 */
+			if (page_on_lruvec(cursor_page, lruvec) &&
+			    __isolate_lru_page(cursor_page, mode, file) == 0) {
 				unsigned int isolated_pages;
 
-				mem_cgroup_lru_del(cursor_page);
+				mem_cgroup_lru_del_list(lruvec, cursor_page,
+							page_lru(cursor_page));
 				list_move(&cursor_page->lru, dst);
 				isolated_pages = hpage_nr_pages(page);
 				nr_taken += isolated_pages;
@@ -1166,20 +1183,18 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 	return nr_taken;
 }
 
-static unsigned long isolate_pages(unsigned long nr, struct mem_cgroup_zone *mz,
+static unsigned long isolate_pages(unsigned long nr, struct lruvec *lruvec,
 				   struct list_head *dst,
 				   unsigned long *scanned, int order,
 				   isolate_mode_t mode, int active, int file)
 {
-	struct lruvec *lruvec;
 	int lru = LRU_BASE;
 
-	lruvec = mem_cgroup_zone_lruvec(mz->zone, mz->mem_cgroup);
 	if (active)
 		lru += LRU_ACTIVE;
 	if (file)
 		lru += LRU_FILE;
-	return isolate_lru_pages(nr, &lruvec->lists[lru], dst,
+	return isolate_lru_pages(nr, lruvec, &lruvec->lists[lru], dst,
 				 scanned, order, mode, file);
 }
 
@@ -1230,7 +1245,7 @@ static unsigned long clear_active_flags(struct list_head *page_list,
  * (1) Must be called with an elevated refcount on the page. This is a
  *     fundamentnal difference from isolate_lru_pages (which is called
  *     without a stable reference).
- * (2) the lru_lock must not be held.
+ * (2) no lruvec lru_lock must be held.
  * (3) interrupts must be enabled.
  */
 int isolate_lru_page(struct page *page)
@@ -1239,16 +1254,18 @@ int isolate_lru_page(struct page *page)
 
 	if (PageLRU(page)) {
 		struct zone *zone = page_zone(page);
+		struct lruvec *lruvec;
 
-		spin_lock_irq(&zone->lru_lock);
-		if (PageLRU(page) && get_page_unless_zero(page)) {
+		lruvec = lock_page_lruvec_irq(page, zone);
+		if (page_on_lruvec(page, lruvec) &&
+		    get_page_unless_zero(page)) {
 			int lru = page_lru(page);
 			ret = 0;
 			ClearPageLRU(page);
 
-			del_page_from_lru_list(zone, page, lru);
+			del_page_from_lru_list(zone, page, lruvec, lru);
 		}
-		spin_unlock_irq(&zone->lru_lock);
+		spin_unlock_irq(&lruvec->lru_lock);
 	}
 	return ret;
 }
@@ -1294,6 +1311,7 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
         unsigned long nr_writeback = 0;
 	struct zone_reclaim_stat *reclaim_stat = get_reclaim_stat(mz);
 	struct zone *zone = mz->zone;
+	struct lruvec *lruvec = mem_cgroup_zone_lruvec(zone, mz->mem_cgroup);
 	int order = 0;
 
 	if (!COMPACTION_BUILD)
@@ -1310,9 +1328,10 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 	pagevec_init(&pvec, 1);
 
 	lru_add_drain();
-	spin_lock_irq(&zone->lru_lock);
+	spin_lock_irq(&lruvec->lru_lock);
 	do {
 		struct page *page;
+		struct lruvec *locked;
 		unsigned long nr_taken;
 		unsigned long nr_scan;
 		unsigned long nr_freed;
@@ -1321,7 +1340,7 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 		unsigned long nr_anon;
 		unsigned long nr_file;
 
-		nr_taken = isolate_pages(SWAP_CLUSTER_MAX, mz, &page_list,
+		nr_taken = isolate_pages(SWAP_CLUSTER_MAX, lruvec, &page_list,
 					 &nr_scan, order,
 					 ISOLATE_INACTIVE, 0, file);
 		if (global_reclaim(sc)) {
@@ -1359,7 +1378,7 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 		reclaim_stat->recent_scanned[1] += count[LRU_INACTIVE_FILE];
 		reclaim_stat->recent_scanned[1] += count[LRU_ACTIVE_FILE];
 
-		spin_unlock_irq(&zone->lru_lock);
+		spin_unlock_irq(&lruvec->lru_lock);
 
 		nr_scanned += nr_scan;
 		nr_freed = shrink_page_list(&page_list, sc, mz,
@@ -1373,9 +1392,12 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 			__count_vm_events(KSWAPD_STEAL, nr_freed);
 		__count_zone_vm_events(PGSTEAL, zone, nr_freed);
 
-		spin_lock(&zone->lru_lock);
+		spin_lock(&lruvec->lru_lock);
+		locked = lruvec;
 		/*
-		 * Put back any unfreeable pages.
+		 * Put back any unfreeable pages.  Their memcg may have
+		 * changed while they were off the LRU (swapcache charged
+		 * meanwhile), so each goes to the lruvec it belongs to now.
 		 */
 		while (!list_empty(&page_list)) {
 			int lru;
@@ -1383,25 +1405,32 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 			VM_BUG_ON(PageLRU(page));
 			list_del(&page->lru);
 			if (unlikely(!page_evictable(page, NULL))) {
-				spin_unlock_irq(&zone->lru_lock);
+				spin_unlock_irq(&locked->lru_lock);
 				putback_lru_page(page);
-				spin_lock_irq(&zone->lru_lock);
+				spin_lock_irq(&lruvec->lru_lock);
+				locked = lruvec;
 				continue;
 			}
-			SetPageLRU(page);
+			locked = relock_page_lruvec(page, zone, locked);
 			lru = page_lru(page);
-			add_page_to_lru_list(zone, page, lru);
+			add_page_to_lru_list(zone, page, locked, lru);
+			SetPageLRU(page);
 			if (is_active_lru(lru)) {
 				int file = is_file_lru(lru);
 				int numpages = hpage_nr_pages(page);
 				reclaim_stat->recent_rotated[file] += numpages;
 			}
 			if (!pagevec_add(&pvec, page)) {
-				spin_unlock_irq(&zone->lru_lock);
+				spin_unlock_irq(&locked->lru_lock);
 				__pagevec_release(&pvec);
-				spin_lock_irq(&zone->lru_lock);
+				spin_lock_irq(&lruvec->lru_lock);
+				locked = lruvec;
 			}
 		}
+		if (locked != lruvec) {
+			spin_unlock(&locked->lru_lock);
+			spin_lock(&lruvec->lru_lock);
+		}
 		__mod_zone_page_state(zone, NR_ISOLATED_ANON, -nr_anon);
 		__mod_zone_page_state(zone, NR_ISOLATED_FILE, -nr_file);
 
@@ -1430,14 +1459,14 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 		 */
 		if (nr_writeback && nr_writeback >=
 			(nr_taken >> (DEF_PRIORITY-priority))) {
-			spin_unlock_irq(&zone->lru_lock);
+			spin_unlock_irq(&lruvec->lru_lock);
 			wait_iff_congested(zone, BLK_RW_ASYNC, HZ/10);
-			spin_lock_irq(&zone->lru_lock);
+			spin_lock_irq(&lruvec->lru_lock);
 		}
   	} while (nr_scanned < max_scan);
 
 done:
-	spin_unlock_irq(&zone->lru_lock);
+	spin_unlock_irq(&lruvec->lru_lock);
 	pagevec_release(&pvec);
 	trace_mm_pagereclaim_shrinkinactive(nr_scanned, file, 
 				nr_reclaimed, priority);
@@ -1477,9 +1506,9 @@ static inline int zone_is_near_oom(struct mem_cgroup_zone *mz)
  * processes, from rmap.
  *
  * If the pages are mostly unmapped, the processing is fast and it is
- * appropriate to hold zone->lru_lock across the whole operation.  But if
+ * appropriate to hold the lru_lock across the whole operation.  But if
  * the pages are mapped, the processing is slow (page_referenced()) so we
- * should drop zone->lru_lock around each page.  It's impossible to balance
+ * should drop the lru_lock around each page.  It's impossible to balance
  * this, so instead we remove the pages from the LRU while processing them.
  * It is safe to rely on PG_active against the non-LRU pages in here because
  * nobody will play with that bit on a non-LRU page.
@@ -1488,36 +1517,46 @@ static inline int zone_is_near_oom(struct mem_cgroup_zone *mz)
  * But we had to alter page->flags anyway.
  */
 
+/*
+ * Called with @lruvec->lru_lock held, pages whose memcg changed while
+ * they were isolated are put on their new lruvec.
+ */
 static void move_active_pages_to_lru(struct zone *zone,
+				     struct lruvec *lruvec,
 				     struct list_head *list,
 				     enum lru_list lru)
 {
 	unsigned long pgmoved = 0;
 	struct pagevec pvec;
 	struct page *page;
+	struct lruvec *locked = lruvec;
 
 	pagevec_init(&pvec, 1);
 
 	while (!list_empty(list)) {
-		struct lruvec *lruvec;
-
 		page = lru_to_page(list);
 
 		VM_BUG_ON(PageLRU(page));
-		SetPageLRU(page);
+		locked = relock_page_lruvec(page, zone, locked);
 
-		lruvec = mem_cgroup_lru_add_list(zone, page, lru);
-		list_move(&page->lru, &lruvec->lists[lru]);
+		mem_cgroup_lru_add_list(locked, page, lru);
+		list_move(&page->lru, &locked->lists[lru]);
+		SetPageLRU(page);
 		pgmoved += hpage_nr_pages(page);
 
 		if (!pagevec_add(&pvec, page) || list_empty(list)) {
-			spin_unlock_irq(&zone->lru_lock);
+			spin_unlock_irq(&locked->lru_lock);
 			if (buffer_heads_over_limit)
 				pagevec_strip(&pvec);
 			__pagevec_release(&pvec);
-			spin_lock_irq(&zone->lru_lock);
+			spin_lock_irq(&lruvec->lru_lock);
+			locked = lruvec;
 		}
 	}
+	if (locked != lruvec) {
+		spin_unlock(&locked->lru_lock);
+		spin_lock(&lruvec->lru_lock);
+	}
 	__mod_zone_page_state(zone, NR_LRU_BASE + lru, pgmoved);
 	if (!is_active_lru(lru))
 		__count_vm_events(PGDEACTIVATE, pgmoved);
@@ -1539,6 +1578,7 @@ static void shrink_active_list(unsigned long nr_pages,
 	unsigned long nr_rotated = 0;
 	int order = 0;
 	struct zone *zone = mz->zone;
+	struct lruvec *lruvec = mem_cgroup_zone_lruvec(zone, mz->mem_cgroup);
 	int reclaim_mapped = 0;
 
 	/* XXX: we only use 18's page reclaim in global memcg */
@@ -1566,9 +1606,9 @@ force_reclaim_mapped:
 		order = sc->order;
 
 	lru_add_drain();
-	spin_lock_irq(&zone->lru_lock);
+	spin_lock_irq(&lruvec->lru_lock);
 
-	nr_taken = isolate_pages(nr_pages, mz, &l_hold,
+	nr_taken = isolate_pages(nr_pages, lruvec, &l_hold,
 				 &pgscanned, order,
 				 ISOLATE_ACTIVE, 1, file);
 
@@ -1583,7 +1623,7 @@ force_reclaim_mapped:
 	else
 		__mod_zone_page_state(zone, NR_ACTIVE_ANON, -nr_taken);
 	__mod_zone_page_state(zone, NR_ISOLATED_ANON + file, nr_taken);
-	spin_unlock_irq(&zone->lru_lock);
+	spin_unlock_irq(&lruvec->lru_lock);
 
 	while (!list_empty(&l_hold)) {
 		cond_resched();
@@ -1639,7 +1679,7 @@ force_reclaim_mapped:
 	/*
 	 * Move pages back to the lru list.
 	 */
-	spin_lock_irq(&zone->lru_lock);
+	spin_lock_irq(&lruvec->lru_lock);
 	/*
 	 * Count referenced pages from currently used mappings as rotated,
 	 * even though only some of them are actually re-activated.  This
@@ -1648,12 +1688,12 @@ force_reclaim_mapped:
 	 */
 	reclaim_stat->recent_rotated[file] += nr_rotated;
 
-	move_active_pages_to_lru(zone, &l_active,
+	move_active_pages_to_lru(zone, lruvec, &l_active,
 						LRU_ACTIVE + file * LRU_FILE);
-	move_active_pages_to_lru(zone, &l_inactive,
+	move_active_pages_to_lru(zone, lruvec, &l_inactive,
 						LRU_BASE   + file * LRU_FILE);
 	__mod_zone_page_state(zone, NR_ISOLATED_ANON + file, -nr_taken);
-	spin_unlock_irq(&zone->lru_lock);
+	spin_unlock_irq(&lruvec->lru_lock);
 	trace_mm_pagereclaim_shrinkactive(pgscanned, file, priority);  
 }
 
@@ -1759,6 +1799,8 @@ static void get_scan_ratio(struct mem_cgroup_zone *mz, struct scan_control *sc,
 	unsigned long anon_prio, file_prio;
 	unsigned long ap, fp;
 	struct zone_reclaim_stat *reclaim_stat = get_reclaim_stat(mz);
+	struct lruvec *lruvec = mem_cgroup_zone_lruvec(mz->zone,
+						       mz->mem_cgroup);
 
 	anon  = zone_nr_lru_pages(mz, LRU_ACTIVE_ANON) +
 		zone_nr_lru_pages(mz, LRU_INACTIVE_ANON);
@@ -1788,17 +1830,17 @@ static void get_scan_ratio(struct mem_cgroup_zone *mz, struct scan_control *sc,
 	 * anon in [0], file in [1]
 	 */
 	if (unlikely(reclaim_stat->recent_scanned[0] > anon / 4)) {
-		spin_lock_irq(&mz->zone->lru_lock);
+		spin_lock_irq(&lruvec->lru_lock);
 		reclaim_stat->recent_scanned[0] /= 2;
 		reclaim_stat->recent_rotated[0] /= 2;
-		spin_unlock_irq(&mz->zone->lru_lock);
+		spin_unlock_irq(&lruvec->lru_lock);
 	}
 
 	if (unlikely(reclaim_stat->recent_scanned[1] > file / 4)) {
-		spin_lock_irq(&mz->zone->lru_lock);
+		spin_lock_irq(&lruvec->lru_lock);
 		reclaim_stat->recent_scanned[1] /= 2;
 		reclaim_stat->recent_rotated[1] /= 2;
-		spin_unlock_irq(&mz->zone->lru_lock);
+		spin_unlock_irq(&lruvec->lru_lock);
 	}
 
 	/*
@@ -3222,36 +3264,30 @@ int page_evictable(struct page *page, struct vm_area_struct *vma)
  * check_move_unevictable_page - check page for evictability and move to appropriate zone lru list
  * @page: page to check evictability and move to appropriate lru list
  * @zone: zone page is in
+ * @lruvec: lruvec page is on
  *
  * Checks a page for evictability and moves the page to the appropriate
  * zone lru list.
  *
- * Restrictions: zone->lru_lock must be held, page must be on LRU and must
- * have PageUnevictable set.
+ * Restrictions: @lruvec->lru_lock must be held, page must be on @lruvec
+ * and must have PageUnevictable set.
  */
-static void check_move_unevictable_page(struct page *page, struct zone *zone)
+static void check_move_unevictable_page(struct page *page, struct zone *zone,
+					struct lruvec *lruvec)
 {
-	struct lruvec *lruvec;
-
 	VM_BUG_ON(PageActive(page));
 retry:
 	ClearPageUnevictable(page);
 	if (page_evictable(page, NULL)) {
 		enum lru_list l = page_lru_base_type(page);
 
-		__dec_zone_state(zone, NR_UNEVICTABLE);
-		lruvec = mem_cgroup_lru_move_lists(zone, page,
-						   LRU_UNEVICTABLE, l);
-		list_move(&page->lru, &lruvec->lists[l]);
-		__inc_zone_state(zone, NR_INACTIVE_ANON + l);
+		move_page_to_lru_list(zone, page, lruvec, LRU_UNEVICTABLE, l);
 		__count_vm_event(UNEVICTABLE_PGRESCUED);
 	} else {
 		/*
 		 * rotate unevictable list
 		 */
 		SetPageUnevictable(page);
-		lruvec = mem_cgroup_lru_move_lists(zone, page, LRU_UNEVICTABLE,
-						   LRU_UNEVICTABLE);
 		list_move(&page->lru, &lruvec->lists[LRU_UNEVICTABLE]);
 		if (page_evictable(page, NULL))
 			goto retry;
@@ -3270,7 +3306,7 @@ void scan_mapping_unevictable_pages(struct address_space *mapping)
 	pgoff_t next = 0;
 	pgoff_t end   = (i_size_read(mapping->host) + PAGE_CACHE_SIZE - 1) >>
 			 PAGE_CACHE_SHIFT;
-	struct zone *zone;
+	struct lruvec *lruvec;
 	struct pagevec pvec;
 
 	if (mapping->nrpages == 0)
@@ -3282,30 +3318,26 @@ void scan_mapping_unevictable_pages(struct address_space *mapping)
 		int i;
 		int pg_scanned = 0;
 
-		zone = NULL;
-
+		lruvec = NULL;
+		local_irq_disable();
 		for (i = 0; i < pagevec_count(&pvec); i++) {
 			struct page *page = pvec.pages[i];
 			pgoff_t page_index = page->index;
-			struct zone *pagezone = page_zone(page);
+			struct zone *zone = page_zone(page);
 
 			pg_scanned++;
 			if (page_index > next)
 				next = page_index;
 			next++;
 
-			if (pagezone != zone) {
-				if (zone)
-					spin_unlock_irq(&zone->lru_lock);
-				zone = pagezone;
-				spin_lock_irq(&zone->lru_lock);
-			}
-
-			if (PageLRU(page) && PageUnevictable(page))
-				check_move_unevictable_page(page, zone);
+			lruvec = relock_page_lruvec(page, zone, lruvec);
+			if (page_on_lruvec(page, lruvec) &&
+			    PageUnevictable(page))
+				check_move_unevictable_page(page, zone, lruvec);
 		}
-		if (zone)
-			spin_unlock_irq(&zone->lru_lock);
+		if (lruvec)
+			spin_unlock(&lruvec->lru_lock);
+		local_irq_enable();
 		pagevec_release(&pvec);
 
 		count_vm_events(UNEVICTABLE_PGSCANNED, pg_scanned);
@@ -3313,20 +3345,11 @@ void scan_mapping_unevictable_pages(struct address_space *mapping)
 
 }
 
-/**
- * scan_zone_unevictable_pages - check unevictable list for evictable pages
- * @zone - zone of which to scan the unevictable list
- *
- * Scan @zone's unevictable LRU lists to check for pages that have become
- * evictable.  Move those that have to @zone's inactive list where they
- * become candidates for reclaim, unless shrink_inactive_zone() decides
- * to reactivate them.  Pages that are still unevictable are rotated
- * back onto @zone's unevictable list.
- */
 #define SCAN_UNEVICTABLE_BATCH_SIZE 16UL /* arbitrary lock hold batch size */
-static void scan_zone_unevictable_pages(struct zone *zone)
+static void scan_lruvec_unevictable_pages(struct zone *zone,
+					  struct lruvec *lruvec)
 {
-	struct list_head *l_unevictable = &zone->lruvec.lists[LRU_UNEVICTABLE];
+	struct list_head *l_unevictable = &lruvec->lists[LRU_UNEVICTABLE];
 	unsigned long scan;
 	unsigned long nr_to_scan = zone_page_state(zone, NR_UNEVICTABLE);
 
@@ -3334,9 +3357,13 @@ static void scan_zone_unevictable_pages(struct zone *zone)
 		unsigned long batch_size = min(nr_to_scan,
 						SCAN_UNEVICTABLE_BATCH_SIZE);
 
-		spin_lock_irq(&zone->lru_lock);
+		spin_lock_irq(&lruvec->lru_lock);
 		for (scan = 0;  scan < batch_size; scan++) {
-			struct page *page = lru_to_page(l_unevictable);
+			struct page *page;
+
+			if (list_empty(l_unevictable))
+				break;
+			page = lru_to_page(l_unevictable);
 
 			if (!trylock_page(page))
 				continue;
@@ -3344,16 +3371,40 @@ static void scan_zone_unevictable_pages(struct zone *zone)
 			prefetchw_prev_lru_page(page, l_unevictable, flags);
 
 			if (likely(PageLRU(page) && PageUnevictable(page)))
-				check_move_unevictable_page(page, zone);
+				check_move_unevictable_page(page, zone, lruvec);
 
 			unlock_page(page);
 		}
-		spin_unlock_irq(&zone->lru_lock);
+		spin_unlock_irq(&lruvec->lru_lock);
 
+		if (scan < batch_size)
+			break;
 		nr_to_scan -= batch_size;
 	}
 }
 
+/**
+ * scan_zone_unevictable_pages - check unevictable list for evictable pages
+ * @zone - zone of which to scan the unevictable list
+ *
+ * Scan the unevictable LRU lists of all lruvecs in @zone to check for
+ * pages that have become evictable.  Move those that have to their
+ * lruvec's inactive list where they become candidates for reclaim,
+ * unless shrink_inactive_zone() decides to reactivate them.  Pages that
+ * are still unevictable are rotated back onto the unevictable list.
+ */
+static void scan_zone_unevictable_pages(struct zone *zone)
+{
+	struct mem_cgroup *memcg;
+
+	memcg = mem_cgroup_iter(NULL, NULL, NULL);
+	do {
+		scan_lruvec_unevictable_pages(zone,
+				mem_cgroup_zone_lruvec(zone, memcg));
+		memcg = mem_cgroup_iter(NULL, memcg, NULL);
+	} while (memcg);
+}
+
 
 /**
  * scan_all_zones_unevictable_pages - scan all unevictable lists for evictable pages
@@ -822,6 +822,12 @@ static const char * const vmstat_text[] = {
 
 #ifdef CONFIG_NUMA
 	"zone_reclaim_failed",
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	"numa_pte_updates",
+	"numa_hint_faults",
+	"numa_hint_faults_local",
+	"numa_pages_migrated",
 #endif
 	"pginodesteal",
 	"slabs_scanned",
@@ -834,6 +840,8 @@ static const char * const vmstat_text[] = {
 	"allocstall",
 
 	"pgrotated",
+	"workingset_refault",
+	"workingset_activate",
 
 #ifdef CONFIG_COMPACTION
 	"compact_blocks_moved",
@@ -0,0 +1,157 @@
+/*
+ * mm/workingset.c - working set detection for the page cache
+ *
+ * When a clean file page is reclaimed, a shadow entry recording the time
+ * of the eviction is left in its slot of the page cache radix tree.  If
+ * the page is faulted back in, the shadow tells how long it was gone.
+ *
+ * Every eviction and every activation moves a page out of the inactive
+ * file list, so a per-zone counter of both, zone->inactive_age, serves
+ * as the clock.  The difference between the clock at refault time and
+ * the one stored at eviction time, the refault distance, is the number
+ * of pages that left the inactive list while the refaulting page was
+ * out of memory: the minimum number of additional inactive slots it
+ * would have needed to stay resident.
+ *
+ * Pages on the active list compete with the inactive list for memory,
+ * so if the refault distance is not bigger than the active list, the
+ * page would have been kept had the active pages been challenged.  It
+ * is then activated right away, instead of going through the inactive
+ * list a second time and being evicted again before its next access.
+ * The active pages that are displaced by this are deactivated by the
+ * inactive:active balancing in vmscan, and get to prove their value on
+ * the inactive list in turn.
+ */
+
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/fs.h>
+#include <linux/vmstat.h>
+#include <linux/radix-tree.h>
+
+/*
+ * Shadow entries are exceptional radix tree entries: the low bits tag
+ * the entry, followed by the zone and node and the eviction time.
+ */
+#define EVICTION_SHIFT	(RADIX_TREE_EXCEPTIONAL_SHIFT + \
+			 NODES_SHIFT + ZONES_SHIFT)
+#define EVICTION_MASK	(~0UL >> EVICTION_SHIFT)
+
+/*
+ * Shadow entries are dropped by truncation and when they are refaulted,
+ * but nothing reclaims them otherwise, so their number is capped.
+ *
+ * In the worst case every shadow sits alone in a radix tree node and
+ * pins it: a node is about a seventh of a page on 64-bit, so allowing
+ * one shadow per page of memory could tie up ~14% of RAM in nodes that
+ * hold nothing else.  Capping them at an eighth of memory bounds that
+ * to ~2%.  Evictions past the cap leave no shadow, and their refaults
+ * go to the inactive list as they did before refault detection.
+ */
+static atomic_long_t nr_shadows;
+
+static unsigned long max_shadows(void)
+{
+	return totalram_pages >> 3;
+}
+
+static void *pack_shadow(unsigned long eviction, struct zone *zone)
+{
+	eviction = (eviction << NODES_SHIFT) | zone_to_nid(zone);
+	eviction = (eviction << ZONES_SHIFT) | zone_idx(zone);
+	eviction = (eviction << RADIX_TREE_EXCEPTIONAL_SHIFT);
+
+	return (void *)(eviction | RADIX_TREE_EXCEPTIONAL_ENTRY);
+}
+
+static void unpack_shadow(void *shadow, struct zone **zone,
+			  unsigned long *distance)
+{
+	unsigned long entry = (unsigned long)shadow;
+	unsigned long eviction;
+	unsigned long refault;
+	int zid, nid;
+
+	entry >>= RADIX_TREE_EXCEPTIONAL_SHIFT;
+	zid = entry & ((1UL << ZONES_SHIFT) - 1);
+	entry >>= ZONES_SHIFT;
+	nid = entry & ((1UL << NODES_SHIFT) - 1);
+	entry >>= NODES_SHIFT;
+	eviction = entry;
+
+	*zone = NODE_DATA(nid)->node_zones + zid;
+
+	/*
+	 * The clock may have wrapped around within the bits available
+	 * in the shadow: the distance is still right, modulo the range.
+	 */
+	refault = atomic_long_read(&(*zone)->inactive_age);
+	*distance = (refault - eviction) & EVICTION_MASK;
+}
+
+/**
+ * workingset_eviction - note the eviction of a page from memory
+ * @mapping: address space the page was backing
+ * @page: the page being evicted
+ *
+ * Returns a shadow entry to be stored in @mapping->page_tree in place
+ * of the evicted @page so that a later refault can be detected, or
+ * %NULL if none should be stored.
+ */
+void *workingset_eviction(struct address_space *mapping, struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	unsigned long eviction;
+
+	if (atomic_long_read(&nr_shadows) >= max_shadows())
+		return NULL;
+	atomic_long_inc(&nr_shadows);
+
+	eviction = atomic_long_inc_return(&zone->inactive_age);
+	return pack_shadow(eviction, zone);
+}
+
+/**
+ * workingset_refault - evaluate the refault of a previously evicted page
+ * @shadow: shadow entry of the evicted page
+ *
+ * Calculates and evaluates the refault distance of the previously
+ * evicted page in the context of the zone it was allocated in.
+ *
+ * Returns %true if the page should be activated, %false otherwise.
+ */
+bool workingset_refault(void *shadow)
+{
+	unsigned long refault_distance;
+	struct zone *zone;
+
+	unpack_shadow(shadow, &zone, &refault_distance);
+	count_vm_event(WORKINGSET_REFAULT);
+
+	if (refault_distance <= zone_page_state(zone, NR_ACTIVE_FILE)) {
+		count_vm_event(WORKINGSET_ACTIVATE);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * workingset_activation - note a page activation
+ * @page: page that is being activated
+ */
+void workingset_activation(struct page *page)
+{
+	atomic_long_inc(&page_zone(page)->inactive_age);
+}
+
+/**
+ * workingset_forget - note the removal of a shadow entry
+ * @shadow: the shadow entry that was removed from a page cache tree
+ *
+ * Must be called for every shadow entry handed out by
+ * workingset_eviction() once it leaves the page cache again.
+ */
+void workingset_forget(void *shadow)
+{
+	atomic_long_dec(&nr_shadows);
+}
@@ -0,0 +1,592 @@
+/*
+ * zswap.c - compressed in-memory cache for swap pages
+ *
+ * zswap is a frontswap backend that takes pages which are in the process
+ * of being swapped out, compresses them with LZO and keeps the result in
+ * a RAM-based pool, saving the I/O of the swap-out and, if the page is
+ * faulted back in, of the swap-in.
+ *
+ * The pool is capped at max_pool_percent of RAM.  While it is full,
+ * pages are written to the swap device as usual, and a worker writes
+ * the least recently stored compressed pages back to their swap slots
+ * on the device until the pool drops below its accept threshold.  A
+ * written back page is decompressed into the swap cache and written out
+ * from there, so the swap device serves as a second, slower tier.
+ */
+
+#include <linux/module.h>
+#include <linux/cpu.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/frontswap.h>
+#include <linux/rbtree.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/swapfile.h>
+#include <linux/pagemap.h>
+#include <linux/writeback.h>
+#include <linux/workqueue.h>
+#include <linux/lzo.h>
+#include <linux/debugfs.h>
+
+/*********************************
+* statistics
+**********************************/
+/* Number of memory pages used by the compressed pool */
+static atomic_long_t zswap_pool_bytes = ATOMIC_LONG_INIT(0);
+/* The number of compressed pages currently stored in zswap */
+static atomic_t zswap_stored_pages = ATOMIC_INIT(0);
+
+/*
+ * The statistics below are not protected from concurrent access for
+ * performance reasons so they may not be a 100% accurate.  However,
+ * they do provide useful information on roughly how many times a
+ * certain event is occurring.
+ */
+/* Store failed because the pool was full */
+static u64 zswap_pool_limit_hit;
+/* Pages written back when the pool was full */
+static u64 zswap_written_back_pages;
+/* Store failed due to a compression or allocation failure */
+static u64 zswap_reject_alloc_fail;
+/* Compressed page was too big for the allocator to (optimally) store */
+static u64 zswap_reject_compress_poor;
+/* Store replaced an older copy of the same slot */
+static u64 zswap_duplicate_entry;
+
+/*********************************
+* tunables
+**********************************/
+/* Enable/disable zswap (disabled by default) */
+static int zswap_enabled;
+module_param_named(enabled, zswap_enabled, bool, 0644);
+
+/* The maximum percentage of memory that the compressed pool can occupy */
+static unsigned int zswap_max_pool_percent = 20;
+module_param_named(max_pool_percent, zswap_max_pool_percent, uint, 0644);
+
+/* Writeback shrinks a full pool to this percentage of its maximum */
+static unsigned int zswap_accept_threshold_percent = 90;
+module_param_named(accept_threshold_percent,
+		   zswap_accept_threshold_percent, uint, 0644);
+
+/*
+ * Pages that compress to more than this are not worth keeping in
+ * memory, and go to the swap device directly.
+ */
+#define ZSWAP_MAX_COMPRESSED	(PAGE_SIZE * 3 / 4)
+
+/*********************************
+* data structures
+**********************************/
+/*
+ * struct zswap_entry
+ *
+ * This structure contains the metadata for tracking a single compressed
+ * page within zswap.
+ *
+ * rbnode - links the entry into the red-black tree of its swap type
+ * lru - links the entry into the global LRU, most recently stored first
+ * type, offset - the swap slot of the page
+ * length - the length in bytes of the compressed page data
+ * data - the compressed page data
+ */
+struct zswap_entry {
+	struct rb_node rbnode;
+	struct list_head lru;
+	unsigned type;
+	pgoff_t offset;
+	unsigned int length;
+	void *data;
+};
+
+/*
+ * The tree lock in the zswap_tree struct protects the entries of the
+ * tree and nests outside of zswap_lru_lock.
+ */
+struct zswap_tree {
+	struct rb_root rbroot;
+	spinlock_t lock;
+};
+
+static struct zswap_tree *zswap_trees[MAX_SWAPFILES];
+
+static LIST_HEAD(zswap_lru);
+static DEFINE_SPINLOCK(zswap_lru_lock);
+
+static struct kmem_cache *zswap_entry_cache;
+
+static void zswap_writeback_fn(struct work_struct *work);
+static DECLARE_WORK(zswap_writeback_work, zswap_writeback_fn);
+
+/*********************************
+* helpers
+**********************************/
+static unsigned long zswap_max_pool_bytes(void)
+{
+	return (totalram_pages * zswap_max_pool_percent / 100) << PAGE_SHIFT;
+}
+
+static bool zswap_is_full(void)
+{
+	return atomic_long_read(&zswap_pool_bytes) >= zswap_max_pool_bytes();
+}
+
+static bool zswap_can_accept(void)
+{
+	return atomic_long_read(&zswap_pool_bytes) <
+		zswap_max_pool_bytes() / 100 * zswap_accept_threshold_percent;
+}
+
+static struct zswap_entry *zswap_entry_alloc(gfp_t gfp)
+{
+	return kmem_cache_alloc(zswap_entry_cache, gfp);
+}
+
+static void zswap_entry_free(struct zswap_entry *entry)
+{
+	atomic_long_sub(ksize(entry->data), &zswap_pool_bytes);
+	atomic_dec(&zswap_stored_pages);
+	kfree(entry->data);
+	kmem_cache_free(zswap_entry_cache, entry);
+}
+
+/*********************************
+* rbtree functions
+**********************************/
+static struct zswap_entry *zswap_rb_search(struct rb_root *root,
+					   pgoff_t offset)
+{
+	struct rb_node *node = root->rb_node;
+	struct zswap_entry *entry;
+
+	while (node) {
+		entry = rb_entry(node, struct zswap_entry, rbnode);
+		if (entry->offset > offset)
+			node = node->rb_left;
+		else if (entry->offset < offset)
+			node = node->rb_right;
+		else
+			return entry;
+	}
+	return NULL;
+}
+
+/*
+ * In the case that an entry with the same offset is found, a pointer to
+ * the existing entry is stored in dupentry and the function returns
+ * -EEXIST.
+ */
+static int zswap_rb_insert(struct rb_root *root, struct zswap_entry *entry,
+			   struct zswap_entry **dupentry)
+{
+	struct rb_node **link = &root->rb_node, *parent = NULL;
+	struct zswap_entry *myentry;
+
+	while (*link) {
+		parent = *link;
+		myentry = rb_entry(parent, struct zswap_entry, rbnode);
+		if (myentry->offset > entry->offset)
+			link = &(*link)->rb_left;
+		else if (myentry->offset < entry->offset)
+			link = &(*link)->rb_right;
+		else {
+			*dupentry = myentry;
+			return -EEXIST;
+		}
+	}
+	rb_link_node(&entry->rbnode, parent, link);
+	rb_insert_color(&entry->rbnode, root);
+	return 0;
+}
+
+/* Unlink @entry from its tree and the LRU, under the tree lock */
+static void zswap_entry_erase(struct zswap_tree *tree,
+			      struct zswap_entry *entry)
+{
+	rb_erase(&entry->rbnode, &tree->rbroot);
+	spin_lock(&zswap_lru_lock);
+	list_del(&entry->lru);
+	spin_unlock(&zswap_lru_lock);
+}
+
+/*********************************
+* per-cpu compression buffers
+**********************************/
+static DEFINE_PER_CPU(u8 *, zswap_dstmem);
+static DEFINE_PER_CPU(void *, zswap_wrkmem);
+
+static int __init zswap_cpu_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		u8 *dst;
+		void *wrk;
+
+		dst = kmalloc_node(lzo1x_worst_compress(PAGE_SIZE),
+				   GFP_KERNEL, cpu_to_node(cpu));
+		wrk = kmalloc_node(LZO1X_1_MEM_COMPRESS,
+				   GFP_KERNEL, cpu_to_node(cpu));
+		per_cpu(zswap_dstmem, cpu) = dst;
+		per_cpu(zswap_wrkmem, cpu) = wrk;
+		if (!dst || !wrk)
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+static void __init zswap_cpu_exit(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		kfree(per_cpu(zswap_dstmem, cpu));
+		kfree(per_cpu(zswap_wrkmem, cpu));
+		per_cpu(zswap_dstmem, cpu) = NULL;
+		per_cpu(zswap_wrkmem, cpu) = NULL;
+	}
+}
+
+/*********************************
+* writeback code
+**********************************/
+/*
+ * Write the least recently stored page back to its slot on the swap
+ * device.  The page is read into the swap cache, which loads it from
+ * zswap, the zswap copy is dropped and the swap cache page is written
+ * out, after which reclaim can free it like any other clean swap cache
+ * page.
+ *
+ * Returns -ENOENT once there is nothing left to write back.
+ */
+static int zswap_writeback_entry(void)
+{
+	struct writeback_control wbc = {
+		.sync_mode = WB_SYNC_NONE,
+	};
+	struct zswap_entry *entry;
+	swp_entry_t swpentry;
+	struct page *page;
+
+	spin_lock(&zswap_lru_lock);
+	if (list_empty(&zswap_lru)) {
+		spin_unlock(&zswap_lru_lock);
+		return -ENOENT;
+	}
+	entry = list_entry(zswap_lru.prev, struct zswap_entry, lru);
+	swpentry = swp_entry(entry->type, entry->offset);
+	/* Rotate it, so an entry that can't be written back won't stall us */
+	list_move(&entry->lru, &zswap_lru);
+	spin_unlock(&zswap_lru_lock);
+
+	/* The entry may be gone by now, the swap slot pins the page */
+	page = read_swap_cache_async(swpentry, GFP_HIGHUSER_MOVABLE, NULL, 0);
+	if (!page)	/* the slot is being freed, or we're out of memory */
+		return 0;
+
+	lock_page(page);
+	if (!PageSwapCache(page) || page_private(page) != swpentry.val) {
+		unlock_page(page);
+		goto out;
+	}
+	wait_on_page_writeback(page);
+	/* Still in zswap?  Otherwise it was freed or already written back */
+	if (frontswap_test(swap_info[swp_type(swpentry)],
+			   swp_offset(swpentry))) {
+		frontswap_invalidate_page(swp_type(swpentry),
+					  swp_offset(swpentry));
+		__swap_writepage(page, &wbc);
+		zswap_written_back_pages++;
+	} else
+		unlock_page(page);
+out:
+	page_cache_release(page);
+	return 0;
+}
+
+static void zswap_writeback_fn(struct work_struct *work)
+{
+	long nr = atomic_read(&zswap_stored_pages);
+
+	while (!zswap_can_accept() && nr-- > 0) {
+		if (zswap_writeback_entry())
+			break;
+		cond_resched();
+	}
+}
+
+/*********************************
+* frontswap hooks
+**********************************/
+/* attempts to compress and store a single page */
+static int zswap_frontswap_store(unsigned type, pgoff_t offset,
+				 struct page *page)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry, *dupentry = NULL;
+	size_t dlen;
+	void *data;
+	u8 *src, *dst;
+	int ret;
+
+	if (!zswap_enabled || !tree)
+		return -ENODEV;
+
+	if (zswap_is_full()) {
+		zswap_pool_limit_hit++;
+		schedule_work(&zswap_writeback_work);
+		return -ENOMEM;
+	}
+
+	entry = zswap_entry_alloc(GFP_NOIO | __GFP_NORETRY | __GFP_NOWARN);
+	if (!entry) {
+		zswap_reject_alloc_fail++;
+		return -ENOMEM;
+	}
+
+	/* compress */
+	dst = get_cpu_var(zswap_dstmem);
+	src = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_1_compress(src, PAGE_SIZE, dst, &dlen,
+			       __get_cpu_var(zswap_wrkmem));
+	kunmap_atomic(src, KM_USER0);
+	if (ret != LZO_E_OK || dlen > ZSWAP_MAX_COMPRESSED) {
+		put_cpu_var(zswap_dstmem);
+		if (ret == LZO_E_OK)
+			zswap_reject_compress_poor++;
+		else
+			zswap_reject_alloc_fail++;
+		ret = -EINVAL;
+		goto freeentry;
+	}
+
+	/* store */
+	data = kmalloc(dlen, GFP_NOWAIT | __GFP_NOWARN);
+	if (!data) {
+		put_cpu_var(zswap_dstmem);
+		zswap_reject_alloc_fail++;
+		ret = -ENOMEM;
+		goto freeentry;
+	}
+	memcpy(data, dst, dlen);
+	put_cpu_var(zswap_dstmem);
+
+	/* populate entry */
+	entry->type = type;
+	entry->offset = offset;
+	entry->length = dlen;
+	entry->data = data;
+	atomic_long_add(ksize(data), &zswap_pool_bytes);
+	atomic_inc(&zswap_stored_pages);
+
+	/* map */
+	spin_lock(&tree->lock);
+	if (zswap_rb_insert(&tree->rbroot, entry, &dupentry) == -EEXIST) {
+		zswap_duplicate_entry++;
+		zswap_entry_erase(tree, dupentry);
+		zswap_rb_insert(&tree->rbroot, entry, &dupentry);
+	}
+	spin_lock(&zswap_lru_lock);
+	list_add(&entry->lru, &zswap_lru);
+	spin_unlock(&zswap_lru_lock);
+	spin_unlock(&tree->lock);
+
+	if (dupentry)
+		zswap_entry_free(dupentry);
+
+	return 0;
+
+freeentry:
+	kmem_cache_free(zswap_entry_cache, entry);
+	return ret;
+}
+
+/*
+ * returns 0 if the page was successfully decompressed
+ * return -1 on entry not found or error
+ */
+static int zswap_frontswap_load(unsigned type, pgoff_t offset,
+				struct page *page)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry;
+	size_t dlen = PAGE_SIZE;
+	u8 *dst;
+	int ret;
+
+	if (!tree)
+		return -1;
+
+	/*
+	 * Decompress under the tree lock: the entry can't be freed under
+	 * us, and LZO is fast enough on a single page.
+	 */
+	spin_lock(&tree->lock);
+	entry = zswap_rb_search(&tree->rbroot, offset);
+	if (!entry) {
+		/* entry was written back */
+		spin_unlock(&tree->lock);
+		return -1;
+	}
+	dst = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_decompress_safe(entry->data, entry->length, dst, &dlen);
+	kunmap_atomic(dst, KM_USER0);
+	spin_unlock(&tree->lock);
+
+	BUG_ON(ret != LZO_E_OK || dlen != PAGE_SIZE);
+	return 0;
+}
+
+/* frees an entry in zswap */
+static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry;
+
+	if (!tree)
+		return;
+
+	spin_lock(&tree->lock);
+	entry = zswap_rb_search(&tree->rbroot, offset);
+	if (!entry) {
+		/* entry was written back */
+		spin_unlock(&tree->lock);
+		return;
+	}
+	zswap_entry_erase(tree, entry);
+	spin_unlock(&tree->lock);
+
+	zswap_entry_free(entry);
+}
+
+/* frees all zswap entries for the given swap type */
+static void zswap_frontswap_invalidate_area(unsigned type)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry;
+	struct rb_node *node;
+
+	if (!tree)
+		return;
+
+	spin_lock(&tree->lock);
+	while ((node = rb_first(&tree->rbroot))) {
+		entry = rb_entry(node, struct zswap_entry, rbnode);
+		zswap_entry_erase(tree, entry);
+		zswap_entry_free(entry);
+	}
+	spin_unlock(&tree->lock);
+}
+
+static void zswap_frontswap_init(unsigned type)
+{
+	struct zswap_tree *tree;
+
+	if (zswap_trees[type])
+		return;
+
+	tree = kzalloc(sizeof(*tree), GFP_KERNEL);
+	if (!tree) {
+		pr_err("zswap: alloc failed, zswap disabled for swap type %d\n",
+		       type);
+		return;
+	}
+	tree->rbroot = RB_ROOT;
+	spin_lock_init(&tree->lock);
+	zswap_trees[type] = tree;
+}
+
+static struct frontswap_ops zswap_frontswap_ops = {
+	.store = zswap_frontswap_store,
+	.load = zswap_frontswap_load,
+	.invalidate_page = zswap_frontswap_invalidate_page,
+	.invalidate_area = zswap_frontswap_invalidate_area,
+	.init = zswap_frontswap_init
+};
+
+/*********************************
+* debugfs functions
+**********************************/
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *zswap_debugfs_root;
+
+static int zswap_pool_bytes_get(void *data, u64 *val)
+{
+	*val = atomic_long_read(&zswap_pool_bytes);
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(zswap_pool_bytes_fops, zswap_pool_bytes_get,
+			NULL, "%llu\n");
+
+static int zswap_stored_pages_get(void *data, u64 *val)
+{
+	*val = atomic_read(&zswap_stored_pages);
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(zswap_stored_pages_fops, zswap_stored_pages_get,
+			NULL, "%llu\n");
+
+static int __init zswap_debugfs_init(void)
+{
+	if (!debugfs_initialized())
+		return -ENODEV;
+
+	zswap_debugfs_root = debugfs_create_dir("zswap", NULL);
+	if (!zswap_debugfs_root)
+		return -ENOMEM;
+
+	debugfs_create_u64("pool_limit_hit", S_IRUGO,
+			   zswap_debugfs_root, &zswap_pool_limit_hit);
+	debugfs_create_u64("written_back_pages", S_IRUGO,
+			   zswap_debugfs_root, &zswap_written_back_pages);
+	debugfs_create_u64("reject_alloc_fail", S_IRUGO,
+			   zswap_debugfs_root, &zswap_reject_alloc_fail);
+	debugfs_create_u64("reject_compress_poor", S_IRUGO,
+			   zswap_debugfs_root, &zswap_reject_compress_poor);
+	debugfs_create_u64("duplicate_entry", S_IRUGO,
+			   zswap_debugfs_root, &zswap_duplicate_entry);
+	debugfs_create_file("pool_total_size", S_IRUGO, zswap_debugfs_root,
+			    NULL, &zswap_pool_bytes_fops);
+	debugfs_create_file("stored_pages", S_IRUGO, zswap_debugfs_root,
+			    NULL, &zswap_stored_pages_fops);
+
+	return 0;
+}
+#else
+static int __init zswap_debugfs_init(void)
+{
+	return 0;
+}
+#endif
+
+/*********************************
+* module init and exit
+**********************************/
+static int __init init_zswap(void)
+{
+	zswap_entry_cache = KMEM_CACHE(zswap_entry, 0);
+	if (!zswap_entry_cache)
+		goto error;
+	if (zswap_cpu_init())
+		goto cpufail;
+
+	frontswap_register_ops(&zswap_frontswap_ops);
+	zswap_debugfs_init();
+	pr_info("zswap: loaded using lzo compression\n");
+	return 0;
+
+cpufail:
+	zswap_cpu_exit();
+	kmem_cache_destroy(zswap_entry_cache);
+error:
+	pr_err("zswap: initialization failed\n");
+	return -ENOMEM;
+}
+late_initcall(init_zswap);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Compressed cache for swap pages");
@@ -128,6 +128,7 @@
 #include <linux/jhash.h>
 #include <linux/random.h>
 #include <linux/openvswitch.h>
+#include <net/busy_poll.h>
 #ifndef __GENKSYMS__
 #include <trace/events/napi.h>
 #include <trace/events/net.h>
@@ -176,6 +177,7 @@
 static DEFINE_SPINLOCK(ptype_lock);
 static struct list_head ptype_base[PTYPE_HASH_SIZE] __read_mostly;
 static struct list_head ptype_all __read_mostly;	/* Taps */
+static LIST_HEAD(ptype_list_handlers);		/* Batched ->func */
 
 /*
  * The @dev_base_head list is protected by @dev_base_lock and the rtnl
@@ -447,6 +449,50 @@ void dev_remove_pack(struct packet_type *pt)
 }
 EXPORT_SYMBOL(dev_remove_pack);
 
+/**
+ *	dev_add_pack_list - add a batched handler to a packet handler
+ *	@plt: batched handler declaration
+ *
+ *	Have netif_receive_skb_list() pass consecutive skbs for @plt->pt,
+ *	which must have been added with dev_add_pack(), to @plt->func
+ *	together instead of to @plt->pt->func one by one.
+ */
+void dev_add_pack_list(struct packet_list_type *plt)
+{
+	spin_lock_bh(&ptype_lock);
+	list_add_rcu(&plt->list, &ptype_list_handlers);
+	spin_unlock_bh(&ptype_lock);
+}
+EXPORT_SYMBOL(dev_add_pack_list);
+
+/**
+ *	dev_remove_pack_list - remove a batched handler
+ *	@plt: batched handler declaration
+ *
+ *	Remove a handler added by dev_add_pack_list(). This call sleeps to
+ *	guarantee that no CPU is looking at it after return.
+ */
+void dev_remove_pack_list(struct packet_list_type *plt)
+{
+	spin_lock_bh(&ptype_lock);
+	list_del_rcu(&plt->list);
+	spin_unlock_bh(&ptype_lock);
+
+	synchronize_net();
+}
+EXPORT_SYMBOL(dev_remove_pack_list);
+
+static struct packet_list_type *ptype_list_handler(struct packet_type *pt)
+{
+	struct packet_list_type *plt;
+
+	list_for_each_entry_rcu(plt, &ptype_list_handlers, list)
+		if (plt->pt == pt)
+			return plt;
+
+	return NULL;
+}
+
 /******************************************************************************
 
 		      Device Boot-time Settings Routines
@@ -1458,6 +1504,10 @@ static void dev_queue_xmit_nit(struct sk_buff *skb, struct net_device *dev)
 
 			skb2->transport_header = skb2->network_header;
 			skb2->pkt_type = PACKET_OUTGOING;
+			if (unlikely(skb_orphan_frags_rx(skb2, GFP_ATOMIC))) {
+				kfree_skb(skb2);
+				break;
+			}
 			ptype->func(skb2, skb->dev, ptype, skb->dev);
 		}
 	}
@@ -2819,7 +2869,15 @@ void netif_nit_deliver(struct sk_buff *skb)
 	rcu_read_unlock();
 }
 
-int __netif_receive_skb(struct sk_buff *skb)
+/*
+ * Everything up to the final protocol handler: taps, ingress, bridge and
+ * friends. If the skb survives, the handler to deliver it to is returned
+ * in @ppt_prev along with the original device, and the caller calls it
+ * before leaving the RCU read side section it holds around this.
+ */
+static int __netif_receive_skb_core(struct sk_buff *skb,
+				    struct packet_type **ppt_prev,
+				    struct net_device **porig_dev)
 {
 	struct packet_type *ptype, *pt_prev;
 	struct net_device *orig_dev;
@@ -2841,6 +2899,12 @@ int __netif_receive_skb(struct sk_buff *skb)
 	if (netpoll_receive_skb(skb))
 		return NET_RX_DROP;
 
+	/* looped back MSG_ZEROCOPY data must not pin the sender's pages */
+	if (unlikely(skb_orphan_frags_rx(skb, GFP_ATOMIC))) {
+		kfree_skb(skb);
+		return NET_RX_DROP;
+	}
+
 	if (!skb->iif)
 		skb->iif = skb->dev->ifindex;
 
@@ -2874,8 +2938,6 @@ int __netif_receive_skb(struct sk_buff *skb)
 
 	pt_prev = NULL;
 
-	rcu_read_lock();
-
 #ifdef CONFIG_NET_CLS_ACT
 	if (skb->tc_verd & TC_NCLS) {
 		skb->tc_verd = CLR_TC_NCLS(skb->tc_verd);
@@ -2936,7 +2998,8 @@ ncls:
 	}
 
 	if (pt_prev) {
-		ret = pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
+		*ppt_prev = pt_prev;
+		*porig_dev = orig_dev;
 	} else {
 		kfree_skb(skb);
 		/* Jamal, now you will not able to escape explaining
@@ -2946,10 +3009,43 @@ ncls:
 	}
 
 out:
+	return ret;
+}
+
+int __netif_receive_skb(struct sk_buff *skb)
+{
+	struct packet_type *pt_prev = NULL;
+	struct net_device *orig_dev;
+	int ret;
+
+	rcu_read_lock();
+	ret = __netif_receive_skb_core(skb, &pt_prev, &orig_dev);
+	if (pt_prev)
+		ret = pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
 	rcu_read_unlock();
 	return ret;
 }
 
+static void __netif_receive_skb_list_ptype(struct sk_buff_head *list,
+					   struct packet_type *pt_prev,
+					   struct net_device *orig_dev)
+{
+	struct packet_list_type *plt;
+	struct sk_buff *skb;
+
+	if (!pt_prev)
+		return;
+
+	plt = ptype_list_handler(pt_prev);
+	if (plt) {
+		plt->func(list, pt_prev, orig_dev);
+		return;
+	}
+
+	while ((skb = __skb_dequeue(list)) != NULL)
+		pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
+}
+
 /**
  *	netif_receive_skb - process receive buffer from network
  *	@skb: buffer to process
@@ -2981,6 +3077,57 @@ int netif_receive_skb(struct sk_buff *skb)
 }
 EXPORT_SYMBOL(netif_receive_skb);
 
+/**
+ *	netif_receive_skb_list - process many receive buffers from network
+ *	@list: list of skbs to process, empty on return
+ *
+ *	Same as calling netif_receive_skb() on each skb of @list in turn,
+ *	but the device level processing is done for the whole batch first,
+ *	and consecutive skbs going to the same protocol handler are then
+ *	passed to it together (see dev_add_pack_list()), which keeps the
+ *	i-cache warm and saves the per packet handler lookups.
+ *
+ *	This function may only be called from softirq context and interrupts
+ *	should be enabled.
+ */
+void netif_receive_skb_list(struct sk_buff_head *list)
+{
+	struct packet_type *pt_curr = NULL, *pt_prev;
+	struct net_device *od_curr = NULL, *orig_dev;
+	struct sk_buff_head sublist;
+	struct sk_buff *skb;
+
+	__skb_queue_head_init(&sublist);
+
+	rcu_read_lock();
+	while ((skb = __skb_dequeue(list)) != NULL) {
+		struct rps_dev_flow voidflow, *rflow = &voidflow;
+		int cpu;
+
+		cpu = get_rps_cpu(skb->dev, skb, &rflow);
+		if (cpu >= 0) {
+			enqueue_to_backlog(skb, cpu, &rflow->last_qtail);
+			continue;
+		}
+
+		pt_prev = NULL;
+		__netif_receive_skb_core(skb, &pt_prev, &orig_dev);
+		if (!pt_prev)
+			continue;
+
+		if (pt_curr != pt_prev || od_curr != orig_dev) {
+			__netif_receive_skb_list_ptype(&sublist, pt_curr,
+						       od_curr);
+			pt_curr = pt_prev;
+			od_curr = orig_dev;
+		}
+		__skb_queue_tail(&sublist, skb);
+	}
+	__netif_receive_skb_list_ptype(&sublist, pt_curr, od_curr);
+	rcu_read_unlock();
+}
+EXPORT_SYMBOL(netif_receive_skb_list);
+
 /* Network device is going away, flush any packets still pending  */
 static void flush_backlog(void *arg)
 {
@@ -3473,6 +3620,145 @@ void netif_napi_del(struct napi_struct *napi)
 }
 EXPORT_SYMBOL(netif_napi_del);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/*
+ * NAPI contexts that can be busy polled, by id. The id is kept here
+ * rather than in struct napi_struct, which drivers embed in their own
+ * structures.
+ */
+struct napi_hash_entry {
+	struct hlist_node	node;
+	struct napi_struct	*napi;
+	unsigned int		napi_id;
+	struct rcu_head		rcu;
+};
+
+#define NAPI_HASH_BITS	8
+#define NAPI_HASH_MASK	((1 << NAPI_HASH_BITS) - 1)
+
+static struct hlist_head napi_hash[1 << NAPI_HASH_BITS];
+static DEFINE_SPINLOCK(napi_hash_lock);
+static unsigned int napi_gen_id;
+
+static struct napi_hash_entry *napi_hash_lookup(unsigned int napi_id)
+{
+	struct napi_hash_entry *e;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry_rcu(e, pos, &napi_hash[napi_id & NAPI_HASH_MASK],
+				 node)
+		if (e->napi_id == napi_id)
+			return e;
+
+	return NULL;
+}
+
+/* must be called under rcu_read_lock_bh(), as the result is only good
+ * for as long as that is held */
+struct napi_struct *napi_by_id(unsigned int napi_id)
+{
+	struct napi_hash_entry *e = napi_hash_lookup(napi_id);
+
+	return e ? e->napi : NULL;
+}
+EXPORT_SYMBOL_GPL(napi_by_id);
+
+/**
+ *	napi_hash_add - make a NAPI context available to busy polling
+ *	@napi: NAPI context
+ *
+ *	Returns the id the driver marks the skbs received by @napi with,
+ *	see skb_mark_napi_id(), or 0 if it cannot be busy polled.
+ */
+unsigned int napi_hash_add(struct napi_struct *napi)
+{
+	struct napi_hash_entry *e;
+
+	e = kmalloc(sizeof(*e), GFP_KERNEL);
+	if (!e)
+		return 0;
+	e->napi = napi;
+
+	spin_lock(&napi_hash_lock);
+	/* 0 means no NAPI context, skip it and ids still in use on wrap */
+	do {
+		if (unlikely(++napi_gen_id == 0))
+			napi_gen_id = 1;
+	} while (napi_hash_lookup(napi_gen_id));
+	e->napi_id = napi_gen_id;
+	hlist_add_head_rcu(&e->node, &napi_hash[e->napi_id & NAPI_HASH_MASK]);
+	spin_unlock(&napi_hash_lock);
+
+	return e->napi_id;
+}
+EXPORT_SYMBOL_GPL(napi_hash_add);
+
+static void napi_hash_free(struct rcu_head *head)
+{
+	kfree(container_of(head, struct napi_hash_entry, rcu));
+}
+
+/**
+ *	napi_hash_del - stop busy polling of a NAPI context
+ *	@napi_id: id returned by napi_hash_add()
+ *
+ *	Busy pollers may still be polling the context until an RCU-bh
+ *	grace period has elapsed.
+ */
+void napi_hash_del(unsigned int napi_id)
+{
+	struct napi_hash_entry *e;
+
+	spin_lock(&napi_hash_lock);
+	e = napi_hash_lookup(napi_id);
+	if (e)
+		hlist_del_rcu(&e->node);
+	spin_unlock(&napi_hash_lock);
+
+	if (e)
+		call_rcu_bh(&e->rcu, napi_hash_free);
+}
+EXPORT_SYMBOL_GPL(napi_hash_del);
+
+/**
+ *	sk_busy_loop - poll the NAPI context that last fed a socket
+ *	@sk: socket
+ *	@nonblock: poll once instead of until data arrives or sk_ll_usec
+ *
+ *	Returns true if the receive queue of @sk is not empty on return.
+ */
+int sk_busy_loop(struct sock *sk, int nonblock)
+{
+	unsigned long end_time = !nonblock ? sk_busy_loop_end_time(sk) : 0;
+	int (*busy_poll)(struct napi_struct *napi);
+	struct napi_struct *napi;
+	int rc = 0;
+
+	rcu_read_lock_bh();
+	napi = napi_by_id(sk_extended(sk)->sk_napi_id);
+	if (!napi)
+		goto out;
+
+	busy_poll = netdev_extended(napi->dev)->ndo_busy_poll;
+	if (!busy_poll)
+		goto out;
+
+	do {
+		rc = busy_poll(napi);
+		if (rc == LL_FLUSH_FAILED)
+			break;	/* permanent failure */
+		cpu_relax();
+	} while (!nonblock && skb_queue_empty(&sk->sk_receive_queue) &&
+		 !need_resched() && !busy_loop_timeout(end_time));
+
+	rc = !skb_queue_empty(&sk->sk_receive_queue);
+out:
+	rcu_read_unlock_bh();
+	return rc;
+}
+EXPORT_SYMBOL(sk_busy_loop);
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
 /*
  * net_rps_action sends any pending IPI's for rps.  This is only called from
  * softirq and interrupts must be enabled.
@@ -608,6 +608,9 @@ static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 	new->mac_header		= old->mac_header;
 	skb_dst_set(new, dst_clone(skb_dst(old)));
 	new->rxhash		= old->rxhash;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	new->napi_id		= old->napi_id;
+#endif
 #ifdef CONFIG_XFRM
 	new->sp			= secpath_get(old->sp);
 #endif
@@ -737,6 +740,18 @@ static int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask)
 	return 0;
 }
 
+/* @nskb shares user pages of the MSG_ZEROCOPY skb @orig */
+static void skb_zerocopy_clone(struct sk_buff *nskb, struct sk_buff *orig)
+{
+	struct sock_zerocopy *uarg = skb_zcopy(orig);
+
+	if (uarg && !skb_tx(nskb)->dev_zerocopy) {
+		atomic_inc(&uarg->refcnt);
+		skb_shinfo(nskb)->destructor_arg = &uarg->ubuf;
+		skb_tx(nskb)->dev_zerocopy = 1;
+	}
+}
+
 
 /**
  *	skb_clone	-	duplicate an sk_buff
@@ -756,7 +771,8 @@ struct sk_buff *skb_clone(struct sk_buff *skb, gfp_t gfp_mask)
 {
 	struct sk_buff *n;
 
-	if (skb_tx(skb)->dev_zerocopy) {
+	/* clones share skb_shinfo(), and so the MSG_ZEROCOPY reference */
+	if (skb_tx(skb)->dev_zerocopy && !skb_zcopy(skb)) {
 		if (skb_copy_ubufs(skb, gfp_mask))
 			return NULL;
 		skb_tx(skb)->dev_zerocopy = 0;
@@ -880,7 +896,9 @@ struct sk_buff *__pskb_copy(struct sk_buff *skb, int headroom, gfp_t gfp_mask)
 	if (skb_shinfo(skb)->nr_frags) {
 		int i;
 
-		if (skb_tx(skb)->dev_zerocopy) {
+		if (skb_zcopy(skb)) {
+			skb_zerocopy_clone(n, skb);
+		} else if (skb_tx(skb)->dev_zerocopy) {
 			if (skb_copy_ubufs(skb, gfp_mask)) {
 				kfree_skb(n);
 				n = NULL;
@@ -942,15 +960,6 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 	if (!data)
 		goto nodata;
 
-	/* Copy only real data... and, alas, header. This should be
-	 * optimized for the cases when header is void.
-	 */
-	memcpy(data + nhead, skb->head, skb_tail_pointer(skb) - skb->head);
-
-	memcpy((struct skb_shared_info *)(data + size),
-	       skb_shinfo(skb),
-	       sizeof(struct skb_shared_info));
-
 	/* Check if we can avoid taking references on fragments if we own
 	 * the last reference on skb->head. (see skb_release_data())
 	 */
@@ -961,15 +970,31 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 		fastpath = atomic_read(&skb_shinfo(skb)->dataref) == delta;
 	}
 
-	if (fastpath) {
-		kfree(skb->head);
-	} else {
-		/* copy this zero copy skb frags */
-		if (skb_tx(skb)->dev_zerocopy) {
+	/* The new skb_shinfo() shares the frags, so zero copy frags must
+	 * be dealt with before they are copied over below.
+	 */
+	if (!fastpath && skb_tx(skb)->dev_zerocopy) {
+		if (skb_zcopy(skb)) {
+			atomic_inc(&skb_zcopy(skb)->refcnt);
+		} else {
 			if (skb_copy_ubufs(skb, gfp_mask))
 				goto nofrags;
 			skb_tx(skb)->dev_zerocopy = 0;
 		}
+	}
+
+	/* Copy only real data... and, alas, header. This should be
+	 * optimized for the cases when header is void.
+	 */
+	memcpy(data + nhead, skb->head, skb_tail_pointer(skb) - skb->head);
+
+	memcpy((struct skb_shared_info *)(data + size),
+	       skb_shinfo(skb),
+	       sizeof(struct skb_shared_info));
+
+	if (fastpath) {
+		kfree(skb->head);
+	} else {
 		for (i = 0; i < skb_shinfo(skb)->nr_frags; i++)
 			get_page(skb_shinfo(skb)->frags[i].page);
 
@@ -2231,6 +2256,9 @@ void skb_split(struct sk_buff *skb, struct sk_buff *skb1, const u32 len)
 		skb_split_inside_header(skb, skb1, len, pos);
 	else		/* Second chunk has no header, nothing to copy. */
 		skb_split_no_header(skb, skb1, len, pos);
+
+	if (skb_shinfo(skb1)->nr_frags)
+		skb_zerocopy_clone(skb1, skb);
 }
 EXPORT_SYMBOL(skb_split);
 
@@ -2269,6 +2297,10 @@ int skb_shift(struct sk_buff *tgt, struct sk_buff *skb, int shiftlen)
 	BUG_ON(shiftlen > skb->len);
 	BUG_ON(skb_headlen(skb));	/* Would corrupt stream */
 
+	/* frags of zero copy skbs can't change owner */
+	if (skb_tx(tgt)->dev_zerocopy || skb_tx(skb)->dev_zerocopy)
+		return 0;
+
 	todo = shiftlen;
 	from = 0;
 	to = skb_shinfo(tgt)->nr_frags;
@@ -2740,6 +2772,10 @@ struct sk_buff *skb_segment(struct sk_buff *skb, int features)
 		skb_copy_from_linear_data_offset(skb, offset,
 						 skb_put(nskb, hsize), hsize);
 
+		/* segments may outlive skb, they hold their own reference */
+		if (pos < offset + len && i < nfrags)
+			skb_zerocopy_clone(nskb, skb);
+
 		while (pos < offset + len && i < nfrags) {
 			*frag = skb_shinfo(skb)->frags[i];
 			get_page(frag->page);
@@ -3153,6 +3189,316 @@ void skb_tstamp_tx(struct sk_buff *orig_skb,
 }
 EXPORT_SYMBOL_GPL(skb_tstamp_tx);
 
+static struct sock_zerocopy *sock_zerocopy_alloc(struct sock *sk, size_t size)
+{
+	struct sock_zerocopy *uarg;
+
+	uarg = kmalloc(sizeof(*uarg), sk->sk_allocation);
+	if (!uarg)
+		return NULL;
+
+	uarg->skb = alloc_skb(0, sk->sk_allocation);
+	if (!uarg->skb) {
+		kfree(uarg);
+		return NULL;
+	}
+
+	uarg->ubuf.callback = sock_zerocopy_callback;
+	uarg->ubuf.arg = NULL;
+	uarg->ubuf.desc = 0;
+	uarg->id = ((u32)atomic_inc_return(&sk_extended(sk)->sk_zckey)) - 1;
+	uarg->len = 1;
+	uarg->bytelen = size;
+	uarg->zerocopy = 1;
+	atomic_set(&uarg->refcnt, 1);
+	sock_hold(sk);
+	uarg->sk = sk;
+
+	return uarg;
+}
+
+/**
+ * sock_zerocopy_realloc - get the MSG_ZEROCOPY state for a send
+ * @sk: socket, locked
+ * @size: bytes about to be sent
+ * @uarg: state of the last skb on the write queue, may be NULL
+ *
+ * Consecutive sends are folded into the notification of @uarg while its
+ * range is still the most recent one, so one error queue entry can
+ * complete many send calls.  The caller owns a reference on the result
+ * and drops it with sock_zerocopy_put() when done.
+ */
+struct sock_zerocopy *sock_zerocopy_realloc(struct sock *sk, size_t size,
+					    struct sock_zerocopy *uarg)
+{
+	if (uarg) {
+		/* keep notifications of large sends apart */
+		const u32 byte_limit = 1 << 19;
+		u32 bytelen = uarg->bytelen + size;
+		u32 next;
+
+		if (uarg->len == USHORT_MAX - 1 || bytelen > byte_limit)
+			goto new_alloc;
+
+		next = (u32)atomic_read(&sk_extended(sk)->sk_zckey);
+		if ((u32)(uarg->id + uarg->len) == next) {
+			uarg->len++;
+			uarg->bytelen = bytelen;
+			atomic_set(&sk_extended(sk)->sk_zckey, ++next);
+			atomic_inc(&uarg->refcnt);
+			return uarg;
+		}
+	}
+
+new_alloc:
+	return sock_zerocopy_alloc(sk, size);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_realloc);
+
+static bool skb_zerocopy_notify_extend(struct sk_buff *skb, u32 lo, u16 len,
+				       u8 code)
+{
+	struct sock_exterr_skb *serr = SKB_EXT_ERR(skb);
+	u32 old_lo, old_hi;
+	u64 sum_len;
+
+	if (serr->ee.ee_code != code)
+		return false;
+
+	old_lo = serr->ee.ee_info;
+	old_hi = serr->ee.ee_data;
+	sum_len = old_hi - old_lo + 1ULL + len;
+
+	if (sum_len >= (1ULL << 32))
+		return false;
+
+	if (lo != old_hi + 1)
+		return false;
+
+	serr->ee.ee_data += len;
+	return true;
+}
+
+static void sock_zerocopy_notify(struct sock_zerocopy *uarg)
+{
+	struct sk_buff *tail, *skb = uarg->skb;
+	struct sock_exterr_skb *serr;
+	struct sock *sk = uarg->sk;
+	struct sk_buff_head *q;
+	unsigned long flags;
+	u32 lo, hi;
+	u16 len;
+
+	/* a single aborted send has nothing to report */
+	if (!uarg->len || sock_flag(sk, SOCK_DEAD))
+		goto release;
+
+	len = uarg->len;
+	lo = uarg->id;
+	hi = uarg->id + len - 1;
+
+	serr = SKB_EXT_ERR(skb);
+	memset(serr, 0, sizeof(*serr));
+	serr->ee.ee_errno = 0;
+	serr->ee.ee_origin = SO_EE_ORIGIN_ZEROCOPY;
+	serr->ee.ee_data = hi;
+	serr->ee.ee_info = lo;
+	if (!uarg->zerocopy)
+		serr->ee.ee_code = SO_EE_CODE_ZEROCOPY_COPIED;
+
+	/* Not charged to sk_rmem_alloc: the queue may only be read under
+	 * the socket lock, and dropping completions would leave the
+	 * application unable to reuse its buffers.
+	 */
+	q = &sk->sk_error_queue;
+	spin_lock_irqsave(&q->lock, flags);
+	tail = skb_peek_tail(q);
+	if (!tail || SKB_EXT_ERR(tail)->ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+	    !skb_zerocopy_notify_extend(tail, lo, len, serr->ee.ee_code)) {
+		__skb_queue_tail(q, skb);
+		skb = NULL;
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	sk->sk_error_report(sk);
+
+release:
+	kfree_skb(skb);
+	sock_put(sk);
+	kfree(uarg);
+}
+
+/* ubuf_info callback, run when an skb_shared_info drops the user pages */
+void sock_zerocopy_callback(void *arg)
+{
+	struct ubuf_info *ubuf = arg;
+
+	sock_zerocopy_put(container_of(ubuf, struct sock_zerocopy, ubuf));
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_callback);
+
+void sock_zerocopy_put(struct sock_zerocopy *uarg)
+{
+	if (uarg && atomic_dec_and_test(&uarg->refcnt))
+		sock_zerocopy_notify(uarg);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put);
+
+/**
+ * sock_zerocopy_put_abort - drop the reference of a failed send
+ * @uarg: state returned by sock_zerocopy_realloc(), may be NULL
+ *
+ * Gives the notification id back if the send queued nothing, so that
+ * ids seen by the application stay contiguous.
+ */
+void sock_zerocopy_put_abort(struct sock_zerocopy *uarg)
+{
+	if (uarg) {
+		struct sock *sk = uarg->sk;
+
+		atomic_dec(&sk_extended(sk)->sk_zckey);
+		uarg->len--;
+
+		sock_zerocopy_put(uarg);
+	}
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put_abort);
+
+static bool is_icmp_err_skb(const struct sk_buff *skb)
+{
+	return skb && (SKB_EXT_ERR(skb)->ee.ee_origin == SO_EE_ORIGIN_ICMP ||
+		       SKB_EXT_ERR(skb)->ee.ee_origin == SO_EE_ORIGIN_ICMP6);
+}
+
+/**
+ * sock_dequeue_err_skb - dequeue the next entry of the socket error queue
+ * @sk: socket
+ *
+ * sk_err mirrors the ICMP error at the head of the queue.  Entries of
+ * any other origin (zerocopy completions, local errors) never set it,
+ * so they must not clear or overwrite it either: a pending TCP error
+ * would otherwise be lost by reading a completion.
+ */
+struct sk_buff *sock_dequeue_err_skb(struct sock *sk)
+{
+	struct sk_buff_head *q = &sk->sk_error_queue;
+	struct sk_buff *skb, *skb_next = NULL;
+	bool icmp_next = false;
+	unsigned long flags;
+
+	spin_lock_irqsave(&q->lock, flags);
+	skb = __skb_dequeue(q);
+	if (skb && (skb_next = skb_peek(q))) {
+		icmp_next = is_icmp_err_skb(skb_next);
+		if (icmp_next)
+			sk->sk_err = SKB_EXT_ERR(skb_next)->ee.ee_errno;
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	if (is_icmp_err_skb(skb) && !icmp_next)
+		sk->sk_err = 0;
+
+	if (skb_next)
+		sk->sk_error_report(sk);
+
+	return skb;
+}
+EXPORT_SYMBOL(sock_dequeue_err_skb);
+
+/**
+ * skb_zerocopy_iter_stream - append user memory to an skb without copying
+ * @sk: socket, locked, @skb is charged to it
+ * @skb: tail skb of the write queue
+ * @from: user memory
+ * @len: bytes wanted
+ * @uarg: MSG_ZEROCOPY state of the send
+ *
+ * Pins the user pages behind @from and adds them as page fragments.
+ * Returns the number of bytes added, -EMSGSIZE if @skb has no free
+ * fragment, -EEXIST if it belongs to another notification or -EFAULT.
+ */
+int skb_zerocopy_iter_stream(struct sock *sk, struct sk_buff *skb,
+			     unsigned char __user *from, int len,
+			     struct sock_zerocopy *uarg)
+{
+	struct sock_zerocopy *orig_uarg = skb_zcopy(skb);
+	struct page *pages[MAX_SKB_FRAGS];
+	unsigned long addr = (unsigned long)from;
+	int i = skb_shinfo(skb)->nr_frags;
+	unsigned int off = addr & ~PAGE_MASK;
+	int copied = 0;
+	int npages, n, k;
+
+	if (orig_uarg && orig_uarg != uarg)
+		return -EEXIST;
+	if (!orig_uarg && skb_tx(skb)->dev_zerocopy)
+		return -EEXIST;
+
+	npages = min_t(int, DIV_ROUND_UP(off + len, PAGE_SIZE),
+		       MAX_SKB_FRAGS - i);
+	if (npages <= 0)
+		return -EMSGSIZE;
+
+	n = get_user_pages_fast(addr & PAGE_MASK, npages, 0, pages);
+	if (n <= 0)
+		return -EFAULT;
+
+	for (k = 0; k < n; k++) {
+		int size = min_t(int, PAGE_SIZE - off, len - copied);
+
+		if (skb_can_coalesce(skb, i, pages[k], off)) {
+			skb_shinfo(skb)->frags[i - 1].size += size;
+			put_page(pages[k]);
+		} else {
+			skb_fill_page_desc(skb, i++, pages[k], off, size);
+		}
+		copied += size;
+		off = 0;
+	}
+
+	skb->len	     += copied;
+	skb->data_len	     += copied;
+	skb->truesize	     += copied;
+	sk->sk_wmem_queued   += copied;
+	sk_mem_charge(sk, copied);
+
+	if (!orig_uarg) {
+		atomic_inc(&uarg->refcnt);
+		skb_shinfo(skb)->destructor_arg = &uarg->ubuf;
+		skb_tx(skb)->dev_zerocopy = 1;
+	}
+	return copied;
+}
+EXPORT_SYMBOL_GPL(skb_zerocopy_iter_stream);
+
+/**
+ * skb_orphan_frags_rx - copy MSG_ZEROCOPY frags of a looped back skb
+ * @skb: buffer entering the receive path
+ * @gfp_mask: allocation priority
+ *
+ * A local receiver may keep the skb queued for an unbounded time, so the
+ * sender's pages are copied and released here instead.  Device zerocopy
+ * buffers are left alone.
+ */
+int skb_orphan_frags_rx(struct sk_buff *skb, gfp_t gfp_mask)
+{
+	struct sock_zerocopy *uarg = skb_zcopy(skb);
+
+	if (likely(!uarg))
+		return 0;
+
+	/* get a private skb_shinfo() so that clones keep their pages */
+	if (skb_cloned(skb) && pskb_expand_head(skb, 0, 0, gfp_mask))
+		return -ENOMEM;
+
+	uarg->zerocopy = 0;
+	if (skb_copy_ubufs(skb, gfp_mask))
+		return -ENOMEM;
+	skb_tx(skb)->dev_zerocopy = 0;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(skb_orphan_frags_rx);
+
 
 /**
  * skb_partial_csum_set - set up and verify partial csum values for packet
@@ -132,6 +132,8 @@
 
 #ifdef CONFIG_INET
 #include <net/tcp.h>
+#include <net/busy_poll.h>
+#include <net/sock_reuseport.h>
 #endif
 
 /*
@@ -221,6 +223,11 @@ __u32 sysctl_rmem_default __read_mostly = SK_RMEM_MAX;
 int sysctl_optmem_max __read_mostly = sizeof(unsigned long)*(2*UIO_MAXIOV+512);
 EXPORT_SYMBOL(sysctl_optmem_max);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+unsigned int sysctl_net_busy_read __read_mostly;
+unsigned int sysctl_net_busy_poll __read_mostly;
+#endif
+
 #if defined(CONFIG_CGROUPS)
 #if !defined(CONFIG_NET_CLS_CGROUP)
 int net_cls_subsys_id = -1;
@@ -737,6 +744,35 @@ set_rcvbuf:
 		else
 			sock_reset_flag(sk, SOCK_RXQ_OVFL);
 		break;
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	case SO_BUSY_POLL:
+		/* allow unprivileged users to decrease the value */
+		if (val > sk_extended(sk)->sk_ll_usec &&
+		    !capable(CAP_NET_ADMIN))
+			ret = -EPERM;
+		else if (val < 0)
+			ret = -EINVAL;
+		else
+			sk_extended(sk)->sk_ll_usec = val;
+		break;
+#endif
+
+	case SO_INCOMING_CPU:
+		ret = reuseport_set_incoming_cpu(sk, val);
+		break;
+
+	case SO_ZEROCOPY:
+		/* SOCK_ZEROCOPY is set by macvtap on its own sockets */
+		if ((sk->sk_family != PF_INET && sk->sk_family != PF_INET6) ||
+		    sk->sk_protocol != IPPROTO_TCP)
+			ret = -EOPNOTSUPP;
+		else if (val < 0 || val > 1)
+			ret = -EINVAL;
+		else
+			sock_valbool_flag(sk, SOCK_ZEROCOPY, valbool);
+		break;
+
 	default:
 		ret = -ENOPROTOOPT;
 		break;
@@ -944,6 +980,20 @@ int sock_getsockopt(struct socket *sock, int level, int optname,
 		v.val = !!sock_flag(sk, SOCK_RXQ_OVFL);
 		break;
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	case SO_BUSY_POLL:
+		v.val = sk_extended(sk)->sk_ll_usec;
+		break;
+#endif
+
+	case SO_INCOMING_CPU:
+		v.val = sk_extended(sk)->sk_incoming_cpu;
+		break;
+
+	case SO_ZEROCOPY:
+		v.val = sock_flag(sk, SOCK_ZEROCOPY);
+		break;
+
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -1135,6 +1185,9 @@ static void __sk_free(struct sock *sk)
 	sock_disable_timestamp(sk, SOCK_TIMESTAMP);
 	sock_disable_timestamp(sk, SOCK_TIMESTAMPING_RX_SOFTWARE);
 
+	if (sk_extended(sk)->sk_reuseport_cb)
+		reuseport_detach_sock(sk);
+
 	if (atomic_read(&sk->sk_omem_alloc))
 		printk(KERN_DEBUG "%s: optmem leakage (%d bytes) detected.\n",
 		       __func__, atomic_read(&sk->sk_omem_alloc));
@@ -1192,6 +1245,7 @@ struct sock *sk_clone(const struct sock *sk, const gfp_t priority)
 		bh_lock_sock(newsk);
 		newsk->sk_backlog.head	= newsk->sk_backlog.tail = NULL;
 		sk_extended(newsk)->sk_backlog.len = 0;
+		sk_extended(newsk)->sk_reuseport_cb = NULL;
 
 		atomic_set(&newsk->sk_rmem_alloc, 0);
 		/*
@@ -1964,6 +2018,13 @@ void sock_init_data(struct socket *sock, struct sock *sk)
 
 	sk->sk_stamp = ktime_set(-1L, 0);
 
+	sk_extended(sk)->sk_pacing_rate = ~0U;
+	sk_extended(sk)->sk_incoming_cpu = -1;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	sk_extended(sk)->sk_napi_id = 0;
+	sk_extended(sk)->sk_ll_usec = sysctl_net_busy_read;
+#endif
+
 	/*
 	 * Before updating sk_refcnt, we must commit prior changes to memory
 	 * (Documentation/RCU/rculist_nulls.txt for details)
@@ -2000,6 +2061,12 @@ void release_sock(struct sock *sk)
 	spin_lock_bh(&sk->sk_lock.slock);
 	if (sk->sk_backlog.tail)
 		__release_sock(sk);
+#ifdef CONFIG_INET
+	if (sk_extended(sk)->sk_release_deferred) {
+		sk_extended(sk)->sk_release_deferred = 0;
+		tcp_release_cb(sk);
+	}
+#endif
 	sk->sk_lock.owned = 0;
 	if (waitqueue_active(&sk->sk_lock.wq))
 		wake_up(&sk->sk_lock.wq);
@@ -0,0 +1,272 @@
+/*
+ * SO_REUSEPORT groups
+ *
+ * Sockets sharing a port with SO_REUSEPORT are collected into an array
+ * hung off each member, so the protocol lookups can select a listener
+ * by flow hash, or by the receiving CPU, without walking the hash chain.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/cpumask.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <net/sock_reuseport.h>
+
+#define INIT_SOCKS 128
+
+DEFINE_SPINLOCK(reuseport_lock);
+
+static struct sock_reuseport *__reuseport_alloc(unsigned int max_socks)
+{
+	unsigned int size = sizeof(struct sock_reuseport) +
+			    (max_socks + nr_cpu_ids) * sizeof(struct sock *);
+	struct sock_reuseport *reuse = kzalloc(size, GFP_ATOMIC);
+
+	if (!reuse)
+		return NULL;
+
+	reuse->max_socks = max_socks;
+	reuse->cpu_socks = &reuse->socks[max_socks];
+	return reuse;
+}
+
+static void reuseport_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct sock_reuseport, rcu));
+}
+
+/* called with reuseport_lock held */
+static void __reuseport_pin_cpu(struct sock_reuseport *reuse, struct sock *sk)
+{
+	int cpu = sk_extended(sk)->sk_incoming_cpu;
+
+	if (cpu >= 0 && cpu < nr_cpu_ids)
+		reuse->cpu_socks[cpu] = sk;
+}
+
+/* called with reuseport_lock held, hands the CPU to another member if any */
+static void __reuseport_unpin_cpu(struct sock_reuseport *reuse,
+				  struct sock *sk)
+{
+	int cpu = sk_extended(sk)->sk_incoming_cpu;
+	int i;
+
+	if (cpu < 0 || cpu >= nr_cpu_ids || reuse->cpu_socks[cpu] != sk)
+		return;
+
+	reuse->cpu_socks[cpu] = NULL;
+	for (i = 0; i < reuse->num_socks; i++) {
+		struct sock *sk2 = reuse->socks[i];
+
+		if (sk2 != sk && sk_extended(sk2)->sk_incoming_cpu == cpu) {
+			reuse->cpu_socks[cpu] = sk2;
+			break;
+		}
+	}
+}
+
+/**
+ * reuseport_alloc - start a new reuseport group with @sk as its only member
+ * @sk: socket bound with SO_REUSEPORT
+ *
+ * Returns 0 on success or if @sk already belongs to a group.
+ */
+int reuseport_alloc(struct sock *sk)
+{
+	struct sock_reuseport *reuse;
+	int ret = 0;
+
+	spin_lock_bh(&reuseport_lock);
+	if (sk_extended(sk)->sk_reuseport_cb)
+		goto out;
+
+	reuse = __reuseport_alloc(INIT_SOCKS);
+	if (!reuse) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	reuse->socks[0] = sk;
+	reuse->num_socks = 1;
+	__reuseport_pin_cpu(reuse, sk);
+	rcu_assign_pointer(sk_extended(sk)->sk_reuseport_cb, reuse);
+out:
+	spin_unlock_bh(&reuseport_lock);
+	return ret;
+}
+EXPORT_SYMBOL(reuseport_alloc);
+
+static struct sock_reuseport *reuseport_grow(struct sock_reuseport *reuse)
+{
+	struct sock_reuseport *more_reuse;
+	unsigned int more_socks_size, i;
+
+	more_socks_size = reuse->max_socks * 2U;
+	if (more_socks_size > USHORT_MAX) {
+		if (reuse->max_socks == USHORT_MAX)
+			return NULL;
+		more_socks_size = USHORT_MAX;
+	}
+
+	more_reuse = __reuseport_alloc(more_socks_size);
+	if (!more_reuse)
+		return NULL;
+
+	more_reuse->num_socks = reuse->num_socks;
+	more_reuse->has_conns = reuse->has_conns;
+	memcpy(more_reuse->socks, reuse->socks,
+	       reuse->num_socks * sizeof(struct sock *));
+	memcpy(more_reuse->cpu_socks, reuse->cpu_socks,
+	       nr_cpu_ids * sizeof(struct sock *));
+
+	for (i = 0; i < reuse->num_socks; ++i)
+		rcu_assign_pointer(sk_extended(reuse->socks[i])->sk_reuseport_cb,
+				   more_reuse);
+
+	/* lookups may still be walking the old array */
+	call_rcu(&reuse->rcu, reuseport_free_rcu);
+	return more_reuse;
+}
+
+/**
+ * reuseport_add_sock - add a socket to the reuseport group of another
+ * @sk: new socket, not yet in a group
+ * @sk2: socket bound to the same address and port, creating its group
+ *	 if it has none yet
+ */
+int reuseport_add_sock(struct sock *sk, struct sock *sk2)
+{
+	struct sock_reuseport *reuse;
+	int ret;
+
+	if (!sk_extended(sk2)->sk_reuseport_cb) {
+		ret = reuseport_alloc(sk2);
+		if (ret)
+			return ret;
+	}
+
+	spin_lock_bh(&reuseport_lock);
+	reuse = sk_extended(sk2)->sk_reuseport_cb;
+	ret = 0;
+	if (sk_extended(sk)->sk_reuseport_cb || !reuse)
+		goto out;
+
+	if (reuse->num_socks == reuse->max_socks) {
+		reuse = reuseport_grow(reuse);
+		if (!reuse) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	reuse->socks[reuse->num_socks] = sk;
+	__reuseport_pin_cpu(reuse, sk);
+	/* paired with smp_rmb() in reuseport_select_sock() */
+	smp_wmb();
+	reuse->num_socks++;
+	rcu_assign_pointer(sk_extended(sk)->sk_reuseport_cb, reuse);
+out:
+	spin_unlock_bh(&reuseport_lock);
+	return ret;
+}
+EXPORT_SYMBOL(reuseport_add_sock);
+
+/**
+ * reuseport_detach_sock - remove a socket from its reuseport group
+ * @sk: socket being unhashed or freed
+ */
+void reuseport_detach_sock(struct sock *sk)
+{
+	struct sock_reuseport *reuse;
+	int i;
+
+	spin_lock_bh(&reuseport_lock);
+	reuse = sk_extended(sk)->sk_reuseport_cb;
+	if (!reuse)
+		goto out;
+
+	rcu_assign_pointer(sk_extended(sk)->sk_reuseport_cb, NULL);
+
+	for (i = 0; i < reuse->num_socks; i++) {
+		if (reuse->socks[i] == sk) {
+			reuse->socks[i] = reuse->socks[reuse->num_socks - 1];
+			reuse->num_socks--;
+			break;
+		}
+	}
+	__reuseport_unpin_cpu(reuse, sk);
+
+	if (reuse->num_socks == 0)
+		call_rcu(&reuse->rcu, reuseport_free_rcu);
+out:
+	spin_unlock_bh(&reuseport_lock);
+}
+EXPORT_SYMBOL(reuseport_detach_sock);
+
+/**
+ * reuseport_set_incoming_cpu - pin a socket to a receiving CPU
+ * @sk: socket, possibly in a reuseport group
+ * @cpu: CPU whose packets @sk should get, or -1 to unpin
+ *
+ * Backs SO_INCOMING_CPU.  Flows received on @cpu then go to @sk instead
+ * of the member chosen by the flow hash, so that accept() and recvmsg()
+ * run where RSS/RPS delivered the packet.
+ */
+int reuseport_set_incoming_cpu(struct sock *sk, int cpu)
+{
+	struct sock_reuseport *reuse;
+
+	if (cpu < -1 || cpu >= (int)nr_cpu_ids)
+		return -EINVAL;
+
+	spin_lock_bh(&reuseport_lock);
+	reuse = sk_extended(sk)->sk_reuseport_cb;
+	if (reuse)
+		__reuseport_unpin_cpu(reuse, sk);
+	sk_extended(sk)->sk_incoming_cpu = cpu;
+	if (reuse)
+		__reuseport_pin_cpu(reuse, sk);
+	spin_unlock_bh(&reuseport_lock);
+	return 0;
+}
+EXPORT_SYMBOL(reuseport_set_incoming_cpu);
+
+/**
+ * reuseport_select_sock - select a socket from a reuseport group
+ * @sk: first socket of the group found by the lookup
+ * @hash: flow hash of the packet
+ *
+ * Must be called under rcu_read_lock().  Returns NULL when @sk is not in
+ * a group, or the group can't be used and the caller has to fall back
+ * to scoring the hash chain.  No reference is taken on the result.
+ */
+struct sock *reuseport_select_sock(struct sock *sk, u32 hash)
+{
+	struct sock_reuseport *reuse;
+	struct sock *sk2 = NULL;
+	u16 socks;
+
+	reuse = rcu_dereference(sk_extended(sk)->sk_reuseport_cb);
+
+	/* if memory allocation failed or connected members exist */
+	if (!reuse || reuse->has_conns)
+		return NULL;
+
+	socks = ACCESS_ONCE(reuse->num_socks);
+	if (likely(socks)) {
+		/* paired with smp_wmb() in reuseport_add_sock() */
+		smp_rmb();
+
+		sk2 = ACCESS_ONCE(reuse->cpu_socks[raw_smp_processor_id()]);
+		if (!sk2)
+			sk2 = reuse->socks[((u64)hash * socks) >> 32];
+	}
+	return sk2;
+}
+EXPORT_SYMBOL(reuseport_select_sock);
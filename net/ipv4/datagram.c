@@ -19,6 +19,7 @@
 #include <net/sock.h>
 #include <net/route.h>
 #include <net/tcp_states.h>
+#include <net/sock_reuseport.h>
 
 int ip4_datagram_connect(struct sock *sk, struct sockaddr *uaddr, int addr_len)
 {
@@ -68,6 +69,7 @@ int ip4_datagram_connect(struct sock *sk, struct sockaddr *uaddr, int addr_len)
 	inet->dport = usin->sin_port;
 	sk->sk_state = TCP_ESTABLISHED;
 	inet->id = jiffies;
+	reuseport_has_conns_set(sk);
 
 	sk_dst_set(sk, &rt->u.dst);
 	return(0);
@@ -22,7 +22,9 @@
 #include <net/inet_connection_sock.h>
 #include <net/inet_hashtables.h>
 #include <net/secure_seq.h>
+#include <net/sock_reuseport.h>
 #include <net/ip.h>
+#include <net/ipv6.h>
 
 /*
  * Allocate and initialize a new local port bind bucket.
@@ -189,6 +191,7 @@ struct sock *__inet_lookup_listener(struct net *net,
 	unsigned int hash = inet_lhashfn(net, hnum);
 	struct inet_listen_hashbucket *ilb = &hashinfo->listening_hash[hash];
 	int score, hiscore, matches = 0, reuseport = 0;
+	struct sock *sk2;
 	u32 phash = 0;
 
 	rcu_read_lock();
@@ -204,6 +207,11 @@ begin:
 			if (reuseport) {
 				phash = inet_ehashfn(net, daddr, hnum,
 				    saddr, htons(sport));
+				sk2 = reuseport_select_sock(sk, phash);
+				if (sk2) {
+					result = sk2;
+					goto found;
+				}
 				matches = 1;
 			}
 		} else if (score == hiscore && reuseport) {
@@ -221,6 +229,7 @@ begin:
 	if (get_nulls_value(node) != hash + LISTENING_NULLS_BASE)
 		goto begin;
 
+found:
 	if (result) {
 		if (unlikely(!atomic_inc_not_zero(&result->sk_refcnt)))
 			result = NULL;
@@ -406,6 +415,58 @@ void __inet_hash_nolisten(struct sock *sk)
 }
 EXPORT_SYMBOL_GPL(__inet_hash_nolisten);
 
+/*
+ * Strict version of the bind conflict address test: true only if both
+ * sockets are bound to the very same local address.
+ */
+int inet_rcv_saddr_same(const struct sock *sk, const struct sock *sk2)
+{
+	if (sk->sk_family != sk2->sk_family ||
+	    ipv6_only_sock(sk) != ipv6_only_sock(sk2))
+		return 0;
+
+#if defined(CONFIG_IPV6) || defined(CONFIG_IPV6_MODULE)
+	if (sk->sk_family == AF_INET6)
+		return ipv6_addr_equal(&inet6_sk(sk)->rcv_saddr,
+				       &inet6_sk(sk2)->rcv_saddr);
+#endif
+	return inet_sk(sk)->rcv_saddr == inet_sk(sk2)->rcv_saddr;
+}
+EXPORT_SYMBOL(inet_rcv_saddr_same);
+
+/*
+ * Put a SO_REUSEPORT listener into the group of the listeners sharing its
+ * bind bucket, address, device and owner.  Called with the listening
+ * bucket locked.  If the group can't be grown the listener simply stays
+ * out of it and is only found by the legacy scoring walk.
+ */
+void inet_reuseport_add_sock(struct sock *sk,
+			     struct inet_listen_hashbucket *ilb)
+{
+	struct inet_bind_bucket *tb = inet_csk(sk)->icsk_bind_hash;
+	const struct hlist_nulls_node *node;
+	int uid = sock_i_uid(sk);
+	struct sock *sk2;
+
+	if (!sk->sk_reuseport)
+		return;
+
+	sk_nulls_for_each(sk2, node, &ilb->head) {
+		if (sk2 != sk &&
+		    sk2->sk_reuseport &&
+		    inet_csk(sk2)->icsk_bind_hash == tb &&
+		    sk2->sk_bound_dev_if == sk->sk_bound_dev_if &&
+		    sock_i_uid(sk2) == uid &&
+		    inet_rcv_saddr_same(sk, sk2)) {
+			reuseport_add_sock(sk, sk2);
+			return;
+		}
+	}
+
+	reuseport_alloc(sk);
+}
+EXPORT_SYMBOL_GPL(inet_reuseport_add_sock);
+
 static void __inet_hash(struct sock *sk)
 {
 	struct inet_hashinfo *hashinfo = sk->sk_prot->h.hashinfo;
@@ -420,6 +481,7 @@ static void __inet_hash(struct sock *sk)
 	ilb = &hashinfo->listening_hash[inet_sk_listen_hashfn(sk)];
 
 	spin_lock(&ilb->lock);
+	inet_reuseport_add_sock(sk, ilb);
 	__sk_nulls_add_node_rcu(sk, &ilb->head);
 	sock_prot_inuse_add(sock_net(sk), sk->sk_prot, 1);
 	spin_unlock(&ilb->lock);
@@ -450,6 +512,8 @@ void inet_unhash(struct sock *sk)
 		lock = inet_ehash_lockp(hashinfo, sk->sk_hash);
 
 	spin_lock_bh(lock);
+	if (sk_extended(sk)->sk_reuseport_cb)
+		reuseport_detach_sock(sk);
 	done =__sk_nulls_del_node_init_rcu(sk);
 	if (done)
 		sock_prot_inuse_add(sock_net(sk), sk->sk_prot, -1);
@@ -373,9 +373,10 @@ drop:
 }
 
 /*
- * 	Main IP Receive routine.
+ * 	Sanity checks of ip_rcv(), returns the skb to go on with or NULL
+ * 	if it was dropped.
  */
-int ip_rcv(struct sk_buff *skb, struct net_device *dev, struct packet_type *pt, struct net_device *orig_dev)
+static struct sk_buff *ip_rcv_core(struct sk_buff *skb, struct net_device *dev)
 {
 	struct iphdr *iph;
 	u32 len;
@@ -443,13 +444,49 @@ int ip_rcv(struct sk_buff *skb, struct net_device *dev, struct packet_type *pt,
 	/* Must drop socket now because of tproxy. */
 	skb_orphan(skb);
 
-	return NF_HOOK(PF_INET, NF_INET_PRE_ROUTING, skb, dev, NULL,
-		       ip_rcv_finish);
+	return skb;
 
 inhdr_error:
 	IP_INC_STATS_BH(dev_net(dev), IPSTATS_MIB_INHDRERRORS);
 drop:
 	kfree_skb(skb);
 out:
-	return NET_RX_DROP;
+	return NULL;
+}
+
+/*
+ * 	Main IP Receive routine.
+ */
+int ip_rcv(struct sk_buff *skb, struct net_device *dev, struct packet_type *pt, struct net_device *orig_dev)
+{
+	skb = ip_rcv_core(skb, dev);
+	if (skb == NULL)
+		return NET_RX_DROP;
+
+	return NF_HOOK(PF_INET, NF_INET_PRE_ROUTING, skb, dev, NULL,
+		       ip_rcv_finish);
+}
+
+/*
+ * 	Batched version of ip_rcv() for netif_receive_skb_list(): all the
+ * 	header checks are done first, then the survivors go through
+ * 	PRE_ROUTING and routing one after the other.
+ */
+void ip_list_rcv(struct sk_buff_head *list, struct packet_type *pt,
+		 struct net_device *orig_dev)
+{
+	struct sk_buff_head sublist;
+	struct sk_buff *skb;
+
+	__skb_queue_head_init(&sublist);
+
+	while ((skb = __skb_dequeue(list)) != NULL) {
+		skb = ip_rcv_core(skb, skb->dev);
+		if (skb)
+			__skb_queue_tail(&sublist, skb);
+	}
+
+	while ((skb = __skb_dequeue(&sublist)) != NULL)
+		NF_HOOK(PF_INET, NF_INET_PRE_ROUTING, skb, skb->dev, NULL,
+			ip_rcv_finish);
 }
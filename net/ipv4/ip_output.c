@@ -784,7 +784,8 @@ static int __ip_append_data(struct sock *sk, struct sk_buff_head *queue,
 			    int getfrag(void *from, char *to, int offset,
 					int len, int odd, struct sk_buff *skb),
 			    void *from, int length, int transhdrlen,
-			    struct ipcm_cookie *ipc, unsigned int flags)
+			    struct ipcm_cookie *ipc, unsigned int flags,
+			    unsigned int gso_size)
 {
 	struct inet_sock *inet = inet_sk(sk);
 	struct sk_buff *skb;
@@ -801,11 +802,16 @@ static int __ip_append_data(struct sock *sk, struct sk_buff_head *queue,
 	struct rtable *rt = (struct rtable *)cork->dst;
 	struct page *page = NULL;
 	int off = 0;
+	bool paged;
 
 	exthdrlen = transhdrlen ? rt->u.dst.header_len : 0;
 	length += exthdrlen;
 	transhdrlen += exthdrlen;
-	mtu = cork->fragsize;
+	/* A GSO datagram is built as one skb and segmented at gso_size
+	 * later, so it is only bounded by the maximum IP datagram size.
+	 */
+	mtu = gso_size ? 0xFFFF : cork->fragsize;
+	paged = gso_size && (rt->u.dst.dev->features & NETIF_F_SG);
 
 	hh_len = LL_RESERVED_SPACE(rt->u.dst.dev);
 
@@ -862,6 +868,7 @@ static int __ip_append_data(struct sock *sk, struct sk_buff_head *queue,
 			unsigned int fraglen;
 			unsigned int fraggap;
 			unsigned int alloclen;
+			unsigned int pagedlen = 0;
 			struct sk_buff *skb_prev;
 alloc_new_skb:
 			skb_prev = skb;
@@ -882,8 +889,15 @@ alloc_new_skb:
 			if ((flags & MSG_MORE) &&
 			    !(rt->u.dst.dev->features&NETIF_F_SG))
 				alloclen = mtu;
-			else
-				alloclen = datalen + fragheaderlen;
+			else if (!paged)
+				alloclen = fraglen;
+			else {
+				/* only the headers go to the linear area,
+				 * the payload is added as page frags below
+				 */
+				alloclen = min_t(int, fraglen, MAX_HEADER);
+				pagedlen = fraglen - alloclen;
+			}
 
 			/* The last fragment gets additional space at tail.
 			 * Note, with MSG_MORE we overallocate on fragments,
@@ -925,7 +939,7 @@ alloc_new_skb:
 			/*
 			 *	Find where to start putting bytes.
 			 */
-			data = skb_put(skb, fraglen);
+			data = skb_put(skb, fraglen - pagedlen);
 			skb_set_network_header(skb, exthdrlen);
 			skb->transport_header = (skb->network_header +
 						 fragheaderlen);
@@ -941,7 +955,7 @@ alloc_new_skb:
 				pskb_trim_unique(skb_prev, maxfraglen);
 			}
 
-			copy = datalen - transhdrlen - fraggap;
+			copy = datalen - transhdrlen - fraggap - pagedlen;
 			if (copy > 0 && getfrag(from, data + transhdrlen, offset, copy, fraggap, skb) < 0) {
 				err = -EFAULT;
 				kfree_skb(skb);
@@ -949,7 +963,7 @@ alloc_new_skb:
 			}
 
 			offset += copy;
-			length -= datalen - fraggap;
+			length -= copy + transhdrlen;
 			transhdrlen = 0;
 			exthdrlen = 0;
 			csummode = CHECKSUM_NONE;
@@ -1101,7 +1115,7 @@ int ip_append_data(struct sock *sk,
 
 	return __ip_append_data(sk, &sk->sk_write_queue,
 				(struct inet_cork *)&inet->cork, getfrag,
-				from, length, transhdrlen, ipc, flags);
+				from, length, transhdrlen, ipc, flags, 0);
 }
 
 ssize_t	ip_append_page(struct sock *sk, struct page *page,
@@ -1418,8 +1432,10 @@ struct sk_buff *ip_make_skb(struct sock *sk,
 	if (err)
 		return ERR_PTR(err);
 
+	/* ipc->gso_size is only set up by udp_sendmsg(), the only user */
 	err = __ip_append_data(sk, &queue, &cork, getfrag,
-			       from, length, transhdrlen, ipc, flags);
+			       from, length, transhdrlen, ipc, flags,
+			       ipc->gso_size);
 	if (err) {
 		__ip_flush_pending_frames(sk, &queue, &cork);
 		return ERR_PTR(err);
@@ -272,6 +272,7 @@
 #include <net/ip.h>
 #include <net/netdma.h>
 #include <net/sock.h>
+#include <net/busy_poll.h>
 
 #include <asm/uaccess.h>
 #include <asm/ioctls.h>
@@ -511,7 +512,7 @@ unsigned int tcp_poll(struct file *file, struct socket *sock, poll_table *wait)
 	}
 	/* This barrier is coupled with smp_wmb() in tcp_reset() */
 	smp_rmb();
-	if (sk->sk_err)
+	if (sk->sk_err || !skb_queue_empty(&sk->sk_error_queue))
 		mask |= POLLERR;
 
 	return mask;
@@ -1185,9 +1186,11 @@ int tcp_sendmsg(struct kiocb *iocb, struct socket *sock, struct msghdr *msg,
 	struct iovec *iov;
 	struct sock *friend = sk->sk_friend;
 	struct tcp_sock *tp = tcp_sk(sk);
+	struct sock_zerocopy *uarg = NULL;
 	struct sk_buff *skb;
 	struct tcp_skb_cb *tcb;
 	int iovlen, flags, err, copied = 0;
+	bool zc = false;
 	int mss_now = 0, size_goal, copied_syn = 0, offset = 0;
 	long timeo;
 
@@ -1223,6 +1226,25 @@ int tcp_sendmsg(struct kiocb *iocb, struct socket *sock, struct msghdr *msg,
 	/* This should be in poll */
 	clear_bit(SOCK_ASYNC_NOSPACE, &sk->sk_socket->flags);
 
+	if ((flags & MSG_ZEROCOPY) && size && sock_flag(sk, SOCK_ZEROCOPY)) {
+		skb = tcp_write_queue_tail(sk);
+		uarg = sock_zerocopy_realloc(sk, size, skb_zcopy(skb));
+		if (!uarg) {
+			err = -ENOBUFS;
+			goto out_err;
+		}
+
+		/* Pinning and completing pages costs more than copying a
+		 * small write.  Without SG and checksum offload the data is
+		 * copied anyway, the completion then says so.
+		 */
+		zc = !friend && size >= PAGE_SIZE &&
+		     (sk->sk_route_caps & NETIF_F_SG) &&
+		     (sk->sk_route_caps & NETIF_F_ALL_CSUM);
+		if (!zc)
+			uarg->zerocopy = 0;
+	}
+
 	mss_now = tcp_send_mss(sk, &size_goal, flags);
 
 	/* Ok commence sending. */
@@ -1282,7 +1304,7 @@ new_segment:
 					 * fitting to single page.
 					 */
 					skb = sk_stream_alloc_skb(sk,
-							select_size(sk),
+							zc ? 0 : select_size(sk),
 							sk->sk_allocation);
 				}
 				if (!skb)
@@ -1305,7 +1327,20 @@ new_segment:
 				copy = seglen;
 
 			/* Where to copy to? */
-			if (skb_tailroom(skb) > 0) {
+			if (zc) {
+				if (!sk_wmem_schedule(sk, copy))
+					goto wait_for_memory;
+
+				err = skb_zerocopy_iter_stream(sk, skb, from,
+							       copy, uarg);
+				if (err == -EMSGSIZE || err == -EEXIST) {
+					tcp_mark_push(tp, skb);
+					goto new_segment;
+				}
+				if (err < 0)
+					goto do_fault;
+				copy = err;
+			} else if (skb_tailroom(skb) > 0) {
 				/* We have some space in skb head. Superb! */
 				if (copy > skb_tailroom(skb))
 					copy = skb_tailroom(skb);
@@ -1444,6 +1479,7 @@ wait_for_memory:
 out:
 	if (copied)
 		tcp_push(sk, flags, mss_now, tp->nonagle);
+	sock_zerocopy_put(uarg);
 	TCP_CHECK_TIMER(sk);
 	release_sock(sk);
 	task_net_accounting_tx(copied);
@@ -1468,6 +1504,7 @@ do_error:
 	if (copied + copied_syn)
 		goto out;
 out_err:
+	sock_zerocopy_put_abort(uarg);
 	err = sk_stream_error(sk, flags, err);
 	TCP_CHECK_TIMER(sk);
 	release_sock(sk);
@@ -1790,6 +1827,14 @@ int tcp_recvmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 	u32 urg_hole = 0;
 	bool locked = false;
 
+	/* MSG_ZEROCOPY completions */
+	if (unlikely(flags & MSG_ERRQUEUE))
+		return ip_recv_error(sk, msg, len);
+
+	if (sk_can_busy_loop(sk) && skb_queue_empty(&sk->sk_receive_queue) &&
+	    sk->sk_state == TCP_ESTABLISHED)
+		sk_busy_loop(sk, nonblock);
+
 	lock_sock(sk);
 
 	TCP_CHECK_TIMER(sk);
@@ -3545,6 +3590,8 @@ void __init tcp_init(void)
 	       tcp_hashinfo.ehash_size, tcp_hashinfo.bhash_size);
 
 	tcp_register_congestion_control(&tcp_reno);
+
+	tcp_tasklet_init();
 }
 
 EXPORT_SYMBOL(tcp_close);
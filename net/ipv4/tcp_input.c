@@ -3634,12 +3634,36 @@ static int tcp_process_frto(struct sock *sk, int flag)
 	return 0;
 }
 
+/* Set the socket pacing rate to 200 % of the current rate
+ * (mss * cwnd / srtt), so that packet schedulers such as sch_fq can
+ * spread the cwnd over the whole RTT instead of sending it in a burst.
+ */
+static void tcp_update_pacing_rate(struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	u64 rate;
+
+	rate = (u64)tp->mss_cache * 2 * (HZ << 3);
+	rate *= max(tp->snd_cwnd, tp->packets_out);
+
+	/* Correction for small srtt: the minimum srtt is 8 (1 jiffy << 3),
+	 * be conservative and assume srtt = 1 in that case. This also
+	 * covers srtt = 0, when tcp_rtt_estimator() was not yet called.
+	 */
+	if (tp->srtt > 8 + 2)
+		do_div(rate, tp->srtt);
+
+	sk_extended(sk)->sk_pacing_rate = min_t(u64, rate, ~0U);
+}
+
 /* This routine deals with incoming acks, but not outgoing ones. */
 static int tcp_ack(struct sock *sk, struct sk_buff *skb, int flag)
 {
 	struct inet_connection_sock *icsk = inet_csk(sk);
 	struct tcp_sock *tp = tcp_sk(sk);
 	u32 prior_snd_una = tp->snd_una;
+	u32 prior_cwnd = tp->snd_cwnd;
+	u32 prior_rtt = tp->srtt;
 	u32 ack_seq = TCP_SKB_CB(skb)->seq;
 	u32 ack = TCP_SKB_CB(skb)->ack_seq;
 	bool is_dupack = false;
@@ -3743,6 +3767,9 @@ static int tcp_ack(struct sock *sk, struct sk_buff *skb, int flag)
 			tcp_cong_avoid(sk, ack, prior_in_flight);
 	}
 
+	if (tp->srtt != prior_rtt || tp->snd_cwnd != prior_cwnd)
+		tcp_update_pacing_rate(sk);
+
 	if ((flag & FLAG_FORWARD_PROGRESS) || !(flag & FLAG_NOT_DUP))
 		dst_confirm(sk->sk_dst_cache);
 
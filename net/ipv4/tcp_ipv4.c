@@ -72,6 +72,7 @@
 #include <net/xfrm.h>
 #include <net/netdma.h>
 #include <net/secure_seq.h>
+#include <net/busy_poll.h>
 
 #include <linux/inet.h>
 #include <linux/ipv6.h>
@@ -1886,6 +1887,7 @@ process:
 	skb->dev = NULL;
 
 	inet_rps_save_rxhash(sk, skb->rxhash);
+	sk_mark_napi_id(sk, skb);
 
 	bh_lock_sock_nested(sk);
 	ret = 0;
@@ -2066,6 +2068,7 @@ static int tcp_v4_init_sock(struct sock *sk)
 	skb_queue_head_init(&tp->out_of_order_queue);
 	tcp_init_xmit_timers(sk);
 	tcp_prequeue_init(tp);
+	INIT_LIST_HEAD(&tp->tsq_node);
 
 	icsk->icsk_rto = TCP_TIMEOUT_INIT;
 	tp->mdev = TCP_TIMEOUT_INIT;
@@ -104,6 +104,9 @@
 #include <net/route.h>
 #include <net/checksum.h>
 #include <net/xfrm.h>
+#include <net/inet_hashtables.h>
+#include <net/busy_poll.h>
+#include <net/sock_reuseport.h>
 #include <trace/events/udp.h>
 #include "udp_impl.h"
 
@@ -119,6 +122,12 @@ EXPORT_SYMBOL(sysctl_udp_rmem_min);
 int sysctl_udp_wmem_min __read_mostly;
 EXPORT_SYMBOL(sysctl_udp_wmem_min);
 
+/*
+ * Only look up the socket for GRO once somebody asked for UDP_GRO, the
+ * lookup is not free and most hosts never coalesce UDP at all.
+ */
+static int udp_gro_wanted __read_mostly;
+
 atomic_t udp_memory_allocated;
 EXPORT_SYMBOL(udp_memory_allocated);
 
@@ -154,6 +163,34 @@ static int udp_lib_lport_inuse(struct net *net, __u16 num,
 	return 0;
 }
 
+/*
+ * Put a SO_REUSEPORT socket into the group of the sockets bound to the
+ * same address, port, device and owner.  Called with the slot locked.
+ */
+static void udp_reuseport_add_sock(struct sock *sk, struct udp_hslot *hslot)
+{
+	struct net *net = sock_net(sk);
+	struct hlist_nulls_node *node;
+	int uid = sock_i_uid(sk);
+	struct sock *sk2;
+
+	sk_nulls_for_each(sk2, node, &hslot->head) {
+		if (net_eq(sock_net(sk2), net) &&
+		    sk2 != sk &&
+		    sk2->sk_hash == sk->sk_hash &&
+		    sk2->sk_reuseport &&
+		    sk2->sk_bound_dev_if == sk->sk_bound_dev_if &&
+		    sock_i_uid(sk2) == uid &&
+		    inet_rcv_saddr_same(sk, sk2)) {
+			reuseport_add_sock(sk, sk2);
+			return;
+		}
+	}
+
+	/* on failure the socket is only found by the legacy scoring walk */
+	reuseport_alloc(sk);
+}
+
 /**
  *  udp_lib_get_port  -  UDP/-Lite port lookup for IPv4 and IPv6
  *
@@ -218,6 +255,8 @@ found:
 	inet_sk(sk)->num = snum;
 	sk->sk_hash = snum;
 	if (sk_unhashed(sk)) {
+		if (sk->sk_reuseport)
+			udp_reuseport_add_sock(sk, hslot);
 		sk_nulls_add_node_rcu(sk, &hslot->head);
 		sock_prot_inuse_add(sock_net(sk), sk->sk_prot, 1);
 	}
@@ -285,7 +324,7 @@ static struct sock *__udp4_lib_lookup(struct net *net, __be32 saddr,
 		__be16 sport, __be32 daddr, __be16 dport,
 		int dif, struct udp_table *udptable)
 {
-	struct sock *sk, *result;
+	struct sock *sk, *result, *sk2;
 	struct hlist_nulls_node *node;
 	unsigned short hnum = ntohs(dport);
 	u32 hash = udp_hashfn(net, hnum);
@@ -307,6 +346,11 @@ begin:
 			if (reuseport) {
 				phash = inet_ehashfn(net, daddr, hnum,
 						saddr, htons(sport));
+				sk2 = reuseport_select_sock(sk, phash);
+				if (sk2) {
+					result = sk2;
+					goto found;
+				}
 				matches = 1;
 			}
 		} else if (score == badness && reuseport) {
@@ -324,6 +368,7 @@ begin:
 	if (get_nulls_value(node) != hash)
 		goto begin;
 
+found:
 	if (result) {
 		if (unlikely(!atomic_inc_not_zero(&result->sk_refcnt)))
 			result = NULL;
@@ -530,7 +575,8 @@ static void udp4_hwcsum(struct sk_buff *skb, __be32 src, __be32 dst)
 	}
 }
 
-static int udp_send_skb(struct sk_buff *skb, __be32 daddr, __be32 dport)
+static int udp_send_skb(struct sk_buff *skb, __be32 daddr, __be32 dport,
+			unsigned int gso_size)
 {
 	struct sock *sk = skb->sk;
 	struct inet_sock *inet = inet_sk(sk);
@@ -551,6 +597,35 @@ static int udp_send_skb(struct sk_buff *skb, __be32 daddr, __be32 dport)
 	uh->len = htons(len);
 	uh->check = 0;
 
+	if (gso_size && len - sizeof(*uh) > gso_size) {
+		const int hlen = skb_network_header_len(skb) + sizeof(*uh);
+
+		if (hlen + gso_size > dst_mtu(&rt->u.dst) ||
+		    len - sizeof(*uh) > gso_size * UDP_MAX_SEGMENTS ||
+		    sk->sk_no_check == UDP_CSUM_NOXMIT) {
+			kfree_skb(skb);
+			return -EINVAL;
+		}
+		/* segments get their checksum patched up in
+		 * __udp_gso_segment(), which needs the partial one */
+		if (skb->ip_summed != CHECKSUM_PARTIAL || is_udplite) {
+			kfree_skb(skb);
+			return -EIO;
+		}
+
+		/* every segment fits the path MTU: let them carry DF the
+		 * way separately sent datagrams would */
+		if (ip_dont_fragment(sk, &rt->u.dst))
+			ip_hdr(skb)->frag_off |= htons(IP_DF);
+
+		skb_shinfo(skb)->gso_size = gso_size;
+		skb_shinfo(skb)->gso_type = SKB_GSO_UDP_L4;
+		skb_shinfo(skb)->gso_segs = DIV_ROUND_UP(len - sizeof(*uh),
+							 gso_size);
+		udp4_hwcsum(skb, rt->rt_src, daddr);
+		goto send;
+	}
+
 	if (is_udplite)  				 /*     UDP-Lite      */
 		csum = udplite_csum(skb);
 
@@ -602,7 +677,7 @@ int udp_push_pending_frames(struct sock *sk)
 	if (!skb)
 		goto out;
 
-	err = udp_send_skb(skb, fl->fl4_dst, fl->fl_ip_dport);
+	err = udp_send_skb(skb, fl->fl4_dst, fl->fl_ip_dport, 0);
 
 out:
 	up->len = 0;
@@ -611,6 +686,46 @@ out:
 }
 EXPORT_SYMBOL(udp_push_pending_frames);
 
+static int __udp_cmsg_send(struct cmsghdr *cmsg, u16 *gso_size)
+{
+	switch (cmsg->cmsg_type) {
+	case UDP_SEGMENT:
+		if (cmsg->cmsg_len != CMSG_LEN(sizeof(__u16)))
+			return -EINVAL;
+		*gso_size = *(__u16 *)CMSG_DATA(cmsg);
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+/*
+ * Parse the SOL_UDP control messages. Returns > 0 if there are others
+ * left for ip_cmsg_send().
+ */
+static int udp_cmsg_send(struct sock *sk, struct msghdr *msg, u16 *gso_size)
+{
+	struct cmsghdr *cmsg;
+	int need_ip = 0;
+	int err;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (!CMSG_OK(msg, cmsg))
+			return -EINVAL;
+
+		if (cmsg->cmsg_level != SOL_UDP) {
+			need_ip = 1;
+			continue;
+		}
+
+		err = __udp_cmsg_send(cmsg, gso_size);
+		if (err)
+			return err;
+	}
+
+	return need_ip;
+}
+
 int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 		size_t len)
 {
@@ -642,6 +757,7 @@ int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 
 	ipc.opt = NULL;
 	ipc.shtx.flags = 0;
+	ipc.gso_size = up->gso_size;
 
 	getfrag = is_udplite ? udplite_getfrag : ip_generic_getfrag;
 
@@ -695,7 +811,9 @@ int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 	if (err)
 		return err;
 	if (msg->msg_controllen) {
-		err = ip_cmsg_send(sock_net(sk), msg, &ipc);
+		err = udp_cmsg_send(sk, msg, &ipc.gso_size);
+		if (err > 0)
+			err = ip_cmsg_send(sock_net(sk), msg, &ipc);
 		if (err)
 			return err;
 		if (ipc.opt)
@@ -781,14 +899,17 @@ back_from_confirm:
 	if (!ipc.addr)
 		daddr = ipc.addr = rt->rt_dst;
 
-	/* Lockless fast path for the non-corking case. */
+	/* Lockless fast path for the non-corking case. This is also the
+	 * only one doing segmentation offload: corked data is always sent
+	 * as a single datagram.
+	 */
 	if (!corkreq) {
 		skb = ip_make_skb(sk, getfrag, msg->msg_iov, ulen,
 				  sizeof(struct udphdr), &ipc, &rt,
 				  msg->msg_flags);
 		err = PTR_ERR(skb);
 		if (skb && !IS_ERR(skb))
-			err = udp_send_skb(skb, daddr, dport);
+			err = udp_send_skb(skb, daddr, dport, ipc.gso_size);
 		goto out;
 	}
 
@@ -1057,6 +1178,12 @@ try_again:
 	if (inet->cmsg_flags)
 		ip_cmsg_recv(msg, skb);
 
+	if (udp_sk(sk)->gro_enabled && skb_is_gso(skb)) {
+		int gso_size = skb_shinfo(skb)->gso_size;
+
+		put_cmsg(msg, SOL_UDP, UDP_GRO, sizeof(gso_size), &gso_size);
+	}
+
 	err = copied;
 	if (!(flags & MSG_PEEK))
 		task_net_accounting_rx(copied);
@@ -1112,6 +1239,8 @@ void udp_lib_unhash(struct sock *sk)
 		struct udp_hslot *hslot = &udptable->hash[hash];
 
 		spin_lock_bh(&hslot->lock);
+		if (sk_extended(sk)->sk_reuseport_cb)
+			reuseport_detach_sock(sk);
 		if (sk_nulls_del_node_init_rcu(sk)) {
 			inet_sk(sk)->num = 0;
 			sock_prot_inuse_add(sock_net(sk), sk->sk_prot, -1);
@@ -1127,6 +1256,7 @@ static int __udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 
 	if (inet_sk(sk)->daddr)
 		sock_rps_save_rxhash(sk, skb->rxhash);
+	sk_mark_napi_id(sk, skb);
 
 	rc = sock_queue_rcv_skb(sk, skb);
 	if (rc < 0) {
@@ -1145,15 +1275,7 @@ static int __udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 	return 0;
 }
 
-/* returns:
- *  -1: error
- *   0: success
- *  >0: "udp encap" protocol resubmission
- *
- * Note that in the success and error cases, the skb is assumed to
- * have either been requeued or freed.
- */
-int udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
+static int udp_queue_rcv_one_skb(struct sock *sk, struct sk_buff *skb)
 {
 	struct udp_sock *up = udp_sk(sk);
 	int rc;
@@ -1259,6 +1381,68 @@ drop:
 	return -1;
 }
 
+static struct sk_buff *__udp_gso_segment(struct sk_buff *gso_skb,
+					 int features);
+
+/*
+ * A datagram coalesced by udp4_gro_receive() reached a socket that
+ * cannot take it as is (UDP_GRO was turned off after the lookup, or the
+ * socket became an encapsulation one): split it back into the datagrams
+ * it was made of.
+ */
+static int udp_queue_rcv_segs(struct sock *sk, struct sk_buff *skb)
+{
+	struct sk_buff *segs, *next;
+	int ret;
+
+	segs = __udp_gso_segment(skb, NETIF_F_SG | NETIF_F_HW_CSUM);
+	if (IS_ERR_OR_NULL(segs)) {
+		UDP_INC_STATS_BH(sock_net(sk), UDP_MIB_INERRORS,
+				 IS_UDPLITE(sk));
+		kfree_skb(skb);
+		return -1;
+	}
+	consume_skb(skb);
+
+	for (; segs; segs = next) {
+		struct iphdr *iph = ip_hdr(segs);
+
+		next = segs->next;
+		segs->next = NULL;
+
+		iph->tot_len = htons(segs->len - skb_network_offset(segs));
+		ip_send_check(iph);
+		__skb_pull(segs, skb_transport_offset(segs));
+
+		/* no resubmission from here: the encap handler was not
+		 * there when the datagrams got merged, just drop them */
+		ret = udp_queue_rcv_one_skb(sk, segs);
+		if (ret > 0)
+			kfree_skb(segs);
+	}
+	return 0;
+}
+
+/* returns:
+ *  -1: error
+ *   0: success
+ *  >0: "udp encap" protocol resubmission
+ *
+ * Note that in the success and error cases, the skb is assumed to
+ * have either been requeued or freed.
+ */
+int udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
+{
+	struct udp_sock *up = udp_sk(sk);
+
+	if (unlikely(skb_is_gso(skb) &&
+		     (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4) &&
+		     (!up->gro_enabled || up->encap_type)))
+		return udp_queue_rcv_segs(sk, skb);
+
+	return udp_queue_rcv_one_skb(sk, skb);
+}
+
 /*
  *	Multicasts and broadcasts go to each listener.
  *
@@ -1504,6 +1688,23 @@ int udp_lib_setsockopt(struct sock *sk, int level, int optname,
 		}
 		break;
 
+	/* The segmentation and coalescing offloads only exist for IPv4. */
+	case UDP_SEGMENT:
+		if (is_udplite || sk->sk_family != AF_INET)
+			return -ENOPROTOOPT;
+		if (val < 0 || val > USHORT_MAX)
+			return -EINVAL;
+		up->gso_size = val;
+		break;
+
+	case UDP_GRO:
+		if (is_udplite || sk->sk_family != AF_INET)
+			return -ENOPROTOOPT;
+		if (val && !udp_gro_wanted)
+			udp_gro_wanted = 1;
+		up->gro_enabled = !!val;
+		break;
+
 	/*
 	 * 	UDP-Lite's partial checksum coverage (RFC 3828).
 	 */
@@ -1586,6 +1787,14 @@ int udp_lib_getsockopt(struct sock *sk, int level, int optname,
 		val = up->encap_type;
 		break;
 
+	case UDP_SEGMENT:
+		val = up->gso_size;
+		break;
+
+	case UDP_GRO:
+		val = up->gro_enabled;
+		break;
+
 	/* The following two cannot be changed on UDP sockets, the return is
 	 * always 0 (which corresponds to the full checksum coverage of UDP). */
 	case UDPLITE_SEND_CSCOV:
@@ -1940,6 +2149,62 @@ int udp4_ufo_send_check(struct sk_buff *skb)
 	return 0;
 }
 
+/*
+ * Split a SKB_GSO_UDP_L4 datagram, which starts at the UDP header, into
+ * datagrams of gso_size payload each. Used both on output and to undo
+ * UDP GRO for sockets that did not ask for it.
+ */
+static struct sk_buff *__udp_gso_segment(struct sk_buff *gso_skb,
+					 int features)
+{
+	struct sk_buff *segs, *seg;
+	struct udphdr *uh;
+	unsigned int mss;
+	u32 oldlen;
+
+	mss = skb_shinfo(gso_skb)->gso_size;
+	if (unlikely(gso_skb->len <= sizeof(*uh) + mss))
+		return ERR_PTR(-EINVAL);
+
+	if (skb_gso_ok(gso_skb, features | NETIF_F_GSO_ROBUST)) {
+		/* Packet is from an untrusted source, reset gso_segs. */
+		skb_shinfo(gso_skb)->gso_segs =
+			DIV_ROUND_UP(gso_skb->len - sizeof(*uh), mss);
+		return NULL;
+	}
+
+	if (!pskb_may_pull(gso_skb, sizeof(*uh)))
+		return ERR_PTR(-EINVAL);
+
+	oldlen = (u32)~gso_skb->len;
+	__skb_pull(gso_skb, sizeof(*uh));
+
+	segs = skb_segment(gso_skb, features);
+	if (IS_ERR_OR_NULL(segs))
+		return segs;
+
+	/* The UDP header was copied along, only the length and the
+	 * checksum differ between the segments.
+	 */
+	for (seg = segs; seg; seg = seg->next) {
+		unsigned int len = seg->len - skb_transport_offset(seg);
+
+		uh = udp_hdr(seg);
+		uh->len = htons(len);
+		uh->check = ~csum_fold((__force __wsum)((__force u32)uh->check +
+							(__force u32)htonl(oldlen + len)));
+
+		if (seg->ip_summed == CHECKSUM_NONE) {
+			uh->check = csum_fold(csum_partial(uh, sizeof(*uh),
+							   seg->csum));
+			if (uh->check == 0)
+				uh->check = CSUM_MANGLED_0;
+		}
+	}
+
+	return segs;
+}
+
 struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, int features)
 {
 	struct sk_buff *segs = ERR_PTR(-EINVAL);
@@ -1947,6 +2212,9 @@ struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, int features)
 	int offset;
 	__wsum csum;
 
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4)
+		return __udp_gso_segment(skb, features);
+
 	mss = skb_shinfo(skb)->gso_size;
 	if (unlikely(skb->len <= mss))
 		goto out;
@@ -1982,3 +2250,111 @@ out:
 	return segs;
 }
 
+struct sk_buff **udp4_gro_receive(struct sk_buff **head, struct sk_buff *skb)
+{
+	struct iphdr *iph = skb_gro_network_header(skb);
+	struct sk_buff **pp = NULL;
+	struct udphdr *uh, *uh2;
+	struct sk_buff *p;
+	struct sock *sk;
+	unsigned int ulen, ulen2;
+	unsigned int hlen, off;
+	int flush = 1;
+
+	if (!udp_gro_wanted)
+		goto out;
+
+	off = skb_gro_offset(skb);
+	hlen = off + sizeof(*uh);
+	uh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		uh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!uh))
+			goto out;
+	}
+
+	/* datagrams without checksum or with trailing padding are left
+	 * alone, the merged one could not be told apart from them */
+	ulen = ntohs(uh->len);
+	if (!uh->check || ulen != skb_gro_len(skb) || ulen <= sizeof(*uh))
+		goto out;
+
+	switch (skb->ip_summed) {
+	case CHECKSUM_COMPLETE:
+		if (!csum_tcpudp_magic(iph->saddr, iph->daddr, ulen,
+				       IPPROTO_UDP, skb->csum)) {
+			skb->ip_summed = CHECKSUM_UNNECESSARY;
+			break;
+		}
+
+		/* fall through */
+	case CHECKSUM_NONE:
+		goto out;
+	}
+
+	sk = __udp4_lib_lookup(dev_net(skb->dev), iph->saddr, uh->source,
+			       iph->daddr, uh->dest, skb->dev->ifindex,
+			       &udp_table);
+	if (!sk)
+		goto out;
+	if (!udp_sk(sk)->gro_enabled || udp_sk(sk)->encap_type) {
+		sock_put(sk);
+		goto out;
+	}
+	sock_put(sk);
+
+	flush = 0;
+	skb_gro_pull(skb, sizeof(*uh));
+
+	for (; (p = *head); head = &p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		uh2 = udp_hdr(p);
+
+		if (*(u32 *)&uh->source ^ *(u32 *)&uh2->source) {
+			NAPI_GRO_CB(p)->same_flow = 0;
+			continue;
+		}
+
+		goto found;
+	}
+
+	goto out;
+
+found:
+	/* A longer datagram cannot be merged, a shorter one is merged but
+	 * ends the train. Stop at UDP_MAX_SEGMENTS as well, the truesize
+	 * of a small packet flood would otherwise grow without bound.
+	 */
+	ulen2 = ntohs(uh2->len);
+	if (ulen > ulen2 || NAPI_GRO_CB(p)->flush ||
+	    skb_gro_receive(head, skb) || ulen != ulen2 ||
+	    NAPI_GRO_CB(*head)->count >= UDP_MAX_SEGMENTS)
+		pp = head;
+
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+int udp4_gro_complete(struct sk_buff *skb)
+{
+	struct iphdr *iph = ip_hdr(skb);
+	struct udphdr *uh = udp_hdr(skb);
+	unsigned int len = skb->len - skb_transport_offset(skb);
+
+	uh->len = htons(len);
+	uh->check = ~csum_tcpudp_magic(iph->saddr, iph->daddr, len,
+				       IPPROTO_UDP, 0);
+
+	skb->csum_start = skb_transport_header(skb) - skb->head;
+	skb->csum_offset = offsetof(struct udphdr, check);
+	skb->ip_summed = CHECKSUM_PARTIAL;
+
+	skb_shinfo(skb)->gso_segs = NAPI_GRO_CB(skb)->count;
+	skb_shinfo(skb)->gso_type = SKB_GSO_UDP_L4;
+
+	return 0;
+}
@@ -21,6 +21,7 @@
 #include <net/inet_hashtables.h>
 #include <net/inet6_hashtables.h>
 #include <net/secure_seq.h>
+#include <net/sock_reuseport.h>
 #include <net/ip.h>
 
 void __inet6_hash(struct sock *sk)
@@ -34,6 +35,7 @@ void __inet6_hash(struct sock *sk)
 
 		ilb = &hashinfo->listening_hash[inet_sk_listen_hashfn(sk)];
 		spin_lock(&ilb->lock);
+		inet_reuseport_add_sock(sk, ilb);
 		__sk_nulls_add_node_rcu(sk, &ilb->head);
 		spin_unlock(&ilb->lock);
 	} else {
@@ -154,7 +156,7 @@ struct sock *inet6_lookup_listener(struct net *net,
 {
 	struct sock *sk;
 	const struct hlist_nulls_node *node;
-	struct sock *result;
+	struct sock *result, *sk2;
 	int score, hiscore, matches = 0, reuseport = 0;
 	u32 phash = 0;
 	unsigned int hash = inet_lhashfn(net, hnum);
@@ -173,6 +175,11 @@ begin:
 			if (reuseport) {
 				phash = inet6_ehashfn(net, daddr, hnum,
 							saddr, sport);
+				sk2 = reuseport_select_sock(sk, phash);
+				if (sk2) {
+					result = sk2;
+					goto found;
+				}
 				matches = 1;
 			}
 		} else if (score == hiscore && reuseport) {
@@ -189,6 +196,7 @@ begin:
 	 */
 	if (get_nulls_value(node) != hash + LISTENING_NULLS_BASE)
 		goto begin;
+found:
 	if (result) {
 		if (unlikely(!atomic_inc_not_zero(&result->sk_refcnt)))
 			result = NULL;
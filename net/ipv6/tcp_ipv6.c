@@ -1869,6 +1869,7 @@ static int tcp_v6_init_sock(struct sock *sk)
 	skb_queue_head_init(&tp->out_of_order_queue);
 	tcp_init_xmit_timers(sk);
 	tcp_prequeue_init(tp);
+	INIT_LIST_HEAD(&tp->tsq_node);
 
 	icsk->icsk_rto = TCP_TIMEOUT_INIT;
 	tp->mdev = TCP_TIMEOUT_INIT;
@@ -2093,6 +2094,17 @@ void tcp6_proc_exit(struct net *net)
 }
 #endif
 
+/* as tcp_recvmsg(), but MSG_ZEROCOPY completions come with IPv6 cmsgs */
+static int tcp_v6_recvmsg(struct kiocb *iocb, struct sock *sk,
+			  struct msghdr *msg, size_t len, int nonblock,
+			  int flags, int *addr_len)
+{
+	if (unlikely(flags & MSG_ERRQUEUE))
+		return ipv6_recv_error(sk, msg, len);
+
+	return tcp_recvmsg(iocb, sk, msg, len, nonblock, flags, addr_len);
+}
+
 struct proto tcpv6_prot = {
 	.name			= "TCPv6",
 	.owner			= THIS_MODULE,
@@ -2106,7 +2118,7 @@ struct proto tcpv6_prot = {
 	.shutdown		= tcp_shutdown,
 	.setsockopt		= tcp_setsockopt,
 	.getsockopt		= tcp_getsockopt,
-	.recvmsg		= tcp_recvmsg,
+	.recvmsg		= tcp_v6_recvmsg,
 	.backlog_rcv		= tcp_v6_do_rcv,
 	.hash			= tcp_v6_hash,
 	.unhash			= inet_unhash,
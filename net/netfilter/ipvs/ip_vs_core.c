@@ -102,25 +102,37 @@ void ip_vs_init_hash_table(struct list_head *table, int rows)
 		INIT_LIST_HEAD(&table[rows]);
 }
 
+/* Softirq context only: the per cpu counters are not otherwise protected */
+static inline void
+ip_vs_cpu_stats_in(struct ip_vs_stats *stats, struct sk_buff *skb)
+{
+	struct ip_vs_cpu_stats *s = this_cpu_ptr(stats->cpustats);
+
+	s->inpkts++;
+	u64_stats_update_begin(&s->syncp);
+	s->inbytes += skb->len;
+	u64_stats_update_end(&s->syncp);
+}
+
+static inline void
+ip_vs_cpu_stats_out(struct ip_vs_stats *stats, struct sk_buff *skb)
+{
+	struct ip_vs_cpu_stats *s = this_cpu_ptr(stats->cpustats);
+
+	s->outpkts++;
+	u64_stats_update_begin(&s->syncp);
+	s->outbytes += skb->len;
+	u64_stats_update_end(&s->syncp);
+}
+
 static inline void
 ip_vs_in_stats(struct ip_vs_conn *cp, struct sk_buff *skb)
 {
 	struct ip_vs_dest *dest = cp->dest;
 	if (dest && (dest->flags & IP_VS_DEST_F_AVAILABLE)) {
-		spin_lock(&dest->stats.lock);
-		dest->stats.ustats.inpkts++;
-		dest->stats.ustats.inbytes += skb->len;
-		spin_unlock(&dest->stats.lock);
-
-		spin_lock(&dest->svc->stats.lock);
-		dest->svc->stats.ustats.inpkts++;
-		dest->svc->stats.ustats.inbytes += skb->len;
-		spin_unlock(&dest->svc->stats.lock);
-
-		spin_lock(&ip_vs_stats.lock);
-		ip_vs_stats.ustats.inpkts++;
-		ip_vs_stats.ustats.inbytes += skb->len;
-		spin_unlock(&ip_vs_stats.lock);
+		ip_vs_cpu_stats_in(&dest->stats, skb);
+		ip_vs_cpu_stats_in(&dest->svc->stats, skb);
+		ip_vs_cpu_stats_in(&ip_vs_stats, skb);
 	}
 }
 
@@ -130,20 +142,9 @@ ip_vs_out_stats(struct ip_vs_conn *cp, struct sk_buff *skb)
 {
 	struct ip_vs_dest *dest = cp->dest;
 	if (dest && (dest->flags & IP_VS_DEST_F_AVAILABLE)) {
-		spin_lock(&dest->stats.lock);
-		dest->stats.ustats.outpkts++;
-		dest->stats.ustats.outbytes += skb->len;
-		spin_unlock(&dest->stats.lock);
-
-		spin_lock(&dest->svc->stats.lock);
-		dest->svc->stats.ustats.outpkts++;
-		dest->svc->stats.ustats.outbytes += skb->len;
-		spin_unlock(&dest->svc->stats.lock);
-
-		spin_lock(&ip_vs_stats.lock);
-		ip_vs_stats.ustats.outpkts++;
-		ip_vs_stats.ustats.outbytes += skb->len;
-		spin_unlock(&ip_vs_stats.lock);
+		ip_vs_cpu_stats_out(&dest->stats, skb);
+		ip_vs_cpu_stats_out(&dest->svc->stats, skb);
+		ip_vs_cpu_stats_out(&ip_vs_stats, skb);
 	}
 }
 
@@ -151,17 +152,9 @@ ip_vs_out_stats(struct ip_vs_conn *cp, struct sk_buff *skb)
 static inline void
 ip_vs_conn_stats(struct ip_vs_conn *cp, struct ip_vs_service *svc)
 {
-	spin_lock(&cp->dest->stats.lock);
-	cp->dest->stats.ustats.conns++;
-	spin_unlock(&cp->dest->stats.lock);
-
-	spin_lock(&svc->stats.lock);
-	svc->stats.ustats.conns++;
-	spin_unlock(&svc->stats.lock);
-
-	spin_lock(&ip_vs_stats.lock);
-	ip_vs_stats.ustats.conns++;
-	spin_unlock(&ip_vs_stats.lock);
+	this_cpu_ptr(cp->dest->stats.cpustats)->conns++;
+	this_cpu_ptr(svc->stats.cpustats)->conns++;
+	this_cpu_ptr(ip_vs_stats.cpustats)->conns++;
 }
 
 
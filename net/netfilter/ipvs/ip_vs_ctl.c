@@ -35,6 +35,7 @@
 #include <linux/netfilter.h>
 #include <linux/netfilter_ipv4.h>
 #include <linux/mutex.h>
+#include <linux/log2.h>
 
 #include <net/net_namespace.h>
 #include <net/ip.h>
@@ -86,6 +87,9 @@ int sysctl_ip_vs_cache_bypass = 0;
 int sysctl_ip_vs_expire_nodest_conn = 0;
 int sysctl_ip_vs_expire_quiescent_template = 0;
 int sysctl_ip_vs_sync_threshold[2] = { 3, 50 };
+int sysctl_ip_vs_sync_ports = 1;
+int sysctl_ip_vs_sync_qlen_max;
+static int sync_qlen_max_min = 1;
 int sysctl_ip_vs_nat_icmp_send = 0;
 
 
@@ -498,6 +502,18 @@ ip_vs_service_get(int af, __u32 fwmark, __u16 protocol,
 }
 
 
+static void ip_vs_service_free(struct ip_vs_service *svc)
+{
+	free_percpu(svc->stats.cpustats);
+	kfree(svc);
+}
+
+static void ip_vs_dest_free(struct ip_vs_dest *dest)
+{
+	free_percpu(dest->stats.cpustats);
+	kfree(dest);
+}
+
 static inline void
 __ip_vs_bind_svc(struct ip_vs_dest *dest, struct ip_vs_service *svc)
 {
@@ -512,7 +528,7 @@ __ip_vs_unbind_svc(struct ip_vs_dest *dest)
 
 	dest->svc = NULL;
 	if (atomic_dec_and_test(&svc->refcnt))
-		kfree(svc);
+		ip_vs_service_free(svc);
 }
 
 
@@ -712,7 +728,7 @@ ip_vs_trash_get_dest(struct ip_vs_service *svc, const union nf_inet_addr *daddr,
 			list_del(&dest->n_list);
 			ip_vs_dst_reset(dest);
 			__ip_vs_unbind_svc(dest);
-			kfree(dest);
+			ip_vs_dest_free(dest);
 		}
 	}
 
@@ -737,7 +753,7 @@ static void ip_vs_trash_cleanup(void)
 		list_del(&dest->n_list);
 		ip_vs_dst_reset(dest);
 		__ip_vs_unbind_svc(dest);
-		kfree(dest);
+		ip_vs_dest_free(dest);
 	}
 }
 
@@ -747,6 +763,14 @@ ip_vs_zero_stats(struct ip_vs_stats *stats)
 {
 	spin_lock_bh(&stats->lock);
 
+	/* the per cpu counters keep running: remember where we are */
+	ip_vs_read_cpu_stats(stats);
+	stats->ustats0.conns += stats->ustats.conns;
+	stats->ustats0.inpkts += stats->ustats.inpkts;
+	stats->ustats0.outpkts += stats->ustats.outpkts;
+	stats->ustats0.inbytes += stats->ustats.inbytes;
+	stats->ustats0.outbytes += stats->ustats.outbytes;
+
 	memset(&stats->ustats, 0, sizeof(stats->ustats));
 	ip_vs_zero_estimator(stats);
 
@@ -847,6 +871,12 @@ ip_vs_new_dest(struct ip_vs_service *svc, struct ip_vs_dest_user_kern *udest,
 		pr_err("%s(): no memory.\n", __func__);
 		return -ENOMEM;
 	}
+	dest->stats.cpustats = alloc_percpu(struct ip_vs_cpu_stats);
+	if (!dest->stats.cpustats) {
+		pr_err("%s(): no memory.\n", __func__);
+		kfree(dest);
+		return -ENOMEM;
+	}
 
 	dest->af = svc->af;
 	dest->protocol = svc->protocol;
@@ -1068,7 +1098,7 @@ static void __ip_vs_del_dest(struct ip_vs_dest *dest)
 		   and only one user context can update virtual service at a
 		   time, so the operation here is OK */
 		atomic_dec(&dest->svc->refcnt);
-		kfree(dest);
+		ip_vs_dest_free(dest);
 	} else {
 		IP_VS_DBG_BUF(3, "Moving dest %s:%u into trash, "
 			      "dest->refcnt=%d\n",
@@ -1182,6 +1212,12 @@ ip_vs_add_service(struct ip_vs_service_user_kern *u,
 		ret = -ENOMEM;
 		goto out_err;
 	}
+	svc->stats.cpustats = alloc_percpu(struct ip_vs_cpu_stats);
+	if (!svc->stats.cpustats) {
+		IP_VS_DBG(1, "%s(): no memory\n", __func__);
+		ret = -ENOMEM;
+		goto out_err;
+	}
 
 	/* I'm the first user of the service */
 	atomic_set(&svc->usecnt, 1);
@@ -1235,7 +1271,7 @@ ip_vs_add_service(struct ip_vs_service_user_kern *u,
 			ip_vs_app_inc_put(svc->inc);
 			local_bh_enable();
 		}
-		kfree(svc);
+		ip_vs_service_free(svc);
 	}
 	ip_vs_scheduler_put(sched);
 
@@ -1378,7 +1414,7 @@ static void __ip_vs_del_service(struct ip_vs_service *svc)
 	 *    Free the service if nobody refers to it
 	 */
 	if (atomic_read(&svc->refcnt) == 0)
-		kfree(svc);
+		ip_vs_service_free(svc);
 
 	/* decrease the module use count */
 	ip_vs_use_count_dec();
@@ -1536,6 +1572,24 @@ proc_do_sync_threshold(ctl_table *table, int write,
 }
 
 
+static int
+proc_do_sync_ports(ctl_table *table, int write,
+		   void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	int *valp = table->data;
+	int val = *valp;
+	int rc;
+
+	rc = proc_dointvec(table, write, buffer, lenp, ppos);
+	if (write && (*valp < 1 || *valp > IP_VS_SYNC_PORTS_MAX ||
+		      !is_power_of_2(*valp))) {
+		/* Restore the correct value */
+		*valp = val;
+	}
+	return rc;
+}
+
+
 /*
  *	IPVS sysctl table (under the /proc/sys/net/ipv4/vs/)
  */
@@ -1699,6 +1753,21 @@ static struct ctl_table vs_vars[] = {
 		.mode		= 0644,
 		.proc_handler	= proc_do_sync_threshold,
 	},
+	{
+		.procname	= "sync_ports",
+		.data		= &sysctl_ip_vs_sync_ports,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_do_sync_ports,
+	},
+	{
+		.procname	= "sync_qlen_max",
+		.data		= &sysctl_ip_vs_sync_qlen_max,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &sync_qlen_max_min,
+	},
 	{
 		.procname	= "nat_icmp_send",
 		.data		= &sysctl_ip_vs_nat_icmp_send,
@@ -1953,6 +2022,7 @@ static int ip_vs_stats_show(struct seq_file *seq, void *v)
 		   "   Conns  Packets  Packets            Bytes            Bytes\n");
 
 	spin_lock_bh(&ip_vs_stats.lock);
+	ip_vs_read_cpu_stats(&ip_vs_stats);
 	seq_printf(seq, "%8X %8X %8X %16LX %16LX\n\n", ip_vs_stats.ustats.conns,
 		   ip_vs_stats.ustats.inpkts, ip_vs_stats.ustats.outpkts,
 		   (unsigned long long) ip_vs_stats.ustats.inbytes,
@@ -2205,6 +2275,7 @@ static void
 ip_vs_copy_stats(struct ip_vs_stats_user *dst, struct ip_vs_stats *src)
 {
 	spin_lock_bh(&src->lock);
+	ip_vs_read_cpu_stats(src);
 	memcpy(dst, &src->ustats, sizeof(*dst));
 	spin_unlock_bh(&src->lock);
 }
@@ -2580,6 +2651,7 @@ static int ip_vs_genl_fill_stats(struct sk_buff *skb, int container_type,
 		return -EMSGSIZE;
 
 	spin_lock_bh(&stats->lock);
+	ip_vs_read_cpu_stats(stats);
 
 	NLA_PUT_U32(skb, IPVS_STATS_ATTR_CONNS, stats->ustats.conns);
 	NLA_PUT_U32(skb, IPVS_STATS_ATTR_INPKTS, stats->ustats.inpkts);
@@ -3376,9 +3448,18 @@ int __init ip_vs_control_init(void)
 
 	EnterFunction(2);
 
+	sysctl_ip_vs_sync_qlen_max = max(nr_free_buffer_pages() / 32, 1U);
+
+	ip_vs_stats.cpustats = alloc_percpu(struct ip_vs_cpu_stats);
+	if (!ip_vs_stats.cpustats) {
+		pr_err("%s(): alloc_percpu failed.\n", __func__);
+		return -ENOMEM;
+	}
+
 	ret = nf_register_sockopt(&ip_vs_sockopts);
 	if (ret) {
 		pr_err("cannot register sockopt.\n");
+		free_percpu(ip_vs_stats.cpustats);
 		return ret;
 	}
 
@@ -3386,6 +3467,7 @@ int __init ip_vs_control_init(void)
 	if (ret) {
 		pr_err("cannot register Generic Netlink interface.\n");
 		nf_unregister_sockopt(&ip_vs_sockopts);
+		free_percpu(ip_vs_stats.cpustats);
 		return ret;
 	}
 
@@ -3425,5 +3507,6 @@ void ip_vs_control_cleanup(void)
 	proc_net_remove(&init_net, "ip_vs");
 	ip_vs_genl_unregister();
 	nf_unregister_sockopt(&ip_vs_sockopts);
+	free_percpu(ip_vs_stats.cpustats);
 	LeaveFunction(2);
 }
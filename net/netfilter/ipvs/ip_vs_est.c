@@ -69,6 +69,7 @@ static void estimation_timer(unsigned long arg)
 		s = container_of(e, struct ip_vs_stats, est);
 
 		spin_lock(&s->lock);
+		ip_vs_read_cpu_stats(s);
 		n_conns = s->ustats.conns;
 		n_inpkts = s->ustats.inpkts;
 		n_outpkts = s->ustats.outpkts;
@@ -106,6 +107,41 @@ static void estimation_timer(unsigned long arg)
 	mod_timer(&est_timer, jiffies + 2*HZ);
 }
 
+/*
+ * Fold the per cpu counters into stats->ustats, relative to the values
+ * at the last zeroing. Caller must hold stats->lock.
+ */
+void ip_vs_read_cpu_stats(struct ip_vs_stats *stats)
+{
+	struct ip_vs_stats_user *sum = &stats->ustats;
+	u32 conns = 0, inpkts = 0, outpkts = 0;
+	u64 inbytes = 0, outbytes = 0;
+	int i;
+
+	for_each_possible_cpu(i) {
+		struct ip_vs_cpu_stats *s = per_cpu_ptr(stats->cpustats, i);
+		unsigned int start;
+		u64 in, out;
+
+		conns += s->conns;
+		inpkts += s->inpkts;
+		outpkts += s->outpkts;
+		do {
+			start = u64_stats_fetch_begin_bh(&s->syncp);
+			in = s->inbytes;
+			out = s->outbytes;
+		} while (u64_stats_fetch_retry_bh(&s->syncp, start));
+		inbytes += in;
+		outbytes += out;
+	}
+
+	sum->conns = conns - stats->ustats0.conns;
+	sum->inpkts = inpkts - stats->ustats0.inpkts;
+	sum->outpkts = outpkts - stats->ustats0.outpkts;
+	sum->inbytes = inbytes - stats->ustats0.inbytes;
+	sum->outbytes = outbytes - stats->ustats0.outbytes;
+}
+
 void ip_vs_new_estimator(struct ip_vs_stats *stats)
 {
 	struct ip_vs_estimator *est = &stats->est;
@@ -0,0 +1,395 @@
+/*
+ * IPVS:        Maglev Hashing scheduling module
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Changes:
+ *
+ */
+
+/*
+ * The mh algorithm is to assign a preference list of all the lookup
+ * table positions to each destination and populate the table with
+ * the most-preferred position of destinations. Then it is to select
+ * destination with the hash key of source IP address through looking
+ * up the lookup table.
+ *
+ * Every destination gets a permutation of the table positions derived
+ * from two hashes of its address and port:
+ *
+ *       offset <- h1(dest) mod M;
+ *       skip   <- h2(dest) mod (M - 1) + 1;
+ *       permutation[j] <- (offset + j * skip) mod M;
+ *
+ * The table is filled in rounds, in each round every destination takes
+ * the next free positions of its permutation, as many as its weight
+ * divided by the gcd of all the weights. M is a prime, so that every
+ * permutation covers the whole table.
+ *
+ * The permutations only depend on the destinations themselves, so when
+ * a server is added or removed the table is rebuilt with almost all
+ * the positions of the other servers left in place and only a small
+ * part of the connections is remapped. Since no random seed is used,
+ * directors with the same set of servers build the same table.
+ *
+ * The mh algorithm is detailed in section 3.4 "Consistent Hashing" of
+ * "Maglev: A Fast and Reliable Software Network Load Balancer",
+ * NSDI 2016.
+ *
+ */
+
+#define KMSG_COMPONENT "IPVS"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/ip.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/skbuff.h>
+#include <linux/bitops.h>
+#include <linux/jhash.h>
+#include <linux/gcd.h>
+
+#include <net/ip_vs.h>
+
+
+/*
+ *      IPVS MH lookup table entry
+ */
+struct ip_vs_mh_lookup {
+	struct ip_vs_dest       *dest;          /* real server */
+};
+
+/*
+ *      Fill state of one destination while the table is populated
+ */
+struct ip_vs_mh_dest_setup {
+	struct ip_vs_dest       *dest;
+	unsigned int            offset;         /* starting offset */
+	unsigned int            skip;           /* skip */
+	unsigned int            perm;           /* next offset */
+	int                     turns;          /* weight / gcd() and rshift */
+};
+
+/*
+ *     for IPVS MH lookup table, the size is a prime taken from the
+ *     primes[] array below
+ */
+#ifndef CONFIG_IP_VS_MH_TAB_INDEX
+#define CONFIG_IP_VS_MH_TAB_INDEX       12
+#endif
+#define IP_VS_MH_TAB_INDEX              (CONFIG_IP_VS_MH_TAB_INDEX - 8)
+#define IP_VS_MH_TAB_SIZE               primes[IP_VS_MH_TAB_INDEX]
+
+static const int primes[] = {251, 509, 1021, 2039, 4093,
+			     8191, 16381, 32749, 65521, 131071};
+
+/* seeds of the two destination hashes and of the source hash */
+#define IP_VS_MH_SEED_OFFSET            0x8d5a3e4fU
+#define IP_VS_MH_SEED_SKIP              0x1f3b7c29U
+#define IP_VS_MH_SEED_SRC               0x5bd1e995U
+
+
+/*
+ *	Returns hash value of the address, for a source address or
+ *	a destination
+ */
+static inline unsigned int
+ip_vs_mh_hashkey(int af, const union nf_inet_addr *addr, __be16 port,
+		 u32 seed)
+{
+	__be32 addr_fold = addr->ip;
+
+#ifdef CONFIG_IP_VS_IPV6
+	if (af == AF_INET6)
+		addr_fold = addr->ip6[0]^addr->ip6[1]^
+			    addr->ip6[2]^addr->ip6[3];
+#endif
+	return jhash_2words((__force u32)addr_fold, (__force u32)port, seed);
+}
+
+
+/*
+ *      Get ip_vs_dest associated with supplied parameters.
+ */
+static inline struct ip_vs_dest *
+ip_vs_mh_get(int af, struct ip_vs_mh_lookup *tbl,
+	     const union nf_inet_addr *addr)
+{
+	unsigned int hash = ip_vs_mh_hashkey(af, addr, 0, IP_VS_MH_SEED_SRC);
+
+	return tbl[hash % IP_VS_MH_TAB_SIZE].dest;
+}
+
+
+/*
+ *      Flush all the entries of the specified table.
+ */
+static void ip_vs_mh_flush(struct ip_vs_mh_lookup *tbl)
+{
+	int i;
+	struct ip_vs_mh_lookup *l;
+
+	l = tbl;
+	for (i=0; i<IP_VS_MH_TAB_SIZE; i++) {
+		if (l->dest) {
+			atomic_dec(&l->dest->refcnt);
+			l->dest = NULL;
+		}
+		l++;
+	}
+}
+
+
+static int ip_vs_mh_gcd_weight(struct ip_vs_service *svc)
+{
+	struct ip_vs_dest *dest;
+	int weight;
+	int g = 0;
+
+	list_for_each_entry(dest, &svc->destinations, n_list) {
+		weight = atomic_read(&dest->weight);
+		if (weight > 0) {
+			if (g > 0)
+				g = gcd(weight, g);
+			else
+				g = weight;
+		}
+	}
+	return g;
+}
+
+
+/*
+ *      Fill the lookup table from the permutations of the destinations
+ *      with a weight above zero.
+ */
+static int
+ip_vs_mh_populate(struct ip_vs_mh_lookup *tbl, struct ip_vs_service *svc)
+{
+	struct ip_vs_mh_dest_setup *ds, *setup;
+	struct ip_vs_dest *dest;
+	unsigned long *table;
+	unsigned int c, n = 0, filled = 0;
+	int g, weight, total = 0, rshift = 0;
+
+	list_for_each_entry(dest, &svc->destinations, n_list) {
+		if (atomic_read(&dest->weight) > 0)
+			n++;
+	}
+	if (!n)
+		return 0;
+
+	setup = kcalloc(n, sizeof(*setup), GFP_ATOMIC);
+	table = kcalloc(BITS_TO_LONGS(IP_VS_MH_TAB_SIZE),
+			sizeof(unsigned long), GFP_ATOMIC);
+	if (!setup || !table) {
+		kfree(setup);
+		kfree(table);
+		return -ENOMEM;
+	}
+
+	g = ip_vs_mh_gcd_weight(svc);
+	ds = setup;
+	list_for_each_entry(dest, &svc->destinations, n_list) {
+		weight = atomic_read(&dest->weight);
+		if (weight <= 0)
+			continue;
+
+		ds->dest = dest;
+		ds->offset = ip_vs_mh_hashkey(svc->af, &dest->addr, dest->port,
+					      IP_VS_MH_SEED_OFFSET) %
+			     IP_VS_MH_TAB_SIZE;
+		ds->skip = ip_vs_mh_hashkey(svc->af, &dest->addr, dest->port,
+					    IP_VS_MH_SEED_SKIP) %
+			   (IP_VS_MH_TAB_SIZE - 1) + 1;
+		ds->perm = ds->offset;
+		ds->turns = weight / g;
+		total += ds->turns;
+		ds++;
+	}
+
+	/* Keep one round below half of the table size, so that the
+	 * heaviest destinations can not take all the positions in the
+	 * first round.
+	 */
+	while (total > IP_VS_MH_TAB_SIZE / 2 && rshift < 31) {
+		rshift++;
+		total = 0;
+		for (ds = setup; ds < setup + n; ds++)
+			total += max(ds->turns >> rshift, 1);
+	}
+	for (ds = setup; ds < setup + n; ds++)
+		ds->turns = max(ds->turns >> rshift, 1);
+
+	for (;;) {
+		for (ds = setup; ds < setup + n; ds++) {
+			int turns = ds->turns;
+
+			while (turns--) {
+				c = ds->perm;
+				while (test_bit(c, table)) {
+					/* Add skip, mod IP_VS_MH_TAB_SIZE */
+					ds->perm += ds->skip;
+					if (ds->perm >= IP_VS_MH_TAB_SIZE)
+						ds->perm -= IP_VS_MH_TAB_SIZE;
+					c = ds->perm;
+				}
+
+				__set_bit(c, table);
+				atomic_inc(&ds->dest->refcnt);
+				tbl[c].dest = ds->dest;
+
+				if (++filled == IP_VS_MH_TAB_SIZE)
+					goto out;
+			}
+		}
+	}
+
+out:
+	IP_VS_DBG(6, "MH table populated from %u destinations, "
+		  "gcd %d, rshift %d\n", n, g, rshift);
+	kfree(table);
+	kfree(setup);
+	return 0;
+}
+
+
+static int ip_vs_mh_init_svc(struct ip_vs_service *svc)
+{
+	struct ip_vs_mh_lookup *tbl;
+
+	/* allocate the MH table for this service */
+	tbl = kcalloc(IP_VS_MH_TAB_SIZE, sizeof(struct ip_vs_mh_lookup),
+		      GFP_ATOMIC);
+	if (tbl == NULL) {
+		pr_err("%s(): no memory\n", __func__);
+		return -ENOMEM;
+	}
+	IP_VS_DBG(6, "MH lookup table (memory=%Zdbytes) allocated for "
+		  "current service\n",
+		  sizeof(struct ip_vs_mh_lookup)*IP_VS_MH_TAB_SIZE);
+
+	/* assign the lookup table with the current destinations */
+	if (ip_vs_mh_populate(tbl, svc)) {
+		ip_vs_mh_flush(tbl);
+		kfree(tbl);
+		pr_err("%s(): no memory\n", __func__);
+		return -ENOMEM;
+	}
+	svc->sched_data = tbl;
+
+	return 0;
+}
+
+
+static int ip_vs_mh_done_svc(struct ip_vs_service *svc)
+{
+	struct ip_vs_mh_lookup *tbl = svc->sched_data;
+
+	/* got to clean up table entries here */
+	ip_vs_mh_flush(tbl);
+
+	/* release the table itself */
+	kfree(svc->sched_data);
+	IP_VS_DBG(6, "MH lookup table (memory=%Zdbytes) released\n",
+		  sizeof(struct ip_vs_mh_lookup)*IP_VS_MH_TAB_SIZE);
+
+	return 0;
+}
+
+
+static int ip_vs_mh_update_svc(struct ip_vs_service *svc)
+{
+	struct ip_vs_mh_lookup *tbl = svc->sched_data;
+
+	/* got to clean up table entries here */
+	ip_vs_mh_flush(tbl);
+
+	/* rebuild the lookup table with the updated service */
+	if (ip_vs_mh_populate(tbl, svc)) {
+		pr_err("%s(): no memory\n", __func__);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+
+/*
+ *      If the dest flags is set with IP_VS_DEST_F_OVERLOAD,
+ *      consider that the server is overloaded here.
+ */
+static inline int is_overloaded(struct ip_vs_dest *dest)
+{
+	return dest->flags & IP_VS_DEST_F_OVERLOAD;
+}
+
+
+/*
+ *      Maglev Hashing scheduling
+ */
+static struct ip_vs_dest *
+ip_vs_mh_schedule(struct ip_vs_service *svc, const struct sk_buff *skb)
+{
+	struct ip_vs_dest *dest;
+	struct ip_vs_mh_lookup *tbl;
+	struct ip_vs_iphdr iph;
+
+	ip_vs_fill_iphdr(svc->af, skb_network_header(skb), &iph);
+
+	IP_VS_DBG(6, "ip_vs_mh_schedule(): Scheduling...\n");
+
+	tbl = (struct ip_vs_mh_lookup *)svc->sched_data;
+	dest = ip_vs_mh_get(svc->af, tbl, &iph.saddr);
+	if (!dest
+	    || !(dest->flags & IP_VS_DEST_F_AVAILABLE)
+	    || atomic_read(&dest->weight) <= 0
+	    || is_overloaded(dest)) {
+		IP_VS_ERR_RL("MH: no destination available\n");
+		return NULL;
+	}
+
+	IP_VS_DBG_BUF(6, "MH: source IP address %s --> server %s:%d\n",
+		      IP_VS_DBG_ADDR(svc->af, &iph.saddr),
+		      IP_VS_DBG_ADDR(svc->af, &dest->addr),
+		      ntohs(dest->port));
+
+	return dest;
+}
+
+
+/*
+ *      IPVS MH Scheduler structure
+ */
+static struct ip_vs_scheduler ip_vs_mh_scheduler =
+{
+	.name =			"mh",
+	.refcnt =		ATOMIC_INIT(0),
+	.module =		THIS_MODULE,
+	.n_list	 =		LIST_HEAD_INIT(ip_vs_mh_scheduler.n_list),
+	.init_service =		ip_vs_mh_init_svc,
+	.done_service =		ip_vs_mh_done_svc,
+	.update_service =	ip_vs_mh_update_svc,
+	.schedule =		ip_vs_mh_schedule,
+};
+
+
+static int __init ip_vs_mh_init(void)
+{
+	return register_ip_vs_scheduler(&ip_vs_mh_scheduler);
+}
+
+
+static void __exit ip_vs_mh_cleanup(void)
+{
+	unregister_ip_vs_scheduler(&ip_vs_mh_scheduler);
+}
+
+
+module_init(ip_vs_mh_init);
+module_exit(ip_vs_mh_cleanup);
+MODULE_DESCRIPTION("Maglev hashing ipvs scheduler");
+MODULE_LICENSE("GPL");
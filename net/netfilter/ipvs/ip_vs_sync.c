@@ -34,6 +34,8 @@
 #include <linux/kthread.h>
 #include <linux/wait.h>
 #include <linux/kernel.h>
+#include <linux/jhash.h>
+#include <linux/rcupdate.h>
 
 #include <net/ip.h>
 #include <net/sock.h>
@@ -41,7 +43,12 @@
 #include <net/ip_vs.h>
 
 #define IP_VS_SYNC_GROUP 0xe0000051    /* multicast addr - 224.0.0.81 */
-#define IP_VS_SYNC_PORT  8848          /* multicast port */
+#define IP_VS_SYNC_PORT  8848          /* multicast port, thread N uses +N */
+
+#define IPVS_SYNC_WAKEUP_RATE	8	/* wakeup master after N buffers */
+#define IPVS_SYNC_SEND_DELAY	(HZ / 50)	/* max delay of a full buffer */
+#define IPVS_SYNC_CHECK_PERIOD	HZ	/* idle poll of the current buffer */
+#define IPVS_SYNC_FLUSH_TIME	(HZ * 2)	/* max age of a partial buffer */
 
 
 /*
@@ -71,9 +78,14 @@ struct ip_vs_sync_conn_options {
 	struct ip_vs_seq        out_seq;        /* outgoing seq. struct */
 };
 
+struct ipvs_master_sync_state;
+
 struct ip_vs_sync_thread_data {
+	struct task_struct *task;
+	struct ipvs_master_sync_state *ms;	/* master only */
 	struct socket *sock;
-	char *buf;
+	char *buf;				/* backup only */
+	int id;
 };
 
 #define SIMPLE_CONN_SIZE  (sizeof(struct ip_vs_sync_conn))
@@ -128,13 +140,28 @@ struct ip_vs_sync_buff {
 };
 
 
-/* the sync_buff list head and the lock */
-static LIST_HEAD(ip_vs_sync_queue);
-static DEFINE_SPINLOCK(ip_vs_sync_lock);
+/*
+ *	Per-thread master state. Connections are spread over the master
+ *	threads by address, so the updates of one connection always go
+ *	through the same queue and socket and reach the backup in order.
+ */
+struct ipvs_master_sync_state {
+	spinlock_t		lock;		/* protects the fields below */
+	struct list_head	sync_queue;	/* full buffers to send */
+	struct ip_vs_sync_buff	*sync_buff;	/* accepts new conn entries */
+	unsigned long		sync_queue_len;
+	unsigned int		sync_queue_delay;
+	struct task_struct	*master_thread;
+	struct delayed_work	master_wakeup_work;
+} ____cacheline_aligned_in_smp;
+
+struct ip_vs_sync_master {
+	unsigned int			threads_mask;
+	struct ipvs_master_sync_state	ms[0];
+};
 
-/* current sync_buff for accepting new conn entries */
-static struct ip_vs_sync_buff   *curr_sb = NULL;
-static DEFINE_SPINLOCK(curr_sb_lock);
+/* master state, RCU protected against ip_vs_sync_conn() */
+static struct ip_vs_sync_master *ip_vs_sync_master;
 
 /* ipvs sync daemon state */
 volatile int ip_vs_sync_state = IP_VS_STATE_NONE;
@@ -145,9 +172,11 @@ volatile int ip_vs_backup_syncid = 0;
 char ip_vs_master_mcast_ifn[IP_VS_IFNAME_MAXLEN];
 char ip_vs_backup_mcast_ifn[IP_VS_IFNAME_MAXLEN];
 
-/* sync daemon tasks */
-static struct task_struct *sync_master_thread;
-static struct task_struct *sync_backup_thread;
+/* sync daemon tasks, serialized by the __ip_vs_mutex of ip_vs_ctl.c */
+static struct ip_vs_sync_thread_data *master_tinfo;
+static struct ip_vs_sync_thread_data *backup_tinfo;
+static int master_threads;
+static int backup_threads;
 
 /* multicast addr */
 static struct sockaddr_in mcast_addr = {
@@ -157,20 +186,23 @@ static struct sockaddr_in mcast_addr = {
 };
 
 
-static inline struct ip_vs_sync_buff *sb_dequeue(void)
+static inline struct ip_vs_sync_buff *
+sb_dequeue(struct ipvs_master_sync_state *ms)
 {
 	struct ip_vs_sync_buff *sb;
 
-	spin_lock_bh(&ip_vs_sync_lock);
-	if (list_empty(&ip_vs_sync_queue)) {
+	spin_lock_bh(&ms->lock);
+	if (list_empty(&ms->sync_queue)) {
 		sb = NULL;
 	} else {
-		sb = list_entry(ip_vs_sync_queue.next,
+		sb = list_entry(ms->sync_queue.next,
 				struct ip_vs_sync_buff,
 				list);
 		list_del(&sb->list);
+		if (!--ms->sync_queue_len)
+			ms->sync_queue_delay = 0;
 	}
-	spin_unlock_bh(&ip_vs_sync_lock);
+	spin_unlock_bh(&ms->lock);
 
 	return sb;
 }
@@ -201,14 +233,25 @@ static inline void ip_vs_sync_buff_release(struct ip_vs_sync_buff *sb)
 	kfree(sb);
 }
 
-static inline void sb_queue_tail(struct ip_vs_sync_buff *sb)
+/*
+ *	Queue a full buffer for the master thread, called with ms->lock
+ *	held. The thread is woken up once IPVS_SYNC_WAKEUP_RATE buffers
+ *	are pending, a lone buffer is pushed out by master_wakeup_work
+ *	after IPVS_SYNC_SEND_DELAY.
+ */
+static inline void sb_queue_tail(struct ipvs_master_sync_state *ms,
+				 struct ip_vs_sync_buff *sb)
 {
-	spin_lock(&ip_vs_sync_lock);
-	if (ip_vs_sync_state & IP_VS_STATE_MASTER)
-		list_add_tail(&sb->list, &ip_vs_sync_queue);
-	else
+	if (ms->sync_queue_len < sysctl_ip_vs_sync_qlen_max) {
+		if (!ms->sync_queue_len)
+			schedule_delayed_work(&ms->master_wakeup_work,
+					      max(IPVS_SYNC_SEND_DELAY, 1));
+		ms->sync_queue_len++;
+		list_add_tail(&sb->list, &ms->sync_queue);
+		if (++ms->sync_queue_delay == IPVS_SYNC_WAKEUP_RATE)
+			wake_up_process(ms->master_thread);
+	} else
 		ip_vs_sync_buff_release(sb);
-	spin_unlock(&ip_vs_sync_lock);
 }
 
 /*
@@ -216,21 +259,45 @@ static inline void sb_queue_tail(struct ip_vs_sync_buff *sb)
  *	than the specified time or the specified time is zero.
  */
 static inline struct ip_vs_sync_buff *
-get_curr_sync_buff(unsigned long time)
+get_curr_sync_buff(struct ipvs_master_sync_state *ms, unsigned long time)
 {
 	struct ip_vs_sync_buff *sb;
 
-	spin_lock_bh(&curr_sb_lock);
-	if (curr_sb && (time == 0 ||
-			time_before(jiffies - curr_sb->firstuse, time))) {
-		sb = curr_sb;
-		curr_sb = NULL;
-	} else
+	spin_lock_bh(&ms->lock);
+	sb = ms->sync_buff;
+	if (sb && (time == 0 ||
+		   time_after_eq(jiffies - sb->firstuse, time)))
+		ms->sync_buff = NULL;
+	else
 		sb = NULL;
-	spin_unlock_bh(&curr_sb_lock);
+	spin_unlock_bh(&ms->lock);
 	return sb;
 }
 
+static void master_wakeup_work_handler(struct work_struct *work)
+{
+	struct ipvs_master_sync_state *ms =
+		container_of(work, struct ipvs_master_sync_state,
+			     master_wakeup_work.work);
+
+	spin_lock_bh(&ms->lock);
+	if (ms->sync_queue_len &&
+	    ms->sync_queue_delay < IPVS_SYNC_WAKEUP_RATE) {
+		ms->sync_queue_delay = IPVS_SYNC_WAKEUP_RATE;
+		wake_up_process(ms->master_thread);
+	}
+	spin_unlock_bh(&ms->lock);
+}
+
+static inline int select_master_thread_id(struct ip_vs_sync_master *sm,
+					  struct ip_vs_conn *cp)
+{
+	return jhash_3words((__force u32)cp->caddr.ip,
+			    (__force u32)cp->vaddr.ip,
+			    ((__force u32)cp->cport << 16) |
+			    (__force u32)cp->vport, 0) & sm->threads_mask;
+}
+
 
 /*
  *      Add an ip_vs_conn information into the current sync_buff.
@@ -238,23 +305,35 @@ get_curr_sync_buff(unsigned long time)
  */
 void ip_vs_sync_conn(struct ip_vs_conn *cp)
 {
+	struct ip_vs_sync_master *sm;
+	struct ipvs_master_sync_state *ms;
+	struct ip_vs_sync_buff *sb;
 	struct ip_vs_sync_mesg *m;
 	struct ip_vs_sync_conn *s;
 	int len;
 
-	spin_lock(&curr_sb_lock);
-	if (!curr_sb) {
-		if (!(curr_sb=ip_vs_sync_buff_create())) {
-			spin_unlock(&curr_sb_lock);
+	rcu_read_lock();
+	sm = rcu_dereference(ip_vs_sync_master);
+	if (!sm)
+		goto out;
+	ms = &sm->ms[select_master_thread_id(sm, cp)];
+
+	spin_lock(&ms->lock);
+	sb = ms->sync_buff;
+	if (!sb) {
+		if (!(sb = ip_vs_sync_buff_create())) {
+			spin_unlock(&ms->lock);
+			rcu_read_unlock();
 			pr_err("ip_vs_sync_buff_create failed.\n");
 			return;
 		}
+		ms->sync_buff = sb;
 	}
 
 	len = (cp->flags & IP_VS_CONN_F_SEQ_MASK) ? FULL_CONN_SIZE :
 		SIMPLE_CONN_SIZE;
-	m = curr_sb->mesg;
-	s = (struct ip_vs_sync_conn *)curr_sb->head;
+	m = sb->mesg;
+	s = (struct ip_vs_sync_conn *)sb->head;
 
 	/* copy members */
 	s->protocol = cp->protocol;
@@ -274,14 +353,16 @@ void ip_vs_sync_conn(struct ip_vs_conn *cp)
 
 	m->nr_conns++;
 	m->size += len;
-	curr_sb->head += len;
+	sb->head += len;
 
 	/* check if there is a space for next one */
-	if (curr_sb->head+FULL_CONN_SIZE > curr_sb->end) {
-		sb_queue_tail(curr_sb);
-		curr_sb = NULL;
+	if (sb->head + FULL_CONN_SIZE > sb->end) {
+		sb_queue_tail(ms, sb);
+		ms->sync_buff = NULL;
 	}
-	spin_unlock(&curr_sb_lock);
+	spin_unlock(&ms->lock);
+out:
+	rcu_read_unlock();
 
 	/* synchronize its controller if it has */
 	if (cp->control)
@@ -611,8 +692,9 @@ static int bind_mcastif_addr(struct socket *sock, char *ifname)
 /*
  *      Set up sending multicast socket over UDP
  */
-static struct socket * make_send_sock(void)
+static struct socket * make_send_sock(int id)
 {
+	struct sockaddr_in addr = mcast_addr;
 	struct socket *sock;
 	int result;
 
@@ -638,7 +720,8 @@ static struct socket * make_send_sock(void)
 		goto error;
 	}
 
-	result = sock->ops->connect(sock, (struct sockaddr *) &mcast_addr,
+	addr.sin_port = cpu_to_be16(IP_VS_SYNC_PORT + id);
+	result = sock->ops->connect(sock, (struct sockaddr *) &addr,
 			sizeof(struct sockaddr), 0);
 	if (result < 0) {
 		pr_err("Error connecting to the multicast addr\n");
@@ -656,8 +739,9 @@ static struct socket * make_send_sock(void)
 /*
  *      Set up receiving multicast socket over UDP
  */
-static struct socket * make_receive_sock(void)
+static struct socket * make_receive_sock(int id)
 {
+	struct sockaddr_in addr = mcast_addr;
 	struct socket *sock;
 	int result;
 
@@ -671,7 +755,8 @@ static struct socket * make_receive_sock(void)
 	/* it is equivalent to the REUSEADDR option in user-space */
 	sock->sk->sk_reuse = 1;
 
-	result = sock->ops->bind(sock, (struct sockaddr *) &mcast_addr,
+	addr.sin_port = cpu_to_be16(IP_VS_SYNC_PORT + id);
+	result = sock->ops->bind(sock, (struct sockaddr *) &addr,
 			sizeof(struct sockaddr));
 	if (result < 0) {
 		pr_err("Error binding to the multicast addr\n");
@@ -712,18 +797,29 @@ ip_vs_send_async(struct socket *sock, const char *buffer, const size_t length)
 	return len;
 }
 
-static void
+/*
+ *	Returns -EAGAIN when the socket has no room for the message, the
+ *	message is left untouched so that the caller can retry it.
+ */
+static int
 ip_vs_send_sync_msg(struct socket *sock, struct ip_vs_sync_mesg *msg)
 {
 	int msize;
+	int ret;
 
 	msize = msg->size;
 
 	/* Put size in network byte order */
-	msg->size = htons(msg->size);
+	msg->size = htons(msize);
 
-	if (ip_vs_send_async(sock, (char *)msg, msize) != msize)
-		pr_err("ip_vs_send_async error\n");
+	ret = ip_vs_send_async(sock, (char *)msg, msize);
+	if (ret == -EAGAIN) {
+		msg->size = msize;
+		return ret;
+	}
+	if (ret != msize)
+		pr_err("ip_vs_send_async error %d\n", ret);
+	return 0;
 }
 
 static int
@@ -749,44 +845,61 @@ ip_vs_receive(struct socket *sock, char *buffer, const size_t buflen)
 }
 
 
+/*
+ *	Get the next buffer to send. The task state is set before the
+ *	queue is checked, so a wake_up_process() from sb_queue_tail() or
+ *	kthread_stop() can not be lost between the check and the sleep.
+ */
+static struct ip_vs_sync_buff *
+next_sync_buff(struct ipvs_master_sync_state *ms)
+{
+	struct ip_vs_sync_buff *sb;
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	sb = sb_dequeue(ms);
+	if (!sb)
+		/* do not delay entries in the buffer for too long */
+		sb = get_curr_sync_buff(ms, IPVS_SYNC_FLUSH_TIME);
+	if (sb)
+		__set_current_state(TASK_RUNNING);
+	return sb;
+}
+
 static int sync_thread_master(void *data)
 {
 	struct ip_vs_sync_thread_data *tinfo = data;
+	struct ipvs_master_sync_state *ms = tinfo->ms;
+	struct sock *sk = tinfo->sock->sk;
 	struct ip_vs_sync_buff *sb;
 
 	pr_info("sync thread started: state = MASTER, mcast_ifn = %s, "
-		"syncid = %d\n",
-		ip_vs_master_mcast_ifn, ip_vs_master_syncid);
-
-	while (!kthread_should_stop()) {
-		while ((sb = sb_dequeue())) {
-			ip_vs_send_sync_msg(tinfo->sock, sb->mesg);
-			ip_vs_sync_buff_release(sb);
+		"syncid = %d, id = %d\n",
+		ip_vs_master_mcast_ifn, ip_vs_master_syncid, tinfo->id);
+
+	for (;;) {
+		sb = next_sync_buff(ms);
+		if (unlikely(kthread_should_stop()))
+			break;
+		if (!sb) {
+			schedule_timeout(IPVS_SYNC_CHECK_PERIOD);
+			continue;
 		}
-
-		/* check if entries stay in curr_sb for 2 seconds */
-		sb = get_curr_sync_buff(2 * HZ);
-		if (sb) {
-			ip_vs_send_sync_msg(tinfo->sock, sb->mesg);
-			ip_vs_sync_buff_release(sb);
+		while (ip_vs_send_sync_msg(tinfo->sock, sb->mesg) < 0) {
+			/* wait for room in the send buffer instead of
+			 * dropping the message */
+			wait_event_interruptible(*sk->sk_sleep,
+						 sock_writeable(sk) ||
+						 kthread_should_stop());
+			if (unlikely(kthread_should_stop()))
+				goto done;
 		}
-
-		schedule_timeout_interruptible(HZ);
-	}
-
-	/* clean up the sync_buff queue */
-	while ((sb=sb_dequeue())) {
 		ip_vs_sync_buff_release(sb);
 	}
 
-	/* clean up the current sync_buff */
-	if ((sb = get_curr_sync_buff(0))) {
+done:
+	__set_current_state(TASK_RUNNING);
+	if (sb)
 		ip_vs_sync_buff_release(sb);
-	}
-
-	/* release the sending multicast socket */
-	sock_release(tinfo->sock);
-	kfree(tinfo);
 
 	return 0;
 }
@@ -798,8 +911,8 @@ static int sync_thread_backup(void *data)
 	int len;
 
 	pr_info("sync thread started: state = BACKUP, mcast_ifn = %s, "
-		"syncid = %d\n",
-		ip_vs_backup_mcast_ifn, ip_vs_backup_syncid);
+		"syncid = %d, id = %d\n",
+		ip_vs_backup_mcast_ifn, ip_vs_backup_syncid, tinfo->id);
 
 	while (!kthread_should_stop()) {
 		wait_event_interruptible(*tinfo->sock->sk->sk_sleep,
@@ -823,81 +936,158 @@ static int sync_thread_backup(void *data)
 		}
 	}
 
-	/* release the sending multicast socket */
-	sock_release(tinfo->sock);
-	kfree(tinfo->buf);
+	return 0;
+}
+
+
+/*
+ *	The sockets and buffers are owned by start/stop_sync_thread() and
+ *	not by the threads, a thread stopped before it ever ran must not
+ *	leak them.
+ */
+static void ip_vs_sync_tinfo_free(struct ip_vs_sync_thread_data *tinfo,
+				  int count)
+{
+	int id;
+
+	for (id = 0; id < count; id++) {
+		if (tinfo[id].sock)
+			sock_release(tinfo[id].sock);
+		kfree(tinfo[id].buf);
+	}
 	kfree(tinfo);
+}
 
-	return 0;
+static void ip_vs_sync_master_free(struct ip_vs_sync_master *sm, int count)
+{
+	struct ipvs_master_sync_state *ms;
+	struct ip_vs_sync_buff *sb;
+	int id;
+
+	for (id = 0; id < count; id++) {
+		ms = &sm->ms[id];
+
+		/* clean up the sync_buff queue */
+		while ((sb = sb_dequeue(ms)))
+			ip_vs_sync_buff_release(sb);
+
+		/* clean up the current sync_buff */
+		if ((sb = get_curr_sync_buff(ms, 0)))
+			ip_vs_sync_buff_release(sb);
+	}
+	kfree(sm);
 }
 
 
 int start_sync_thread(int state, char *mcast_ifn, __u8 syncid)
 {
-	struct ip_vs_sync_thread_data *tinfo;
-	struct task_struct **realtask, *task;
+	struct ip_vs_sync_thread_data *tinfo, *ti;
+	struct ip_vs_sync_master *sm = NULL;
+	struct task_struct *task;
 	struct socket *sock;
-	char *name, *buf = NULL;
+	char *name;
 	int (*threadfn)(void *data);
-	int result = -ENOMEM;
+	int count, id, result;
 
 	IP_VS_DBG(7, "%s(): pid %d\n", __func__, task_pid_nr(current));
 	IP_VS_DBG(7, "Each ip_vs_sync_conn entry needs %Zd bytes\n",
 		  sizeof(struct ip_vs_sync_conn));
 
 	if (state == IP_VS_STATE_MASTER) {
-		if (sync_master_thread)
+		if (master_tinfo)
 			return -EEXIST;
 
 		strlcpy(ip_vs_master_mcast_ifn, mcast_ifn,
 			sizeof(ip_vs_master_mcast_ifn));
 		ip_vs_master_syncid = syncid;
-		realtask = &sync_master_thread;
-		name = "ipvs_syncmaster";
+		name = "ipvs_syncm:%d";
 		threadfn = sync_thread_master;
-		sock = make_send_sock();
 	} else if (state == IP_VS_STATE_BACKUP) {
-		if (sync_backup_thread)
+		if (backup_tinfo)
 			return -EEXIST;
 
 		strlcpy(ip_vs_backup_mcast_ifn, mcast_ifn,
 			sizeof(ip_vs_backup_mcast_ifn));
 		ip_vs_backup_syncid = syncid;
-		realtask = &sync_backup_thread;
-		name = "ipvs_syncbackup";
+		name = "ipvs_syncb:%d";
 		threadfn = sync_thread_backup;
-		sock = make_receive_sock();
 	} else {
 		return -EINVAL;
 	}
 
-	if (IS_ERR(sock)) {
-		result = PTR_ERR(sock);
-		goto out;
-	}
+	result = set_sync_mesg_maxlen(state);
+	if (result < 0)
+		return result;
+
+	count = sysctl_ip_vs_sync_ports;
+	tinfo = kcalloc(count, sizeof(*tinfo), GFP_KERNEL);
+	if (!tinfo)
+		return -ENOMEM;
 
-	set_sync_mesg_maxlen(state);
-	if (state == IP_VS_STATE_BACKUP) {
-		buf = kmalloc(sync_recv_mesg_maxlen, GFP_KERNEL);
-		if (!buf)
-			goto outsocket;
+	result = -ENOMEM;
+	if (state == IP_VS_STATE_MASTER) {
+		sm = kzalloc(sizeof(*sm) + count * sizeof(sm->ms[0]),
+			     GFP_KERNEL);
+		if (!sm)
+			goto out;
+		sm->threads_mask = count - 1;
+		for (id = 0; id < count; id++) {
+			struct ipvs_master_sync_state *ms = &sm->ms[id];
+
+			spin_lock_init(&ms->lock);
+			INIT_LIST_HEAD(&ms->sync_queue);
+			INIT_DELAYED_WORK(&ms->master_wakeup_work,
+					  master_wakeup_work_handler);
+		}
 	}
 
-	tinfo = kmalloc(sizeof(*tinfo), GFP_KERNEL);
-	if (!tinfo)
-		goto outbuf;
+	for (id = 0; id < count; id++) {
+		ti = &tinfo[id];
+		ti->id = id;
+		if (state == IP_VS_STATE_MASTER) {
+			ti->ms = &sm->ms[id];
+			sock = make_send_sock(id);
+		} else {
+			sock = make_receive_sock(id);
+		}
+		if (IS_ERR(sock)) {
+			result = PTR_ERR(sock);
+			goto out;
+		}
+		ti->sock = sock;
 
-	tinfo->sock = sock;
-	tinfo->buf = buf;
+		if (state == IP_VS_STATE_BACKUP) {
+			ti->buf = kmalloc(sync_recv_mesg_maxlen, GFP_KERNEL);
+			if (!ti->buf) {
+				result = -ENOMEM;
+				goto out;
+			}
+		}
+	}
 
-	task = kthread_run(threadfn, tinfo, name);
-	if (IS_ERR(task)) {
-		result = PTR_ERR(task);
-		goto outtinfo;
+	for (id = 0; id < count; id++) {
+		ti = &tinfo[id];
+		task = kthread_create(threadfn, ti, name, id);
+		if (IS_ERR(task)) {
+			result = PTR_ERR(task);
+			goto outthreads;
+		}
+		ti->task = task;
+		if (sm)
+			sm->ms[id].master_thread = task;
 	}
+	for (id = 0; id < count; id++)
+		wake_up_process(tinfo[id].task);
 
 	/* mark as active */
-	*realtask = task;
+	if (state == IP_VS_STATE_MASTER) {
+		master_tinfo = tinfo;
+		master_threads = count;
+		rcu_assign_pointer(ip_vs_sync_master, sm);
+	} else {
+		backup_tinfo = tinfo;
+		backup_threads = count;
+	}
 	ip_vs_sync_state |= state;
 
 	/* increase the module use count */
@@ -905,49 +1095,61 @@ int start_sync_thread(int state, char *mcast_ifn, __u8 syncid)
 
 	return 0;
 
-outtinfo:
-	kfree(tinfo);
-outbuf:
-	kfree(buf);
-outsocket:
-	sock_release(sock);
+outthreads:
+	for (id = 0; id < count; id++)
+		if (tinfo[id].task)
+			kthread_stop(tinfo[id].task);
 out:
+	ip_vs_sync_tinfo_free(tinfo, count);
+	kfree(sm);
 	return result;
 }
 
 
 int stop_sync_thread(int state)
 {
+	struct ip_vs_sync_master *sm;
+	int id;
+
 	IP_VS_DBG(7, "%s(): pid %d\n", __func__, task_pid_nr(current));
 
 	if (state == IP_VS_STATE_MASTER) {
-		if (!sync_master_thread)
+		if (!master_tinfo)
 			return -ESRCH;
 
-		pr_info("stopping master sync thread %d ...\n",
-			task_pid_nr(sync_master_thread));
+		pr_info("stopping %d master sync threads ...\n",
+			master_threads);
 
 		/*
-		 * The lock synchronizes with sb_queue_tail(), so that we don't
-		 * add sync buffers to the queue, when we are already in
-		 * progress of stopping the master sync daemon.
+		 * Unpublish the master state and wait for ip_vs_sync_conn()
+		 * callers still using it, so that no sync buffers are added
+		 * to the queues or wakeups scheduled once we stop the
+		 * threads.
 		 */
-
-		spin_lock_bh(&ip_vs_sync_lock);
 		ip_vs_sync_state &= ~IP_VS_STATE_MASTER;
-		spin_unlock_bh(&ip_vs_sync_lock);
-		kthread_stop(sync_master_thread);
-		sync_master_thread = NULL;
+		sm = ip_vs_sync_master;
+		rcu_assign_pointer(ip_vs_sync_master, NULL);
+		synchronize_net();
+
+		for (id = 0; id < master_threads; id++) {
+			cancel_delayed_work_sync(&sm->ms[id].master_wakeup_work);
+			kthread_stop(master_tinfo[id].task);
+		}
+		ip_vs_sync_master_free(sm, master_threads);
+		ip_vs_sync_tinfo_free(master_tinfo, master_threads);
+		master_tinfo = NULL;
 	} else if (state == IP_VS_STATE_BACKUP) {
-		if (!sync_backup_thread)
+		if (!backup_tinfo)
 			return -ESRCH;
 
-		pr_info("stopping backup sync thread %d ...\n",
-			task_pid_nr(sync_backup_thread));
+		pr_info("stopping %d backup sync threads ...\n",
+			backup_threads);
 
 		ip_vs_sync_state &= ~IP_VS_STATE_BACKUP;
-		kthread_stop(sync_backup_thread);
-		sync_backup_thread = NULL;
+		for (id = 0; id < backup_threads; id++)
+			kthread_stop(backup_tinfo[id].task);
+		ip_vs_sync_tinfo_free(backup_tinfo, backup_threads);
+		backup_tinfo = NULL;
 	} else {
 		return -EINVAL;
 	}
@@ -97,6 +97,7 @@
 
 #include <net/sock.h>
 #include <linux/netfilter.h>
+#include <net/busy_poll.h>
 
 static int sock_no_open(struct inode *irrelevant, struct file *dontcare);
 static ssize_t sock_aio_read(struct kiocb *iocb, const struct iovec *iov,
@@ -1057,12 +1058,23 @@ out_release:
 static unsigned int sock_poll(struct file *file, poll_table *wait)
 {
 	struct socket *sock;
+	unsigned int busy_flag = 0;
 
 	/*
 	 *      We can't return errors to poll, so it's either yes or no.
 	 */
 	sock = file->private_data;
-	return sock->ops->poll(file, sock, wait);
+
+	if (sock->sk && sk_can_busy_loop(sock->sk)) {
+		/* this socket can busy poll, tell the system call */
+		busy_flag = POLL_BUSY_LOOP;
+
+		/* once per pass, only if the system call asked for it */
+		if (wait && (wait->key & POLL_BUSY_LOOP))
+			sk_busy_loop(sock->sk, 1);
+	}
+
+	return busy_flag | sock->ops->poll(file, sock, wait);
 }
 
 static int sock_mmap(struct file *file, struct vm_area_struct *vma)